@@ -332,6 +332,10 @@ void Collector::GetGeneratorSandeshStatsInfo(vector<ModuleServerState> &genlist)
             ginfo.set_db_drop_level(db_drop_level);
             ginfo.set_db_msg_dropped(db_msg_dropped);
         }
+        GenDb::DbWriteBatchStats db_write_stats;
+        if (gen->GetDbWriteBatchStats(db_write_stats)) {
+            ginfo.set_db_write_batch_stats(db_write_stats);
+        }
         ginfo.set_session_stats(session->GetStats());
         TcpServerSocketStats rx_stats;
         session->GetRxSocketStats(rx_stats);
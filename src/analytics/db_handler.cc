@@ -252,6 +252,10 @@ bool DbHandler::GetStats(uint64_t &queue_count, uint64_t &enqueues,
     return dbif_->Db_GetQueueStats(queue_count, enqueues);
 }
 
+bool DbHandler::GetWriteBatchStats(GenDb::DbWriteBatchStats &stats) const {
+    return dbif_->Db_GetWriteBatchStats(stats);
+}
+
 inline bool DbHandler::AllowMessageTableInsert(SandeshHeader &header) {
     return header.get_Type() != SandeshType::FLOW;
 }
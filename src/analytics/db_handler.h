@@ -77,6 +77,7 @@ public:
     bool FlowTableInsert(const RuleMsg& rmsg);
     bool GetStats(uint64_t &queue_count, uint64_t &enqueues,
         std::string &drop_level, uint64_t &msg_dropped) const;
+    bool GetWriteBatchStats(GenDb::DbWriteBatchStats &stats) const;
 
     typedef boost::tuple<size_t, SandeshLevel::type, bool> DbQueueWaterMarkInfo;
     void SetDbQueueWaterMarkInfo(DbQueueWaterMarkInfo &wm);
@@ -252,6 +252,10 @@ bool Generator::GetDbStats(uint64_t &queue_count, uint64_t &enqueues,
     return db_handler_->GetStats(queue_count, enqueues, drop_level,
                msg_dropped);
 }
+
+bool Generator::GetDbWriteBatchStats(GenDb::DbWriteBatchStats &stats) const {
+    return db_handler_->GetWriteBatchStats(stats);
+}
     
 void Generator::GetMessageTypeStats(vector<SandeshStats> &ssv) const {
     for (MessageTypeStatsMap::const_iterator mt_it = stats_map_.begin();
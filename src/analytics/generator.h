@@ -62,6 +62,7 @@ public:
                                      SandeshGeneratorStats &sm_msg_stats) const;
     bool GetDbStats(uint64_t &queue_count, uint64_t &enqueues,
         std::string  &drop_level, uint64_t &msg_dropped) const;
+    bool GetDbWriteBatchStats(GenDb::DbWriteBatchStats &stats) const;
 
     const std::string &module() const { return module_; }
     const std::string &source() const { return source_; }
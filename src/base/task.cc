@@ -3,6 +3,7 @@
  */
 
 #include <assert.h>
+#include <algorithm>
 #include <fstream>
 #include <map>
 #include <iostream>
@@ -10,6 +11,7 @@
 
 #include "tbb/task.h"
 #include "tbb/enumerable_thread_specific.h"
+#include "tbb/spin_mutex.h"
 #include "base/logging.h"
 #include "base/task.h"
 
@@ -23,6 +25,26 @@ typedef tbb::enumerable_thread_specific<Task *> TaskInfo;
 
 static TaskInfo task_running;
 
+// Latency statistics of the tasks run by a thread. The mutex is only
+// contended while the statistics are read or cleared.
+struct TaskThreadStats {
+    typedef std::vector<TaskLatencyStats> LatencyList;
+    typedef std::vector<TaskRunInfo> RunList;
+
+    tbb::spin_mutex mutex;
+    LatencyList latency;        // Indexed by task id.
+    RunList longest;            // Min-heap on run_usec.
+};
+
+typedef tbb::enumerable_thread_specific<TaskThreadStats *> TaskThreadStatsPtr;
+
+static TaskThreadStatsPtr task_thread_stats(
+    static_cast<TaskThreadStats *>(NULL));
+
+// All the per-thread statistics, for the readers.
+static tbb::mutex task_thread_stats_mutex;
+static std::vector<TaskThreadStats *> task_thread_stats_list;
+
 // Vector of Task entries
 typedef std::vector<TaskEntry *> TaskEntryList;
 
@@ -38,6 +60,7 @@ public:
 
 private:
     tbb::task *execute();
+    virtual void note_affinity(affinity_id id);
 
     Task    *parent_;
 
@@ -110,6 +133,7 @@ private:
     int             run_count_; // # of tasks running
 
     Task            *run_task_; // Task currently running
+    tbb::task::affinity_id affinity_; // Thread that last ran the instance
     TaskList        waitq_;     // Tasks waiting to run on some condition
     TaskEntryList   policyq_;   // Policy rules for a task
     TaskDeferList   *deferq_;    // Tasks deferred for this to exit
@@ -212,9 +236,15 @@ private:
 tbb::task *TaskImpl::execute() {
     TaskInfo::reference running = task_running.local();
     running = parent_;
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    bool latency_stats = scheduler->latency_stats_enabled();
+    uint64_t start = latency_stats ? UTCTimestampUsec() : 0;
     try {
         bool is_complete = parent_->Run();
         running = NULL;
+        if (latency_stats) {
+            scheduler->RecordLatency(parent_, start, UTCTimestampUsec());
+        }
         if (is_complete == true) {
             parent_->SetTaskComplete();
         } else {
@@ -236,6 +266,12 @@ tbb::task *TaskImpl::execute() {
     return NULL;
 }
 
+// Called when the task runs on a thread other than its affinity. Remember
+// the thread for the next run of the task instance.
+void TaskImpl::note_affinity(affinity_id id) {
+    parent_->affinity_ = id;
+}
+
 // Destructor called when a task execution is compeleted. Invoked
 // implicitly by tbb::task. 
 // Invokes OnTaskExit to schedule tasks pending tasks
@@ -276,7 +312,8 @@ int TaskScheduler::GetThreadCount() {
 // part of tbb. So, initialize TBB with one thread more than its default
 TaskScheduler::TaskScheduler() : 
     task_scheduler_(GetThreadCount() + 1),
-    running_(true), seqno_(0), id_max_(0) {
+    running_(true), seqno_(0), start_head_(NULL), start_tail_(NULL),
+    affinity_enabled_(false), latency_stats_enabled_(true), id_max_(0) {
     hw_thread_count_ = GetThreadCount();
     task_group_db_.resize(TaskScheduler::kVectorGrowSize);
     stop_entry_ = new TaskEntry(-1);
@@ -390,13 +427,20 @@ void TaskScheduler::SetPolicy(int task_id, TaskPolicy &policy) {
 // Enqueue a Task for running. Starts task if all policy rules are met else 
 // puts task in waitq
 void TaskScheduler::Enqueue(Task *t) {
-    tbb::mutex::scoped_lock     lock(mutex_);
-
-    EnqueueUnLocked(t);
+    Task *start_list;
+    {
+        tbb::mutex::scoped_lock     lock(mutex_);
+        EnqueueUnLocked(t);
+        start_list = TakeStartList();
+    }
+    StartTasks(start_list);
 }
 
 void TaskScheduler::EnqueueUnLocked(Task *t) {
     t->SetSeqNo(++seqno_);
+    if (latency_stats_enabled_) {
+        t->enqueue_time_ = UTCTimestampUsec();
+    }
     TaskGroup *group = GetTaskGroup(t->GetTaskId());
 
 
@@ -486,27 +530,66 @@ TaskScheduler::CancelReturnCode TaskScheduler::Cancel(Task *t) {
 // Method invoked on exit of a Task.
 // Exit of a task can potentially start tasks in pendingq.
 void TaskScheduler::OnTaskExit(Task *t) {
-    tbb::mutex::scoped_lock lock(mutex_);
-
-    TaskEntry *entry = QueryTaskEntry(t->GetTaskId(), t->GetTaskInstance());
-    entry->TaskExited(t, GetTaskGroup(t->GetTaskId()));
-
-    //
-    // Delete the task it is not marked for recycling or already cancelled.
-    //
-    if ((t->task_recycle_ == false) || (t->task_cancel_ == true)) {
-        // Delete the container Task object, if the 
-        // task is not marked to be recycled (or) 
-        // if the task is marked for cancellation
-        if (t->task_cancel_ == true) {
-            t->OnTaskCancel();
+    Task *start_list;
+    bool delete_task = false;
+    {
+        tbb::mutex::scoped_lock lock(mutex_);
+
+        TaskEntry *entry =
+            QueryTaskEntry(t->GetTaskId(), t->GetTaskInstance());
+        entry->TaskExited(t, GetTaskGroup(t->GetTaskId()));
+
+        //
+        // Delete the task it is not marked for recycling or already
+        // cancelled.
+        //
+        if ((t->task_recycle_ == false) || (t->task_cancel_ == true)) {
+            // Delete the container Task object, if the 
+            // task is not marked to be recycled (or) 
+            // if the task is marked for cancellation
+            if (t->task_cancel_ == true) {
+                t->OnTaskCancel();
+            }
+            delete_task = true;
+        } else {
+            t->task_impl_ = NULL;
+            EnqueueUnLocked(t);
         }
+        start_list = TakeStartList();
+    }
+
+    // The task is no longer known to the scheduler, so there's no need to
+    // hold the mutex while running its destructor.
+    if (delete_task) {
         delete t;
-        return;
     }
+    StartTasks(start_list);
+}
 
-    t->task_impl_ = NULL;
-    EnqueueUnLocked(t);
+void TaskScheduler::AddToStartList(Task *t) {
+    t->start_next_ = NULL;
+    if (start_tail_ == NULL) {
+        start_head_ = t;
+    } else {
+        start_tail_->start_next_ = t;
+    }
+    start_tail_ = t;
+}
+
+Task *TaskScheduler::TakeStartList() {
+    Task *list = start_head_;
+    start_head_ = start_tail_ = NULL;
+    return list;
+}
+
+// Spawn the tbb tasks, in the order in which they were started. A task may
+// run and exit as soon as it's spawned, so get the next one first.
+void TaskScheduler::StartTasks(Task *list) {
+    while (list != NULL) {
+        Task *t = list;
+        list = t->start_next_;
+        t->StartTask();
+    }
 }
 
 void TaskScheduler::Stop() {
@@ -516,13 +599,17 @@ void TaskScheduler::Stop() {
 }
 
 void TaskScheduler::Start() {
-    tbb::mutex::scoped_lock             lock(mutex_);
+    Task *start_list;
+    {
+        tbb::mutex::scoped_lock             lock(mutex_);
 
-    running_ = true;
+        running_ = true;
 
-    // Run all tasks that may be suspended
-    stop_entry_->RunDeferQ();
-    return;
+        // Run all tasks that may be suspended
+        stop_entry_->RunDeferQ();
+        start_list = TakeStartList();
+    }
+    StartTasks(start_list);
 }
 
 void TaskScheduler::Print() {
@@ -558,6 +645,17 @@ bool TaskScheduler::IsEmpty() {
     return true;
 }
 
+string TaskScheduler::GetTaskName(int task_id) {
+    tbb::reader_writer_lock::scoped_lock_read lock(id_map_mutex_);
+    for (TaskIdMap::const_iterator loc = id_map_.begin();
+         loc != id_map_.end(); ++loc) {
+        if (loc->second == task_id) {
+            return loc->first;
+        }
+    }
+    return "";
+}
+
 int TaskScheduler::GetTaskId(const string &name) {
     {
         // Grab read-only lock first. Most of the time, task-id already exists
@@ -577,6 +675,99 @@ int TaskScheduler::GetTaskId(const string &name) {
     return tid;
 }
 
+static bool TaskRunInfoCmp(const TaskRunInfo &lhs, const TaskRunInfo &rhs) {
+    return lhs.run_usec > rhs.run_usec;
+}
+
+// Called from the thread that ran the task, before the task exits.
+void TaskScheduler::RecordLatency(Task *t, uint64_t start, uint64_t end) {
+    TaskThreadStatsPtr::reference local = task_thread_stats.local();
+    if (local == NULL) {
+        local = new TaskThreadStats;
+        tbb::mutex::scoped_lock lock(task_thread_stats_mutex);
+        task_thread_stats_list.push_back(local);
+    }
+
+    uint64_t wait_usec = 0;
+    if (t->enqueue_time_ != 0 && start > t->enqueue_time_) {
+        wait_usec = start - t->enqueue_time_;
+    }
+    uint64_t run_usec = (end > start) ? end - start : 0;
+    size_t task_id = t->GetTaskId();
+
+    tbb::spin_mutex::scoped_lock lock(local->mutex);
+    if (local->latency.size() <= task_id) {
+        local->latency.resize(task_id + kVectorGrowSize);
+    }
+    local->latency[task_id].Add(wait_usec, run_usec);
+
+    // Keep the longest runs in a min-heap so that the shortest of them is
+    // the one that is replaced.
+    TaskThreadStats::RunList &longest = local->longest;
+    if (longest.size() == kLongestRunCount) {
+        if (run_usec <= longest.front().run_usec) {
+            return;
+        }
+        pop_heap(longest.begin(), longest.end(), TaskRunInfoCmp);
+        longest.pop_back();
+    }
+    TaskRunInfo info;
+    info.task_id = task_id;
+    info.task_instance = t->GetTaskInstance();
+    info.start_time = start;
+    info.run_usec = run_usec;
+    longest.push_back(info);
+    push_heap(longest.begin(), longest.end(), TaskRunInfoCmp);
+}
+
+void TaskScheduler::GetLatencyStats(vector<TaskLatencyStats> *stats) {
+    stats->clear();
+    tbb::mutex::scoped_lock lock(task_thread_stats_mutex);
+    for (vector<TaskThreadStats *>::iterator it =
+         task_thread_stats_list.begin();
+         it != task_thread_stats_list.end(); ++it) {
+        TaskThreadStats *thread_stats = *it;
+        tbb::spin_mutex::scoped_lock thread_lock(thread_stats->mutex);
+        if (stats->size() < thread_stats->latency.size()) {
+            stats->resize(thread_stats->latency.size());
+        }
+        for (size_t idx = 0; idx < thread_stats->latency.size(); idx++) {
+            (*stats)[idx].Merge(thread_stats->latency[idx]);
+        }
+    }
+}
+
+void TaskScheduler::GetLongestRuns(vector<TaskRunInfo> *runs) {
+    runs->clear();
+    {
+        tbb::mutex::scoped_lock lock(task_thread_stats_mutex);
+        for (vector<TaskThreadStats *>::iterator it =
+             task_thread_stats_list.begin();
+             it != task_thread_stats_list.end(); ++it) {
+            TaskThreadStats *thread_stats = *it;
+            tbb::spin_mutex::scoped_lock thread_lock(thread_stats->mutex);
+            runs->insert(runs->end(), thread_stats->longest.begin(),
+                         thread_stats->longest.end());
+        }
+    }
+    sort(runs->begin(), runs->end(), TaskRunInfoCmp);
+    if (runs->size() > kLongestRunCount) {
+        runs->resize(kLongestRunCount);
+    }
+}
+
+void TaskScheduler::ClearLatencyStats() {
+    tbb::mutex::scoped_lock lock(task_thread_stats_mutex);
+    for (vector<TaskThreadStats *>::iterator it =
+         task_thread_stats_list.begin();
+         it != task_thread_stats_list.end(); ++it) {
+        TaskThreadStats *thread_stats = *it;
+        tbb::spin_mutex::scoped_lock thread_lock(thread_stats->mutex);
+        thread_stats->latency.clear();
+        thread_stats->longest.clear();
+    }
+}
+
 void TaskScheduler::ClearTaskGroupStats(int task_id) {
     TaskGroup *group = GetTaskGroup(task_id);
     if (group == NULL)
@@ -869,7 +1060,7 @@ TaskStats *TaskGroup::GetTaskStats(int task_instance) {
 
 TaskEntry::TaskEntry(int task_id, int task_instance) : task_id_(task_id),
     task_instance_(task_instance), run_count_(0), run_task_(NULL),
-    deferq_task_entry_(NULL), deferq_task_group_(NULL) {
+    affinity_(0), deferq_task_entry_(NULL), deferq_task_group_(NULL) {
     // When a new TaskEntry is created, adds an implicit rule into policyq_ to
     // ensure that only one Task of an instance is run at a time
     if (task_instance != -1) {
@@ -882,7 +1073,7 @@ TaskEntry::TaskEntry(int task_id, int task_instance) : task_id_(task_id),
 
 TaskEntry::TaskEntry(int task_id) : task_id_(task_id),
     task_instance_(-1), run_count_(0), run_task_(NULL),
-    deferq_task_entry_(NULL), deferq_task_group_(NULL) {
+    affinity_(0), deferq_task_entry_(NULL), deferq_task_group_(NULL) {
     memset(&stats_, 0, sizeof(stats_));
     // allocate memory for deferq
     deferq_ = new TaskDeferList;
@@ -962,20 +1153,27 @@ void TaskEntry::DeleteFromDeferQ(TaskEntry &entry) {
 
 // Start a single task.
 // If there are more entries in waitq_ add them to deferq_
+// The task is marked running here, but the tbb task is only spawned once
+// the scheduler releases its mutex.
 void TaskEntry::RunTask (Task *t) {
     stats_.run_count_++;
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    t->affinity_ = 0;
     if (t->GetTaskInstance() != -1) {
         assert(run_task_ == NULL);
         assert (run_count_ == 0);
         run_task_ = t;
+        if (scheduler->affinity_enabled()) {
+            t->affinity_ = affinity_;
+        }
     }
 
     run_count_++;
-    TaskScheduler *scheduler = TaskScheduler::GetInstance();
     TaskGroup *group = scheduler->QueryTaskGroup(t->GetTaskId());
     group->TaskStarted();
 
-    t->StartTask();
+    t->SetState(Task::RUN);
+    scheduler->AddToStartList(t);
 }
 
 void TaskEntry::RunWaitQ() {
@@ -1083,6 +1281,7 @@ void TaskEntry::TaskExited(Task *t, TaskGroup *group) {
         assert(run_task_ == t);
         run_task_ = NULL;
         assert(run_count_ == 1);
+        affinity_ = t->affinity_;
     }
     
     run_count_--;
@@ -1124,24 +1323,70 @@ int TaskEntry::GetTaskDeferEntrySeqno() const {
     return -1;
 }
 
+////////////////////////////////////////////////////////////////////////////
+// Implementation for class TaskLatencyStats
+////////////////////////////////////////////////////////////////////////////
+
+TaskLatencyStats::TaskLatencyStats()
+    : count(0), wait_total_usec(0), wait_max_usec(0), run_total_usec(0),
+      run_max_usec(0) {
+    memset(wait_histogram, 0, sizeof(wait_histogram));
+    memset(run_histogram, 0, sizeof(run_histogram));
+}
+
+int TaskLatencyStats::Bucket(uint64_t usec) {
+    if (usec < 2) {
+        return 0;
+    }
+    int bucket = 63 - __builtin_clzll(usec);
+    return min(bucket, kBucketCount - 1);
+}
+
+void TaskLatencyStats::Add(uint64_t wait_usec, uint64_t run_usec) {
+    count++;
+    wait_total_usec += wait_usec;
+    wait_max_usec = max(wait_max_usec, wait_usec);
+    wait_histogram[Bucket(wait_usec)]++;
+    run_total_usec += run_usec;
+    run_max_usec = max(run_max_usec, run_usec);
+    run_histogram[Bucket(run_usec)]++;
+}
+
+void TaskLatencyStats::Merge(const TaskLatencyStats &rhs) {
+    count += rhs.count;
+    wait_total_usec += rhs.wait_total_usec;
+    wait_max_usec = max(wait_max_usec, rhs.wait_max_usec);
+    run_total_usec += rhs.run_total_usec;
+    run_max_usec = max(run_max_usec, rhs.run_max_usec);
+    for (int idx = 0; idx < kBucketCount; idx++) {
+        wait_histogram[idx] += rhs.wait_histogram[idx];
+        run_histogram[idx] += rhs.run_histogram[idx];
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////
 // Implementation for class Task
 ////////////////////////////////////////////////////////////////////////////
 Task::Task(int task_id, int task_instance) : task_id_(task_id),
     task_instance_(task_instance), task_impl_(NULL), state_(INIT), seqno_(0),
-    task_recycle_(false), task_cancel_(false) {
+    task_recycle_(false), task_cancel_(false), affinity_(0),
+    enqueue_time_(0), start_next_(NULL) {
 }
 
 Task::Task(int task_id) : task_id_(task_id),
     task_instance_(-1), task_impl_(NULL), state_(INIT), seqno_(0),
-    task_recycle_(false), task_cancel_(false) {
+    task_recycle_(false), task_cancel_(false), affinity_(0),
+    enqueue_time_(0), start_next_(NULL) {
 }
 
 // Start execution of task
 void Task::StartTask() {
     assert(task_impl_ == NULL);
-    state_ = RUN;
+    assert(state_ == RUN);
     task_impl_ = new (task::allocate_root())TaskImpl(this);
+    if (affinity_ != 0) {
+        task_impl_->set_affinity(affinity_);
+    }
     task::spawn(*task_impl_);
 }
 
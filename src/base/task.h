@@ -27,12 +27,17 @@
 //
 // When there are multiple tasks ready to run, they are scheduled in their
 // order of enqueue
+//
+// With affinity enabled, a task with an instance is spawned with the tbb
+// affinity of the worker thread that last ran <task-id, instance>, so that
+// the instance tends to keep running on the same thread.
 
 #ifndef ctrlplane_task_h
 #define ctrlplane_task_h
 
 #include <boost/scoped_ptr.hpp>
 #include <map>
+#include <string>
 #include <vector>
 #include <tbb/mutex.h>
 #include <tbb/reader_writer_lock.h>
@@ -49,6 +54,35 @@ struct TaskStats {
     int     defer_count_;
 };
 
+// Queue wait and run time statistics for a task id.
+// The histograms have a bucket for each power of 2 microseconds. Bucket 0
+// counts [0, 2) usec, bucket i counts [2^i, 2^(i+1)) usec and the last
+// bucket also counts everything above.
+struct TaskLatencyStats {
+    static const int kBucketCount = 24;
+
+    TaskLatencyStats();
+    void Add(uint64_t wait_usec, uint64_t run_usec);
+    void Merge(const TaskLatencyStats &rhs);
+    static int Bucket(uint64_t usec);
+
+    uint64_t    count;
+    uint64_t    wait_total_usec;
+    uint64_t    wait_max_usec;
+    uint64_t    run_total_usec;
+    uint64_t    run_max_usec;
+    uint64_t    wait_histogram[kBucketCount];
+    uint64_t    run_histogram[kBucketCount];
+};
+
+// A single run of a task, kept for the longest running tasks.
+struct TaskRunInfo {
+    int         task_id;
+    int         task_instance;
+    uint64_t    start_time;     // UTC usec
+    uint64_t    run_usec;
+};
+
 struct TaskExclusion {
     TaskExclusion(int task_id) : match_id(task_id), match_instance(-1) {}
     TaskExclusion(int task_id, int instance_id)
@@ -111,6 +145,9 @@ private:
     uint32_t            seqno_;
     bool                task_recycle_;
     bool                task_cancel_;
+    tbb::task::affinity_id affinity_;   // Worker thread hint.
+    uint64_t            enqueue_time_;  // For queue wait statistics.
+    Task                *start_next_;   // Next task in the start list.
 
     DISALLOW_COPY_AND_ASSIGN(Task);
 };
@@ -172,11 +209,28 @@ public:
 
     int HardwareThreadCount() { return hw_thread_count_; }
 
+    // Keep <task-id, instance> on the same worker thread where possible.
+    void EnableAffinity(bool enable) { affinity_enabled_ = enable; }
+    bool affinity_enabled() const { return affinity_enabled_; }
+
+    // Queue wait and run time statistics. They are recorded per worker
+    // thread and merged when read. The latency stats are indexed by task
+    // id and the longest runs are sorted by decreasing run time.
+    static const size_t kLongestRunCount = 16;
+    void EnableLatencyStats(bool enable) { latency_stats_enabled_ = enable; }
+    bool latency_stats_enabled() const { return latency_stats_enabled_; }
+    void GetLatencyStats(std::vector<TaskLatencyStats> *stats);
+    void GetLongestRuns(std::vector<TaskRunInfo> *runs);
+    void ClearLatencyStats();
+    std::string GetTaskName(int task_id);
+
     // Get number of tbb worker threads.
     static int GetThreadCount();
 
 private:
     friend class ConcurrencyScope;
+    friend class TaskEntry;
+    friend class TaskImpl;
     typedef std::vector<TaskGroup *> TaskGroupDb;
     typedef std::map<std::string, int> TaskIdMap;
 
@@ -191,6 +245,14 @@ private:
     void ClearRunningTask();
     void WaitForTerminateCompletion();
 
+    // Tasks that are started while holding mutex_ are added to the start
+    // list and only spawned as tbb tasks once the mutex is released.
+    void AddToStartList(Task *task);
+    Task *TakeStartList();
+    static void StartTasks(Task *list);
+
+    void RecordLatency(Task *task, uint64_t start, uint64_t end);
+
     TaskEntry               *stop_entry_;
 
     tbb::task_scheduler_init task_scheduler_;
@@ -198,6 +260,11 @@ private:
     bool                    running_;
     int                     seqno_;
     TaskGroupDb             task_group_db_;
+    Task                    *start_head_;
+    Task                    *start_tail_;
+    bool                    affinity_enabled_;
+
+    bool                    latency_stats_enabled_;
 
     tbb::reader_writer_lock id_map_mutex_;
     TaskIdMap               id_map_;
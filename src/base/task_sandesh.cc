@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <sandesh/sandesh_types.h>
+#include <sandesh/sandesh.h>
+
+#include "base/task.h"
+#include "base/util.h"
+#include "base/sandesh/task_types.h"
+
+using namespace std;
+
+static void FillTaskLatency(TaskScheduler *scheduler,
+                            vector<SandeshTaskLatency> *list) {
+    vector<TaskLatencyStats> stats;
+    scheduler->GetLatencyStats(&stats);
+    for (size_t task_id = 0; task_id < stats.size(); task_id++) {
+        const TaskLatencyStats &latency = stats[task_id];
+        if (latency.count == 0) {
+            continue;
+        }
+        SandeshTaskLatency entry;
+        entry.set_name(scheduler->GetTaskName(task_id));
+        entry.set_task_id(task_id);
+        entry.set_runs(latency.count);
+        entry.set_wait_avg_usec(latency.wait_total_usec / latency.count);
+        entry.set_wait_max_usec(latency.wait_max_usec);
+        entry.set_run_avg_usec(latency.run_total_usec / latency.count);
+        entry.set_run_max_usec(latency.run_max_usec);
+
+        // Leave out the empty buckets at the end.
+        int last = 0;
+        for (int idx = 0; idx < TaskLatencyStats::kBucketCount; idx++) {
+            if (latency.wait_histogram[idx] || latency.run_histogram[idx]) {
+                last = idx;
+            }
+        }
+        vector<uint64_t> wait_histogram(latency.wait_histogram,
+                                        latency.wait_histogram + last + 1);
+        vector<uint64_t> run_histogram(latency.run_histogram,
+                                       latency.run_histogram + last + 1);
+        entry.set_wait_histogram(wait_histogram);
+        entry.set_run_histogram(run_histogram);
+        list->push_back(entry);
+    }
+}
+
+static void FillLongestRuns(TaskScheduler *scheduler,
+                            vector<SandeshTaskRun> *list) {
+    vector<TaskRunInfo> runs;
+    scheduler->GetLongestRuns(&runs);
+    for (vector<TaskRunInfo>::const_iterator it = runs.begin();
+         it != runs.end(); ++it) {
+        SandeshTaskRun entry;
+        entry.set_name(scheduler->GetTaskName(it->task_id));
+        entry.set_instance(it->task_instance);
+        entry.set_start_time(boost::posix_time::to_simple_string(
+            UTCUsecToPTime(it->start_time)));
+        entry.set_run_usec(it->run_usec);
+        list->push_back(entry);
+    }
+}
+
+void TaskLatencyReq::HandleRequest() const {
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    vector<SandeshTaskLatency> tasks;
+    vector<SandeshTaskRun> longest_runs;
+    FillTaskLatency(scheduler, &tasks);
+    FillLongestRuns(scheduler, &longest_runs);
+    if (get_reset()) {
+        scheduler->ClearLatencyStats();
+    }
+
+    TaskLatencyResp *resp = new TaskLatencyResp;
+    resp->set_tasks(tasks);
+    resp->set_longest_runs(longest_runs);
+    resp->set_context(context());
+    resp->Response();
+}
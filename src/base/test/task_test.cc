@@ -7,6 +7,8 @@
 #include "tbb/task.h"
 #include "base/task.h"
 #include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
 #include "testing/gunit.h"
 
 void TestWait(int max);
@@ -1353,6 +1355,244 @@ TEST_F(TestUT, test9_1)
     EXPECT_TRUE(scheduler->IsEmpty());
 }
 
+static tbb::atomic<long> bench_run_count;
+
+class SleepTask : public Task {
+public:
+    SleepTask(int id, int instance, int usec)
+        : Task(id, instance), usec_(usec) {
+    }
+    bool Run() {
+        usleep(usec_);
+        bench_run_count++;
+        return true;
+    }
+
+private:
+    int usec_;
+};
+
+TEST_F(TestUT, LatencyBucket)
+{
+    EXPECT_EQ(0, TaskLatencyStats::Bucket(0));
+    EXPECT_EQ(0, TaskLatencyStats::Bucket(1));
+    EXPECT_EQ(1, TaskLatencyStats::Bucket(2));
+    EXPECT_EQ(1, TaskLatencyStats::Bucket(3));
+    EXPECT_EQ(10, TaskLatencyStats::Bucket(1024));
+    EXPECT_EQ(TaskLatencyStats::kBucketCount - 1,
+              TaskLatencyStats::Bucket(1ULL << 40));
+}
+
+// Tasks of the same instance run one at a time, so all but the first wait
+// for at least one run time.
+TEST_F(TestUT, LatencyStats)
+{
+    int task_id = scheduler->GetTaskId("test::Latency");
+    EXPECT_EQ("test::Latency", scheduler->GetTaskName(task_id));
+    scheduler->ClearLatencyStats();
+    bench_run_count = 0;
+    for (int i = 0; i < 4; i++) {
+        scheduler->Enqueue(new SleepTask(task_id, 1, 5000));
+    }
+    for (int i = 0; i < 1000 && bench_run_count != 4; i++) {
+        usleep(10000);
+    }
+    for (int i = 0; i < 1000 && !scheduler->IsEmpty(); i++) {
+        usleep(1000);
+    }
+
+    vector<TaskLatencyStats> stats;
+    scheduler->GetLatencyStats(&stats);
+    ASSERT_LT(task_id, (int) stats.size());
+    const TaskLatencyStats &latency = stats[task_id];
+    EXPECT_EQ(4, latency.count);
+    EXPECT_LE(5000, latency.run_max_usec);
+    EXPECT_LE(15000, latency.wait_max_usec);
+    uint64_t runs = 0;
+    for (int idx = 0; idx < TaskLatencyStats::kBucketCount; idx++) {
+        runs += latency.run_histogram[idx];
+    }
+    EXPECT_EQ(4, runs);
+
+    vector<TaskRunInfo> longest;
+    scheduler->GetLongestRuns(&longest);
+    ASSERT_FALSE(longest.empty());
+    EXPECT_EQ(task_id, longest[0].task_id);
+    EXPECT_EQ(1, longest[0].task_instance);
+    for (size_t idx = 1; idx < longest.size(); idx++) {
+        EXPECT_GE(longest[idx - 1].run_usec, longest[idx].run_usec);
+    }
+
+    scheduler->ClearLatencyStats();
+    scheduler->GetLatencyStats(&stats);
+    EXPECT_TRUE(stats.size() <= (size_t) task_id ||
+                stats[task_id].count == 0);
+}
+
+//
+// Records the tbb affinity that the task was spawned with and the thread
+// that ran it.
+//
+class AffinityTask : public Task {
+public:
+    AffinityTask(int id, int instance, tbb::task::affinity_id *affinity,
+                 pthread_t *thread)
+        : Task(id, instance), affinity_(affinity), thread_(thread) {
+    }
+    bool Run() {
+        *affinity_ = tbb::task::self().affinity();
+        *thread_ = pthread_self();
+        bench_run_count++;
+        return true;
+    }
+
+private:
+    tbb::task::affinity_id *affinity_;
+    pthread_t *thread_;
+};
+
+// Runs count tasks of instance one at a time, enqueued from this thread,
+// which doesn't run tasks, so that each of them is taken by a worker.
+static void RunAffinityTasks(int instance, int count,
+                             vector<tbb::task::affinity_id> *affinity,
+                             vector<pthread_t> *thread) {
+    int task_id = scheduler->GetTaskId("test::Affinity");
+    affinity->resize(count);
+    thread->resize(count);
+    for (int i = 0; i < count; i++) {
+        bench_run_count = 0;
+        scheduler->Enqueue(new AffinityTask(task_id, instance,
+                                            &(*affinity)[i], &(*thread)[i]));
+        for (int j = 0; j < 10000 && bench_run_count == 0; j++) {
+            usleep(100);
+        }
+        for (int j = 0; j < 10000 && !scheduler->IsEmpty(); j++) {
+            usleep(100);
+        }
+        ASSERT_EQ(1, bench_run_count);
+        ASSERT_TRUE(scheduler->IsEmpty());
+    }
+}
+
+// With affinity enabled, each task of an instance but the first is spawned
+// with the affinity of the worker thread that ran the previous one. Tasks
+// without an instance, and all tasks with affinity disabled, are spawned
+// without one. Which thread the task then runs on is up to tbb.
+TEST_F(TestUT, Affinity)
+{
+    const int count = 32;
+    vector<tbb::task::affinity_id> affinity;
+    vector<pthread_t> thread;
+
+    RunAffinityTasks(1, count, &affinity, &thread);
+    for (int i = 0; i < count; i++) {
+        EXPECT_EQ(0U, affinity[i]);
+    }
+
+    scheduler->EnableAffinity(true);
+    RunAffinityTasks(-1, count, &affinity, &thread);
+    for (int i = 0; i < count; i++) {
+        EXPECT_EQ(0U, affinity[i]);
+    }
+
+    RunAffinityTasks(2, count, &affinity, &thread);
+    scheduler->EnableAffinity(false);
+    EXPECT_EQ(0U, affinity[0]);
+    int same_thread = 0;
+    for (int i = 1; i < count; i++) {
+        EXPECT_NE(0U, affinity[i]);
+        for (int j = 1; j < count; j++) {
+            // The same thread has the same affinity, and other threads
+            // have other affinities.
+            EXPECT_EQ(pthread_equal(thread[i - 1], thread[j - 1]) != 0,
+                      affinity[i] == affinity[j]);
+        }
+        if (pthread_equal(thread[i - 1], thread[i])) {
+            same_thread++;
+        }
+    }
+    cout << "Affinity: " << same_thread << " of " << count - 1 <<
+        " tasks ran on the thread of the previous one" << endl;
+}
+
+//
+// Throughput of Enqueue and task exit with a number of producer threads.
+// Each producer enqueues tasks for its own instance of a task id without
+// any policy, so the only contention is in the scheduler itself.
+//
+// The run is kept short by default. Set BENCH_TASK_COUNT (tasks per
+// producer) and BENCH_THREAD_COUNT (most producers) to measure.
+//
+static int bench_task_count;
+
+class BenchTask : public Task {
+public:
+    BenchTask(int id, int instance) : Task(id, instance) { }
+    bool Run() {
+        bench_run_count++;
+        return true;
+    }
+};
+
+struct BenchProducer {
+    int task_id;
+    int instance;
+};
+
+static void *BenchProducerThread(void *arg) {
+    BenchProducer *producer = static_cast<BenchProducer *>(arg);
+    for (int i = 0; i < bench_task_count; i++) {
+        scheduler->Enqueue(new BenchTask(producer->task_id,
+                                         producer->instance));
+    }
+    return NULL;
+}
+
+static void BenchEnqueue(int thread_count, bool affinity) {
+    scheduler->EnableAffinity(affinity);
+    bench_run_count = 0;
+    int task_id = scheduler->GetTaskId("bench::Enqueue");
+    vector<BenchProducer> producers(thread_count);
+    vector<pthread_t> threads(thread_count);
+
+    uint64_t start = UTCTimestampUsec();
+    for (int i = 0; i < thread_count; i++) {
+        producers[i].task_id = task_id;
+        producers[i].instance = i;
+        pthread_create(&threads[i], NULL, &BenchProducerThread,
+                       &producers[i]);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    long total = (long) thread_count * bench_task_count;
+    while (bench_run_count != total) {
+        usleep(100);
+    }
+    uint64_t usec = max(UTCTimestampUsec() - start, (uint64_t) 1);
+    scheduler->EnableAffinity(false);
+
+    cout << "Producers " << thread_count << " affinity " << affinity <<
+        ": " << total << " tasks in " << usec << " usec, " <<
+        total * 1000000 / usec << " enqueues/sec" << endl;
+
+    // The last tasks may still be exiting.
+    for (int i = 0; i < 10000 && !scheduler->IsEmpty(); i++) {
+        usleep(1000);
+    }
+    EXPECT_TRUE(scheduler->IsEmpty());
+}
+
+TEST_F(TestUT, EnqueueThroughput)
+{
+    bench_task_count = GetEnvInt("BENCH_TASK_COUNT", 1000);
+    int thread_count = GetEnvInt("BENCH_THREAD_COUNT", 2);
+    for (int threads = 1; threads <= thread_count; threads *= 2) {
+        BenchEnqueue(threads, false);
+        BenchEnqueue(threads, true);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     ::testing::InitGoogleTest(&argc, argv);
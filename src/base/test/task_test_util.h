@@ -5,6 +5,7 @@
 #ifndef __BASE__TASK_TEST_UTIL_H__
 #define __BASE__TASK_TEST_UTIL_H__
 
+#include <stdlib.h>
 #include <boost/function.hpp>
 #include "testing/gunit.h"
 class EventManager;
@@ -113,6 +114,16 @@ static inline unsigned long long int task_util_retry_count() {
     return retry;
 }
 
+// Value of the environment variable name as an integer, or value if it is
+// not set. The benchmarks take their sizes from it.
+static inline int GetEnvInt(const char *name, int value) {
+    char *str = getenv(name);
+    if (str) {
+        value = strtol(str, NULL, 0);
+    }
+    return value;
+}
+
 #define TASK_UTIL_EXPECT_EQ(expected, actual) \
     TASK_UTIL_WAIT_EQ(expected, actual, task_util_wait_time(), \
                       task_util_retry_count(), "")
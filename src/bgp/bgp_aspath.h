@@ -119,7 +119,7 @@ public:
 
 private:
     friend int intrusive_ptr_add_ref(const AsPath *cpath);
-    friend int intrusive_ptr_del_ref(const AsPath *cpath);
+    friend bool intrusive_ptr_add_ref_if_live(const AsPath *cpath);
     friend void intrusive_ptr_release(const AsPath *cpath);
 
     mutable tbb::atomic<int> refcount_;
@@ -131,8 +131,8 @@ inline int intrusive_ptr_add_ref(const AsPath *cpath) {
     return cpath->refcount_.fetch_and_increment();
 }
 
-inline int intrusive_ptr_del_ref(const AsPath *cpath) {
-    return cpath->refcount_.fetch_and_decrement();
+inline bool intrusive_ptr_add_ref_if_live(const AsPath *cpath) {
+    return BgpAttrRefcountIncrementIfLive(&cpath->refcount_);
 }
 
 inline void intrusive_ptr_release(const AsPath *cpath) {
@@ -282,7 +282,7 @@ public:
 private:
     friend class BgpAttrDB;
     friend int intrusive_ptr_add_ref(const BgpAttr *cattrp);
-    friend int intrusive_ptr_del_ref(const BgpAttr *cattrp);
+    friend bool intrusive_ptr_add_ref_if_live(const BgpAttr *cattrp);
     friend void intrusive_ptr_release(const BgpAttr *cattrp);
 
     mutable tbb::atomic<int> refcount_;
@@ -306,8 +306,8 @@ inline int intrusive_ptr_add_ref(const BgpAttr *cattrp) {
     return cattrp->refcount_.fetch_and_increment();
 }
 
-inline int intrusive_ptr_del_ref(const BgpAttr *cattrp) {
-    return cattrp->refcount_.fetch_and_decrement();
+inline bool intrusive_ptr_add_ref_if_live(const BgpAttr *cattrp) {
+    return BgpAttrRefcountIncrementIfLive(&cattrp->refcount_);
 }
 
 inline void intrusive_ptr_release(const BgpAttr *cattrp) {
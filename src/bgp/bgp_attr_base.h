@@ -9,7 +9,8 @@
 #include <boost/scoped_array.hpp>
 #include <set>
 #include <string>
-#include <tbb/mutex.h>
+#include <tbb/atomic.h>
+#include <tbb/spin_rw_mutex.h>
 #include <vector>
 #include "base/parse_object.h"
 #include "base/task.h"
@@ -66,11 +67,47 @@ struct BgpProtoPrefix : public ParseObject {
     uint8_t type; // only applicable for evpn
 };
 
+// Counters for a path attribute database. The contended counter is the
+// number of times a partition lock could not be acquired right away.
+struct BgpPathAttributeDBStats {
+    BgpPathAttributeDBStats()
+        : partitions(0), size(0), lookups(0), hits(0), inserts(0),
+          replaced(0), contended(0) {
+    }
+    size_t partitions;
+    size_t size;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t replaced;
+    uint64_t contended;
+};
+
+// Increment the refcount of a path attribute unless it is 0. A refcount of
+// 0 means the last reference is released and the attribute is about to be
+// removed from its database, so it must not be revived.
+inline bool BgpAttrRefcountIncrementIfLive(tbb::atomic<int> *refcount) {
+    int count = *refcount;
+    while (count > 0) {
+        int prev = refcount->compare_and_swap(count + 1, count);
+        if (prev == count) return true;
+        count = prev;
+    }
+    return false;
+}
+
 // Base class to manage BGP Path Attributes database. This class provides
 // thread safe access to the data base.
 //
-// Lock contention can be tuned by varying the hash table size passed to the
-// constructor.
+// The database is partitioned by attribute hash, and each partition is
+// protected by a reader-writer lock. Locating an attribute that is already
+// present only needs the lock in shared mode, so concurrent lookups of the
+// common attributes do not serialize. The lock is taken in exclusive mode
+// only to insert or delete an entry.
+//
+// By default the number of partitions scales with the number of worker
+// threads. It can be overridden with BGP_PATH_ATTRIBUTE_DB_HASH_SIZE or by
+// passing the hash table size to the constructor.
 //
 // Attribute contents must be hashable via hash_value() and hashed using
 // boost::hash_combine() to partition the attribute database.
@@ -79,25 +116,31 @@ template <class Type, class TypePtr, class TypeSpec, typename TypeCompare,
 class BgpPathAttributeDB {
 public:
     BgpPathAttributeDB(int hash_size = GetHashSize()) :
-            hash_size_(hash_size), set_(new Set[hash_size]),
-            mutex_(new tbb::mutex[hash_size]) {
+            hash_size_(hash_size), partitions_(new Partition[hash_size]) {
     }
 
     size_t Size() {
         size_t size = 0;
 
         for (size_t i = 0; i < hash_size_; i++) {
-            tbb::mutex::scoped_lock lock(mutex_[i]);
-            size += set_[i].size();
+            ScopedLock lock(partitions_[i].mutex, false);
+            size += partitions_[i].set.size();
         }
         return size;
     }
 
+    // Remove the attribute from the data base, unless its place has already
+    // been taken by another attribute with the same contents. See
+    // LocateInternal.
     void Delete(Type *attr) {
-        size_t hash = HashCompute(attr);
+        Partition *partition = &partitions_[HashCompute(attr)];
 
-        tbb::mutex::scoped_lock lock(mutex_[hash]);
-        set_[hash].erase(attr);
+        ScopedLock lock;
+        Acquire(partition, &lock, true);
+        typename Set::iterator it = partition->set.find(attr);
+        if (it != partition->set.end() && *it == attr) {
+            partition->set.erase(it);
+        }
     }
 
     // Locate passed in attribute in the data base based on the attr ptr.
@@ -111,7 +154,41 @@ public:
         return LocateInternal(attr);
     }
 
+    void GetStats(BgpPathAttributeDBStats *stats) {
+        *stats = BgpPathAttributeDBStats();
+        stats->partitions = hash_size_;
+        for (size_t i = 0; i < hash_size_; i++) {
+            const Partition &partition = partitions_[i];
+            stats->lookups += partition.lookups;
+            stats->hits += partition.hits;
+            stats->inserts += partition.inserts;
+            stats->replaced += partition.replaced;
+            stats->contended += partition.contended;
+        }
+        stats->size = Size();
+    }
+
 private:
+    typedef std::set<Type *, TypeCompare> Set;
+    typedef tbb::spin_rw_mutex::scoped_lock ScopedLock;
+
+    struct Partition {
+        Partition() {
+            lookups = 0;
+            hits = 0;
+            inserts = 0;
+            replaced = 0;
+            contended = 0;
+        }
+        tbb::spin_rw_mutex mutex;
+        Set set;
+        tbb::atomic<uint64_t> lookups;
+        tbb::atomic<uint64_t> hits;
+        tbb::atomic<uint64_t> inserts;
+        tbb::atomic<uint64_t> replaced;
+        tbb::atomic<uint64_t> contended;
+    };
+
     const size_t HashCompute(Type *attr) const {
         if (hash_size_ <= 1) return 0;
 
@@ -122,10 +199,40 @@ private:
 
     static size_t GetHashSize() {
         char *str = getenv("BGP_PATH_ATTRIBUTE_DB_HASH_SIZE");
+        if (str) return strtoul(str, NULL, 0);
+
+        // A few partitions per worker thread keeps the odds of two threads
+        // hitting the same partition low.
+        size_t hash_size = 1;
+        while (hash_size < 4 * (size_t) TaskScheduler::GetThreadCount()) {
+            hash_size <<= 1;
+        }
+        return hash_size;
+    }
+
+    static void Acquire(Partition *partition, ScopedLock *lock, bool write) {
+        if (!lock->try_acquire(partition->mutex, write)) {
+            partition->contended++;
+            lock->acquire(partition->mutex, write);
+        }
+    }
 
-        // Use just one bucket for now.
-        if (!str) return 1;
-        return strtoul(str, NULL, 0);
+    // Take a reference to an entry in the database, unless the entry is
+    // undergoing deletion. This can happen because attribute intrusive
+    // pointer is released without taking the mutex. If the refcount is 0,
+    // the entry is about to be removed from the database by the thread that
+    // released the last reference.
+    //
+    // The refcount is only incremented if it is not 0, so concurrent readers
+    // holding the lock in shared mode can not revive an entry whose last
+    // reference is gone. The releasing thread needs the lock in exclusive
+    // mode in Delete, so it can not free the entry while we look at it.
+    static bool AddRefIfLive(Type *entry, TypePtr *ptr) {
+        if (!intrusive_ptr_add_ref_if_live(entry)) {
+            return false;
+        }
+        *ptr = TypePtr(entry, false);
+        return true;
     }
 
     // This template safely retrieves an attribute entry from its data base.
@@ -134,71 +241,53 @@ private:
     // If the entry is already present, then passed in entry is freed and
     // existing entry is returned.
     TypePtr LocateInternal(Type *attr) {
-
-        // Hash attribute contents to to avoid potential mutex contention.
-        size_t hash = HashCompute(attr);
-        while (true) {
-
-            // Grab mutex to keep db access thread safe.
-            tbb::mutex::scoped_lock lock(mutex_[hash]);
-            std::pair<typename Set::iterator, bool> ret;
-
-            // Try to insert the passed entry into the database.
-            ret = set_[hash].insert(attr);
-
-            // Take a reference to prevent this entry from getting deleted.
-            // Counter is automatically incremented, hence we get thread safety
-            // here.
-            int prev = intrusive_ptr_add_ref(*ret.first);
-
-            // Check if passed in entry did get into the data base.
-            if (ret.second) {
-
-                // Take intrusive pointer, thereby incrementing the refcount.
-                TypePtr ptr = TypePtr(*ret.first);
-
-                // Release redundant refcount taken above to protect this entry
-                // from getting deleted, as we have now bumped up refcount above
-                intrusive_ptr_del_ref(*ret.first);
+        Partition *partition = &partitions_[HashCompute(attr)];
+        partition->lookups++;
+        TypePtr ptr;
+
+        // Look for a live entry holding the lock in shared mode.
+        {
+            ScopedLock lock;
+            Acquire(partition, &lock, false);
+            typename Set::iterator it = partition->set.find(attr);
+            if (it != partition->set.end() && AddRefIfLive(*it, &ptr)) {
+                partition->hits++;
+                lock.release();
+                delete attr;
                 return ptr;
             }
+        }
 
-            // Make sure that this entry, though in the database is not
-            // undergoing deletion. This can happen because attribute intrusive
-            // pointer is released without taking the mutex.
-            //
-            // If the previous refcount is 0, it implies that this entry is
-            // about to get deleted (after we release the mutex). In such
-            // cases, we retry inserting the passed attribute pointer into the
-            // data base.
-            if (prev > 0) {
-
-                // Free passed in attribute, as it is already in the database.
-                delete attr;
-
-                // Take intrusive pointer, thereby incrementing the refcount.
-                TypePtr ptr = TypePtr(*ret.first);
+        ScopedLock lock;
+        Acquire(partition, &lock, true);
 
-                // Release redundant refcount taken above to protect this entry
-                // from getting deleted, as we have now bumped up refcount above
-                intrusive_ptr_del_ref(*ret.first);
-                return ptr;
-            }
+        // Try to insert the passed entry into the database.
+        std::pair<typename Set::iterator, bool> ret;
+        ret = partition->set.insert(attr);
+        if (ret.second) {
+            partition->inserts++;
+            return TypePtr(attr);
+        }
 
-            // Decrement the counter bumped up above as we can't use this entry
-            // which is above to be deleted. Instead, retry inserting the passed
-            // entry again, into the database.
-            intrusive_ptr_del_ref(*ret.first);
+        // Someone else inserted the same contents in the meantime.
+        if (AddRefIfLive(*ret.first, &ptr)) {
+            partition->hits++;
+            lock.release();
+            delete attr;
+            return ptr;
         }
 
-        assert(false);
-        return NULL;
+        // The existing entry is about to be deleted. Rather than wait for
+        // that to happen, replace it with the passed attribute. Delete for
+        // the old entry sees that it is no longer in the database.
+        partition->set.erase(ret.first);
+        partition->set.insert(attr);
+        partition->replaced++;
+        return TypePtr(attr);
     }
 
-    typedef std::set<Type *, TypeCompare> Set;
     size_t hash_size_;
-    boost::scoped_array<Set> set_;
-    boost::scoped_array<tbb::mutex> mutex_;
+    boost::scoped_array<Partition> partitions_;
 };
 
 #endif
@@ -671,6 +671,18 @@ static bool SkipUpdateSend() {
     return skip_;
 }
 
+void BgpPeer::Cork() {
+    tbb::spin_mutex::scoped_lock lock(spin_mutex_);
+    if (session_ && !SkipUpdateSend())
+        session_->Cork();
+}
+
+void BgpPeer::Uncork() {
+    tbb::spin_mutex::scoped_lock lock(spin_mutex_);
+    if (session_)
+        session_->Uncork();
+}
+
 bool BgpPeer::SendUpdate(const uint8_t *msg, size_t msgsize) {
     tbb::spin_mutex::scoped_lock lock(spin_mutex_);
 
@@ -785,6 +797,9 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
     }
 
 
+    // Enqueue all the routes in the update together, rather than one
+    // request at a time.
+    DBRequestBatch batch;
     RoutingInstance *instance = GetRoutingInstance();
     if (msg->nlri.size() || msg->withdrawn_routes.size()) {
         InetTable *table =
@@ -803,7 +818,7 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
             req.data.reset(NULL);
             Ip4Prefix prefix = Ip4Prefix(**it);
             req.key.reset(new InetTable::RequestKey(prefix, this));
-            table->Enqueue(&req);
+            batch.Add(table, &req);
             inc_rx_route_unreach();
         }
 
@@ -814,7 +829,7 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
             req.data.reset(new InetTable::RequestData(attr, flags, 0));
             Ip4Prefix prefix = Ip4Prefix(**it);
             req.key.reset(new InetTable::RequestKey(prefix, this));
-            table->Enqueue(&req);
+            batch.Add(table, &req);
             inc_rx_route_reach();
         }
     }
@@ -862,7 +877,7 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
                     req.data.reset(new InetTable::RequestData(attr, flags, 0));
                 Ip4Prefix prefix = Ip4Prefix(**it);
                 req.key.reset(new InetTable::RequestKey(prefix, this));
-                table->Enqueue(&req);
+                batch.Add(table, &req);
             }
             break;
         }
@@ -883,7 +898,7 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
                     req.data.reset(new InetVpnTable::RequestData(attr, flags, label));
                 req.key.reset(new InetVpnTable::RequestKey(InetVpnPrefix(**it),
                                                            this));
-                table->Enqueue(&req);
+                batch.Add(table, &req);
             }
             break;
         }
@@ -910,7 +925,7 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
                 if (oper == DBRequest::DB_ENTRY_ADD_CHANGE)
                     req.data.reset(new EvpnTable::RequestData(attr, flags, label));
                 req.key.reset(new EvpnTable::RequestKey(EvpnPrefix(**it), this));
-                table->Enqueue(&req);
+                batch.Add(table, &req);
             }
             break;
         }
@@ -919,6 +934,8 @@ void BgpPeer::ProcessUpdate(const BgpProto::Update *msg) {
             continue;
         }
     }
+
+    batch.Enqueue();
 }
 
 void BgpPeer::KeepaliveTimerErrorHandler(string error_name,
@@ -52,6 +52,8 @@ public:
     // thread: bgp::SendTask
     // Used to send an UPDATE message on the socket.
     virtual bool SendUpdate(const uint8_t *msg, size_t msgsize);
+    virtual void Cork();
+    virtual void Uncork();
 
     // thread: bgp::config
     void ConfigUpdate(const BgpNeighborConfig *config);
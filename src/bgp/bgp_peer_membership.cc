@@ -9,12 +9,14 @@
 #include <tbb/mutex.h>
 
 #include "base/task_annotations.h"
+#include "base/task_trigger.h"
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
 
 #include "bgp/bgp_export.h"
 #include "bgp/bgp_log.h"
 #include "bgp/bgp_peer.h"
+#include "bgp/bgp_peer_close.h"
 #include "bgp/bgp_peer_types.h"
 #include "bgp/bgp_ribout.h"
 #include "bgp/bgp_ribout_updates.h"
@@ -29,6 +31,7 @@
 using namespace std;
 
 int PeerRibMembershipManager::membership_task_id_ = -1;
+int RibInSweeper::budget_ = -1;
 const int PeerRibMembershipManager::kMembershipTaskInstanceId;
 
 MembershipRequest::MembershipRequest() {
@@ -314,6 +317,177 @@ void IPeerRib::ManagedDelete() {
     // membership_mgr_->Unregister(ipeer_, table_);
 }
 
+//
+// Concurrency: Runs in the context of the BGP peer membership task.
+//
+RibInSweeper::RibInSweeper(PeerRibMembershipManager *manager, BgpTable *table,
+                           MembershipRequestList *request_list)
+    : manager_(manager), table_(table), request_list_(request_list) {
+    pending_ = 0;
+}
+
+RibInSweeper::~RibInSweeper() {
+    STLDeleteValues(&partitions_);
+    STLDeleteValues(&peers_);
+}
+
+int RibInSweeper::budget() {
+    if (budget_ < 0) {
+        char *str = getenv("BGP_PEER_CLOSE_BUDGET");
+        budget_ = str ? strtol(str, NULL, 0) : 1024;
+        if (budget_ < 0) budget_ = 0;
+    }
+    return budget_;
+}
+
+//
+// Concurrency: Runs in the context of the BGP peer membership task.
+//
+// Note down the RibIn work for each peer in the request list and trigger the
+// processing of all partitions. The BGP peer membership task excludes the
+// db::DBTable tasks, so the route counts of all partitions can be read here.
+//
+// If walk is true, the Leave is also walking the table and WalkDone will be
+// called once the walk is complete.
+//
+void RibInSweeper::Start(bool walk) {
+    uint64_t now = UTCTimestampUsec();
+    for (MembershipRequestList::iterator iter = request_list_->begin();
+         iter != request_list_->end(); iter++) {
+        MembershipRequest *request = iter.operator->();
+        PeerState *peer_state = new PeerState;
+        peer_state->ipeer = request->ipeer;
+        peer_state->start_time = now;
+        IPeerRib *peer_rib = manager_->IPeerRibFind(request->ipeer, table_);
+        if (peer_rib && peer_rib->IsRibInRegistered()) {
+            peer_state->action_mask = request->action_mask &
+                (MembershipRequest::RIBIN_STALE |
+                 MembershipRequest::RIBIN_SWEEP |
+                 MembershipRequest::RIBIN_DELETE);
+        }
+        if (peer_state->action_mask) {
+            peer_state->route_count =
+                table_->GetPeerRouteCount(request->ipeer);
+        }
+        peers_.push_back(peer_state);
+    }
+
+    int task_id = TaskScheduler::GetInstance()->GetTaskId("db::DBTable");
+    int part_count = table_->PartitionCount();
+    pending_ = part_count + (walk ? 1 : 0);
+    for (int part_id = 0; part_id < part_count; part_id++) {
+        PartitionState *part_state = new PartitionState;
+        part_state->trigger.reset(new TaskTrigger(
+            boost::bind(&RibInSweeper::ProcessPartition, this, part_id),
+            task_id, part_id));
+        partitions_.push_back(part_state);
+    }
+    for (int part_id = 0; part_id < part_count; part_id++) {
+        partitions_[part_id]->trigger->Set();
+    }
+}
+
+//
+// Concurrency: Runs in the context of the db::DBTable task for the partition.
+//
+// Process up to budget() routes of the closing peers in the partition. The
+// cursor is the last route that was processed for the current peer, so that
+// the next run resumes after it even though the routes that were processed
+// may have been removed from the list, or (re)inserted when they are staled.
+//
+// Return false to get the task to run again when the budget is exhausted.
+//
+bool RibInSweeper::ProcessPartition(int part_id) {
+    PartitionState *part_state = partitions_[part_id];
+    DBTablePartBase *root = table_->GetTablePartition(part_id);
+    int budget = RibInSweeper::budget();
+    int count = 0;
+
+    for (; part_state->peer_idx < peers_.size();
+         part_state->peer_idx++, part_state->cursor = NULL) {
+        PeerState *peer_state = peers_[part_state->peer_idx];
+        if (!peer_state->action_mask) continue;
+
+        PeerCloseManager *close_manager =
+            peer_state->ipeer->peer_close()->close_manager();
+
+        // Look up the list and the cursor again for each route since
+        // processing a route may remove it from the list, and the list
+        // itself goes away when its last route is removed.
+        while (true) {
+            BgpTable::PeerRouteList *route_list =
+                table_->GetPeerRouteList(part_id, peer_state->ipeer);
+            if (!route_list) break;
+            BgpTable::PeerRouteList::iterator it = part_state->cursor ?
+                route_list->upper_bound(part_state->cursor) :
+                route_list->begin();
+            if (it == route_list->end()) break;
+            if (count == budget) return false;
+
+            BgpRoute *rt = it->first;
+            part_state->cursor = rt;
+            close_manager->ProcessRibIn(root, rt, table_,
+                                        peer_state->action_mask);
+            peer_state->processed++;
+            count++;
+        }
+    }
+
+    StepDone();
+    return true;
+}
+
+//
+// Concurrency: Runs in the context of the DB partition task.
+//
+void RibInSweeper::WalkDone() {
+    StepDone();
+}
+
+//
+// Concurrency: Runs in the context of a db::DBTable task.
+//
+// Post the UNREGISTER_RIB_COMPLETE event once the walk and the sweep of all
+// partitions are done. The sweeper is deleted when the event is processed.
+//
+void RibInSweeper::StepDone() {
+    if (--pending_ != 0) return;
+
+    IPeerRibEvent *event =
+        new IPeerRibEvent(IPeerRibEvent::UNREGISTER_RIB_COMPLETE, NULL, table_,
+                          request_list_);
+    manager_->Enqueue(event);
+}
+
+//
+// Concurrency: Runs in the context of the bgp::ShowCommand task, which
+// excludes the BGP peer membership task.
+//
+void RibInSweeper::FillCloseProgress(const IPeer *peer,
+        vector<BgpNeighborCloseProgress> *list) const {
+    uint64_t now = UTCTimestampUsec();
+    for (vector<PeerState *>::const_iterator it = peers_.begin();
+         it != peers_.end(); ++it) {
+        const PeerState *peer_state = *it;
+        if (peer_state->ipeer != peer || !peer_state->action_mask) continue;
+
+        uint64_t processed = peer_state->processed;
+        uint64_t elapsed = now - peer_state->start_time;
+        BgpNeighborCloseProgress progress;
+        progress.set_table(table_->name());
+        progress.set_action(MembershipRequest::ActionMaskToString(
+            static_cast<MembershipRequest::Action>(peer_state->action_mask)));
+        progress.set_routes(peer_state->route_count);
+        progress.set_processed(processed);
+        progress.set_elapsed_msecs(elapsed / 1000);
+        if (processed && processed < peer_state->route_count) {
+            progress.set_eta_msecs((peer_state->route_count - processed) *
+                                   elapsed / processed / 1000);
+        }
+        list->push_back(progress);
+    }
+}
+
 //
 // Constructor for the PeerMembershipMgr. Create the peer membership task if
 // required.  Also create a WorkQueue to handle IPeerRibEvents.
@@ -422,6 +596,7 @@ void PeerRibMembershipManager::Leave(BgpTable *table,
                               MembershipRequestList *request_list) {
 
     DB *db = table->database();
+    bool ribout_delete = false;
 
     for (MembershipRequestList::iterator iter = request_list->begin();
              iter != request_list->end(); iter++) {
@@ -430,6 +605,7 @@ void PeerRibMembershipManager::Leave(BgpTable *table,
         if (!(request->action_mask & MembershipRequest::RIBOUT_DELETE)) {
             continue;
         }
+        ribout_delete = true;
 
         IPeerRib *peer_rib = IPeerRibFind(request->ipeer, table);
 
@@ -442,26 +618,43 @@ void PeerRibMembershipManager::Leave(BgpTable *table,
         }
     }
 
+    //
+    // The RibIn is processed by a RibInSweeper from the per peer route lists
+    // of the table unless it's disabled. The table still needs to be walked
+    // if any of the RibOuts is being deleted.
+    //
+    RibInSweeper *sweeper = NULL;
+    bool walk = true;
+    if (RibInSweeper::budget() > 0) {
+        sweeper = new RibInSweeper(this, table, request_list);
+        sweeper_map_.insert(make_pair(request_list, sweeper));
+        walk = ribout_delete;
+        sweeper->Start(walk);
+    }
+    if (!walk) return;
+
     DBTableWalker *walker = db->GetWalker();
     walker->WalkTable(table, NULL,
         // _1: DBTablePartBase, _2: DBEntry
         boost::bind(&PeerRibMembershipManager::RouteLeave, this, _1, _2, table,
-                    request_list),
+                    request_list, sweeper),
         // _1: DBTableBase
         boost::bind(&PeerRibMembershipManager::LeaveDone, this, _1,
-                    request_list));
+                    request_list, sweeper));
 }
 
 //
 // Concurrency: Runs in the context of the db walker task triggered from
 // BGP peer membership task.
 //
-// Leave the route from RibIn and from RibOut
+// Leave the route from RibOut, and from RibIn unless the RibIn is handled
+// by a RibInSweeper.
 //
 bool PeerRibMembershipManager::RouteLeave(DBTablePartBase *root,
                                           DBEntryBase *db_entry,
                                           BgpTable *table,
-                                          MembershipRequestList *request_list) {
+                                          MembershipRequestList *request_list,
+                                          RibInSweeper *sweeper) {
     for (MembershipRequestList::iterator iter = request_list->begin();
              iter != request_list->end(); iter++) {
         MembershipRequest *request = iter.operator->();
@@ -471,7 +664,9 @@ bool PeerRibMembershipManager::RouteLeave(DBTablePartBase *root,
             continue;
         }
         peer_rib->RibOutLeave(root, db_entry, table, request->action_mask);
-        peer_rib->RibInLeave(root, db_entry, table, request->action_mask);
+        if (!sweeper) {
+            peer_rib->RibInLeave(root, db_entry, table, request->action_mask);
+        }
     }
     return true;
 }
@@ -496,10 +691,16 @@ void PeerRibMembershipManager::MembershipRequestListDebug(
 // Process the table walk done notification from the DB infrastructure.  This
 // walk was started from the Leave method. Since the table walk is complete,
 // we can post an IPeerRib UNREGISTER_RIB event for the BGP peer membership
-// task.
+// task. If there's a RibInSweeper, it posts the event once it is done too.
 //
 void PeerRibMembershipManager::LeaveDone(DBTableBase *db,
-                                         MembershipRequestList *request_list) {
+                                         MembershipRequestList *request_list,
+                                         RibInSweeper *sweeper) {
+    if (sweeper) {
+        sweeper->WalkDone();
+        return;
+    }
+
     BgpTable *table = static_cast<BgpTable *>(db);
 
     IPeerRibEvent *event =
@@ -781,6 +982,13 @@ void PeerRibMembershipManager::FillPeerMembershipInfo(const IPeer *peer,
         table_list.push_back(table);
     }
     if (table_list.size()) resp.set_routing_tables(table_list);
+
+    std::vector<BgpNeighborCloseProgress> progress_list;
+    for (SweeperMap::const_iterator it = sweeper_map_.begin();
+         it != sweeper_map_.end(); ++it) {
+        it->second->FillCloseProgress(peer, &progress_list);
+    }
+    if (progress_list.size()) resp.set_close_progress(progress_list);
 }
 
 void PeerRibMembershipManager::FillRegisteredTable(IPeer *peer, 
@@ -983,6 +1191,11 @@ void PeerRibMembershipManager::ProcessUnregisterRibEvent(BgpTable *table,
 //
 void PeerRibMembershipManager::ProcessUnregisterRibCompleteEvent(
         IPeerRibEvent *event) {
+    SweeperMap::iterator sweeper_it = sweeper_map_.find(event->request_list);
+    if (sweeper_it != sweeper_map_.end()) {
+        delete sweeper_it->second;
+        sweeper_map_.erase(sweeper_it);
+    }
 
     for (MembershipRequestList::iterator iter =
             event->request_list->begin();
@@ -5,8 +5,12 @@
 #ifndef __BGP_PEER_MEMBERSHIP_H__
 #define __BGP_PEER_MEMBERSHIP_H__
 
+#include <map>
 #include <set>
 
+#include <boost/scoped_ptr.hpp>
+#include <tbb/atomic.h>
+
 #include "base/lifetime.h"
 #include "base/util.h"
 #include "base/queue_task.h"
@@ -20,7 +24,9 @@ class DBTableBase;
 class PeerRibMembershipManager;
 class RibOut;
 class ShowRoutingInstanceTable;
+class BgpNeighborCloseProgress;
 class BgpNeighborResp;
+class TaskTrigger;
 
 struct MembershipRequest {
 public:
@@ -159,6 +165,78 @@ private:
 };
 
 
+//
+// This class runs the RibIn part of a Leave for a BgpTable, i.e. deletes,
+// stales or sweeps the paths of a set of closing peers.
+//
+// Rather than walking the whole table, it only visits the routes on the
+// per peer route lists maintained by the BgpTable. Each partition is handled
+// by a TaskTrigger that runs in the db::DBTable task for the partition and
+// processes at most budget() routes per run before yielding, so that the
+// close of a large number of peers does not hold off the processing of live
+// updates in the partition.
+//
+// The RibOut part of the Leave still needs a table walk since it is driven
+// by the routes that were advertised to the peer. The Leave is complete
+// once the walk, if any, and all partitions of the sweep are done.
+//
+// The progress of the sweep is kept per request so that it can be shown for
+// each closing peer.
+//
+class RibInSweeper {
+public:
+    RibInSweeper(PeerRibMembershipManager *manager, BgpTable *table,
+                 MembershipRequestList *request_list);
+    ~RibInSweeper();
+
+    void Start(bool walk);
+    void WalkDone();
+
+    BgpTable *table() { return table_; }
+    void FillCloseProgress(const IPeer *peer,
+                           std::vector<BgpNeighborCloseProgress> *list) const;
+
+    // Maximum number of routes processed per partition in one run of the
+    // task. Set with BGP_PEER_CLOSE_BUDGET, 0 disables the sweeper and the
+    // RibIn is processed from the table walk as before.
+    static int budget();
+    static void set_budget(int budget) { budget_ = budget; }
+
+private:
+    struct PeerState {
+        PeerState()
+            : ipeer(NULL), action_mask(0), route_count(0), start_time(0) {
+            processed = 0;
+        }
+        IPeer *ipeer;
+        int action_mask;
+        uint64_t route_count;
+        uint64_t start_time;
+        tbb::atomic<uint64_t> processed;
+    };
+
+    struct PartitionState {
+        PartitionState() : peer_idx(0), cursor(NULL) { }
+        size_t peer_idx;
+        BgpRoute *cursor;
+        boost::scoped_ptr<TaskTrigger> trigger;
+    };
+
+    bool ProcessPartition(int part_id);
+    void StepDone();
+
+    static int budget_;
+
+    PeerRibMembershipManager *manager_;
+    BgpTable *table_;
+    MembershipRequestList *request_list_;
+    std::vector<PeerState *> peers_;
+    std::vector<PartitionState *> partitions_;
+    tbb::atomic<int> pending_;
+
+    DISALLOW_COPY_AND_ASSIGN(RibInSweeper);
+};
+
 //
 // This struct represents the compare function that's used to impose the
 // strict weak ordering in the PeerRibSet of IPeerRibs maintained by the
@@ -193,6 +271,7 @@ public:
     typedef std::set<IPeerRib *, IPeerRibCompare> PeerRibSet;
     typedef std::map<BgpTable *, MembershipRequestList *>
                                      TableMembershipRequestMap;
+    typedef std::map<MembershipRequestList *, RibInSweeper *> SweeperMap;
     typedef MembershipRequest::NotifyCompletionFn NotifyCompletionFn;
     static const int kMembershipTaskInstanceId = 0;
 
@@ -240,8 +319,10 @@ private:
 
     void Leave(BgpTable *table, MembershipRequestList *request_list);
     bool RouteLeave(DBTablePartBase *root, DBEntryBase *db_entry,
-                    BgpTable *table, MembershipRequestList *request_list);
-    void LeaveDone(DBTableBase *db, MembershipRequestList *request_list);
+                    BgpTable *table, MembershipRequestList *request_list,
+                    RibInSweeper *sweeper);
+    void LeaveDone(DBTableBase *db, MembershipRequestList *request_list,
+                   RibInSweeper *sweeper);
 
     IPeerRibEvent *ProcessRequest(IPeerRibEvent::EventType event_type,
                                   BgpTable *table,
@@ -277,6 +358,7 @@ private:
 
     TableMembershipRequestMap register_request_map_;
     TableMembershipRequestMap unregister_request_map_;
+    SweeperMap sweeper_map_;
     tbb::mutex mutex_;
 
     DISALLOW_COPY_AND_ASSIGN(PeerRibMembershipManager);
@@ -4,38 +4,150 @@
 
 #include "bgp/bgp_ribout_updates.h"
 
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <tbb/compat/condition_variable>
+
 #include "base/logging.h"
+#include "base/task.h"
 #include "base/task_annotations.h"
+#include "base/timer.h"
 #include "bgp/bgp_log.h"
 #include "bgp/bgp_peer.h"
 #include "bgp/bgp_route.h"
+#include "bgp/bgp_server.h"
+#include "bgp/bgp_table.h"
 #include "bgp/bgp_update_queue.h"
 #include "bgp/bgp_update_monitor.h"
 #include "bgp/message_builder.h"
+#include "bgp/routing-instance/routing_instance.h"
 #include "bgp/scheduling_group.h"
 
 using namespace std;
 
+const size_t RibOutUpdates::kMinPeersPerShard;
+int RibOutUpdates::pack_delay_msec_ = -1;
+
+//
+// The send shards of one message. The shards are taken one at a time by
+// the send task that builds the message and by the SendShardTasks that it
+// starts, and each shard is sent by whoever takes it. Each shard has its
+// own set of blocked peers and byte count, so the shards don't share any
+// state that is modified while sending.
+//
+// A SendShardTask may only start once all the shards have been sent and
+// the message is gone. The shards are reference counted for that case, and
+// a task that finds no shard left does not look at the message.
+//
+class RibOutUpdates::SendShards {
+public:
+    SendShards(RibOutUpdates *updates, Message *message,
+               const IoSharedBufferPtr &body, int count)
+        : updates_(updates), message_(message), body_(body),
+          dst_vec_(count), blocked_vec_(count), bytes_vec_(count, 0),
+          done_(0) {
+        next_ = 0;
+    }
+
+    // Send the shards that are left, until there are none.
+    void Run() {
+        int count = dst_vec_.size();
+        for (int shard = next_.fetch_and_increment(); shard < count;
+             shard = next_.fetch_and_increment()) {
+            bytes_vec_[shard] = updates_->SendToPeers(message_, body_,
+                dst_vec_[shard], &blocked_vec_[shard]);
+            tbb::mutex::scoped_lock lock(mutex_);
+            if (++done_ == count)
+                cond_var_.notify_all();
+        }
+    }
+
+    // Wait for the shards taken by SendShardTasks to be sent.
+    void Wait() {
+        tbb::interface5::unique_lock<tbb::mutex> lock(mutex_);
+        while (done_ < (int) dst_vec_.size()) {
+            cond_var_.wait(lock);
+        }
+    }
+
+    RibPeerSet *dst(int shard) { return &dst_vec_[shard]; }
+    const RibPeerSet &blocked(int shard) const { return blocked_vec_[shard]; }
+    uint64_t bytes(int shard) const { return bytes_vec_[shard]; }
+
+private:
+    RibOutUpdates *updates_;
+    Message *message_;
+    IoSharedBufferPtr body_;
+    vector<RibPeerSet> dst_vec_;
+    vector<RibPeerSet> blocked_vec_;
+    vector<uint64_t> bytes_vec_;
+    tbb::atomic<int> next_;
+    tbb::mutex mutex_;
+    tbb::interface5::condition_variable cond_var_;
+    int done_;
+
+    DISALLOW_COPY_AND_ASSIGN(SendShards);
+};
+
+//
+// Helps send the shards of a message. The tasks run as instances of
+// bgp::SendTask, so they are excluded by the same tasks as the send task.
+//
+class RibOutUpdates::SendShardTask : public Task {
+public:
+    SendShardTask(int task_id, int instance,
+                  const boost::shared_ptr<SendShards> &shards)
+        : Task(task_id, instance), shards_(shards) {
+    }
+
+    virtual bool Run() {
+        shards_->Run();
+        return true;
+    }
+
+private:
+    boost::shared_ptr<SendShards> shards_;
+};
+
 //
 // Create a new RibOutUpdates.  Also create the necessary UpdateQueue and
 // add them to the vector.
 //
-RibOutUpdates::RibOutUpdates(RibOut *ribout) : ribout_(ribout) {
+RibOutUpdates::RibOutUpdates(RibOut *ribout)
+    : ribout_(ribout), pack_timer_(NULL), pack_pending_(0) {
     for (int i = 0; i < QCOUNT; i++) {
         UpdateQueue *queue = new UpdateQueue(i);
         queue_vec_.push_back(queue);
     }
     monitor_.reset(new RibUpdateMonitor(ribout, &queue_vec_));
     builder_ = MessageBuilder::GetInstance(ribout->ExportPolicy().encoding);
+    message_count_ = 0;
+    prefix_count_ = 0;
+    encode_usecs_ = 0;
+    send_usecs_ = 0;
+    encoded_bytes_ = 0;
+    sent_bytes_ = 0;
+    last_dequeue_usec_ = 0;
 }
 
 //
-// Destructor.  Get rid of all the UpdateQueues.
+// Destructor.  Get rid of all the UpdateQueues and the pack timer.
 //
 RibOutUpdates::~RibOutUpdates() {
+    if (pack_timer_) {
+        TimerManager::DeleteTimer(pack_timer_);
+    }
     STLDeleteValues(&queue_vec_);
 }
 
+int RibOutUpdates::pack_delay_msec() {
+    if (pack_delay_msec_ < 0) {
+        char *str = getenv("BGP_UPDATE_PACK_DELAY_MSEC");
+        pack_delay_msec_ = str ? strtol(str, NULL, 0) : 0;
+    }
+    return pack_delay_msec_;
+}
+
 //
 // Concurrency: Called in the context of the routing table partition task.
 //
@@ -51,13 +163,73 @@ void RibOutUpdates::Enqueue(DBEntryBase *db_entry, RouteUpdate *rt_update) {
     CHECK_CONCURRENCY("db::DBTable");
 
     bool need_tail_dequeue = monitor_->EnqueueUpdate(db_entry, rt_update);
-    if (need_tail_dequeue) {
+    if (need_tail_dequeue && !DelayTailDequeue(rt_update->queue_id())) {
         SchedulingGroup *group = ribout_->GetSchedulingGroup();
         assert(group != NULL);
         group->RibOutActive(ribout_, rt_update->queue_id());
     }
 }
 
+//
+// Concurrency: Called in the context of the routing table partition task.
+//
+// Hold back the tail dequeue for the queue till the pack timer fires if the
+// queue was dequeued within the pack delay, which means that the updates
+// are coming in faster than they would be packed otherwise.
+//
+// If the timer has already fired, the queues that are waiting for it may
+// have been collected, so don't delay the tail dequeue in that case.
+//
+// Return true if the tail dequeue has been delayed.
+//
+bool RibOutUpdates::DelayTailDequeue(int queue_id) {
+    int delay_msec = pack_delay_msec();
+    if (delay_msec <= 0)
+        return false;
+    if (UTCTimestampUsec() - last_dequeue_usec_ >= delay_msec * 1000ULL)
+        return false;
+
+    tbb::mutex::scoped_lock lock(pack_mutex_);
+    if (!pack_timer_) {
+        pack_timer_ = TimerManager::CreateTimer(
+            *ribout_->table()->routing_instance()->server()->ioservice(),
+            "BGP update pack timer",
+            TaskScheduler::GetInstance()->GetTaskId("bgp::SendTask"), 0);
+    }
+    if (pack_timer_->fired())
+        return false;
+
+    pack_pending_ |= (1 << queue_id);
+    if (!pack_timer_->running()) {
+        pack_timer_->Start(delay_msec,
+            boost::bind(&RibOutUpdates::PackTimerExpired, this));
+    }
+    return true;
+}
+
+//
+// Concurrency: Called in the context of the scheduling group task.
+//
+// Trigger the tail dequeue for all the queues that were delayed.
+//
+bool RibOutUpdates::PackTimerExpired() {
+    CHECK_CONCURRENCY("bgp::SendTask");
+
+    tbb::mutex::scoped_lock lock(pack_mutex_);
+    int pending = pack_pending_;
+    pack_pending_ = 0;
+    lock.release();
+
+    SchedulingGroup *group = ribout_->GetSchedulingGroup();
+    assert(group != NULL);
+    for (int queue_id = QFIRST; queue_id < QCOUNT; queue_id++) {
+        if (pending & (1 << queue_id)) {
+            group->RibOutActive(ribout_, queue_id);
+        }
+    }
+    return false;
+}
+
 //
 // Concurrency: Called in the context of the scheduling group task.
 //
@@ -106,10 +278,15 @@ bool RibOutUpdates::DequeueCommon(UpdateMarker *marker, RouteUpdate *rt_update,
         }
 
         // Generate the update and merge additional updates into that message.
+        uint64_t start = UTCTimestampUsec();
         auto_ptr<Message> message(
             builder_->Create(table, &uinfo->roattr, rt_update->route()));
         UpdatePack(rt_update->queue_id(), message.get(), uinfo, msgset);
         message->Finish();
+        encode_usecs_ += UTCTimestampUsec() - start;
+        message_count_++;
+        prefix_count_ +=
+            message->num_reach_routes() + message->num_unreach_routes();
 
         // Send the message to the target RibPeerSet.
         RibPeerSet msg_blocked;
@@ -155,6 +332,7 @@ bool RibOutUpdates::TailDequeue(int queue_id, const RibPeerSet &msync,
         RibPeerSet *blocked) {
     CHECK_CONCURRENCY("bgp::SendTask");
 
+    last_dequeue_usec_ = UTCTimestampUsec();
     UpdateQueue *queue = queue_vec_[queue_id];
     UpdateMarker *start_marker = queue->tail_marker();
     RouteUpdatePtr update = monitor_->GetNextUpdate(queue_id, start_marker);
@@ -393,13 +571,89 @@ void RibOutUpdates::UpdateSend(Message *message, const RibPeerSet &dst,
         RibPeerSet *blocked) {
     CHECK_CONCURRENCY("bgp::SendTask");
 
+    uint64_t start = UTCTimestampUsec();
+    IoSharedBufferPtr body = message->GetSharedBody();
+    uint64_t bytes;
+    int shards = SchedulingGroup::send_shards();
+    if (shards > 1 && dst.count() >= shards * kMinPeersPerShard) {
+        bytes = UpdateSendSharded(message, body, dst, shards, blocked);
+    } else {
+        bytes = SendToPeers(message, body, dst, blocked);
+    }
+
+    // A message without a shared body has the same data for all the peers.
+    encoded_bytes_ += body ? body->size() : bytes / dst.count();
+    sent_bytes_ += bytes;
+    send_usecs_ += UTCTimestampUsec() - start;
+}
+
+//
+// Concurrency: Called in the context of the scheduling group task.
+//
+// Split the peers into send shards by their bit index and send the message
+// to the shards in parallel, from this task and from a SendShardTask
+// instance for each of the other shards. The message has already been
+// finished and the shards only read it. Shards that no SendShardTask has
+// taken by the time this task is done with its own are sent here as well,
+// so this task only waits for shards that are being sent. Returns the
+// number of bytes sent.
+//
+uint64_t RibOutUpdates::UpdateSendSharded(Message *message,
+        const IoSharedBufferPtr &body, const RibPeerSet &dst, int shards,
+        RibPeerSet *blocked) {
+    CHECK_CONCURRENCY("bgp::SendTask");
+
+    boost::shared_ptr<SendShards> send_shards(
+        new SendShards(this, message, body, shards));
+    for (size_t bit = dst.find_first(); bit != RibPeerSet::npos;
+         bit = dst.find_next(bit)) {
+        send_shards->dst(bit % shards)->set(bit);
+    }
+
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    int task_id = scheduler->GetTaskId("bgp::SendTask");
+    for (int instance = 1; instance < shards; instance++) {
+        scheduler->Enqueue(
+            new SendShardTask(task_id, instance, send_shards));
+    }
+    send_shards->Run();
+    send_shards->Wait();
+
+    uint64_t bytes = 0;
+    for (int shard = 0; shard < shards; shard++) {
+        *blocked |= send_shards->blocked(shard);
+        bytes += send_shards->bytes(shard);
+    }
+    return bytes;
+}
+
+//
+// Send the message to each peer in the set and return the number of bytes
+// sent. If the message has a shared body, each peer gets its own header
+// followed by a reference to the body.
+//
+uint64_t RibOutUpdates::SendToPeers(Message *message,
+        const IoSharedBufferPtr &body, const RibPeerSet &dst,
+        RibPeerSet *blocked) {
+    uint64_t bytes = 0;
+    string header;
     RibOut::PeerIterator iter(ribout_, dst);
     while (iter.HasNext()) {
         int ix_current = iter.index();
         IPeerUpdate *peer = iter.Next();
-        size_t msgsize;
-        const uint8_t *data = message->GetData(peer, &msgsize);
-        bool more = peer->SendUpdate(data, msgsize);
+        bool more;
+        if (body) {
+            message->GetHeader(peer, &header);
+            more = peer->SendUpdateShared(
+                reinterpret_cast<const uint8_t *>(header.data()),
+                header.size(), body);
+            bytes += header.size() + body->size();
+        } else {
+            size_t msgsize;
+            const uint8_t *data = message->GetData(peer, &msgsize);
+            more = peer->SendUpdate(data, msgsize);
+            bytes += msgsize;
+        }
         if (!more) {
             blocked->set(ix_current);
         }
@@ -411,6 +665,7 @@ void RibOutUpdates::UpdateSend(Message *message, const RibPeerSet &dst,
             stats->UpdateTxUnreachRoute(message->num_unreach_routes());
         }
     }
+    return bytes;
 }
 
 //
@@ -5,7 +5,11 @@
 #ifndef ctrlplane_bgp_ribout_updates_h
 #define ctrlplane_bgp_ribout_updates_h
 
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
 #include "bgp/bgp_ribout.h"
+#include "io/io_shared_buffer.h"
 
 class BgpTable;
 class Message;
@@ -13,6 +17,7 @@ class MessageBuilder;
 class RibUpdateMonitor;
 class RouteUpdate;
 class RouteUpdatePtr;
+class Timer;
 class UpdateQueue;
 struct UpdateInfo;
 struct UpdateMarker;
@@ -30,6 +35,28 @@ struct UpdateMarker;
 // all the concurrency constraints.  There's an exception for UpdateMarker
 // which are accessed directly through the UpdateQueue.
 //
+// Updates are packed by attribute when they are dequeued, so the number of
+// prefixes per message depends on how many updates with the same attribute
+// are on the queue at that time. When the pack delay is set and a queue is
+// dequeued again within the delay of the previous tail dequeue, the next
+// tail dequeue is held back for the delay so that a burst of updates gets
+// packed into fewer messages. Updates to a RibOut that isn't busy are not
+// delayed. The number of messages built and the prefixes in them are kept
+// for each RibOut.
+//
+// A message is encoded once and the same data is sent to all the peers.
+// For messages that have a per-peer header, the body is handed to the
+// peers as a shared buffer so that it isn't copied for each peer. The time
+// spent building and sending the messages and the bytes built and sent are
+// kept for each RibOut as well.
+//
+// When the SchedulingGroup has more than one send shard, a message that
+// goes to many peers is sent to the peers of each shard in parallel, by
+// instances of bgp::SendTask. The dequeue and the marker updates are still
+// done by the single send task of the RibOut, since the RibUpdateMonitor
+// relies on there being one dequeuer for a RibOut; only the per-peer
+// encoding and the writes are spread across the shards.
+//
 class RibOutUpdates {
 public:
     typedef std::vector<UpdateQueue *> QueueVec;
@@ -64,11 +91,28 @@ public:
 
     QueueVec &queue_vec() { return queue_vec_; }
 
+    uint64_t message_count() const { return message_count_; }
+    uint64_t prefix_count() const { return prefix_count_; }
+    uint64_t encode_usecs() const { return encode_usecs_; }
+    uint64_t send_usecs() const { return send_usecs_; }
+    uint64_t encoded_bytes() const { return encoded_bytes_; }
+    uint64_t sent_bytes() const { return sent_bytes_; }
+
+    // The pack delay defaults to BGP_UPDATE_PACK_DELAY_MSEC, or 0 which
+    // disables it.
+    static int pack_delay_msec();
+    static void set_pack_delay_msec(int msec) { pack_delay_msec_ = msec; }
+
     // Testing only
     void SetMessageBuilder(MessageBuilder *builder) { builder_ = builder; }
 
 private:
     friend class RibOutUpdatesTest;
+    class SendShards;
+    class SendShardTask;
+
+    bool DelayTailDequeue(int queue_id);
+    bool PackTimerExpired();
 
     bool DequeueCommon(UpdateMarker *marker, RouteUpdate *rt_update,
                        RibPeerSet *blocked);
@@ -80,6 +124,11 @@ private:
     // Transmit the updates to a set of peers.
     void UpdateSend(Message *message, const RibPeerSet &dst,
                     RibPeerSet *blocked);
+    uint64_t UpdateSendSharded(Message *message, const IoSharedBufferPtr &body,
+                               const RibPeerSet &dst, int shards,
+                               RibPeerSet *blocked);
+    uint64_t SendToPeers(Message *message, const IoSharedBufferPtr &body,
+                         const RibPeerSet &dst, RibPeerSet *blocked);
 
     // Remove the advertised bits on an update. This updates the history
     // information. Returns true if the UpdateInfo should be deleted.
@@ -93,10 +142,25 @@ private:
     bool UpdateMarkersOnBlocked(UpdateMarker *marker, RouteUpdate *rt_update,
                                 const RibPeerSet *blocked);
 
+    static const size_t kMinPeersPerShard = 8;
+    static int pack_delay_msec_;
+
     RibOut *ribout_;
     MessageBuilder *builder_;
     QueueVec queue_vec_;
     boost::scoped_ptr<RibUpdateMonitor> monitor_;
+    tbb::atomic<uint64_t> message_count_;
+    tbb::atomic<uint64_t> prefix_count_;
+    tbb::atomic<uint64_t> encode_usecs_;
+    tbb::atomic<uint64_t> send_usecs_;
+    tbb::atomic<uint64_t> encoded_bytes_;
+    tbb::atomic<uint64_t> sent_bytes_;
+    tbb::atomic<uint64_t> last_dequeue_usec_;
+
+    // Protects the pack timer and the queues that are waiting for it.
+    tbb::mutex pack_mutex_;
+    Timer *pack_timer_;
+    int pack_pending_;
     DISALLOW_COPY_AND_ASSIGN(RibOutUpdates);
 };
 
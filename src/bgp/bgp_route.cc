@@ -19,7 +19,9 @@
 #include "bgp/tunnel_encap/tunnel_encap.h"
 
 
-BgpRoute::BgpRoute() {
+tbb::atomic<uint64_t> BgpRoute::generation_counter_;
+
+BgpRoute::BgpRoute() : generation_(++generation_counter_) {
 }
 
 BgpRoute::~BgpRoute() {
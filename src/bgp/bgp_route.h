@@ -5,6 +5,8 @@
 #ifndef ctrlplane_bgp_route_h
 #define ctrlplane_bgp_route_h
 
+#include <tbb/atomic.h>
+
 #include "route/route.h"
 #include "net/address.h"
 #include "bgp/bgp_path.h"
@@ -56,7 +58,15 @@ public:
 
     // Fill info needed for introspect
     void FillRouteInfo(BgpTable *table, ShowRoute *show_route);
+
+    // Unique for each route that is ever created, unlike its address,
+    // which may be reused once the route is freed.
+    uint64_t generation() const { return generation_; }
+
 private:
+    static tbb::atomic<uint64_t> generation_counter_;
+
+    uint64_t generation_;
 
     DISALLOW_COPY_AND_ASSIGN(BgpRoute);
 };
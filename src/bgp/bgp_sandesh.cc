@@ -11,12 +11,14 @@
 #include <sandesh/request_pipeline.h>
 
 #include "base/util.h"
+#include "io/event_manager.h"
 #include "io/tcp_server.h"
 #include "bgp/bgp_config.h"
 #include "bgp/bgp_multicast.h"
 #include "bgp/bgp_path.h"
 #include "bgp/bgp_peer_types.h"
 #include "bgp/bgp_peer_membership.h"
+#include "bgp/bgp_ribout_updates.h"
 #include "bgp/bgp_route.h"
 #include "bgp/bgp_sandesh.h"
 #include "bgp/bgp_session_manager.h"
@@ -616,6 +618,51 @@ public:
         rit.secondary_paths = table->GetSecondaryPathCount();
         rit.infeasible_paths = table->GetInfeasiblePathCount();
         rit.paths = rit.primary_paths + rit.secondary_paths;
+
+        vector<ShowTablePartition> partitions;
+        for (int idx = 0; idx < table->PartitionCount(); idx++) {
+            DBTablePartition *tpart = static_cast<DBTablePartition *>(
+                table->GetTablePartition(idx));
+            DBTablePartition::LockStats stats;
+            tpart->GetLockStats(&stats);
+            ShowTablePartition partition;
+            partition.set_index(idx);
+            partition.set_prefixes(tpart->size());
+            partition.set_writes(stats.writes);
+            partition.set_read_contended(stats.read_contended);
+            partition.set_write_contended(stats.write_contended);
+            partitions.push_back(partition);
+        }
+        rit.set_partitions(partitions);
+
+        vector<ShowRibOutStatistics> ribouts;
+        BOOST_FOREACH(const BgpTable::RibOutMap::value_type &value,
+                      table->ribout_map()) {
+            RibOut *ribout = value.second;
+            RibOutUpdates *updates = ribout->updates();
+            if (!updates)
+                continue;
+            ShowRibOutStatistics stats;
+            stats.set_encoding(ribout->IsEncodingXmpp() ? "xmpp" : "bgp");
+            if (ribout->peer_type() == BgpProto::XMPP) {
+                stats.set_peer_type("xmpp");
+            } else {
+                stats.set_peer_type(ribout->peer_type() == BgpProto::IBGP ?
+                                    "internal" : "external");
+            }
+            stats.set_peers(ribout->PeerSet().count());
+            stats.set_messages(updates->message_count());
+            stats.set_prefixes(updates->prefix_count());
+            stats.set_prefixes_per_message(updates->message_count() ?
+                static_cast<double>(updates->prefix_count()) /
+                updates->message_count() : 0.0);
+            stats.set_encode_usecs(updates->encode_usecs());
+            stats.set_send_usecs(updates->send_usecs());
+            stats.set_encoded_bytes(updates->encoded_bytes());
+            stats.set_sent_bytes(updates->sent_bytes());
+            ribouts.push_back(stats);
+        }
+        rit.set_ribouts(ribouts);
     }
 
     static void FillRoutingInstanceInfo(const RequestPipeline::StageData *sd,
@@ -1280,6 +1327,24 @@ void ShowBgpNeighborConfigReq::HandleRequest() const {
 
 class ShowBgpServerHandler {
 public:
+    template <typename TypeDB>
+    static void FillAttributeDBStats(const string &name, TypeDB *db,
+                                     vector<ShowPathAttributeDBStats> *list) {
+        BgpPathAttributeDBStats stats;
+        db->GetStats(&stats);
+
+        ShowPathAttributeDBStats sdb;
+        sdb.set_name(name);
+        sdb.set_size(stats.size);
+        sdb.set_partitions(stats.partitions);
+        sdb.set_lookups(stats.lookups);
+        sdb.set_hits(stats.hits);
+        sdb.set_inserts(stats.inserts);
+        sdb.set_replaced(stats.replaced);
+        sdb.set_contended(stats.contended);
+        list->push_back(sdb);
+    }
+
     static bool CallbackS1(const Sandesh *sr,
             const RequestPipeline::PipeSpec ps, int stage, int instNum,
             RequestPipeline::InstData *data) {
@@ -1296,6 +1361,20 @@ public:
         bsc->bgp_server->session_manager()->GetTxSocketStats(peer_socket_stats);
         resp->set_tx_socket_stats(peer_socket_stats);
 
+        BgpServer *server = bsc->bgp_server;
+        vector<ShowPathAttributeDBStats> db_stats;
+        FillAttributeDBStats("attr", server->attr_db(), &db_stats);
+        FillAttributeDBStats("as-path", server->aspath_db(), &db_stats);
+        FillAttributeDBStats("community", server->comm_db(), &db_stats);
+        FillAttributeDBStats("ext-community", server->extcomm_db(),
+                             &db_stats);
+        resp->set_attribute_db_stats(db_stats);
+
+        IoBufferPoolStats pool_stats;
+        server->session_manager()->event_manager()->buffer_pool()->GetStats(
+            &pool_stats);
+        resp->set_buffer_pool_stats(pool_stats);
+
         resp->set_context(req->context());
         resp->Response();
         return true;
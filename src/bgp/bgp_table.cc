@@ -10,6 +10,7 @@
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
 
+#include "db/db.h"
 #include "db/db_table_partition.h"
 #include "bgp/bgp_log.h"
 #include "bgp/bgp_path.h"
@@ -57,7 +58,8 @@ class BgpTable::DeleteActor : public LifetimeActor {
 BgpTable::BgpTable(DB *db, const string &name)
         : RouteTable(db, name),
           rtinstance_(NULL),
-          instance_delete_ref_(this, NULL) {
+          instance_delete_ref_(this, NULL),
+          peer_routes_(DB::PartitionCount()) {
     primary_path_count_ = 0;
     secondary_path_count_ = 0;
     infeasible_path_count_ = 0;
@@ -255,6 +257,7 @@ void BgpTable::InputCommon(DBTablePartBase *root, BgpRoute *rt, BgpPath *path,
                 // Update Attributes and notify (if needed)
                 is_stale = path->IsStale();
                 rt->DeletePath(path);
+                PeerRouteDelete(root, peer, rt);
             } else {
 
                 //
@@ -276,6 +279,7 @@ void BgpTable::InputCommon(DBTablePartBase *root, BgpRoute *rt, BgpPath *path,
         }
 
         rt->InsertPath(new_path);
+        PeerRouteAdd(root, peer, rt);
         root->Notify(rt);
         break;
     }
@@ -286,7 +290,9 @@ void BgpTable::InputCommon(DBTablePartBase *root, BgpRoute *rt, BgpPath *path,
                           "Delete BGP path");
 
             // Remove the Path from the route
-            rt->RemovePath(BgpPath::BGP_XMPP, peer, path_id);
+            if (rt->RemovePath(BgpPath::BGP_XMPP, peer, path_id)) {
+                PeerRouteDelete(root, peer, rt);
+            }
 
             if (rt->front() == NULL) {
                 // Delete the route only if all paths are gone
@@ -305,6 +311,70 @@ void BgpTable::InputCommon(DBTablePartBase *root, BgpRoute *rt, BgpPath *path,
     }
 }
 
+//
+// Concurrency: Runs in the context of the db::DBTable task for the partition.
+//
+// Note that the route has a(nother) path from the peer.
+//
+void BgpTable::PeerRouteAdd(DBTablePartBase *root, const IPeer *peer,
+                            BgpRoute *rt) {
+    if (!peer) return;
+    PeerRouteMap *peer_map = &peer_routes_[root->index()];
+    (*peer_map)[peer][rt]++;
+}
+
+//
+// Concurrency: Runs in the context of the db::DBTable task for the partition.
+//
+// Note that a path from the peer has been removed from the route. The entry
+// for the peer goes away with its last route so that the map does not keep
+// state for peers that are gone.
+//
+void BgpTable::PeerRouteDelete(DBTablePartBase *root, const IPeer *peer,
+                               BgpRoute *rt) {
+    if (!peer) return;
+    PeerRouteMap *peer_map = &peer_routes_[root->index()];
+    PeerRouteMap::iterator it = peer_map->find(peer);
+    assert(it != peer_map->end());
+    PeerRouteList::iterator rt_it = it->second.find(rt);
+    assert(rt_it != it->second.end());
+    if (--rt_it->second == 0) {
+        it->second.erase(rt_it);
+        if (it->second.empty()) {
+            peer_map->erase(it);
+        }
+    }
+}
+
+//
+// Concurrency: Runs in the context of the db::DBTable task for the partition.
+//
+// Return the routes in the partition that have paths from the peer, or NULL
+// if there are none.
+//
+BgpTable::PeerRouteList *BgpTable::GetPeerRouteList(int part_id,
+                                                    const IPeer *peer) {
+    PeerRouteMap *peer_map = &peer_routes_[part_id];
+    PeerRouteMap::iterator it = peer_map->find(peer);
+    return (it != peer_map->end() ? &it->second : NULL);
+}
+
+//
+// Concurrency: Must be called from a task that excludes the db::DBTable
+// tasks, since it looks at all the partitions.
+//
+size_t BgpTable::GetPeerRouteCount(const IPeer *peer) const {
+    size_t count = 0;
+    for (vector<PeerRouteMap>::const_iterator it = peer_routes_.begin();
+         it != peer_routes_.end(); ++it) {
+        PeerRouteMap::const_iterator peer_it = it->find(peer);
+        if (peer_it != it->end()) {
+            count += peer_it->second.size();
+        }
+    }
+    return count;
+}
+
 void BgpTable::Input(DBTablePartition *root, DBClient *client,
                      DBRequest *req) {
     BgpRoute *rt = TableFind(root, req->key.get());
@@ -6,6 +6,7 @@
 #define ctrlplane_bgp_table_h
 
 #include <map>
+#include <vector>
 #include <tbb/atomic.h>
 
 #include "base/lifetime.h"
@@ -29,6 +30,12 @@ class BgpTable : public RouteTable {
 public:
     typedef std::map<RibExportPolicy, RibOut *> RibOutMap;
 
+    // Routes in a partition that have paths from a peer, with the number of
+    // paths from the peer in each route. This lets the close of a peer visit
+    // only its own routes instead of walking the whole table.
+    typedef std::map<BgpRoute *, int> PeerRouteList;
+    typedef std::map<const IPeer *, PeerRouteList> PeerRouteMap;
+
     struct RequestKey : DBRequestKey {
         virtual const IPeer *GetPeer() const = 0;
     };
@@ -119,11 +126,19 @@ public:
         return infeasible_path_count_;
     }
 
+    PeerRouteList *GetPeerRouteList(int part_id, const IPeer *peer);
+    size_t GetPeerRouteCount(const IPeer *peer) const;
+
 private:
     class DeleteActor;
     friend class BgpTableTest;
     virtual BgpRoute *TableFind(DBTablePartition *rtp,
             const DBRequestKey *prefix) = 0;
+    void PeerRouteAdd(DBTablePartBase *root, const IPeer *peer,
+                      BgpRoute *rt);
+    void PeerRouteDelete(DBTablePartBase *root, const IPeer *peer,
+                         BgpRoute *rt);
+
     RoutingInstance *rtinstance_;
     RibOutMap ribout_map_;
 
@@ -133,6 +148,10 @@ private:
     tbb::atomic<uint64_t> secondary_path_count_;
     tbb::atomic<uint64_t> infeasible_path_count_;
 
+    // Indexed by partition, only accessed from the db::DBTable task for the
+    // partition or from tasks that exclude all of them.
+    std::vector<PeerRouteMap> peer_routes_;
+
     DISALLOW_COPY_AND_ASSIGN(BgpTable);
 };
 
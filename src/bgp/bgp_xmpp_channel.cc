@@ -9,6 +9,7 @@
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <pugixml/pugixml.hpp>
+#include <tbb/mutex.h>
 
 #include "base/label_block.h"
 #include "base/logging.h"
@@ -225,6 +226,31 @@ private:
 };
 
 
+//
+// Updates are sent to the peers of a RibOut by several send shard tasks at
+// once, so this is read at load time rather than on the first send.
+//
+static const bool skip_update_send_ = getenv("XMPP_SKIP_UPDATE_SEND") != NULL;
+
+static bool SkipUpdateSend() {
+    return skip_update_send_;
+}
+
+//
+// The send state of the peers is updated from the send shard tasks and
+// from the write ready callbacks at the same time, and the UVE sends share
+// the UVE cache.
+//
+static tbb::mutex send_state_mutex_;
+
+static void SendStateUpdate(const string &name, const string &state) {
+    XmppPeerInfoData peer_info;
+    peer_info.set_name(name);
+    peer_info.set_send_state(state);
+    tbb::mutex::scoped_lock lock(send_state_mutex_);
+    XMPPPeerInfo::Send(peer_info);
+}
+
 class BgpXmppChannel::XmppPeer : public IPeer {
 public:
     XmppPeer(BgpServer *server, BgpXmppChannel *channel)
@@ -239,6 +265,14 @@ public:
     }
 
     virtual bool SendUpdate(const uint8_t *msg, size_t msgsize);
+    virtual bool SendUpdateShared(const uint8_t *header, size_t header_size,
+                                  const IoSharedBufferPtr &body);
+    virtual void Cork() {
+        parent_->channel_->Cork();
+    }
+    virtual void Uncork() {
+        parent_->channel_->Uncork();
+    }
     virtual std::string ToString() const {
         return parent_->ToString();
     }
@@ -302,10 +336,7 @@ private:
                      BGP_PEER_DIR_NA, "Sender is ready");
         sg_mgr->SendReady(this);
         send_ready_ = true;
-        XmppPeerInfoData peer_info;
-        peer_info.set_name(ToUVEKey());
-        peer_info.set_send_state("in sync");
-        XMPPPeerInfo::Send(peer_info);
+        SendStateUpdate(ToUVEKey(), "in sync");
     }
 
     BgpServer *server_;
@@ -315,18 +346,6 @@ private:
     bool send_ready_;
 };
 
-static bool SkipUpdateSend() {
-    static bool init_;
-    static bool skip_;
-
-    if (init_) return skip_;
-
-    skip_ = getenv("XMPP_SKIP_UPDATE_SEND") != NULL;
-    init_ = true;
-
-    return skip_;
-}
-
 bool BgpXmppChannel::XmppPeer::SendUpdate(const uint8_t *msg, size_t msgsize) {
     XmppChannel *channel = parent_->channel_;
     if (channel->GetPeerState() == xmps::READY) {
@@ -335,10 +354,25 @@ bool BgpXmppChannel::XmppPeer::SendUpdate(const uint8_t *msg, size_t msgsize) {
         send_ready_ = channel->Send(msg, msgsize, xmps::BGP,
                 boost::bind(&BgpXmppChannel::XmppPeer::WriteReadyCb, this, _1));
         if (!send_ready_) {
-            XmppPeerInfoData peer_info;
-            peer_info.set_name(ToUVEKey());
-            peer_info.set_send_state("not in sync");
-            XMPPPeerInfo::Send(peer_info);
+            SendStateUpdate(ToUVEKey(), "not in sync");
+        }
+        return send_ready_;
+    } else {
+        return false;
+    }
+}
+
+bool BgpXmppChannel::XmppPeer::SendUpdateShared(const uint8_t *header,
+        size_t header_size, const IoSharedBufferPtr &body) {
+    XmppChannel *channel = parent_->channel_;
+    if (channel->GetPeerState() == xmps::READY) {
+        parent_->stats_[1].rt_updates ++;
+        if (SkipUpdateSend()) return true;
+        send_ready_ = channel->SendShared(header, header_size, body,
+                xmps::BGP,
+                boost::bind(&BgpXmppChannel::XmppPeer::WriteReadyCb, this, _1));
+        if (!send_ready_) {
+            SendStateUpdate(ToUVEKey(), "not in sync");
         }
         return send_ready_;
     } else {
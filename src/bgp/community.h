@@ -62,7 +62,7 @@ public:
 
 private:
     friend int intrusive_ptr_add_ref(const Community *ccomm);
-    friend int intrusive_ptr_del_ref(const Community *ccomm);
+    friend bool intrusive_ptr_add_ref_if_live(const Community *ccomm);
     friend void intrusive_ptr_release(const Community *ccomm);
 
     mutable tbb::atomic<int> refcount_;
@@ -74,8 +74,8 @@ inline int intrusive_ptr_add_ref(const Community *ccomm) {
     return ccomm->refcount_.fetch_and_increment();
 }
 
-inline int intrusive_ptr_del_ref(const Community *ccomm) {
-    return ccomm->refcount_.fetch_and_decrement();
+inline bool intrusive_ptr_add_ref_if_live(const Community *ccomm) {
+    return BgpAttrRefcountIncrementIfLive(&ccomm->refcount_);
 }
 
 inline void intrusive_ptr_release(const Community *ccomm) {
@@ -201,7 +201,7 @@ public:
 
 private:
     friend int intrusive_ptr_add_ref(const ExtCommunity *cextcomm);
-    friend int intrusive_ptr_del_ref(const ExtCommunity *cextcomm);
+    friend bool intrusive_ptr_add_ref_if_live(const ExtCommunity *cextcomm);
     friend void intrusive_ptr_release(const ExtCommunity *cextcomm);
 
     mutable tbb::atomic<int> refcount_;
@@ -213,8 +213,8 @@ inline int intrusive_ptr_add_ref(const ExtCommunity *cextcomm) {
     return cextcomm->refcount_.fetch_and_increment();
 }
 
-inline int intrusive_ptr_del_ref(const ExtCommunity *cextcomm) {
-    return cextcomm->refcount_.fetch_and_decrement();
+inline bool intrusive_ptr_add_ref_if_live(const ExtCommunity *cextcomm) {
+    return BgpAttrRefcountIncrementIfLive(&cextcomm->refcount_);
 }
 
 inline void intrusive_ptr_release(const ExtCommunity *cextcomm) {
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef ctrlplane_inet_prefix_index_h
+#define ctrlplane_inet_prefix_index_h
+
+#include "base/patricia.h"
+#include "base/util.h"
+#include "bgp/inet/inet_route.h"
+
+//
+// Longest prefix match index of Ip4Prefix to a value of type T.
+//
+// The index is a Patricia tree, so that a lookup visits at most one node
+// per bit of the prefix, regardless of the number of prefixes that are in
+// the index. It is meant for the checks of a route against a set of subnets
+// that are made for every route notification, which would otherwise have
+// to compare the route with each subnet in turn.
+//
+// Concurrency: not thread safe. The users build the index when they are
+// created and only look it up from the db::DBTable tasks afterwards.
+//
+template <typename T>
+class InetPrefixIndex {
+public:
+    InetPrefixIndex() {
+    }
+    ~InetPrefixIndex() {
+        Clear();
+    }
+
+    // Returns false if the prefix is already present, in which case the
+    // value is not modified.
+    bool Insert(const Ip4Prefix &prefix, const T &value) {
+        Entry *entry = new Entry(prefix, value);
+        if (!tree_.Insert(entry)) {
+            delete entry;
+            return false;
+        }
+        return true;
+    }
+
+    bool Remove(const Ip4Prefix &prefix) {
+        Key key(prefix);
+        Entry *entry = static_cast<Entry *>(tree_.Find(&key));
+        if (!entry) {
+            return false;
+        }
+        tree_.Remove(entry);
+        delete entry;
+        return true;
+    }
+
+    void Clear() {
+        Key *key = tree_.GetNext(NULL);
+        while (key) {
+            Key *next = tree_.GetNext(key);
+            tree_.Remove(key);
+            delete static_cast<Entry *>(key);
+            key = next;
+        }
+    }
+
+    // Exact match.
+    T *Find(const Ip4Prefix &prefix) {
+        Key key(prefix);
+        return Value(tree_.Find(&key), NULL);
+    }
+
+    // Longest prefix in the index that covers the given prefix, which may
+    // be the prefix itself.
+    T *LongestMatch(const Ip4Prefix &prefix, Ip4Prefix *match = NULL) {
+        Key key(prefix);
+        return Value(tree_.LPMFind(&key), match);
+    }
+
+    // Longest prefix in the index that covers the given prefix and is less
+    // specific than it.
+    T *LongestCoveringMatch(const Ip4Prefix &prefix, Ip4Prefix *match = NULL) {
+        if (prefix.prefixlen() == 0) {
+            return NULL;
+        }
+        Key key(Ip4Prefix(prefix.ip4_addr(), prefix.prefixlen() - 1));
+        return Value(tree_.LPMFind(&key), match);
+    }
+
+    size_t size() { return tree_.Size(); }
+    bool empty() { return tree_.Size() == 0; }
+
+private:
+    struct Key {
+        explicit Key(const Ip4Prefix &prefix)
+            : addr(prefix.ip4_addr().to_ulong()), len(prefix.prefixlen()) {
+        }
+        Ip4Prefix prefix() const {
+            return Ip4Prefix(Ip4Address(addr), len);
+        }
+        uint32_t addr;
+        size_t len;
+        Patricia::Node node;
+    };
+
+    struct Entry : public Key {
+        Entry(const Ip4Prefix &prefix, const T &value)
+            : Key(prefix), value(value) {
+        }
+        T value;
+    };
+
+    struct KeyTraits {
+        static std::size_t Length(Key *key) {
+            return key->len;
+        }
+        static char ByteValue(Key *key, std::size_t i) {
+            return (key->addr >> (24 - (i << 3))) & 0xff;
+        }
+    };
+
+    typedef Patricia::Tree<Key, &Key::node, KeyTraits> Tree;
+
+    T *Value(Key *key, Ip4Prefix *match) {
+        if (!key) {
+            return NULL;
+        }
+        if (match) {
+            *match = key->prefix();
+        }
+        return &static_cast<Entry *>(key)->value;
+    }
+
+    Tree tree_;
+
+    DISALLOW_COPY_AND_ASSIGN(InetPrefixIndex);
+};
+
+#endif
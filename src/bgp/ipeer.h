@@ -6,6 +6,7 @@
 #define __IPEER_H__
 
 #include "bgp/bgp_proto.h"
+#include "io/io_shared_buffer.h"
 #include "tbb/atomic.h"
 
 class BgpServer;
@@ -20,6 +21,22 @@ public:
     // Send an update. Returns true if the peer can send additional messages,
     // false if it is send blocked.
     virtual bool SendUpdate(const uint8_t *msg, size_t msgsize) = 0;
+
+    // Send an update that is a header for the peer followed by a body that
+    // is shared with other peers. Peers that can queue the body by reference
+    // override this to avoid a copy of the body for each peer.
+    virtual bool SendUpdateShared(const uint8_t *header, size_t header_size,
+                                  const IoSharedBufferPtr &body) {
+        std::string msg(reinterpret_cast<const char *>(header), header_size);
+        msg.append(reinterpret_cast<const char *>(body->data()), body->size());
+        return SendUpdate(reinterpret_cast<const uint8_t *>(msg.data()),
+                          msg.size());
+    }
+
+    // Updates sent between Cork and Uncork may be held back and written out
+    // together when the peer is uncorked.
+    virtual void Cork() { }
+    virtual void Uncork() { }
 };
 
 class IPeerDebugStats {
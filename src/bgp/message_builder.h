@@ -6,6 +6,7 @@
 #define ctrlplane_message_builder_h
 
 #include "bgp/bgp_ribout.h"
+#include "io/io_shared_buffer.h"
 
 class BgpRoute;
 
@@ -18,6 +19,16 @@ public:
     virtual bool AddRoute(const BgpRoute *route, const RibOutAttr *roattr) = 0;
     virtual void Finish() = 0;
     virtual const uint8_t *GetData(IPeerUpdate *peer_update, size_t *lenp) = 0;
+    // A message that is a header for each peer followed by a body that is
+    // the same for all the peers returns the encoded body once finished,
+    // and NULL otherwise. The data for a peer is then the header written by
+    // GetHeader followed by the body. GetHeader doesn't modify the message,
+    // so it may be called for several peers concurrently.
+    virtual IoSharedBufferPtr GetSharedBody() {
+        return IoSharedBufferPtr();
+    }
+    virtual void GetHeader(IPeerUpdate *peer_update, std::string *header) {
+    }
     uint32_t num_reach_routes() const { 
         return num_reach_route_; 
     }
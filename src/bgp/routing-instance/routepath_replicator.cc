@@ -14,6 +14,7 @@
 #include "base/task.h"
 #include "base/task_annotations.h"
 #include "base/task_trigger.h"
+#include "base/util.h"
 #include "bgp/bgp_config.h"
 #include "bgp/bgp_log.h"
 #include "bgp/bgp_path.h"
@@ -48,12 +49,124 @@ do {                                                                           \
     Rpr##obj::TraceMsg(trace_buf_, __FILE__, __LINE__, __VA_ARGS__);           \
 } while (false)
 
-TableState::TableState(BgpTable *table, DBTableBase::ListenerId id)
+RtIndexPartition::RtIndexPartition(RoutePathReplicator *replicator,
+                                   DBTablePartBase *partition)
+    : replicator_(replicator),
+      partition_(partition),
+      sync_trigger_(new TaskTrigger(
+          boost::bind(&RtIndexPartition::ProcessSync, this),
+          TaskScheduler::GetInstance()->GetTaskId("db::DBTable"),
+          partition->index())) {
+    sync_pending_ = false;
+}
+
+RtIndexPartition::~RtIndexPartition() {
+    assert(!sync_pending_);
+}
+
+void RtIndexPartition::Update(BgpRoute *rt,
+                              const RouteTargetList &rtarget_list) {
+    RouteMap::iterator loc = route_map_.find(rt);
+    if (loc == route_map_.end()) {
+        if (rtarget_list.empty())
+            return;
+        loc = route_map_.insert(
+            std::make_pair(rt, RouteTargetList())).first;
+    } else if (loc->second == rtarget_list) {
+        return;
+    }
+
+    RouteTargetList *current = &loc->second;
+    BOOST_FOREACH(const RouteTarget &rtarget, *current) {
+        if (rtarget_list.find(rtarget) != rtarget_list.end())
+            continue;
+        RouteTargetMap::iterator it = rtarget_map_.find(rtarget);
+        assert(it != rtarget_map_.end());
+        it->second.erase(rt);
+        if (it->second.empty())
+            rtarget_map_.erase(it);
+    }
+    BOOST_FOREACH(const RouteTarget &rtarget, rtarget_list) {
+        if (current->find(rtarget) != current->end())
+            continue;
+        rtarget_map_[rtarget].insert(rt);
+    }
+
+    if (rtarget_list.empty()) {
+        route_map_.erase(loc);
+    } else {
+        *current = rtarget_list;
+    }
+}
+
+void RtIndexPartition::RequestSync(const RouteTarget &rtarget) {
+    CHECK_CONCURRENCY("bgp::Config");
+    sync_list_.insert(rtarget);
+    sync_pending_ = true;
+    sync_trigger_->Set();
+}
+
+size_t RtIndexPartition::route_count(const RouteTarget &rtarget) const {
+    RouteTargetMap::const_iterator loc = rtarget_map_.find(rtarget);
+    if (loc == rtarget_map_.end())
+        return 0;
+    return loc->second.size();
+}
+
+//
+// Run the table listener for the routes with any of the RouteTargets on
+// the sync list. The routes are collected up front since the listener
+// updates the index.
+//
+bool RtIndexPartition::ProcessSync() {
+    CHECK_CONCURRENCY("db::DBTable");
+    RouteList route_list;
+    BOOST_FOREACH(const RouteTarget &rtarget, sync_list_) {
+        RouteTargetMap::const_iterator loc = rtarget_map_.find(rtarget);
+        if (loc == rtarget_map_.end())
+            continue;
+        route_list.insert(loc->second.begin(), loc->second.end());
+    }
+    sync_list_.clear();
+
+    BOOST_FOREACH(BgpRoute *rt, route_list) {
+        replicator_->BgpTableListener(partition_, rt);
+    }
+    replicator_->AddSyncRouteCount(route_list.size());
+
+    sync_pending_ = false;
+    replicator_->SyncDone(static_cast<BgpTable *>(partition_->parent()));
+    return true;
+}
+
+TableState::TableState(RoutePathReplicator *replicator, BgpTable *table,
+                       DBTableBase::ListenerId id)
     : id_(id), table_delete_ref_(this, table->deleter()) {
     assert(table->deleter() != NULL);
+    if (table->routing_instance()->IsDefaultRoutingInstance()) {
+        for (int idx = 0; idx < table->PartitionCount(); idx++) {
+            index_.push_back(new RtIndexPartition(
+                replicator, table->GetTablePartition(idx)));
+        }
+    }
 }
 
 TableState::~TableState() {
+    STLDeleteValues(&index_);
+}
+
+void TableState::RequestSync(const RouteTarget &rtarget) {
+    BOOST_FOREACH(RtIndexPartition *partition, index_) {
+        partition->RequestSync(rtarget);
+    }
+}
+
+bool TableState::SyncPending() const {
+    BOOST_FOREACH(const RtIndexPartition *partition, index_) {
+        if (partition->sync_pending())
+            return true;
+    }
+    return false;
 }
 
 // TODO: verify that the RoutePathReplicator is going to Leave this table.
@@ -71,6 +184,7 @@ RoutePathReplicator::RoutePathReplicator(
           boost::bind(&RoutePathReplicator::UnregisterTables, this),
               TaskScheduler::GetInstance()->GetTaskId("bgp::Config"), 0)),
           trace_buf_(SandeshTraceBufferCreate("RoutePathReplicator", 500)) {
+    sync_route_count_ = 0;
 }
 
 RoutePathReplicator::~RoutePathReplicator() {
@@ -163,6 +277,62 @@ RoutePathReplicator::StartWalk() {
     return true;
 }
 
+//
+// Resync the routes in the table that carry the RouteTarget. Tables that are
+// indexed by RouteTarget only visit those routes, others are walked.
+//
+// A walk that has been requested but not started yet covers the routes. A
+// walk that is in progress may already have visited some of the routes, but
+// those are in the index, so the resync is still sufficient.
+//
+void RoutePathReplicator::RequestSync(BgpTable *table,
+                                      const RouteTarget &rtarget) {
+    CHECK_CONCURRENCY("bgp::Config");
+    RtGroupTableState::iterator loc = table_state_.find(table);
+    if (loc == table_state_.end() || !loc->second->indexed()) {
+        RequestWalk(table);
+        return;
+    }
+
+    BulkSyncOrders::iterator walk = bulk_sync_.find(table);
+    if (walk != bulk_sync_.end() &&
+        walk->second->GetWalkerId() == DBTableWalker::kInvalidWalkerId) {
+        return;
+    }
+
+    RPR_TRACE(Sync, table->name(), rtarget.ToString());
+    loc->second->RequestSync(rtarget);
+}
+
+//
+// Unregister from the table once the last partition has completed its
+// resync if the table left all the groups in the meantime.
+//
+void RoutePathReplicator::SyncDone(BgpTable *table) {
+    tbb::mutex::scoped_lock lock(mutex_);
+    RtGroupTableState::iterator ts_it = table_state_.find(table);
+    assert(ts_it != table_state_.end());
+    TableState *ts = ts_it->second;
+    if (ts->SyncPending() || !ts->GetGroupList().empty() ||
+        bulk_sync_.find(table) != bulk_sync_.end()) {
+        return;
+    }
+    unreg_table_list_.insert(table);
+    unreg_trigger_->Set();
+}
+
+size_t RoutePathReplicator::GetIndexedRouteCount(BgpTable *table,
+                                                 const RouteTarget &rtarget) {
+    RtGroupTableState::iterator loc = table_state_.find(table);
+    if (loc == table_state_.end() || !loc->second->indexed())
+        return 0;
+    size_t count = 0;
+    for (int idx = 0; idx < table->PartitionCount(); idx++) {
+        count += loc->second->GetIndexPartition(idx)->route_count(rtarget);
+    }
+    return count;
+}
+
 bool 
 RoutePathReplicator::UnregisterTables() {
     for (UnregTableList::iterator it = unreg_table_list_.begin(); 
@@ -171,7 +341,8 @@ RoutePathReplicator::UnregisterTables() {
         RtGroupTableState::iterator ts_it = table_state_.find(bgptable);
         assert(ts_it != table_state_.end());
         TableState *ts = ts_it->second;
-        if (ts->GetGroupList().empty()) {
+        // Tables with a resync in progress are unregistered from SyncDone.
+        if (ts->GetGroupList().empty() && !ts->SyncPending()) {
             bgptable->Unregister(ts->GetListenerId());
             table_state_.erase(bgptable);
             RPR_TRACE(UnregTable, bgptable->name());
@@ -221,7 +392,7 @@ void RoutePathReplicator::Join(BgpTable *table, const RouteTarget &rt,
     RPR_TRACE(TableJoin, table->name(), rt.ToString(), import);
     if (import) {
         BOOST_FOREACH(BgpTable *bgptable, group->GetExportTables()) {
-            RequestWalk(bgptable);
+            RequestSync(bgptable, rt);
         }
         walk_trigger_->Set();
         return;
@@ -232,16 +403,17 @@ void RoutePathReplicator::Join(BgpTable *table, const RouteTarget &rt,
         // Route Replication/export is done in DB notification
         DBTableBase::ListenerId id = table->Register(
             boost::bind(&RoutePathReplicator::BgpTableListener, this, _1, _2));
-        TableState *ts = new TableState(table, id);
+        TableState *ts = new TableState(this, table, id);
         ts->MutableGroupList()->push_back(group);
         table_state_.insert(std::make_pair(table, ts));
         RPR_TRACE(RegTable, table->name());
+        RequestWalk(table);
     } else {
         TableState *ts = loc->second;
         ts->MutableGroupList()->push_back(group);
+        RequestSync(table, rt);
     }
 
-    RequestWalk(table);
     walk_trigger_->Set();
 }
 
@@ -257,11 +429,11 @@ void RoutePathReplicator::Leave(BgpTable *table, const RouteTarget &rt,
     if (import) {
         group->RemoveImportTable(table);
         BOOST_FOREACH(BgpTable *bgptable, group->GetExportTables()) {
-            RequestWalk(bgptable);
+            RequestSync(bgptable, rt);
         }
     } else {
         group->RemoveExportTable(table);
-        RequestWalk(table);
+        RequestSync(table, rt);
     }
 
     if (!import) {
@@ -290,6 +462,9 @@ void RoutePathReplicator::Leave(BgpTable *table, const RouteTarget &rt,
                 group->RemoveImportTable(vpntable);
                 group->RemoveExportTable(vpntable);
                 rt_group_map_.erase(rt);
+                // Walk the table to clean up before it is unregistered
+                if (ts->GetGroupList().empty())
+                    RequestWalk(vpntable);
             }
         }
     } else if (group->empty()) {
@@ -413,11 +588,19 @@ bool RoutePathReplicator::BgpTableListener(DBTablePartBase *root,
         static_cast<RtReplicated *>(rt->GetState(table, id));
 
     RtReplicated::ReplicatedRtPathList replicated_path_list;
+    RtIndexPartition::RouteTargetList rtarget_list;
+    RtIndexPartition *index = NULL;
+    if (ts->indexed()) {
+        index = ts->GetIndexPartition(root->index());
+    }
 
     // Cleanup if the route is marked for deletion, or there is no best path or
     // if the best path is infeasible
     if (entry->IsDeleted() || !rt->BestPath() ||
             !rt->BestPath()->IsFeasible()) {
+        if (index) {
+            index->Update(rt, rtarget_list);
+        }
         if (!dbstate) {
             return true;
         }
@@ -471,6 +654,9 @@ bool RoutePathReplicator::BgpTableListener(DBTablePartBase *root,
                 OriginVn origin_vn(comm);
                 vn_index = origin_vn.vn_index();
             } else if (ExtCommunity::is_route_target(comm)) {
+                if (index) {
+                    rtarget_list.insert(RouteTarget(comm));
+                }
                 RtGroup *rtgroup = GetRtGroup(comm);
                 if (!rtgroup)
                     continue;
@@ -525,6 +711,9 @@ bool RoutePathReplicator::BgpTableListener(DBTablePartBase *root,
         }
     }
 
+    if (index) {
+        index->Update(rt, rtarget_list);
+    }
     DBStateSync(table, rt, id, dbstate, replicated_path_list);
     return true;
 }
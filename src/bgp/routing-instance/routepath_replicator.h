@@ -6,8 +6,12 @@
 #define ctrlplane_routepath_replicator_h
 
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 #include <boost/ptr_container/ptr_map.hpp>
+#include <tbb/atomic.h>
 #include <tbb/mutex.h>
 
 #include "bgp/bgp_table.h"
@@ -19,14 +23,59 @@
 
 class BgpRoute;
 class BgpServer;
+class RoutePathReplicator;
 class RtGroup;
 class RouteTarget;
 class TaskTrigger;
 
+// RtIndexPartition
+// Index of the routes in one partition of a table by the RouteTargets that
+// they carry. When a table starts or stops importing a RouteTarget, only the
+// routes with that RouteTarget are run through the table listener again
+// instead of walking the whole table.
+// The index is updated from the table listener and the resync runs in the
+// db::DBTable task of the partition, so the partitions are resynced in
+// parallel. RequestSync is called from bgp::Config, which excludes it.
+class RtIndexPartition {
+public:
+    typedef std::set<RouteTarget> RouteTargetList;
+
+    RtIndexPartition(RoutePathReplicator *replicator,
+                     DBTablePartBase *partition);
+    ~RtIndexPartition();
+
+    // Set the RouteTargets that the route is indexed under. An empty list
+    // removes the route from the index.
+    void Update(BgpRoute *rt, const RouteTargetList &rtarget_list);
+
+    // Run the table listener again for the routes with the RouteTarget.
+    void RequestSync(const RouteTarget &rtarget);
+    bool sync_pending() const { return sync_pending_; }
+
+    size_t route_count(const RouteTarget &rtarget) const;
+
+private:
+    typedef std::set<BgpRoute *> RouteList;
+    typedef std::map<RouteTarget, RouteList> RouteTargetMap;
+    typedef std::map<BgpRoute *, RouteTargetList> RouteMap;
+
+    bool ProcessSync();
+
+    RoutePathReplicator *replicator_;
+    DBTablePartBase *partition_;
+    RouteTargetMap rtarget_map_;
+    RouteMap route_map_;
+    RouteTargetList sync_list_;
+    tbb::atomic<bool> sync_pending_;
+    boost::scoped_ptr<TaskTrigger> sync_trigger_;
+    DISALLOW_COPY_AND_ASSIGN(RtIndexPartition);
+};
+
 class TableState {
 public:
     typedef std::list<RtGroup *> GroupList;
-    TableState(BgpTable *table, DBTableBase::ListenerId id);
+    TableState(RoutePathReplicator *replicator, BgpTable *table,
+               DBTableBase::ListenerId id);
     ~TableState();
 
     void ManagedDelete();
@@ -41,10 +90,20 @@ public:
         return id_;
     }
 
+    // The RouteTarget index is only kept for the tables of the default
+    // routing instance, which carry the routes of all RouteTargets.
+    bool indexed() const { return !index_.empty(); }
+    RtIndexPartition *GetIndexPartition(int index) {
+        return index_[index];
+    }
+    void RequestSync(const RouteTarget &rtarget);
+    bool SyncPending() const;
+
 private:
     DBTableBase::ListenerId id_;
     LifetimeRef<TableState> table_delete_ref_;
     GroupList list_;
+    std::vector<RtIndexPartition *> index_;
     DISALLOW_COPY_AND_ASSIGN(TableState);
 };
 
@@ -184,6 +243,19 @@ public:
 
     void RequestWalk(BgpTable *table);
 
+    // Resync the routes in the table that carry the RouteTarget
+    void RequestSync(BgpTable *table, const RouteTarget &rtarget);
+
+    // Called when a partition has completed its resync
+    void SyncDone(BgpTable *table);
+
+    // Number of routes in the table that are indexed under the RouteTarget
+    size_t GetIndexedRouteCount(BgpTable *table, const RouteTarget &rtarget);
+
+    // Number of indexed routes that have been resynced, over all tables
+    uint64_t sync_route_count() const { return sync_route_count_; }
+    void AddSyncRouteCount(size_t count) { sync_route_count_ += count; }
+
     SandeshTraceBufferPtr trace_buffer() const { return trace_buf_; }
 
     bool UnregisterTables();
@@ -213,6 +285,7 @@ private:
     boost::scoped_ptr<TaskTrigger> walk_trigger_;
     boost::scoped_ptr<TaskTrigger> unreg_trigger_;
     SandeshTraceBufferPtr trace_buf_;
+    tbb::atomic<uint64_t> sync_route_count_;
 };
 
 #endif // ctrlplane_routepath_replicator_h
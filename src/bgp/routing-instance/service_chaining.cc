@@ -42,7 +42,8 @@ ServiceChain::ServiceChain(RoutingInstance *src, RoutingInstance *dest,
         error_code ec;
         Ip4Prefix ipam_subnet = Ip4Prefix::FromString(*it, &ec);
         assert(ec == 0);
-        prefix_to_routelist_map_[ipam_subnet] = RouteList();
+        RouteList *list = &prefix_to_routelist_map_[ipam_subnet];
+        prefix_index_.Insert(ipam_subnet, list);
     }
 }
 
@@ -184,32 +185,18 @@ bool ServiceChain::Match(BgpServer *server, BgpTable *table,
     return true;
 }
 
+// The route is more specific if any of the subnets covers it. If several
+// subnets do, the route is aggregated into the longest one.
 bool ServiceChain::is_more_specific(BgpRoute *route, 
                                     Ip4Prefix *aggregate_match) {
-    unsigned long broadcast = 0xFFFFFFFF;
-    InetRoute *inet_route = dynamic_cast<InetRoute *>(route);
-    Ip4Address address = inet_route->GetPrefix().ip4_addr();
-    for(PrefixToRouteListMap::iterator it = prefix_to_route_list_map()->begin();
-        it != prefix_to_route_list_map()->end(); it++) {
-        unsigned long shift_mask = (32 - it->first.prefixlen());
-        if ((it->first.prefixlen() != inet_route->GetPrefix().prefixlen()) &&
-            ((address.to_ulong() & (broadcast << shift_mask)) == 
-             (it->first.ip4_addr().to_ulong() & (broadcast << shift_mask)))) {
-            *aggregate_match = it->first;
-            return true;
-        }
-    }
-    return false;
+    InetRoute *inet_route = static_cast<InetRoute *>(route);
+    return (prefix_index_.LongestCoveringMatch(inet_route->GetPrefix(),
+                                               aggregate_match) != NULL);
 }
 
 bool ServiceChain::is_aggregate(BgpRoute *route) {
-    InetRoute *inet_route = dynamic_cast<InetRoute *>(route);
-    for (PrefixToRouteListMap::iterator it = prefix_to_route_list_map()->begin();
-        it != prefix_to_route_list_map()->end(); it++) {
-        if (it->first == inet_route->GetPrefix())
-            return true;
-    }
-    return false;
+    InetRoute *inet_route = static_cast<InetRoute *>(route);
+    return (prefix_index_.Find(inet_route->GetPrefix()) != NULL);
 }
 
 // RemoveServiceChainRoute
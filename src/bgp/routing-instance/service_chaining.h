@@ -19,6 +19,7 @@
 
 #include "bgp/bgp_condition_listener.h"
 #include "bgp/bgp_config.h"
+#include "bgp/inet/inet_prefix_index.h"
 #include "bgp/inet/inet_route.h"
 
 #include "bgp/routing-instance/service_chaining_types.h"
@@ -40,6 +41,11 @@ public:
     //
     typedef std::map<Ip4Prefix, RouteList> PrefixToRouteListMap;
     //
+    // Longest prefix match index of the Virtual Network subnet prefixes,
+    // used to match routes against the subnets
+    //
+    typedef InetPrefixIndex<RouteList *> PrefixIndex;
+    //
     // Map of External Connecting route to Service Chain Route
     //
     typedef std::set<BgpRoute *> ExtConnectRouteList;
@@ -114,24 +120,22 @@ public:
     void RemoveServiceChainRoute(Ip4Prefix prefix, bool aggregate);
 
     bool add_more_specific(Ip4Prefix aggregate, BgpRoute *more_specific) {
-        PrefixToRouteListMap::iterator it = 
-            prefix_to_routelist_map_.find(aggregate);
-        assert(it != prefix_to_routelist_map_.end());
+        RouteList **list = prefix_index_.Find(aggregate);
+        assert(list != NULL);
         bool ret = false;
-        if (it->second.empty()) {
+        if ((*list)->empty()) {
             // Add the aggregate for the first time
             ret = true;
         }
-        it->second.insert(more_specific);
+        (*list)->insert(more_specific);
         return ret;
     }
 
     bool delete_more_specific(Ip4Prefix aggregate, BgpRoute *more_specific) {
-        PrefixToRouteListMap::iterator it = 
-            prefix_to_routelist_map_.find(aggregate);
-        assert(it != prefix_to_routelist_map_.end());
-        it->second.erase(more_specific);
-        return it->second.empty(); 
+        RouteList **list = prefix_index_.Find(aggregate);
+        assert(list != NULL);
+        (*list)->erase(more_specific);
+        return (*list)->empty(); 
     }
 
     BgpTable *src_table() const;
@@ -209,6 +213,7 @@ private:
     BgpRoute *connected_route_;
     IpAddress service_chain_addr_;
     PrefixToRouteListMap prefix_to_routelist_map_;
+    PrefixIndex prefix_index_;
     // List of routes from Destination VN for external connectivity
     ExtConnectRouteList ext_connect_routes_;
     bool connected_table_unregistered_;
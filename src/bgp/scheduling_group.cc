@@ -20,6 +20,7 @@
 using namespace std;
 
 int SchedulingGroup::send_task_id_ = -1;
+int SchedulingGroup::send_shards_ = -1;
 
 //
 // This struct represents RibOut specific state for a PeerState.  There's one
@@ -504,6 +505,14 @@ bool SchedulingGroup::empty() const {
     return rib_state_imap_.empty();
 }
 
+int SchedulingGroup::send_shards() {
+    if (send_shards_ < 0) {
+        char *str = getenv("BGP_SEND_SHARDS");
+        send_shards_ = str ? max(strtol(str, NULL, 0), 1L) : 1;
+    }
+    return send_shards_;
+}
+
 //
 // Return true if the IPeer is in sync.
 //
@@ -944,6 +953,37 @@ void SchedulingGroup::SetQueueSync(PeerState *ps, int queue_id) {
     }
 }
 
+//
+// When enabled, the peers are corked while the updates for a work item are
+// sent to them, so that their sessions write the update messages together
+// instead of one write per message.
+//
+static bool CorkUpdates() {
+    static bool init_;
+    static bool cork_;
+
+    if (init_) return cork_;
+
+    cork_ = getenv("BGP_CORK_UPDATES") != NULL;
+    init_ = true;
+
+    return cork_;
+}
+
+static void CorkPeers(RibOut *ribout, const RibPeerSet &peer_set) {
+    RibOut::PeerIterator iter(ribout, peer_set);
+    while (iter.HasNext()) {
+        iter.Next()->Cork();
+    }
+}
+
+static void UncorkPeers(RibOut *ribout, const RibPeerSet &peer_set) {
+    RibOut::PeerIterator iter(ribout, peer_set);
+    while (iter.HasNext()) {
+        iter.Next()->Uncork();
+    }
+}
+
 //
 // Drain the queue until there are no more updates or all the members become
 // blocked.    
@@ -960,7 +1000,12 @@ void SchedulingGroup::UpdateRibOut(RibOut *ribout, int queue_id) {
 
     // Drain the queue till we can do no more.
     RibPeerSet blocked;
+    bool cork = CorkUpdates();
+    if (cork)
+        CorkPeers(ribout, msync);
     bool done = updates->TailDequeue(queue_id, msync, &blocked);
+    if (cork)
+        UncorkPeers(ribout, msync);
     assert(msync.Contains(blocked));
 
     // Mark peers as send blocked.
@@ -1047,15 +1092,22 @@ void SchedulingGroup::UpdatePeer(IPeerUpdate *peer) {
     }
 
     // Go through all queues and drain them if there's anything on them.
+    bool cork = CorkUpdates();
+    if (cork)
+        peer->Cork();
     for (int queue_id = RibOutUpdates::QCOUNT - 1; queue_id >= 0; --queue_id) {
         if (ps->QueueCount(queue_id) == 0) {
             continue;
         }
         if (!UpdatePeerQueue(peer, ps, queue_id)) {
             assert(!ps->send_ready());
+            if (cork)
+                peer->Uncork();
             return;
         }
     }
+    if (cork)
+        peer->Uncork();
 
     // Checking the return value of UpdatePeerQueue above is not sufficient as
     // that only tells us that *some* peer(s) got merged with the tail marker.
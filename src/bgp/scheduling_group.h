@@ -54,6 +54,11 @@ class GroupPeerSet : public BitSet {
 // WorkRibOut entry after adding a RouteUpdate to an empty UpdateQueue, and
 // the IPeer class which create a WorkPeer entry when it becomes unblocked.
 //
+// The Worker may fan a message out to the peers of a RibOut in several send
+// shards that run in parallel. A peer always belongs to the same shard for a
+// RibOut and the RibOuts are processed one at a time, so there's still only
+// one thread at a time that writes to an IPeerUpdate.
+//
 class SchedulingGroup {
 public:
     typedef std::vector<RibOut *> RibOutList;
@@ -102,6 +107,11 @@ public:
     void clear();
     bool empty() const;
 
+    // The number of send shards defaults to BGP_SEND_SHARDS, or 1 which
+    // sends to all the peers from the Worker.
+    static int send_shards();
+    static void set_send_shards(int shards) { send_shards_ = shards; }
+
 private:
     friend class RibOutUpdatesTest;
     friend class BgpUpdateTest;
@@ -158,6 +168,7 @@ private:
     RibStateMap rib_state_imap_;
     
     static int send_task_id_;
+    static int send_shards_;
 
     DISALLOW_COPY_AND_ASSIGN(SchedulingGroup);
 };
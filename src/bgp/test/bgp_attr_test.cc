@@ -481,6 +481,75 @@ TEST_F(BgpAttrTest, ExtCommunityDBConcurrency) {
                     ExtCommunitySpec>(extcomm_db_);
 }
 
+// ----- Multi-threaded interning benchmark.
+// Each thread repeatedly locates attributes from a common pool, the way peer
+// input processing does when many peers advertise routes with the same
+// attributes. Most lookups find an existing entry. Reports the number of
+// locates per second for increasing thread counts.
+
+struct InternBenchmarkArgs {
+    BgpAttrDB *db;
+    int attr_count;
+    int iterations;
+};
+
+static void *InternBenchmarkThreadRun(void *objp) {
+    InternBenchmarkArgs *args = reinterpret_cast<InternBenchmarkArgs *>(objp);
+    std::vector<BgpAttrPtr> attrs(args->attr_count);
+
+    for (int i = 0; i < args->iterations; i++) {
+        int idx = i % args->attr_count;
+        BgpAttrSpec spec;
+        BgpAttrNextHop nexthop(0x0a000001 + idx);
+        spec.push_back(&nexthop);
+        BgpAttrLocalPref local_pref(100);
+        spec.push_back(&local_pref);
+        attrs[idx] = args->db->Locate(spec);
+    }
+    return NULL;
+}
+
+TEST_F(BgpAttrTest, BgpAttrDBInternBenchmark) {
+    int max_threads = 16;
+    char *str = getenv("THREAD_COUNT");
+    if (str) max_threads = strtoul(str, NULL, 0);
+
+    InternBenchmarkArgs args;
+    args.db = attr_db_;
+    args.attr_count = 1024;
+    args.iterations = 100000;
+
+    for (int thread_count = 1; thread_count <= max_threads;
+         thread_count *= 2) {
+        BgpPathAttributeDBStats start_stats;
+        attr_db_->GetStats(&start_stats);
+
+        std::vector<pthread_t> thread_ids;
+        pthread_t tid;
+        uint64_t start = UTCTimestampUsec();
+        for (int i = 0; i < thread_count; i++) {
+            if (!pthread_create(&tid, NULL, &InternBenchmarkThreadRun,
+                                &args)) {
+                thread_ids.push_back(tid);
+            }
+        }
+        BOOST_FOREACH(tid, thread_ids) { pthread_join(tid, NULL); }
+        uint64_t elapsed = std::max(UTCTimestampUsec() - start, (uint64_t) 1);
+
+        BgpPathAttributeDBStats stats;
+        attr_db_->GetStats(&stats);
+        uint64_t lookups = stats.lookups - start_stats.lookups;
+        EXPECT_EQ(thread_ids.size() * args.iterations, lookups);
+        LOG(DEBUG, "Threads " << thread_count <<
+            ": " << lookups * 1000000 / elapsed << " locates/sec, " <<
+            stats.hits - start_stats.hits << " hits, " <<
+            stats.contended - start_stats.contended << " contended, " <<
+            stats.partitions << " partitions");
+    }
+
+    TASK_UTIL_EXPECT_EQ(0, attr_db_->Size());
+}
+
 static void SetUp() {
     bgp_log_test::init();
     ControlNode::SetDefaultSchedulingPolicy();
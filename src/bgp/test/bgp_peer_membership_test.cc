@@ -495,6 +495,53 @@ TEST_F(PeerMembershipMgrTest, PeerDeleteWithDBRequestPending) {
         server_->FindPeer(BgpConfigManager::kMasterInstance, peer_names_[0]));
 }
 
+// Delete the paths of a peer from the per peer route lists of the table,
+// with a small budget so that every partition has to yield several times.
+TEST_F(PeerMembershipMgrTest, RibInSweep) {
+    PeerRibMembershipManager *mgr = server()->membership_mgr();
+    int budget = RibInSweeper::budget();
+    RibInSweeper::set_budget(4);
+
+    mgr->Register(peers_[0], inet_tbl_, peers_[0]->GetRibExportPolicy(), -1);
+    mgr->Register(peers_[1], inet_tbl_, peers_[1]->GetRibExportPolicy(), -1);
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_EQ(2, size());
+
+    BgpAttrSpec attr_spec;
+    BgpAttrPtr attr = server_->attr_db()->Locate(attr_spec);
+    const int kRouteCount = 256;
+    for (int idx = 0; idx < kRouteCount; idx++) {
+        Ip4Prefix prefix(Ip4Address(0x0a000000 + (idx << 8)), 24);
+        for (int peer_idx = 0; peer_idx < 2; peer_idx++) {
+            DBRequest req;
+            req.oper = DBRequest::DB_ENTRY_ADD_CHANGE;
+            req.key.reset(new InetTable::RequestKey(prefix, peers_[peer_idx]));
+            req.data.reset(new InetTable::RequestData(attr, 0, 0));
+            inet_tbl_->Enqueue(&req);
+        }
+    }
+    task_util::WaitForIdle();
+    EXPECT_EQ(kRouteCount, inet_tbl_->Size());
+    EXPECT_EQ(kRouteCount, inet_tbl_->GetPeerRouteCount(peers_[0]));
+    EXPECT_EQ(kRouteCount, inet_tbl_->GetPeerRouteCount(peers_[1]));
+
+    // The routes stay since they still have the paths from the other peer.
+    mgr->Unregister(peers_[0], inet_tbl_);
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_EQ(1, size());
+    EXPECT_EQ(kRouteCount, inet_tbl_->Size());
+    EXPECT_EQ(0, inet_tbl_->GetPeerRouteCount(peers_[0]));
+    EXPECT_EQ(kRouteCount, inet_tbl_->GetPeerRouteCount(peers_[1]));
+
+    mgr->Unregister(peers_[1], inet_tbl_);
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_EQ(0, size());
+    TASK_UTIL_EXPECT_EQ(0, inet_tbl_->Size());
+    EXPECT_EQ(0, inet_tbl_->GetPeerRouteCount(peers_[1]));
+
+    RibInSweeper::set_budget(budget);
+}
+
 static void SetUp() {
     bgp_log_test::init();
     ControlNode::SetDefaultSchedulingPolicy();
@@ -97,6 +97,71 @@ TEST_F(RibOutUpdatesTest, TailDequeueBasic2a) {
     }
 }
 
+// Routes:   Routes x=[0,kRouteCount-1] enqueued to all peers, alternating
+//           between attr A and attr B.
+// Blocking: None.
+// Result:   Routes get sent to all peers in 2 updates, one for each attr,
+//           and the RibOut pack statistics account for all the routes.
+TEST_F(RibOutUpdatesTest, TailDequeuePackStats) {
+    UpdateInfoSList uinfo_slistA, uinfo_slistB;
+    PrependUpdateInfo(uinfo_slistA, attrA_, 0, kPeerCount-1);
+    PrependUpdateInfo(uinfo_slistB, attrB_, 0, kPeerCount-1);
+
+    for (int idx = 0; idx < kRouteCount; idx++) {
+        UpdateInfoSList temp_uinfo_slist;
+        CloneUpdateInfo(idx % 2 ? uinfo_slistB : uinfo_slistA,
+                        temp_uinfo_slist);
+        BuildRouteUpdate(routes_[idx], temp_uinfo_slist);
+    }
+
+    UpdateRibOut();
+    VerifyUpdateCount(0, kPeerCount-1, COUNT_2);
+    VerifyPeerInSync(0, kPeerCount-1, true);
+    VerifyMessageCount(2);
+
+    RibOutUpdates *updates = ribout_.updates();
+    EXPECT_EQ(2, updates->message_count());
+    EXPECT_EQ(kRouteCount, updates->prefix_count());
+}
+
+// Routes:   Routes x=[0,kRouteCount-1] enqueued to all peers with attr A,
+//           right after a dequeue and with the pack delay set.
+// Blocking: None.
+// Result:   The tail dequeue is held back till the pack timer fires, and
+//           the routes then get sent to all peers in 1 update.
+TEST_F(RibOutUpdatesTest, TailDequeuePackDelay) {
+    RibOutUpdates::set_pack_delay_msec(500);
+    CreatePackTimer();
+    SetLastDequeueNow();
+
+    UpdateInfoSList uinfo_slist;
+    PrependUpdateInfo(uinfo_slist, attrA_, 0, kPeerCount-1);
+    for (int idx = 0; idx < kRouteCount; idx++) {
+        UpdateInfoSList temp_uinfo_slist;
+        CloneUpdateInfo(uinfo_slist, temp_uinfo_slist);
+        BuildRouteUpdate(routes_[idx], temp_uinfo_slist);
+    }
+    EXPECT_EQ(1 << RibOutUpdates::QUPDATE, PackPending());
+    VerifyUpdateCount(0, kPeerCount-1, COUNT_0);
+    VerifyMessageCount(0);
+
+    ServerThread thread(&evm_);
+    thread.Start();
+    SchedulerStart();
+    TASK_UTIL_EXPECT_EQ(1, builder_.msg_count());
+    task_util::WaitForIdle();
+
+    EXPECT_EQ(0, PackPending());
+    VerifyUpdateCount(0, kPeerCount-1, COUNT_1);
+    VerifyPeerInSync(0, kPeerCount-1, true);
+    VerifyMessageCount(1);
+    EXPECT_EQ(kRouteCount, updates_->prefix_count());
+
+    evm_.Shutdown();
+    thread.Join();
+    RibOutUpdates::set_pack_delay_msec(0);
+}
+
 // Routes:   Routes x=[0,vRouteCount-1] enqueued to all peers for withdraw.
 // Blocking: None.
 // Result:   Routes get withdrawn from all peers in 1 update.
@@ -2417,6 +2482,106 @@ TEST_F(RibOutUpdatesTest, PeerDequeueSplitMerge1) {
     }
 }
 
+// Routes:   Routes x=[0,kRouteCount-1] enqueued to 64 peers, alternating
+//           between attr A and attr B, with 4 send shards.
+// Blocking: Even peers block at step 1.
+// Result:   Odd peers get 2 updates and even peers get 1 update and are
+//           blocked, as when the message is sent from a single shard. The
+//           scheduling group worker does the tail dequeue, and the shards
+//           are sent from more than one instance of bgp::SendTask.
+TEST_F(RibOutUpdatesTest, TailDequeueSendShards) {
+    for (int idx = kPeerCount; idx < 64; idx++) {
+        CreatePeer();
+    }
+    int peer_count = peers_.size();
+    SchedulingGroup::set_send_shards(4);
+
+    // Slow the peers down so that the shard tasks start while the worker
+    // is still sending its own shard.
+    SetPeerSendDelay(0, peer_count-1, 1000);
+
+    UpdateInfoSList uinfo_slistA, uinfo_slistB;
+    PrependUpdateInfo(uinfo_slistA, attrA_, 0, peer_count-1);
+    PrependUpdateInfo(uinfo_slistB, attrB_, 0, peer_count-1);
+    for (int idx = 0; idx < kRouteCount; idx++) {
+        UpdateInfoSList temp_uinfo_slist;
+        CloneUpdateInfo(idx % 2 ? uinfo_slistB : uinfo_slistA,
+                        temp_uinfo_slist);
+        BuildRouteUpdate(routes_[idx], temp_uinfo_slist);
+    }
+    SetEvenPeerBlock(0, peer_count-1, STEP_1);
+
+    // The enqueues made the RibOut active, so the worker runs the tail
+    // dequeue once the scheduler is started.
+    SchedulerStart();
+    task_util::WaitForIdle();
+
+    VerifyEvenUpdateCount(0, peer_count-1, COUNT_1);
+    VerifyOddUpdateCount(0, peer_count-1, COUNT_2);
+    VerifyEvenPeerBlock(0, peer_count-1, true);
+    VerifyOddPeerBlock(0, peer_count-1, false);
+    VerifyMessageCount(2);
+
+    int send_task_id =
+        TaskScheduler::GetInstance()->GetTaskId("bgp::SendTask");
+    set<int> instances;
+    for (int idx = 0; idx < peer_count; idx++) {
+        EXPECT_EQ(send_task_id, peers_[idx]->send_task_id());
+        int instance = peers_[idx]->send_task_instance();
+        EXPECT_TRUE(instance == -1 || (instance >= 1 && instance < 4))
+            << instance;
+        instances.insert(instance);
+    }
+    EXPECT_GE(4U, instances.size());
+    if (TaskScheduler::GetThreadCount() > 1) {
+        EXPECT_LT(1U, instances.size());
+    }
+
+    SchedulingGroup::set_send_shards(1);
+}
+
+//
+// Time the fan out of the updates to a large number of peers with 1, 2, 4
+// and 8 send shards. The updates are sent by the scheduling group worker
+// and the shard tasks, and the time is the send time of the RibOut.
+// PEER_COUNT and ROUTE_COUNT override the number of peers and of updates
+// that are sent to them, and SEND_DELAY_USEC the time that each peer takes
+// to send an update.
+//
+TEST_F(RibOutUpdatesTest, SendShardScaling) {
+    int peer_count = GetEnvInt("PEER_COUNT", 1000);
+    int route_count = min(GetEnvInt("ROUTE_COUNT", kRouteCount), kRouteCount);
+    for (int idx = kPeerCount; idx < peer_count; idx++) {
+        CreatePeer();
+    }
+    SetPeerSendDelay(0, peer_count-1, GetEnvInt("SEND_DELAY_USEC", 0));
+
+    for (int shards = 1; shards <= 8; shards *= 2) {
+        SchedulingGroup::set_send_shards(shards);
+        SchedulerStop();
+        for (int idx = 0; idx < route_count; idx++) {
+            UpdateInfoSList uinfo_slist;
+            PrependUpdateInfo(uinfo_slist, attr_[idx], 0, peer_count-1);
+            BuildRouteUpdate(routes_[idx], uinfo_slist);
+        }
+
+        uint64_t send_usecs = updates_->send_usecs();
+        SchedulerStart();
+        task_util::WaitForIdle();
+        uint64_t elapsed = updates_->send_usecs() - send_usecs;
+        VerifyUpdateCount(0, peer_count-1, (Count) route_count);
+
+        LOG(DEBUG, "Sent " << route_count << " updates to " << peer_count <<
+            " peers with " << shards << " shards in " << elapsed << " usec");
+
+        ClearPeerCount(0, peer_count-1);
+        ClearMessageCount();
+        DeleteRouteState(0, route_count-1);
+    }
+
+    SchedulingGroup::set_send_shards(1);
+}
+
 static void SetUp() {
     bgp_log_test::init();
     ControlNode::SetDefaultSchedulingPolicy();
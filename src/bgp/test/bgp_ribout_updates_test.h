@@ -7,6 +7,7 @@
 
 #include "bgp/bgp_ribout_updates.h"
 
+#include <unistd.h>
 #include <string>
 #include <vector>
 
@@ -14,6 +15,7 @@
 #include "base/task_annotations.h"
 #include "base/util.h"
 #include "base/test/task_test_util.h"
+#include "base/timer.h"
 #include "control-node/control_node.h"
 #include "bgp/bgp_attr.h"
 #include "bgp/bgp_export.h"
@@ -45,7 +47,9 @@ static const int kAttrCount = 12;
 
 class BgpTestPeer : public IPeerUpdate {
 public:
-    BgpTestPeer() : index_(gbl_index++), count_(0) {
+    BgpTestPeer()
+        : index_(gbl_index++), count_(0), send_task_id_(-1),
+          send_task_instance_(-1), send_delay_usec_(0) {
     }
 
     virtual ~BgpTestPeer() { }
@@ -59,6 +63,12 @@ public:
     virtual bool SendUpdate(const uint8_t *msg, size_t msgsize) {
         count_++;
         send_block_ = block_set_.find(count_) != block_set_.end();
+        if (send_delay_usec_) {
+            usleep(send_delay_usec_);
+        }
+        Task *task = Task::Running();
+        send_task_id_ = task ? task->GetTaskId() : -1;
+        send_task_instance_ = task ? task->GetTaskInstance() : -1;
         return !send_block_;
     }
 
@@ -73,22 +83,36 @@ public:
     void clear_update_count() { count_ = 0; }
     bool send_block() const { return send_block_; }
 
+    // The task that the last update was sent from
+    int send_task_id() const { return send_task_id_; }
+    int send_task_instance() const { return send_task_instance_; }
+
+    // Time that each update takes to send
+    void set_send_delay_usec(int usec) { send_delay_usec_ = usec; }
+
 private:
     int index_;
     std::set<int> block_set_;
     int count_;
     bool send_block_;
+    int send_task_id_;
+    int send_task_instance_;
+    int send_delay_usec_;
 };
 
 class MessageMock : public Message {
 public:
-    MessageMock() : route_count_(1) { }
+    MessageMock() : route_count_(1) { num_reach_route_ = 1; }
     virtual bool AddRoute(const BgpRoute *route, const RibOutAttr *attr) {
-        return (++route_count_ == 1000 ? false : true);
+        if (++route_count_ == 1000)
+            return false;
+        num_reach_route_ = route_count_;
+        return true;
     }
     virtual void Finish() {
     }
     virtual const uint8_t *GetData(IPeerUpdate *peer, size_t *lenp) {
+        *lenp = 0;
         return NULL;
     }
 
@@ -425,6 +449,14 @@ protected:
         }
     }
 
+    void SetPeerSendDelay(int start_idx, int end_idx, int usec) {
+        ASSERT_TRUE(start_idx <= end_idx);
+        ASSERT_TRUE(end_idx < (int) peers_.size());
+        for (int idx = start_idx; idx <= end_idx; idx++) {
+            peers_[idx]->set_send_delay_usec(usec);
+        }
+    }
+
     void ClearPeerCount(int start_idx, int end_idx) {
         ASSERT_TRUE(start_idx <= end_idx);
         ASSERT_TRUE(end_idx < (int) peers_.size());
@@ -671,6 +703,23 @@ protected:
         }
     }
 
+    // The table has no routing instance to take the io_service of the
+    // server from, so the pack timer is created on the evm of the test.
+    void CreatePackTimer() {
+        updates_->pack_timer_ = TimerManager::CreateTimer(*evm_.io_service(),
+            "BGP update pack timer",
+            TaskScheduler::GetInstance()->GetTaskId("bgp::SendTask"), 0);
+    }
+
+    void SetLastDequeueNow() {
+        updates_->last_dequeue_usec_ = UTCTimestampUsec();
+    }
+
+    int PackPending() {
+        tbb::mutex::scoped_lock lock(updates_->pack_mutex_);
+        return updates_->pack_pending_;
+    }
+
     EventManager evm_;
     BgpServer server_;
     DB db_;
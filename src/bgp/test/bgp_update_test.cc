@@ -117,6 +117,7 @@ public:
         virtual void Finish() {
         }
         virtual const uint8_t *GetData(IPeerUpdate *peer, size_t *lenp) {
+            *lenp = 0;
             return NULL;
         }
     };
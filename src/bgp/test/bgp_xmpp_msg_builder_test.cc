@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <new>
+#include <vector>
+
+#include <pugixml/pugixml.hpp>
+
+#include "base/logging.h"
+#include "base/task.h"
+#include "base/task_annotations.h"
+#include "base/test/task_test_util.h"
+#include "base/util.h"
+#include "testing/gunit.h"
+
+#include "bgp/bgp_attr.h"
+#include "bgp/bgp_config.h"
+#include "bgp/bgp_log.h"
+#include "bgp/bgp_ribout.h"
+#include "bgp/bgp_server.h"
+#include "bgp/inet/inet_route.h"
+#include "bgp/routing-instance/routing_instance.h"
+#include "bgp/security_group/security_group.h"
+#include "bgp/xmpp_message_builder.h"
+#include "control-node/control_node.h"
+#include "io/event_manager.h"
+#include "xmpp/xmpp_init.h"
+
+using namespace std;
+using namespace pugi;
+
+namespace {
+
+class PeerUpdateMock : public IPeerUpdate {
+public:
+    explicit PeerUpdateMock(const string &name) : name_(name) { }
+    virtual string ToString() const { return name_; }
+    virtual bool SendUpdate(const uint8_t *msg, size_t msgsize) {
+        return true;
+    }
+
+private:
+    string name_;
+};
+
+class BgpXmppMsgBuilderTest : public testing::Test {
+protected:
+    BgpXmppMsgBuilderTest() : server_(&evm_) {
+    }
+
+    virtual void SetUp() {
+        BgpInstanceConfig instance_config(BgpConfigManager::kMasterInstance);
+        ConcurrencyScope scope("bgp::Config");
+        RoutingInstance *rti =
+            server_.routing_instance_mgr()->CreateRoutingInstance(
+                &instance_config);
+        table_ = rti->GetTable(Address::INET);
+        cache_.Clear();
+    }
+
+    virtual void TearDown() {
+        cache_.Clear();
+        server_.Shutdown();
+        task_util::WaitForIdle();
+    }
+
+    BgpAttrPtr BuildAttr(uint32_t nexthop, uint32_t sgid) {
+        BgpAttrSpec spec;
+        BgpAttrNextHop nh(nexthop);
+        spec.push_back(&nh);
+        ExtCommunitySpec ext_community;
+        SecurityGroup sg(64512, sgid);
+        ext_community.communities.push_back(sg.GetExtCommunityValue());
+        spec.push_back(&ext_community);
+        return server_.attr_db()->Locate(spec);
+    }
+
+    // Parse the data for the given peer and return the items node.
+    xml_node Parse(BgpXmppMessage *message, const string &peer,
+                   xml_document *xdoc) {
+        PeerUpdateMock peer_update(peer);
+        size_t length;
+        const uint8_t *data = message->GetData(&peer_update, &length);
+        xml_parse_result result =
+            xdoc->load_buffer(data, length, parse_default, encoding_utf8);
+        EXPECT_TRUE(result);
+        xml_node xmessage = xdoc->child("message");
+        EXPECT_EQ(string(XmppInit::kControlNodeJID),
+                  xmessage.attribute("from").value());
+        EXPECT_EQ(peer + "/" + XmppInit::kBgpPeer,
+                  xmessage.attribute("to").value());
+        return xmessage.child("event").child("items");
+    }
+
+    // Encode the route into a message for a peer, using the given cache.
+    string Encode(BgpXmppItemCache *cache, const BgpRoute *route,
+                  const RibOutAttr *roattr) {
+        BgpXmppMessage message(table_, roattr, cache);
+        message.Start(roattr, route);
+        message.Finish();
+        PeerUpdateMock peer_update("agent-a");
+        size_t length;
+        const uint8_t *cp = message.GetData(&peer_update, &length);
+        return string(reinterpret_cast<const char *>(cp), length);
+    }
+
+    EventManager evm_;
+    BgpServer server_;
+    BgpTable *table_;
+    BgpXmppItemCache cache_;
+};
+
+TEST_F(BgpXmppMsgBuilderTest, Reach) {
+    BgpAttrPtr attr = BuildAttr(0x0a010101, 8000001);
+    RibOutAttr roattr(attr.get(), 16);
+    InetRoute route1(Ip4Prefix::FromString("10.1.1.0/24"));
+    InetRoute route2(Ip4Prefix::FromString("10.1.2.0/24"));
+
+    BgpXmppMessage message(table_, &roattr, &cache_);
+    message.Start(&roattr, &route1);
+    message.AddRoute(&route2, &roattr);
+    message.Finish();
+    EXPECT_EQ(2, message.num_reach_routes());
+
+    // The body is shared, so the data for the first peer must still be
+    // valid xml after the header has been rewritten for longer names.
+    const char *peers[] = { "agent-a", "agent-bbbbbbbbbbbbbbbbbbbb", "x" };
+    for (size_t idx = 0; idx < sizeof(peers) / sizeof(peers[0]); idx++) {
+        xml_document xdoc;
+        xml_node items = Parse(&message, peers[idx], &xdoc);
+        EXPECT_EQ(string("1/1/") + BgpConfigManager::kMasterInstance,
+                  items.attribute("node").value());
+
+        int count = 0;
+        for (xml_node item = items.child("item"); item;
+             item = item.next_sibling("item"), count++) {
+            xml_node entry = item.child("entry");
+            EXPECT_EQ(item.attribute("id").value(),
+                      string(entry.child("nlri").child_value("address")));
+            xml_node nh = entry.child("next-hops").child("next-hop");
+            EXPECT_EQ(string("10.1.1.1"), nh.child_value("address"));
+            EXPECT_EQ(string("16"), nh.child_value("label"));
+            EXPECT_EQ(string("gre"), nh.child("tunnel-encapsulation-list").
+                      child_value("tunnel-encapsulation"));
+            EXPECT_EQ(string("8000001"), entry.child("security-group-list").
+                      child_value("security-group"));
+        }
+        EXPECT_EQ(2, count);
+    }
+}
+
+TEST_F(BgpXmppMsgBuilderTest, Unreach) {
+    RibOutAttr roattr;
+    InetRoute route1(Ip4Prefix::FromString("10.1.1.0/24"));
+
+    BgpXmppMessage message(table_, &roattr, &cache_);
+    message.Start(&roattr, &route1);
+    message.Finish();
+    EXPECT_EQ(1, message.num_unreach_routes());
+
+    xml_document xdoc;
+    xml_node items = Parse(&message, "agent-a", &xdoc);
+    EXPECT_EQ(string("10.1.1.0/24"),
+              items.child("retract").attribute("id").value());
+    EXPECT_EQ(0, cache_.size());
+}
+
+// The second encoding of the same route and attributes comes from the
+// cache, while a change in the attributes misses.
+TEST_F(BgpXmppMsgBuilderTest, ItemCache) {
+    BgpAttrPtr attr1 = BuildAttr(0x0a010101, 8000001);
+    BgpAttrPtr attr2 = BuildAttr(0x0a010102, 8000001);
+    RibOutAttr roattr1(attr1.get(), 16);
+    RibOutAttr roattr2(attr2.get(), 16);
+    InetRoute route(Ip4Prefix::FromString("10.1.1.0/24"));
+
+    string data[3];
+    const RibOutAttr *roattr[3] = { &roattr1, &roattr1, &roattr2 };
+    for (int idx = 0; idx < 3; idx++) {
+        BgpXmppMessage message(table_, roattr[idx], &cache_);
+        message.Start(roattr[idx], &route);
+        message.Finish();
+        PeerUpdateMock peer_update("agent-a");
+        size_t length;
+        const uint8_t *cp = message.GetData(&peer_update, &length);
+        data[idx] = string(reinterpret_cast<const char *>(cp), length);
+    }
+
+    EXPECT_EQ(1, cache_.size());
+    EXPECT_EQ(1, cache_.hits());
+    EXPECT_EQ(2, cache_.misses());
+    EXPECT_EQ(data[0], data[1]);
+    EXPECT_NE(data[0], data[2]);
+    EXPECT_NE(string::npos, data[2].find("10.1.1.2"));
+}
+
+// A route created at the address of a freed route with the same prefix
+// does not get the entry of the freed route, which had other attributes.
+TEST_F(BgpXmppMsgBuilderTest, ItemCacheReusedAddress) {
+    BgpAttrPtr attr1 = BuildAttr(0x0a010101, 8000001);
+    BgpAttrPtr attr2 = BuildAttr(0x0a010102, 8000001);
+    RibOutAttr roattr1(attr1.get(), 16);
+    RibOutAttr roattr2(attr2.get(), 16);
+    Ip4Prefix prefix(Ip4Prefix::FromString("10.1.1.0/24"));
+
+    void *storage = operator new(sizeof(InetRoute));
+    InetRoute *route = new (storage) InetRoute(prefix);
+    string data1 = Encode(&cache_, route, &roattr1);
+    route->~InetRoute();
+
+    route = new (storage) InetRoute(prefix);
+    string data2 = Encode(&cache_, route, &roattr1);
+    route->~InetRoute();
+    operator delete(storage);
+
+    EXPECT_EQ(data1, data2);
+    EXPECT_EQ(0, cache_.hits());
+    EXPECT_EQ(2, cache_.misses());
+    EXPECT_EQ(2, cache_.size());
+}
+
+// A full partition evicts the entry that was used least recently, rather
+// than the one that was inserted first.
+TEST_F(BgpXmppMsgBuilderTest, ItemCacheLru) {
+    BgpAttrPtr attr = BuildAttr(0x0a010101, 8000001);
+    RibOutAttr roattr(attr.get(), 16);
+    BgpXmppItemCache cache(2);
+
+    // Pick three routes that map to the same partition.
+    vector<InetRoute *> routes;
+    vector<InetRoute *> same;
+    for (int idx = 0; same.size() < 3; idx++) {
+        Ip4Address addr(0x0a000000 + (idx << 8));
+        InetRoute *route = new InetRoute(Ip4Prefix(addr, 24));
+        routes.push_back(route);
+        if (route->generation() % BgpXmppItemCache::kPartitionCount ==
+            routes[0]->generation() % BgpXmppItemCache::kPartitionCount) {
+            same.push_back(route);
+        }
+    }
+
+    Encode(&cache, same[0], &roattr);
+    Encode(&cache, same[1], &roattr);
+    Encode(&cache, same[0], &roattr);
+    EXPECT_EQ(1, cache.hits());
+
+    // Evicts same[1], which was used before the last use of same[0].
+    Encode(&cache, same[2], &roattr);
+    EXPECT_EQ(2, cache.size());
+    Encode(&cache, same[0], &roattr);
+    EXPECT_EQ(2, cache.hits());
+    Encode(&cache, same[1], &roattr);
+    EXPECT_EQ(2, cache.hits());
+    EXPECT_EQ(4, cache.misses());
+
+    STLDeleteValues(&routes);
+}
+
+// The header for a peer followed by the shared body is the same data that
+// GetData returns for the peer, and the body is released with the last
+// reference to it.
+TEST_F(BgpXmppMsgBuilderTest, SharedBody) {
+    BgpAttrPtr attr = BuildAttr(0x0a010101, 8000001);
+    RibOutAttr roattr(attr.get(), 16);
+    InetRoute route(Ip4Prefix::FromString("10.1.1.0/24"));
+    PeerUpdateMock peer_update("agent-a");
+    uint64_t live_count = IoSharedBuffer::live_count();
+
+    IoSharedBufferPtr body;
+    string expected;
+    {
+        BgpXmppMessage message(table_, &roattr, &cache_);
+        message.Start(&roattr, &route);
+        message.Finish();
+        size_t length;
+        const uint8_t *cp = message.GetData(&peer_update, &length);
+        expected = string(reinterpret_cast<const char *>(cp), length);
+
+        body = message.GetSharedBody();
+        ASSERT_TRUE(body != NULL);
+        EXPECT_EQ(body, message.GetSharedBody());
+        EXPECT_EQ(live_count + 1, IoSharedBuffer::live_count());
+
+        // GetData still works once the body has been handed out.
+        cp = message.GetData(&peer_update, &length);
+        EXPECT_EQ(expected,
+                  string(reinterpret_cast<const char *>(cp), length));
+    }
+
+    string header;
+    BgpXmppMessage message(table_, &roattr, &cache_);
+    message.GetHeader(&peer_update, &header);
+    EXPECT_EQ(expected, header +
+              string(reinterpret_cast<const char *>(body->data()),
+                     body->size()));
+
+    body.reset();
+    EXPECT_EQ(live_count, IoSharedBuffer::live_count());
+}
+
+}  // namespace
+
+static void SetUp() {
+    ControlNode::SetDefaultSchedulingPolicy();
+}
+
+static void TearDown() {
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    scheduler->Terminate();
+}
+
+int main(int argc, char **argv) {
+    bgp_log_test::init();
+    ::testing::InitGoogleTest(&argc, argv);
+    SetUp();
+    int result = RUN_ALL_TESTS();
+    TearDown();
+    return result;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "bgp/inet/inet_prefix_index.h"
+
+#include <map>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+class InetPrefixIndexTest : public ::testing::Test {
+protected:
+    typedef InetPrefixIndex<int> PrefixIndex;
+
+    static Ip4Prefix Prefix(const string &str) {
+        return Ip4Prefix::FromString(str);
+    }
+
+    PrefixIndex index_;
+};
+
+TEST_F(InetPrefixIndexTest, Basic) {
+    EXPECT_TRUE(index_.empty());
+    EXPECT_TRUE(index_.Insert(Prefix("10.1.0.0/16"), 1));
+    EXPECT_TRUE(index_.Insert(Prefix("10.1.1.0/24"), 2));
+    EXPECT_FALSE(index_.Insert(Prefix("10.1.1.0/24"), 3));
+    EXPECT_EQ(2, index_.size());
+
+    ASSERT_TRUE(index_.Find(Prefix("10.1.1.0/24")) != NULL);
+    EXPECT_EQ(2, *index_.Find(Prefix("10.1.1.0/24")));
+    EXPECT_TRUE(index_.Find(Prefix("10.1.0.0/24")) == NULL);
+    EXPECT_TRUE(index_.Find(Prefix("10.0.0.0/8")) == NULL);
+
+    EXPECT_TRUE(index_.Remove(Prefix("10.1.1.0/24")));
+    EXPECT_FALSE(index_.Remove(Prefix("10.1.1.0/24")));
+    EXPECT_TRUE(index_.Find(Prefix("10.1.1.0/24")) == NULL);
+    EXPECT_EQ(1, index_.size());
+
+    index_.Clear();
+    EXPECT_TRUE(index_.empty());
+}
+
+TEST_F(InetPrefixIndexTest, LongestMatch) {
+    index_.Insert(Prefix("0.0.0.0/0"), 0);
+    index_.Insert(Prefix("10.0.0.0/8"), 8);
+    index_.Insert(Prefix("10.1.0.0/16"), 16);
+    index_.Insert(Prefix("10.1.1.0/24"), 24);
+    index_.Insert(Prefix("10.1.1.1/32"), 32);
+
+    Ip4Prefix match;
+    EXPECT_EQ(32, *index_.LongestMatch(Prefix("10.1.1.1/32"), &match));
+    EXPECT_EQ(Prefix("10.1.1.1/32"), match);
+    EXPECT_EQ(24, *index_.LongestMatch(Prefix("10.1.1.2/32"), &match));
+    EXPECT_EQ(Prefix("10.1.1.0/24"), match);
+    EXPECT_EQ(16, *index_.LongestMatch(Prefix("10.1.2.0/24")));
+    EXPECT_EQ(8, *index_.LongestMatch(Prefix("10.2.0.0/16")));
+    EXPECT_EQ(0, *index_.LongestMatch(Prefix("11.0.0.0/8"), &match));
+    EXPECT_EQ(Prefix("0.0.0.0/0"), match);
+
+    // The covering match excludes the prefix itself.
+    EXPECT_EQ(24, *index_.LongestCoveringMatch(Prefix("10.1.1.1/32")));
+    EXPECT_EQ(16, *index_.LongestCoveringMatch(Prefix("10.1.1.0/24"),
+                                               &match));
+    EXPECT_EQ(Prefix("10.1.0.0/16"), match);
+    EXPECT_EQ(0, *index_.LongestCoveringMatch(Prefix("10.0.0.0/8")));
+    EXPECT_TRUE(index_.LongestCoveringMatch(Prefix("0.0.0.0/0")) == NULL);
+
+    index_.Remove(Prefix("0.0.0.0/0"));
+    EXPECT_TRUE(index_.LongestMatch(Prefix("11.0.0.0/8")) == NULL);
+    EXPECT_TRUE(index_.LongestCoveringMatch(Prefix("10.0.0.0/8")) == NULL);
+}
+
+// Compare the index with a scan of all the subnets, which is how the
+// service chain used to match routes.
+TEST_F(InetPrefixIndexTest, RandomCompare) {
+    vector<Ip4Prefix> subnets;
+    for (int i = 0; i < 512; i++) {
+        int len = 8 + random() % 25;
+        uint32_t addr = random() & (~0U << (32 - len));
+        Ip4Prefix prefix(Ip4Address(addr), len);
+        if (index_.Insert(prefix, len)) {
+            subnets.push_back(prefix);
+        }
+    }
+
+    for (int i = 0; i < 10000; i++) {
+        Ip4Prefix route(Ip4Address(random()), 24 + random() % 9);
+        int best = -1;
+        for (vector<Ip4Prefix>::const_iterator it = subnets.begin();
+             it != subnets.end(); ++it) {
+            if (it->prefixlen() < route.prefixlen() &&
+                route.IsMoreSpecific(*it) && it->prefixlen() > best) {
+                best = it->prefixlen();
+            }
+        }
+        int *value = index_.LongestCoveringMatch(route);
+        EXPECT_EQ(best, value ? *value : -1);
+    }
+}
+
+//
+// Cost of matching every route notification against the subnets of a
+// service chain. The default number of subnets and routes match a virtual
+// network with a large IPAM; SUBNET_COUNT and ROUTE_COUNT override them.
+//
+class InetPrefixIndexBenchmark : public ::testing::Test {
+protected:
+    typedef map<Ip4Prefix, int> PrefixMap;
+
+    virtual void SetUp() {
+        int subnet_count = GetEnvInt("SUBNET_COUNT", 512);
+        int route_count = GetEnvInt("ROUTE_COUNT", 100000);
+
+        // /24 subnets carved out of 10.0.0.0/8 and /32 routes in them.
+        for (int i = 0; i < subnet_count; i++) {
+            Ip4Prefix prefix(Ip4Address(0x0a000000 + (i << 8)), 24);
+            map_.insert(make_pair(prefix, i));
+            index_.Insert(prefix, i);
+        }
+        for (int i = 0; i < route_count; i++) {
+            uint32_t addr = 0x0a000000 + (random() % (subnet_count << 8));
+            routes_.push_back(Ip4Prefix(Ip4Address(addr), 32));
+        }
+    }
+
+    // Same algorithm as the one ServiceChain::is_more_specific used.
+    bool ScanMatch(const Ip4Prefix &route, Ip4Prefix *match) {
+        unsigned long broadcast = 0xFFFFFFFF;
+        Ip4Address address = route.ip4_addr();
+        for (PrefixMap::iterator it = map_.begin(); it != map_.end(); it++) {
+            unsigned long shift_mask = (32 - it->first.prefixlen());
+            if ((it->first.prefixlen() != route.prefixlen()) &&
+                ((address.to_ulong() & (broadcast << shift_mask)) ==
+                 (it->first.ip4_addr().to_ulong() &
+                  (broadcast << shift_mask)))) {
+                *match = it->first;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    PrefixMap map_;
+    InetPrefixIndex<int> index_;
+    vector<Ip4Prefix> routes_;
+};
+
+TEST_F(InetPrefixIndexBenchmark, ScanVsIndex) {
+    Ip4Prefix match;
+    size_t scan_count = 0;
+    uint64_t start = UTCTimestampUsec();
+    for (vector<Ip4Prefix>::const_iterator it = routes_.begin();
+         it != routes_.end(); ++it) {
+        if (ScanMatch(*it, &match)) {
+            scan_count++;
+        }
+    }
+    uint64_t scan_usec = UTCTimestampUsec() - start;
+
+    size_t index_count = 0;
+    start = UTCTimestampUsec();
+    for (vector<Ip4Prefix>::const_iterator it = routes_.begin();
+         it != routes_.end(); ++it) {
+        if (index_.LongestCoveringMatch(*it, &match)) {
+            index_count++;
+        }
+    }
+    uint64_t index_usec = UTCTimestampUsec() - start;
+
+    EXPECT_EQ(routes_.size(), scan_count);
+    EXPECT_EQ(routes_.size(), index_count);
+
+    LOG(DEBUG, "Matched " << routes_.size() << " routes against " <<
+        map_.size() << " subnets");
+    LOG(DEBUG, "scan:  " << scan_usec << " usec, " <<
+        routes_.size() * 1000000 / max(scan_usec, (uint64_t) 1) <<
+        " routes/sec");
+    LOG(DEBUG, "index: " << index_usec << " usec, " <<
+        routes_.size() * 1000000 / max(index_usec, (uint64_t) 1) <<
+        " routes/sec");
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
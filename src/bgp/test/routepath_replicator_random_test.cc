@@ -778,6 +778,139 @@ TEST_P(ReplicationTest, RandomTest) {
     task_util::WaitForIdle();
 }
 
+//
+// Replication throughput with primary routes in bgp.l3vpn.0 that are spread
+// over the route targets of a set of VRFs, and the cost of an import target
+// change once the routes are in place. VRF_COUNT and ROUTE_COUNT override
+// the defaults.
+//
+class ReplicationBenchmark : public ReplicationTest {
+protected:
+    virtual void SetUp() {
+        IFMapServerParser *parser = IFMapServerParser::GetInstance("schema");
+        vnc_cfg_ParserInit(parser);
+        bgp_schema_ParserInit(parser);
+        bgp_server_->config_manager()->Initialize(&config_db_, &config_graph_,
+                                                  "localhost");
+    }
+
+    void AddVPNRoute(IPeer *peer, const string &prefix,
+                     const string &target) {
+        boost::system::error_code error;
+        InetVpnPrefix nlri = InetVpnPrefix::FromString(prefix, &error);
+        EXPECT_FALSE(error);
+        DBRequest request;
+        request.oper = DBRequest::DB_ENTRY_ADD_CHANGE;
+        request.key.reset(new InetVpnTable::RequestKey(nlri, peer));
+
+        BgpAttrSpec attr_spec;
+        BgpAttrLocalPref local_pref(100);
+        attr_spec.push_back(&local_pref);
+        ExtCommunitySpec commspec;
+        RouteTarget tgt = RouteTarget::FromString(target);
+        const ExtCommunity::ExtCommunityValue &extcomm =
+            tgt.GetExtCommunity();
+        commspec.communities.push_back(
+            get_value(extcomm.data(), extcomm.size()));
+        attr_spec.push_back(&commspec);
+        BgpAttrPtr attr = bgp_server_->attr_db()->Locate(attr_spec);
+        request.data.reset(new BgpTable::RequestData(attr, 0, 0));
+        VPNTable()->Enqueue(&request);
+    }
+
+    void DeleteVPNRoute(IPeer *peer, const string &prefix) {
+        boost::system::error_code error;
+        InetVpnPrefix nlri = InetVpnPrefix::FromString(prefix, &error);
+        EXPECT_FALSE(error);
+        DBRequest request;
+        request.oper = DBRequest::DB_ENTRY_DELETE;
+        request.key.reset(new InetVpnTable::RequestKey(nlri, peer));
+        VPNTable()->Enqueue(&request);
+    }
+
+    BgpTable *VPNTable() {
+        return static_cast<BgpTable *>(
+            bgp_server_->database()->FindTable("bgp.l3vpn.0"));
+    }
+
+    static string Target(int index) {
+        stringstream target;
+        target << "target:64496:" << (index + 1);
+        return target.str();
+    }
+
+    static string Prefix(int index) {
+        stringstream prefix;
+        prefix << "10.0.0.1:" << (index % 0xFFFF) << ":172." <<
+            ((index >> 16) & 0xFF) << "." << ((index >> 8) & 0xFF) << "." <<
+            (index & 0xFF) << "/32";
+        return prefix.str();
+    }
+};
+
+TEST_F(ReplicationBenchmark, ImportTargetChange) {
+    int vrf_count = GetEnvInt("VRF_COUNT", 64);
+    int route_count = GetEnvInt("ROUTE_COUNT", 16384);
+
+    boost::system::error_code ec;
+    peers_.push_back(new BgpPeerMock(Ip4Address::from_string("192.168.0.1",
+                                                             ec)));
+    for (int i = 0; i < vrf_count; i++) {
+        stringstream oss;
+        oss << "vrf_" << i;
+        vrfs_.push_back(oss.str());
+    }
+    NetworkConfig(vrfs_, connections_);
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_TRUE(VPNTable() != NULL);
+
+    // Each route carries the target of one VRF and is replicated into it.
+    uint64_t start = UTCTimestampUsec();
+    for (int i = 0; i < route_count; i++) {
+        AddVPNRoute(peers_[0], Prefix(i), Target(i % vrf_count));
+    }
+    task_util::WaitForIdle();
+    uint64_t add_usec = UTCTimestampUsec() - start;
+    TASK_UTIL_EXPECT_EQ(route_count, VPNTable()->Size());
+
+    RoutePathReplicator *replicator =
+        bgp_server_->replicator(Address::INETVPN);
+    size_t indexed = replicator->GetIndexedRouteCount(VPNTable(), Target(0)) +
+        replicator->GetIndexedRouteCount(VPNTable(), Target(1));
+    EXPECT_EQ((route_count + vrf_count - 1) / vrf_count +
+              (route_count + vrf_count - 2) / vrf_count, indexed);
+
+    // vrf_0 and vrf_1 start importing each other's target. Only the routes
+    // of bgp.l3vpn.0 with one of the two targets are visited.
+    uint64_t sync_count = replicator->sync_route_count();
+    start = UTCTimestampUsec();
+    AddConnection(vrfs_[0], vrfs_[1]);
+    uint64_t sync_usec = UTCTimestampUsec() - start;
+    EXPECT_EQ(indexed, replicator->sync_route_count() - sync_count);
+    for (int i = 1; i < route_count; i += vrf_count) {
+        ostringstream prefix;
+        prefix << "172." << ((i >> 16) & 0xFF) << "." << ((i >> 8) & 0xFF) <<
+            "." << (i & 0xFF) << "/32";
+        TASK_UTIL_EXPECT_TRUE(InetRouteLookup(vrfs_[0], prefix.str()) != NULL);
+    }
+
+    LOG(DEBUG, "Replicated " << route_count << " routes into " <<
+        vrf_count << " VRFs in " << add_usec << " usec, " <<
+        route_count * 1000000ULL / max(add_usec, (uint64_t) 1) <<
+        " routes/sec");
+    LOG(DEBUG, "Import target change resynced " << indexed <<
+        " routes in " << sync_usec << " usec");
+
+    RemoveConnection(vrfs_[0], vrfs_[1]);
+    connections_.clear();
+    for (int i = 0; i < route_count; i++) {
+        DeleteVPNRoute(peers_[0], Prefix(i));
+    }
+    task_util::WaitForIdle();
+    TASK_UTIL_EXPECT_EQ(0, VPNTable()->Size());
+    EXPECT_EQ(0, replicator->GetIndexedRouteCount(VPNTable(), Target(1)));
+}
+
 class TestEnvironment : public ::testing::Environment {
     virtual ~TestEnvironment() { }
 };
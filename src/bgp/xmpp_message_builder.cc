@@ -4,8 +4,9 @@
 
 #include "bgp/xmpp_message_builder.h"
 
+#include <cstdio>
+
 #include <boost/foreach.hpp>
-#include <pugixml/pugixml.hpp>
 
 #include "base/parse_object.h"
 #include "base/logging.h"
@@ -18,321 +19,471 @@
 #include "bgp/origin-vn/origin_vn.h"
 #include "bgp/security_group/security_group.h"
 #include "net/bgp_af.h"
-#include "schema/xmpp_unicast_types.h"
-#include "schema/xmpp_multicast_types.h"
-#include "schema/xmpp_enet_types.h"
 #include "xmpp/xmpp_init.h"
 
-using namespace pugi;
 using namespace std;
 
-class BgpXmppMessage : public Message {
+namespace {
+
+//
+// Streaming xml writer that appends to a string. Only the constructs used
+// in route updates are supported.
+//
+class XmlWriter {
 public:
-    BgpXmppMessage(const BgpTable *table, const RibOutAttr *roattr)
-        : table_(table),
-          is_reachable_(roattr->IsReachable()),
-          virtual_network_("unresolved") {
+    explicit XmlWriter(string *repr) : repr_(repr) { }
+
+    // Writes "<name"; must be followed by EndStartTag or EndEmptyElement.
+    void StartElement(const char *name) {
+        repr_->push_back('<');
+        repr_->append(name);
+    }
+    void Attribute(const char *name, const string &value) {
+        repr_->push_back(' ');
+        repr_->append(name);
+        repr_->append("=\"");
+        Escape(value);
+        repr_->push_back('"');
+    }
+    void EndStartTag() { repr_->push_back('>'); }
+    void EndEmptyElement() { repr_->append("/>"); }
+
+    void OpenElement(const char *name) {
+        StartElement(name);
+        EndStartTag();
+    }
+    void CloseElement(const char *name) {
+        repr_->append("</");
+        repr_->append(name);
+        repr_->push_back('>');
+    }
+
+    void Element(const char *name, const string &value) {
+        OpenElement(name);
+        Escape(value);
+        CloseElement(name);
+    }
+    void Element(const char *name, uint64_t value) {
+        char buf[24];
+        int len = snprintf(buf, sizeof(buf), "%llu",
+                           static_cast<unsigned long long>(value));
+        OpenElement(name);
+        repr_->append(buf, len);
+        CloseElement(name);
     }
-    virtual ~BgpXmppMessage() { }
-    void Start(const RibOutAttr *roattr, const BgpRoute *route);
-    virtual bool AddRoute(const BgpRoute *route, const RibOutAttr *roattr);
-    virtual void Finish() { }
-    virtual const uint8_t *GetData(IPeerUpdate *peer, size_t *lenp);
 
 private:
-    void EncodeNextHop(const BgpRoute *route, RibOutAttr::NextHop nexthop,
-                       autogen::ItemType &item);
-    void AddInetReach(const BgpRoute *route, const RibOutAttr *roattr);
-    void AddInetUnreach(const BgpRoute *route);
-    bool AddInetRoute(const BgpRoute *route, const RibOutAttr *roattr);
-
-    void EncodeEnetNextHop(const BgpRoute *route, RibOutAttr::NextHop nexthop,
-                           autogen::EnetItemType &item);
-    void AddEnetReach(const BgpRoute *route, const RibOutAttr *roattr);
-    void AddEnetUnreach(const BgpRoute *route);
-    bool AddEnetRoute(const BgpRoute *route, const RibOutAttr *roattr);
-
-    void AddMcastReach(const BgpRoute *route, const RibOutAttr *roattr);
-    void AddMcastUnreach(const BgpRoute *route);
-    bool AddMcastRoute(const BgpRoute *route, const RibOutAttr *roattr);
-
-    void ProcessExtCommunity(const ExtCommunity *ext_community) {
-        if (ext_community == NULL)
-            return;
-
-        for (ExtCommunity::ExtCommunityList::const_iterator iter =
-             ext_community->communities().begin();
-             iter != ext_community->communities().end(); ++iter) {
-            if (ExtCommunity::is_security_group(*iter)) {
-                SecurityGroup security_group(*iter);
-                security_group_list_.push_back(security_group.security_group_id());
-            }
-            if (ExtCommunity::is_origin_vn(*iter)) {
-                OriginVn origin_vn(*iter);
-                const RoutingInstanceMgr *manager =
-                    table_->routing_instance()->manager();
-                virtual_network_ =
-                    manager->GetVirtualNetworkByVnIndex(origin_vn.vn_index());
+    void Escape(const string &value) {
+        for (string::const_iterator it = value.begin(); it != value.end();
+             ++it) {
+            switch (*it) {
+            case '&':
+                repr_->append("&amp;");
+                break;
+            case '<':
+                repr_->append("&lt;");
+                break;
+            case '>':
+                repr_->append("&gt;");
+                break;
+            case '"':
+                repr_->append("&quot;");
+                break;
+            default:
+                repr_->push_back(*it);
+                break;
             }
         }
     }
 
-    const BgpTable *table_;
-    bool is_reachable_;
-    xml_document xdoc_;
-    xml_node xitems_;
-    std::string virtual_network_;
-    std::vector<int> security_group_list_;
-    string repr_;
-    string repr_new_;
-    size_t repr_part1_;
-    size_t repr_part2_;
-    DISALLOW_COPY_AND_ASSIGN(BgpXmppMessage);
+    string *repr_;
 };
 
-void BgpXmppMessage::Start(const RibOutAttr *roattr, const BgpRoute *route) {
-    // Build the DOM tree
-    xml_node message = xdoc_.append_child("message");
-    message.append_attribute("from") = XmppInit::kControlNodeJID;
+}  // namespace
 
-    xml_node event = message.append_child("event");
-    event.append_attribute("xmlns") = "http://jabber.org/protocol/pubsub";
-    xitems_ = event.append_child("items");
+BgpXmppItemCache::BgpXmppItemCache(size_t max_partition_size)
+    : max_partition_size_(max_partition_size) {
+    hits_ = 0;
+    misses_ = 0;
+}
 
-    if (is_reachable_) {
-        const BgpAttr *attr = roattr->attr();
-        ProcessExtCommunity(attr->ext_community());
-    }
-    
-    stringstream ss;
-    ss << route->Afi() << "/" << int(route->Safi()) << "/" <<
-          table_->routing_instance()->name();
-    std::string node(ss.str());
-    if (table_->family() == Address::INETMCAST) {
-        xitems_.append_attribute("node") = node.c_str();
-        AddMcastRoute(route, roattr);
-    } else if (table_->family() == Address::ENET) {
-        xitems_.append_attribute("node") = node.c_str();
-        AddEnetRoute(route, roattr);
-    } else {
-        xitems_.append_attribute("node") = node.c_str();
-        AddInetRoute(route, roattr);
+bool BgpXmppItemCache::Entry::Match(const Key &key) const {
+    return (afi == key.route->Afi() &&
+            safi == key.route->Safi() &&
+            id == key.id &&
+            virtual_network == key.virtual_network &&
+            security_group_list == key.security_group_list &&
+            nexthop_list == key.roattr->nexthop_list());
+}
+
+BgpXmppItemCache::EntryKey BgpXmppItemCache::GetEntryKey(
+        const BgpRoute *route) {
+    return make_pair(route, route->generation());
+}
+
+BgpXmppItemCache::Partition *BgpXmppItemCache::GetPartition(
+        const BgpRoute *route) {
+    return &partitions_[route->generation() % kPartitionCount];
+}
+
+bool BgpXmppItemCache::Append(const Key &key, string *repr) {
+    Partition *partition = GetPartition(key.route);
+    tbb::mutex::scoped_lock lock(partition->mutex);
+    EntryMap::const_iterator loc =
+        partition->entries.find(GetEntryKey(key.route));
+    if (loc == partition->entries.end() || !loc->second.Match(key)) {
+        misses_++;
+        return false;
     }
+    partition->lru.splice(partition->lru.begin(), partition->lru,
+                          loc->second.lru);
+    repr->append(loc->second.repr);
+    hits_++;
+    return true;
 }
 
-bool BgpXmppMessage::AddRoute(const BgpRoute *route, const RibOutAttr *roattr) {
-    if (table_->family() == Address::INETMCAST) {
-        return AddMcastRoute(route, roattr);
-    } else if (table_->family() == Address::ENET) {
-        return AddEnetRoute(route, roattr);
+void BgpXmppItemCache::Insert(const Key &key, const char *data, size_t size) {
+    Partition *partition = GetPartition(key.route);
+    tbb::mutex::scoped_lock lock(partition->mutex);
+    EntryKey entry_key = GetEntryKey(key.route);
+    EntryMap::iterator loc = partition->entries.find(entry_key);
+    if (loc == partition->entries.end()) {
+        if (partition->entries.size() >= max_partition_size_) {
+            partition->entries.erase(partition->lru.back());
+            partition->lru.pop_back();
+        }
+        loc = partition->entries.insert(make_pair(entry_key, Entry())).first;
+        partition->lru.push_front(entry_key);
+        loc->second.lru = partition->lru.begin();
     } else {
-        return AddInetRoute(route, roattr);
+        partition->lru.splice(partition->lru.begin(), partition->lru,
+                              loc->second.lru);
     }
-}
 
-void BgpXmppMessage::EncodeNextHop(const BgpRoute *route,
-                                   RibOutAttr::NextHop nexthop,
-                                   autogen::ItemType &item) {
-    autogen::NextHopType item_nexthop;
+    Entry &entry = loc->second;
+    entry.afi = key.route->Afi();
+    entry.safi = key.route->Safi();
+    entry.id = key.id;
+    entry.nexthop_list = key.roattr->nexthop_list();
+    entry.virtual_network = key.virtual_network;
+    entry.security_group_list = key.security_group_list;
+    entry.repr.assign(data, size);
+}
 
-    item_nexthop.af = route->Afi();
-    item_nexthop.address = nexthop.address().to_v4().to_string();
-    item_nexthop.label = nexthop.label();
-    if (nexthop.encap().empty()) {
-        // If encap list is empty, routes from non-control-node, 
-        // use mpls over gre as default encap
-        item_nexthop.tunnel_encapsulation_list.tunnel_encapsulation.push_back(std::string("gre"));
-    } else {
-        item_nexthop.tunnel_encapsulation_list.tunnel_encapsulation= nexthop.encap();
+void BgpXmppItemCache::Clear() {
+    for (int idx = 0; idx < kPartitionCount; idx++) {
+        tbb::mutex::scoped_lock lock(partitions_[idx].mutex);
+        partitions_[idx].entries.clear();
+        partitions_[idx].lru.clear();
     }
+}
 
-    item.entry.next_hops.next_hop.push_back(item_nexthop);
+size_t BgpXmppItemCache::size() const {
+    size_t size = 0;
+    for (int idx = 0; idx < kPartitionCount; idx++) {
+        tbb::mutex::scoped_lock lock(partitions_[idx].mutex);
+        size += partitions_[idx].entries.size();
+    }
+    return size;
 }
 
-void BgpXmppMessage::AddInetReach(const BgpRoute *route, const RibOutAttr *roattr) {
-    autogen::ItemType item;
+BgpXmppMessage::BgpXmppMessage(const BgpTable *table,
+                               const RibOutAttr *roattr,
+                               BgpXmppItemCache *cache)
+    : table_(table),
+      cache_(cache),
+      is_reachable_(roattr->IsReachable()),
+      finished_(false),
+      virtual_network_("unresolved") {
+}
 
-    item.entry.nlri.af = route->Afi();
-    item.entry.nlri.safi = route->Safi();
-    item.entry.nlri.address = route->ToString();
-    item.entry.version = 1;
-    item.entry.virtual_network = virtual_network_;
+BgpXmppMessage::~BgpXmppMessage() {
+}
 
-    assert(!roattr->nexthop_list().empty());
+void BgpXmppMessage::ProcessExtCommunity(const ExtCommunity *ext_community) {
+    if (ext_community == NULL)
+        return;
 
-    //
-    // Encode all next-hops in the list
-    //
-    BOOST_FOREACH(RibOutAttr::NextHop nexthop, roattr->nexthop_list()) {
-        EncodeNextHop(route, nexthop, item);
+    for (ExtCommunity::ExtCommunityList::const_iterator iter =
+         ext_community->communities().begin();
+         iter != ext_community->communities().end(); ++iter) {
+        if (ExtCommunity::is_security_group(*iter)) {
+            SecurityGroup security_group(*iter);
+            security_group_list_.push_back(security_group.security_group_id());
+        }
+        if (ExtCommunity::is_origin_vn(*iter)) {
+            OriginVn origin_vn(*iter);
+            const RoutingInstanceMgr *manager =
+                table_->routing_instance()->manager();
+            virtual_network_ =
+                manager->GetVirtualNetworkByVnIndex(origin_vn.vn_index());
+        }
     }
+}
 
-    for (std::vector<int>::iterator it = security_group_list_.begin(); 
-         it !=  security_group_list_.end(); it++) {
-        item.entry.security_group_list.security_group.push_back(*it);
+//
+// The body of the message is written after kHeaderReserve bytes, which are
+// filled in with the message header for each peer in GetData.
+//
+void BgpXmppMessage::Start(const RibOutAttr *roattr, const BgpRoute *route) {
+    if (is_reachable_) {
+        const BgpAttr *attr = roattr->attr();
+        ProcessExtCommunity(attr->ext_community());
     }
 
-    xml_node node = xitems_.append_child("item");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
-    item.Encode(&node);
-}
+    repr_.reserve(kHeaderReserve + 4096);
+    repr_.assign(kHeaderReserve, ' ');
 
-void BgpXmppMessage::AddInetUnreach(const BgpRoute *route) {
-    xml_node node = xitems_.append_child("retract");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
+    stringstream ss;
+    ss << route->Afi() << "/" << int(route->Safi()) << "/" <<
+          table_->routing_instance()->name();
+
+    XmlWriter writer(&repr_);
+    writer.StartElement("event");
+    writer.Attribute("xmlns", "http://jabber.org/protocol/pubsub");
+    writer.EndStartTag();
+    writer.StartElement("items");
+    writer.Attribute("node", ss.str());
+    writer.EndStartTag();
+
+    AddRoute(route, roattr);
 }
 
-bool BgpXmppMessage::AddInetRoute(const BgpRoute *route, const RibOutAttr *roattr) {
+bool BgpXmppMessage::AddRoute(const BgpRoute *route, const RibOutAttr *roattr) {
+    assert(!finished_);
     if (is_reachable_) {
         num_reach_route_++;
-        AddInetReach(route, roattr);
+        AddItem(route, roattr);
     } else {
         num_unreach_route_++;
-        AddInetUnreach(route);
+        AddRetract(route);
     }
     return true;
 }
 
-void BgpXmppMessage::EncodeEnetNextHop(const BgpRoute *route,
-                                       RibOutAttr::NextHop nexthop,
-                                       autogen::EnetItemType &item) {
-    autogen::EnetNextHopType item_nexthop;
+void BgpXmppMessage::Finish() {
+    if (finished_)
+        return;
+    XmlWriter writer(&repr_);
+    writer.CloseElement("items");
+    writer.CloseElement("event");
+    writer.CloseElement("message");
+    finished_ = true;
+}
 
-    item_nexthop.af = BgpAf::IPv4;
-    item_nexthop.address = nexthop.address().to_v4().to_string();
-    item_nexthop.label = nexthop.label();
+void BgpXmppMessage::EncodeNextHop(const char *tag, uint16_t afi,
+                                   const RibOutAttr::NextHop &nexthop) {
+    XmlWriter writer(&repr_);
+    writer.OpenElement(tag);
+    writer.Element("af", afi);
+    writer.Element("address", nexthop.address().to_v4().to_string());
+    writer.Element("label", nexthop.label());
+    writer.OpenElement("tunnel-encapsulation-list");
     if (nexthop.encap().empty()) {
-        // If encap list is empty, routes from non-control-node, 
+        // If encap list is empty, routes from non-control-node,
         // use mpls over gre as default encap
-        item_nexthop.tunnel_encapsulation_list.tunnel_encapsulation.push_back(std::string("gre"));
+        writer.Element("tunnel-encapsulation", string("gre"));
     } else {
-        item_nexthop.tunnel_encapsulation_list.tunnel_encapsulation= nexthop.encap();
+        BOOST_FOREACH(const string &encap, nexthop.encap()) {
+            writer.Element("tunnel-encapsulation", encap);
+        }
     }
-    item.entry.next_hops.next_hop.push_back(item_nexthop);
+    writer.CloseElement("tunnel-encapsulation-list");
+    writer.CloseElement(tag);
 }
 
-void BgpXmppMessage::AddEnetReach(const BgpRoute *route, const RibOutAttr *roattr) {
+void BgpXmppMessage::EncodeInetEntry(const BgpRoute *route,
+                                     const RibOutAttr *roattr) {
+    XmlWriter writer(&repr_);
+    writer.OpenElement("entry");
+    writer.OpenElement("nlri");
+    writer.Element("af", route->Afi());
+    writer.Element("safi", route->Safi());
+    writer.Element("address", route->ToString());
+    writer.CloseElement("nlri");
 
-    autogen::EnetItemType item;
-    item.entry.nlri.af = route->Afi();
-    item.entry.nlri.safi = route->Safi();
+    //
+    // Encode all next-hops in the list
+    //
+    writer.OpenElement("next-hops");
+    BOOST_FOREACH(const RibOutAttr::NextHop &nexthop, roattr->nexthop_list()) {
+        EncodeNextHop("next-hop", route->Afi(), nexthop);
+    }
+    writer.CloseElement("next-hops");
 
-    EnetRoute *enet_route =
-        static_cast<EnetRoute *>(const_cast<BgpRoute *>(route));
-    item.entry.nlri.mac = enet_route->GetPrefix().mac_addr().ToString();
-    item.entry.nlri.address =  enet_route->GetPrefix().ip_prefix().ToString();
-    item.entry.virtual_network = virtual_network_;
+    writer.Element("version", 1);
+    writer.Element("virtual-network", virtual_network_);
 
-    assert(!roattr->nexthop_list().empty());
-    BOOST_FOREACH(RibOutAttr::NextHop nexthop, roattr->nexthop_list()) {
-        EncodeEnetNextHop(route, nexthop, item);
+    writer.OpenElement("security-group-list");
+    BOOST_FOREACH(int security_group, security_group_list_) {
+        writer.Element("security-group", security_group);
     }
-
-    xml_node node = xitems_.append_child("item");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
-    item.Encode(&node);
+    writer.CloseElement("security-group-list");
+    writer.CloseElement("entry");
 }
 
-void BgpXmppMessage::AddEnetUnreach(const BgpRoute *route) {
-    xml_node node = xitems_.append_child("retract");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
+void BgpXmppMessage::EncodeEnetEntry(const BgpRoute *route,
+                                     const RibOutAttr *roattr) {
+    const EnetRoute *enet_route = static_cast<const EnetRoute *>(route);
+
+    XmlWriter writer(&repr_);
+    writer.OpenElement("entry");
+    writer.OpenElement("nlri");
+    writer.Element("af", route->Afi());
+    writer.Element("safi", route->Safi());
+    writer.Element("mac", enet_route->GetPrefix().mac_addr().ToString());
+    writer.Element("address", enet_route->GetPrefix().ip_prefix().ToString());
+    writer.CloseElement("nlri");
+
+    writer.OpenElement("next-hops");
+    BOOST_FOREACH(const RibOutAttr::NextHop &nexthop, roattr->nexthop_list()) {
+        EncodeNextHop("next-hop", BgpAf::IPv4, nexthop);
+    }
+    writer.CloseElement("next-hops");
+
+    writer.Element("virtual-network", virtual_network_);
+    writer.CloseElement("entry");
 }
 
-bool BgpXmppMessage::AddEnetRoute(const BgpRoute *route, const RibOutAttr *roattr) {
-    if (is_reachable_) {
-        num_reach_route_++;
-        AddEnetReach(route, roattr);
-    } else {
-        num_unreach_route_++;
-        AddEnetUnreach(route);
+void BgpXmppMessage::EncodeMcastEntry(const BgpRoute *route,
+                                      const RibOutAttr *roattr) {
+    const InetMcastRoute *mcast_route =
+        static_cast<const InetMcastRoute *>(route);
+
+    XmlWriter writer(&repr_);
+    writer.OpenElement("entry");
+    writer.OpenElement("nlri");
+    writer.Element("af", route->Afi());
+    writer.Element("safi", route->Safi());
+    writer.Element("group", mcast_route->GetPrefix().group().to_string());
+    writer.Element("source", mcast_route->GetPrefix().source().to_string());
+    writer.Element("source-label", roattr->label());
+    writer.CloseElement("nlri");
+
+    writer.OpenElement("next-hops");
+    writer.CloseElement("next-hops");
+
+    writer.OpenElement("olist");
+    BgpOList *olist = roattr->attr()->olist().get();
+    BOOST_FOREACH(const BgpOListElem &elem, olist->elements) {
+        writer.OpenElement("next-hop");
+        writer.Element("af", BgpAf::IPv4);
+        writer.Element("address", elem.address.to_string());
+        writer.Element("label", integerToString(elem.label));
+        writer.OpenElement("tunnel-encapsulation-list");
+        BOOST_FOREACH(const string &encap, elem.encap) {
+            writer.Element("tunnel-encapsulation", encap);
+        }
+        writer.CloseElement("tunnel-encapsulation-list");
+        writer.CloseElement("next-hop");
     }
-    return true;
+    writer.CloseElement("olist");
+    writer.CloseElement("entry");
 }
 
-void BgpXmppMessage::AddMcastReach(const BgpRoute *route, const RibOutAttr *roattr) {
-
-    autogen::McastItemType item;
-    item.entry.nlri.af = route->Afi();
-    item.entry.nlri.safi = route->Safi();
+//
+// Multicast items depend on the olist rather than the nexthop list, so they
+// are always encoded and are not cached.
+//
+void BgpXmppMessage::AddItem(const BgpRoute *route, const RibOutAttr *roattr) {
+    string id(route->ToXmppIdString());
+    if (table_->family() == Address::INETMCAST) {
+        XmlWriter writer(&repr_);
+        writer.StartElement("item");
+        writer.Attribute("id", id);
+        writer.EndStartTag();
+        EncodeMcastEntry(route, roattr);
+        writer.CloseElement("item");
+        return;
+    }
 
-    InetMcastRoute *mcast_route =
-        static_cast<InetMcastRoute *>(const_cast<BgpRoute *>(route));
-    item.entry.nlri.group = mcast_route->GetPrefix().group().to_string();
-    item.entry.nlri.source =  mcast_route->GetPrefix().source().to_string();
-    item.entry.nlri.source_label = roattr->label();
+    assert(!roattr->nexthop_list().empty());
 
-    BgpOList *olist = roattr->attr()->olist().get();
-    std::vector<BgpOListElem>::const_iterator iterator;
-    for (iterator = olist->elements.begin();
-         iterator != olist->elements.end(); ++iterator) {
-        BgpOListElem elem = static_cast<BgpOListElem>(*iterator);
-
-        autogen::McastNextHopType nh;
-        nh.af = BgpAf::IPv4;
-        nh.address = elem.address.to_string();
-        stringstream label;
-        label << elem.label;
-        nh.label = label.str();
-        nh.tunnel_encapsulation_list.tunnel_encapsulation = elem.encap;
-        item.entry.olist.next_hop.push_back(nh);
+    BgpXmppItemCache::Key key(route, id, roattr, virtual_network_,
+                              security_group_list_);
+    if (cache_ && cache_->Append(key, &repr_))
+        return;
+
+    size_t start = repr_.size();
+    XmlWriter writer(&repr_);
+    writer.StartElement("item");
+    writer.Attribute("id", id);
+    writer.EndStartTag();
+    if (table_->family() == Address::ENET) {
+        EncodeEnetEntry(route, roattr);
+    } else {
+        EncodeInetEntry(route, roattr);
     }
+    writer.CloseElement("item");
 
-    xml_node node = xitems_.append_child("item");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
-    item.Encode(&node);
+    if (cache_)
+        cache_->Insert(key, repr_.data() + start, repr_.size() - start);
 }
 
-void BgpXmppMessage::AddMcastUnreach(const BgpRoute *route) {
-    xml_node node = xitems_.append_child("retract");
-    node.append_attribute("id") = route->ToXmppIdString().c_str();
+void BgpXmppMessage::AddRetract(const BgpRoute *route) {
+    XmlWriter writer(&repr_);
+    writer.StartElement("retract");
+    writer.Attribute("id", route->ToXmppIdString());
+    writer.EndEmptyElement();
 }
 
-bool BgpXmppMessage::AddMcastRoute(const BgpRoute *route, const RibOutAttr *roattr) {
-    if (is_reachable_) {
-        num_reach_route_++;
-        AddMcastReach(route, roattr);
-    } else {
-        num_unreach_route_++;
-        AddMcastUnreach(route);
-    }
-    return true;
+void BgpXmppMessage::GetHeader(IPeerUpdate *peer, string *header) {
+    header->assign("<?xml version=\"1.0\"?>\n");
+    XmlWriter writer(header);
+    writer.StartElement("message");
+    writer.Attribute("from", XmppInit::kControlNodeJID);
+    writer.Attribute("to", peer->ToString() + "/" + XmppInit::kBgpPeer);
+    writer.EndStartTag();
 }
 
+//
+// Write the header for the peer into the space reserved in front of the
+// body. The body is shared by all the peers that the message is sent to.
+//
 const uint8_t *BgpXmppMessage::GetData(IPeerUpdate *peer, size_t *lenp) {
-    std::string str = peer->ToString() + "/" + XmppInit::kBgpPeer;
+    Finish();
 
-    // If the message has already been constructed, just replace the 'to' part.
-    if (!repr_.empty()) {
-        repr_new_ = string(repr_, 0, repr_part1_) + "to=\"" + str + "\">" +
-                    string(repr_, repr_part2_);
+    string header;
+    GetHeader(peer, &header);
 
+    if (body_) {
+        repr_new_ = header;
+        repr_new_.append(reinterpret_cast<const char *>(body_->data()),
+                         body_->size());
         *lenp = repr_new_.size();
-        return reinterpret_cast<const uint8_t *>(repr_new_.c_str());
+        return reinterpret_cast<const uint8_t *>(repr_new_.data());
     }
 
-    xml_node message =  xdoc_.child("message");
-    xml_attribute attr_to = message.attribute("to");
-    if (!attr_to) {
-        attr_to = message.append_attribute("to");
+    if (header.size() > kHeaderReserve) {
+        repr_new_ = header;
+        repr_new_.append(repr_, kHeaderReserve, string::npos);
+        *lenp = repr_new_.size();
+        return reinterpret_cast<const uint8_t *>(repr_new_.data());
+    }
+
+    size_t offset = kHeaderReserve - header.size();
+    repr_.replace(offset, header.size(), header);
+    *lenp = repr_.size() - offset;
+    return reinterpret_cast<const uint8_t *>(repr_.data() + offset);
+}
+
+//
+// The body is moved out of the message into the shared buffer the first
+// time it's asked for. GetData still works afterwards, but copies the body
+// for each peer.
+//
+IoSharedBufferPtr BgpXmppMessage::GetSharedBody() {
+    Finish();
+    if (!body_) {
+        body_ = new IoSharedBuffer(&repr_, kHeaderReserve);
     }
-    attr_to.set_value(str.c_str());
-    ostringstream oss;
-    xdoc_.save(oss);
-    repr_ = oss.str();
-
-    repr_part1_ = repr_.find("to=", 0);
-    assert(repr_part1_ != string::npos);
-    repr_part2_ = repr_.find("\n\t<event xmlns");
-    assert(repr_part2_ != string::npos);
-
-    *lenp = repr_.size();
-    return reinterpret_cast<const uint8_t *>(repr_.c_str());
+    return body_;
 }
 
 Message *BgpXmppMessageBuilder::Create(const BgpTable *table,
                                        const RibOutAttr *roattr,
                                        const BgpRoute *route) const {
-    BgpXmppMessage *msg = new BgpXmppMessage(table, roattr);
+    BgpXmppMessage *msg = new BgpXmppMessage(table, roattr, &item_cache_);
     msg->Start(roattr, route);
     return msg;
 }
@@ -5,8 +5,155 @@
 #ifndef ctrlplane_xmpp_message_builder_h
 #define ctrlplane_xmpp_message_builder_h
 
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <tbb/atomic.h>
+#include <tbb/mutex.h>
+
 #include "bgp/message_builder.h"
 
+class ExtCommunity;
+
+//
+// Cache of xml encoded <item> elements for reachable inet and enet routes.
+//
+// The same route and attributes are typically encoded many times over,
+// once for each set of peers that are at a different position in the
+// update queue, and once for each RibOut that advertises the route. The
+// cache allows all but the first of these encodings to simply copy the
+// bytes.
+//
+// An entry is indexed by the route and its generation number, so that a
+// route allocated at the address of a freed one never finds the entry of
+// the freed route. The entry keeps all the inputs that go into the encoding
+// of the item and a hit requires all of them to match. An entry whose
+// attributes have changed is overwritten by the next encoding of the route.
+// Entries of deleted routes are never hit again and age out.
+//
+// The cache is partitioned by route to reduce contention between the send
+// tasks for different scheduling groups. Each partition holds a bounded
+// number of entries and evicts the least recently used one when full.
+//
+class BgpXmppItemCache {
+public:
+    static const int kPartitionCount = 32;
+    static const size_t kMaxPartitionSize = 4096;
+
+    struct Key {
+        Key(const BgpRoute *route, const std::string &id,
+            const RibOutAttr *roattr, const std::string &virtual_network,
+            const std::vector<int> &security_group_list)
+            : route(route), id(id), roattr(roattr),
+              virtual_network(virtual_network),
+              security_group_list(security_group_list) {
+        }
+        const BgpRoute *route;
+        const std::string &id;
+        const RibOutAttr *roattr;
+        const std::string &virtual_network;
+        const std::vector<int> &security_group_list;
+    };
+
+    explicit BgpXmppItemCache(size_t max_partition_size = kMaxPartitionSize);
+
+    // Append the cached encoding for the key to repr. Returns false if
+    // there is no valid entry.
+    bool Append(const Key &key, std::string *repr);
+    void Insert(const Key &key, const char *data, size_t size);
+    void Clear();
+
+    size_t size() const;
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    typedef std::pair<const BgpRoute *, uint64_t> EntryKey;
+    typedef std::list<EntryKey> LruList;
+
+    struct Entry {
+        bool Match(const Key &key) const;
+
+        LruList::iterator lru;
+
+        uint16_t afi;
+        uint8_t safi;
+        std::string id;
+        RibOutAttr::NextHopList nexthop_list;
+        std::string virtual_network;
+        std::vector<int> security_group_list;
+        std::string repr;
+    };
+
+    typedef std::map<EntryKey, Entry> EntryMap;
+
+    // The lru list has the keys of the entries, most recently used first.
+    struct Partition {
+        mutable tbb::mutex mutex;
+        EntryMap entries;
+        LruList lru;
+    };
+
+    static EntryKey GetEntryKey(const BgpRoute *route);
+    Partition *GetPartition(const BgpRoute *route);
+
+    Partition partitions_[kPartitionCount];
+    size_t max_partition_size_;
+    tbb::atomic<uint64_t> hits_;
+    tbb::atomic<uint64_t> misses_;
+
+    DISALLOW_COPY_AND_ASSIGN(BgpXmppItemCache);
+};
+
+//
+// Xmpp update message for routes with the same attributes.
+//
+// The message is written directly as xml text, rather than built as a DOM
+// and serialized. The buffer has room for the per-peer message header in
+// front of the body so that GetData only writes the header for each peer
+// and the body is shared by all peers.
+//
+// The body can also be handed out as a shared buffer, which the sessions of
+// the peers queue by reference when they can't write it right away.
+//
+class BgpXmppMessage : public Message {
+public:
+    static const size_t kHeaderReserve = 256;
+
+    BgpXmppMessage(const BgpTable *table, const RibOutAttr *roattr,
+                   BgpXmppItemCache *cache = NULL);
+    virtual ~BgpXmppMessage();
+    void Start(const RibOutAttr *roattr, const BgpRoute *route);
+    virtual bool AddRoute(const BgpRoute *route, const RibOutAttr *roattr);
+    virtual void Finish();
+    virtual const uint8_t *GetData(IPeerUpdate *peer, size_t *lenp);
+    virtual IoSharedBufferPtr GetSharedBody();
+    virtual void GetHeader(IPeerUpdate *peer, std::string *header);
+
+private:
+    void AddItem(const BgpRoute *route, const RibOutAttr *roattr);
+    void AddRetract(const BgpRoute *route);
+    void EncodeInetEntry(const BgpRoute *route, const RibOutAttr *roattr);
+    void EncodeEnetEntry(const BgpRoute *route, const RibOutAttr *roattr);
+    void EncodeMcastEntry(const BgpRoute *route, const RibOutAttr *roattr);
+    void EncodeNextHop(const char *tag, uint16_t afi,
+                       const RibOutAttr::NextHop &nexthop);
+    void ProcessExtCommunity(const ExtCommunity *ext_community);
+
+    const BgpTable *table_;
+    BgpXmppItemCache *cache_;
+    bool is_reachable_;
+    bool finished_;
+    std::string virtual_network_;
+    std::vector<int> security_group_list_;
+    std::string repr_;
+    std::string repr_new_;
+    IoSharedBufferPtr body_;
+    DISALLOW_COPY_AND_ASSIGN(BgpXmppMessage);
+};
+
 class BgpXmppMessageBuilder : public MessageBuilder {
 public:
     BgpXmppMessageBuilder();
@@ -15,8 +162,11 @@ public:
                             const BgpRoute *route) const;
     static BgpXmppMessageBuilder *GetInstance();
 
+    BgpXmppItemCache *item_cache() const { return &item_cache_; }
+
 private:
     static BgpXmppMessageBuilder instance_;
+    mutable BgpXmppItemCache item_cache_;
     DISALLOW_COPY_AND_ASSIGN(BgpXmppMessageBuilder);
 };
 
@@ -10,15 +10,105 @@
 
 using namespace std;
 
+DBEntryStateMap::DBEntryStateMap()
+    : states_(NULL), mask_(0), capacity_(0), overflow_(NULL) {
+}
+
+DBEntryStateMap::~DBEntryStateMap() {
+    delete [] states_;
+    delete overflow_;
+}
+
+void DBEntryStateMap::Grow(ListenerId listener) {
+    int capacity = ((listener / kGrowSize) + 1) * kGrowSize;
+    if (capacity > kMaxIndexedId) {
+        capacity = kMaxIndexedId;
+    }
+    DBState **states = new DBState *[capacity];
+    for (int i = 0; i < capacity; i++) {
+        states[i] = (i < capacity_) ? states_[i] : NULL;
+    }
+    delete [] states_;
+    states_ = states;
+    capacity_ = capacity;
+}
+
+bool DBEntryStateMap::Insert(ListenerId listener, DBState *state) {
+    assert(listener >= 0);
+    if (listener >= kMaxIndexedId) {
+        if (overflow_ == NULL) {
+            overflow_ = new OverflowMap;
+        }
+        pair<OverflowMap::iterator, bool> res =
+            overflow_->insert(make_pair(listener, state));
+        if (!res.second) {
+            res.first->second = state;
+        }
+        return res.second;
+    }
+
+    if (listener >= capacity_) {
+        Grow(listener);
+    }
+    states_[listener] = state;
+    uint64_t bit = 1ULL << listener;
+    if (mask_ & bit) {
+        return false;
+    }
+    mask_ |= bit;
+    return true;
+}
+
+DBState *DBEntryStateMap::Find(ListenerId listener) const {
+    if (listener < kMaxIndexedId) {
+        if (listener < capacity_) {
+            return states_[listener];
+        }
+        return NULL;
+    }
+    if (overflow_ == NULL) {
+        return NULL;
+    }
+    OverflowMap::const_iterator loc = overflow_->find(listener);
+    if (loc != overflow_->end()) {
+        return loc->second;
+    }
+    return NULL;
+}
+
+void DBEntryStateMap::Erase(ListenerId listener) {
+    if (listener >= kMaxIndexedId) {
+        if (overflow_ == NULL) {
+            return;
+        }
+        overflow_->erase(listener);
+        if (overflow_->empty()) {
+            delete overflow_;
+            overflow_ = NULL;
+        }
+        return;
+    }
+
+    if (listener >= capacity_) {
+        return;
+    }
+    states_[listener] = NULL;
+    mask_ &= ~(1ULL << listener);
+}
+
+size_t DBEntryStateMap::size() const {
+    size_t count = __builtin_popcountll(mask_);
+    if (overflow_ != NULL) {
+        count += overflow_->size();
+    }
+    return count;
+}
+
 void DBEntryBase::SetState(DBTableBase *tbl_base, ListenerId listener,
                            DBState *state) {
     DBTablePartBase *tpart = tbl_base->GetTablePartition(this);
     tbb::mutex::scoped_lock lock(tpart->dbstate_mutex());
-    pair<StateMap::iterator, bool> res = state_.insert(
-        make_pair(listener, state));
-    if (!res.second) {
-        res.first->second = state;
-    } else {
+    if (state_.Insert(listener, state)) {
         assert(!IsDeleted());
     }
 }
@@ -26,11 +116,7 @@ void DBEntryBase::SetState(DBTableBase *tbl_base, ListenerId listener,
 DBState *DBEntryBase::GetState(DBTableBase *tbl_base, ListenerId listener) {
     DBTablePartBase *tpart = tbl_base->GetTablePartition(this);
     tbb::mutex::scoped_lock lock(tpart->dbstate_mutex());
-    StateMap::iterator loc = state_.find(listener);
-    if (loc != state_.end()) {
-        return loc->second;
-    }
-    return NULL;
+    return state_.Find(listener);
 }
 
 const DBState *DBEntryBase::GetState(const DBTableBase *tbl_base,
@@ -38,17 +124,13 @@ const DBState *DBEntryBase::GetState(const DBTableBase *tbl_base,
     DBTableBase *table = const_cast<DBTableBase *>(tbl_base);
     DBTablePartBase *tpart = table->GetTablePartition(this);
     tbb::mutex::scoped_lock lock(tpart->dbstate_mutex());
-    StateMap::const_iterator loc = state_.find(listener);
-    if (loc != state_.end()) {
-        return loc->second;
-    }
-    return NULL;
+    return state_.Find(listener);
 }
 
 void DBEntryBase::ClearState(DBTableBase *tbl_base, ListenerId listener) {
     DBTablePartBase *tpart = tbl_base->GetTablePartition(this);
     tbb::mutex::scoped_lock lock(tpart->dbstate_mutex());
-    state_.erase(listener);
+    state_.Erase(listener);
     if (state_.empty() && IsDeleted() && !is_onlist()) {
         assert(!IsOnRemoveQ());
         tbl_base->EnqueueRemove(this);
@@ -16,6 +16,52 @@ struct DBState {
     virtual ~DBState() { }
 };
 
+//
+// Listener states of a DBEntryBase.
+//
+// Listener ids are small integers that DBTableBase::Register allocates
+// densely, reusing the ids of unregistered listeners. The states are kept
+// in an array indexed by listener id, which grows on demand, and a bitmask
+// records the ids that have a state since a listener may set a NULL state.
+// Ids at or beyond kMaxIndexedId, which only occur with a very large number
+// of listeners on a table, fall back to a map. The array is kept until the
+// entry is destroyed, since listeners often clear and set the state of an
+// entry again.
+//
+class DBEntryStateMap {
+public:
+    typedef DBTableBase::ListenerId ListenerId;
+    static const int kMaxIndexedId = 64;
+
+    DBEntryStateMap();
+    ~DBEntryStateMap();
+
+    // Returns true if the listener did not already have a state.
+    bool Insert(ListenerId listener, DBState *state);
+    // Returns NULL if the listener does not have a state.
+    DBState *Find(ListenerId listener) const;
+    void Erase(ListenerId listener);
+
+    bool empty() const {
+        return (mask_ == 0 && overflow_ == NULL);
+    }
+    size_t size() const;
+    // Number of listener ids the array has room for.
+    size_t capacity() const { return capacity_; }
+
+private:
+    typedef std::map<ListenerId, DBState *> OverflowMap;
+    static const int kGrowSize = 4;
+
+    void Grow(ListenerId listener);
+
+    DBState **states_;
+    uint64_t mask_;
+    uint8_t capacity_;
+    OverflowMap *overflow_;
+    DISALLOW_COPY_AND_ASSIGN(DBEntryStateMap);
+};
+
 // Generic database entry
 class DBEntryBase {
 public:
@@ -66,9 +112,8 @@ private:
         DeleteMarked = 1 << 1,
         OnRemoveQ    = 1 << 2,
     };
-    typedef std::map<ListenerId, DBState *> StateMap;
     DBTableBase *table_;
-    StateMap state_;
+    DBEntryStateMap state_;
     uint8_t flags;
     uint64_t last_change_at_; // time at which entry was last 'changed'
     DISALLOW_COPY_AND_ASSIGN(DBEntryBase);
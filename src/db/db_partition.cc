@@ -18,15 +18,53 @@ using tbb::atomic;
 
 int DBPartition::db_partition_task_id_ = -1;
 
+//
+// An entry in the request queue is either a single request or a list of
+// requests, possibly for different table partitions, from DBRequestBatch.
+//
 struct RequestQueueEntry {
+    typedef DBRequestBatch::ItemList ItemList;
+
     // Constructor takes ownership of DBRequest key, data.
     RequestQueueEntry(DBTablePartBase *tpart, DBClient *client, DBRequest *req)
-        : tpart(tpart), client(client) {
+        : tpart(tpart), client(client), count(1), next(0) {
         request.Swap(req);
     }
+    // Constructor takes ownership of the requests in the list.
+    RequestQueueEntry(DBClient *client, ItemList *items)
+        : tpart(NULL), client(client), count(items->size()), next(0) {
+        batch.swap(*items);
+    }
+    ~RequestQueueEntry() {
+        for (ItemList::iterator iter = batch.begin(); iter != batch.end();
+             ++iter) {
+            delete iter->request;
+        }
+    }
+
+    // Get the next request to process. Returns false once all the requests
+    // in the entry have been returned.
+    bool Next(DBTablePartBase **tpartp, DBRequest **reqp) {
+        if (next == count) {
+            return false;
+        }
+        if (batch.empty()) {
+            *tpartp = tpart;
+            *reqp = &request;
+        } else {
+            *tpartp = batch[next].tpart;
+            *reqp = batch[next].request;
+        }
+        next++;
+        return true;
+    }
+
     DBTablePartBase *tpart;
     DBClient *client;
     DBRequest request;
+    ItemList batch;
+    size_t count;
+    size_t next;
 };
 
 struct RemoveQueueEntry {
@@ -45,10 +83,12 @@ public:
     typedef std::list<DBTablePartBase *> TablePartList;
 
     explicit WorkQueue(int partition_id) 
-        : db_partition_id_(partition_id), disable_(false), running_(false) {
+        : current_(NULL), db_partition_id_(partition_id), disable_(false),
+          running_(false) {
         request_count_ = 0;
     }
     ~WorkQueue() {
+        delete current_;
         for (RequestQueue::iterator iter = request_queue_.unsafe_begin();
              iter != request_queue_.unsafe_end();) {
             RequestQueueEntry *req_entry = *iter;
@@ -59,17 +99,30 @@ public:
     }
 
     bool EnqueueRequest(RequestQueueEntry *req_entry) {
+        long count = req_entry->count;
         request_queue_.push(req_entry);
         MaybeStartRunner();
-        return request_count_.fetch_and_increment() < (kThreshold - 1);
+        return request_count_.fetch_and_add(count) + count < kThreshold;
     }
 
-    bool DequeueRequest(RequestQueueEntry **req_entry) {
-        bool success = request_queue_.try_pop(*req_entry);
-        if (success) {
-            request_count_.fetch_and_decrement();
+    // Get the next request, one at a time from each queue entry. The
+    // current entry is deleted once all its requests have been processed
+    // i.e. on the following call.
+    bool DequeueRequest(RequestQueueEntry **req_entry,
+                        DBTablePartBase **tpart, DBRequest **req) {
+        while (true) {
+            if (current_ == NULL && !request_queue_.try_pop(current_)) {
+                return false;
+            }
+            if (current_->Next(tpart, req)) {
+                break;
+            }
+            delete current_;
+            current_ = NULL;
         }
-        return success;
+        *req_entry = current_;
+        request_count_.fetch_and_decrement();
+        return true;
     }
 
     void EnqueueRemove(RemoveQueueEntry *rm_entry) {
@@ -104,7 +157,8 @@ public:
     }
 
     bool IsDBQueueEmpty() {
-        return (request_queue_.empty() && change_list_.empty());
+        return (request_queue_.empty() && current_ == NULL &&
+                change_list_.empty());
     }
 
     bool disable() { return disable_; }
@@ -112,6 +166,7 @@ public:
 
 private:
     RequestQueue request_queue_;
+    RequestQueueEntry *current_;
     TablePartList change_list_;
     atomic<long> request_count_;
     RemoveQueue remove_queue_;
@@ -162,9 +217,10 @@ public:
         }
 
         RequestQueueEntry *req_entry = NULL;
-        while (queue_->DequeueRequest(&req_entry)) {
-            req_entry->tpart->Process(req_entry->client, &req_entry->request);
-            delete req_entry;
+        DBTablePartBase *tpart = NULL;
+        DBRequest *req = NULL;
+        while (queue_->DequeueRequest(&req_entry, &tpart, &req)) {
+            tpart->Process(req_entry->client, req);
             if (++count == kMaxIterations) {
                 return false;
             }
@@ -229,6 +285,12 @@ bool DBPartition::EnqueueRequest(DBTablePartBase *tpart, DBClient *client,
     return work_queue_->EnqueueRequest(entry);
 }
 
+bool DBPartition::EnqueueRequests(DBClient *client,
+                                  DBRequestBatch::ItemList *items) {
+    RequestQueueEntry *entry = new RequestQueueEntry(client, items);
+    return work_queue_->EnqueueRequest(entry);
+}
+
 void DBPartition::EnqueueRemove(DBTablePartBase *tpart, DBEntryBase *db_entry) {
     RemoveQueueEntry *entry = new RemoveQueueEntry(tpart, db_entry);
     db_entry->SetOnRemoveQ();
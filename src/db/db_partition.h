@@ -29,6 +29,10 @@ public:
     bool EnqueueRequest(DBTablePartBase *tpart, DBClient *client,
                         DBRequest *req);
 
+    // Enqueue a list of requests as a single entry. Takes ownership of
+    // the requests and clears the list.
+    bool EnqueueRequests(DBClient *client, DBRequestBatch::ItemList *items);
+
     void EnqueueRemove(DBTablePartBase *tpart, DBEntryBase *db_entry);
 
     // Enqueue table on change list.
@@ -119,6 +119,45 @@ bool DBTableBase::Enqueue(DBRequest *req) {
     return partition->EnqueueRequest(tpart, NULL, req);
 }
 
+DBRequestBatch::DBRequestBatch()
+    : db_(NULL), buckets_(DB::PartitionCount()), count_(0) {
+}
+
+DBRequestBatch::~DBRequestBatch() {
+    for (vector<ItemList>::iterator it = buckets_.begin();
+         it != buckets_.end(); ++it) {
+        for (ItemList::iterator item = it->begin(); item != it->end();
+             ++item) {
+            delete item->request;
+        }
+    }
+}
+
+void DBRequestBatch::Add(DBTableBase *table, DBRequest *req) {
+    assert(db_ == NULL || db_ == table->database());
+    db_ = table->database();
+    DBTablePartBase *tpart = table->GetTablePartition(req->key.get());
+    DBRequest *request = new DBRequest();
+    request->Swap(req);
+    buckets_[tpart->index()].push_back(Item(tpart, request));
+    count_++;
+}
+
+bool DBRequestBatch::Enqueue() {
+    bool more = true;
+    for (size_t index = 0; index < buckets_.size(); index++) {
+        if (buckets_[index].empty()) {
+            continue;
+        }
+        DBPartition *partition = db_->GetPartition(index);
+        if (!partition->EnqueueRequests(NULL, &buckets_[index])) {
+            more = false;
+        }
+    }
+    count_ = 0;
+    return more;
+}
+
 void DBTableBase::EnqueueRemove(DBEntryBase *db_entry) {
     DBTablePartBase *tpart = GetTablePartition(db_entry);
     DBPartition *partition = db_->GetPartition(tpart->index());
@@ -14,6 +14,7 @@ class DB;
 class DBClient;
 class DBEntryBase;
 class DBEntry;
+class DBTableBase;
 class DBTablePartBase;
 class DBTablePartition;
 
@@ -47,6 +48,42 @@ private:
     DISALLOW_COPY_AND_ASSIGN(DBRequest);
 };
 
+// Requests that are enqueued together, possibly to different tables.
+//
+// Add buckets the requests by DB partition, so that Enqueue pushes a single
+// entry on the work queue of each DB partition instead of one per request.
+// The order of the requests for a given DB partition is preserved.
+class DBRequestBatch {
+public:
+    struct Item {
+        Item(DBTablePartBase *tpart, DBRequest *request)
+            : tpart(tpart), request(request) {
+        }
+        DBTablePartBase *tpart;
+        DBRequest *request;
+    };
+    typedef std::vector<Item> ItemList;
+
+    DBRequestBatch();
+    ~DBRequestBatch();
+
+    // Add a request to the batch. Takes ownership of the data.
+    void Add(DBTableBase *table, DBRequest *req);
+
+    // Enqueue all the requests in the batch. The batch is empty after.
+    // Returns false if the client should stop enqueuing updates.
+    bool Enqueue();
+
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+
+private:
+    DB *db_;
+    std::vector<ItemList> buckets_;
+    size_t count_;
+    DISALLOW_COPY_AND_ASSIGN(DBRequestBatch);
+};
+
 // Database table interface.
 class DBTableBase {
 public:
@@ -58,6 +95,7 @@ public:
     virtual ~DBTableBase();
 
     // Enqueue a request to the table. Takes ownership of the data.
+    // Use DBRequestBatch when enqueuing a number of requests at once.
     bool Enqueue(DBRequest *req);
     void EnqueueRemove(DBEntryBase *db_entry);
 
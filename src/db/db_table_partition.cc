@@ -2,7 +2,7 @@
  * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
  */
 
-#include <tbb/mutex.h>
+#include <tbb/spin_rw_mutex.h>
 
 #include "base/logging.h"
 #include "db/db.h"
@@ -61,8 +61,44 @@ void DBTablePartBase::Delete(DBEntryBase *entry) {
     }
 }
 
+//
+// Scoped locks on the tree. The lock is first tried without waiting so that
+// contention is counted without adding any shared writes to the fast path.
+//
+class DBTablePartition::ReadLock {
+public:
+    explicit ReadLock(DBTablePartition *tpart) {
+        if (!lock_.try_acquire(tpart->rw_mutex_, false)) {
+            tpart->read_contended_++;
+            lock_.acquire(tpart->rw_mutex_, false);
+        }
+    }
+
+private:
+    tbb::spin_rw_mutex::scoped_lock lock_;
+    DISALLOW_COPY_AND_ASSIGN(ReadLock);
+};
+
+class DBTablePartition::WriteLock {
+public:
+    explicit WriteLock(DBTablePartition *tpart) {
+        if (!lock_.try_acquire(tpart->rw_mutex_, true)) {
+            tpart->write_contended_++;
+            lock_.acquire(tpart->rw_mutex_, true);
+        }
+        tpart->writes_++;
+    }
+
+private:
+    tbb::spin_rw_mutex::scoped_lock lock_;
+    DISALLOW_COPY_AND_ASSIGN(WriteLock);
+};
+
 DBTablePartition::DBTablePartition(DBTable *table, int index)
     : DBTablePartBase(table, index) {
+    writes_ = 0;
+    read_contended_ = 0;
+    write_contended_ = 0;
 }
 
 void DBTablePartition::Process(DBClient *client, DBRequest *req) {
@@ -71,20 +107,21 @@ void DBTablePartition::Process(DBClient *client, DBRequest *req) {
 }
 
 void DBTablePartition::Add(DBEntry *entry) {
-    tbb::mutex::scoped_lock lock(mutex_);
+    WriteLock lock(this);
     std::pair<Tree::iterator, bool> ret = tree_.insert(*entry);
     assert(ret.second);
     entry->set_table(static_cast<DBTableBase *>(table()));
     Notify(entry);
 }
 
+// The tree is not modified, and the change list is only accessed from the
+// DBPartition task, so there's no need to lock.
 void DBTablePartition::Change(DBEntry *entry) {
-    tbb::mutex::scoped_lock lock(mutex_);
     Notify(entry);
 }
 
 void DBTablePartition::Remove(DBEntryBase *db_entry) {
-    tbb::mutex::scoped_lock lock(mutex_);
+    WriteLock lock(this);
     DBEntry *entry = static_cast<DBEntry *>(db_entry);
 
     assert(tree_.erase(*entry));
@@ -98,7 +135,7 @@ void DBTablePartition::Remove(DBEntryBase *db_entry) {
 }
 
 DBEntry *DBTablePartition::Find(const DBEntry *entry) {
-    tbb::mutex::scoped_lock lock(mutex_);
+    ReadLock lock(this);
     Tree::iterator loc = tree_.find(*entry);
     if (loc != tree_.end()) {
         return loc.operator->();
@@ -107,7 +144,7 @@ DBEntry *DBTablePartition::Find(const DBEntry *entry) {
 }
 
 DBEntry *DBTablePartition::Find(const DBRequestKey *key) {
-    tbb::mutex::scoped_lock lock(mutex_);
+    ReadLock lock(this);
     DBTable *table = static_cast<DBTable *>(parent());
     std::auto_ptr<DBEntry> entry_ptr = table->AllocEntry(key);
 
@@ -121,7 +158,7 @@ DBEntry *DBTablePartition::Find(const DBRequestKey *key) {
 // Returns the matching entry or next in lex order
 DBEntry *DBTablePartition::lower_bound(const DBEntryBase *key) {
     const DBEntry *entry = static_cast<const DBEntry *>(key);
-    tbb::mutex::scoped_lock lock(mutex_);
+    ReadLock lock(this);
 
     Tree::iterator it = tree_.lower_bound(*entry);
     if (it != tree_.end()) {
@@ -131,7 +168,7 @@ DBEntry *DBTablePartition::lower_bound(const DBEntryBase *key) {
 }
 
 DBEntry *DBTablePartition::GetFirst() {
-    tbb::mutex::scoped_lock lock(mutex_);
+    ReadLock lock(this);
     Tree::iterator it = tree_.begin();
     if (it == tree_.end()) {
         return NULL;
@@ -142,7 +179,7 @@ DBEntry *DBTablePartition::GetFirst() {
 // Returns the next entry (Doesn't search). Threaded walk
 DBEntry *DBTablePartition::GetNext(const DBEntryBase *key) {
     const DBEntry *entry = static_cast<const DBEntry *>(key);
-    tbb::mutex::scoped_lock lock(mutex_);
+    ReadLock lock(this);
 
     Tree::const_iterator it = tree_.iterator_to(*entry);
     it++;
@@ -152,6 +189,12 @@ DBEntry *DBTablePartition::GetNext(const DBEntryBase *key) {
     return NULL;
 }
 
+void DBTablePartition::GetLockStats(LockStats *stats) const {
+    stats->writes = writes_;
+    stats->read_contended = read_contended_;
+    stats->write_contended = write_contended_;
+}
+
 DBTable *DBTablePartition::table() {
     return static_cast<DBTable *>(parent());
 }
@@ -6,7 +6,9 @@
 #define ctrlplane_db_table_partition_h
 
 #include <boost/intrusive/list.hpp>
+#include <tbb/atomic.h>
 #include <tbb/mutex.h>
+#include <tbb/spin_rw_mutex.h>
 
 #include "db/db_entry.h"
 
@@ -61,12 +63,26 @@ private:
     DISALLOW_COPY_AND_ASSIGN(DBTablePartBase);
 };
 
+//
+// The tree is protected by a reader-writer lock. Only the DBPartition task
+// modifies the tree, while lookups and walks from other tasks (introspect,
+// DBTableWalker, lookups from other tables) share the lock with each other
+// and only wait for the writer while it is adding or removing an entry.
+//
 class DBTablePartition : public DBTablePartBase {
 public:
     typedef boost::intrusive::member_hook<DBEntry,
         boost::intrusive::set_member_hook<>,
         &DBEntry::node_> SetMember;
     typedef boost::intrusive::set<DBEntry, SetMember> Tree;
+
+    // A lookup that has to wait for the writer, or a write that has to
+    // wait for lookups, counts as contended.
+    struct LockStats {
+        uint64_t writes;
+        uint64_t read_contended;
+        uint64_t write_contended;
+    };
     
     DBTablePartition(DBTable *parent, int index);
 
@@ -103,10 +119,17 @@ public:
 
     DBTable *table();
     size_t size() const { return tree_.size(); }
+    void GetLockStats(LockStats *stats) const;
 
 private:
-    tbb::mutex mutex_;
+    class ReadLock;
+    class WriteLock;
+
+    tbb::spin_rw_mutex rw_mutex_;
     Tree tree_;
+    tbb::atomic<uint64_t> writes_;
+    tbb::atomic<uint64_t> read_contended_;
+    tbb::atomic<uint64_t> write_contended_;
     DISALLOW_COPY_AND_ASSIGN(DBTablePartition);
 };
 
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "db/db_entry.h"
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+#if defined(__linux__)
+#include <malloc.h>
+#endif
+#include <boost/bind.hpp>
+#include <tbb/atomic.h>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+#include "db/db.h"
+#include "db/db_table.h"
+#include "db/db_table_partition.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+class TestState : public DBState {
+};
+
+class DBEntryStateMapTest : public ::testing::Test {
+protected:
+    TestState states_[DBEntryStateMap::kMaxIndexedId + 8];
+    DBEntryStateMap map_;
+};
+
+TEST_F(DBEntryStateMapTest, Basic) {
+    EXPECT_TRUE(map_.empty());
+    EXPECT_TRUE(map_.Find(0) == NULL);
+
+    EXPECT_TRUE(map_.Insert(0, &states_[0]));
+    EXPECT_TRUE(map_.Insert(5, &states_[5]));
+    EXPECT_FALSE(map_.empty());
+    EXPECT_EQ(2, map_.size());
+    EXPECT_EQ(&states_[0], map_.Find(0));
+    EXPECT_EQ(&states_[5], map_.Find(5));
+    EXPECT_TRUE(map_.Find(1) == NULL);
+    EXPECT_TRUE(map_.Find(31) == NULL);
+
+    // Replace.
+    EXPECT_FALSE(map_.Insert(5, &states_[6]));
+    EXPECT_EQ(&states_[6], map_.Find(5));
+    EXPECT_EQ(2, map_.size());
+
+    map_.Erase(0);
+    EXPECT_TRUE(map_.Find(0) == NULL);
+    EXPECT_EQ(1, map_.size());
+    map_.Erase(5);
+    EXPECT_TRUE(map_.empty());
+    EXPECT_EQ(0, map_.size());
+
+    // Erase of a listener without state is a no-op.
+    map_.Erase(7);
+    EXPECT_TRUE(map_.empty());
+}
+
+// A listener may set a NULL state, which still counts as state.
+TEST_F(DBEntryStateMapTest, NullState) {
+    EXPECT_TRUE(map_.Insert(3, NULL));
+    EXPECT_FALSE(map_.empty());
+    EXPECT_EQ(1, map_.size());
+    EXPECT_TRUE(map_.Find(3) == NULL);
+    EXPECT_FALSE(map_.Insert(3, &states_[3]));
+    EXPECT_FALSE(map_.Insert(3, NULL));
+    map_.Erase(3);
+    EXPECT_TRUE(map_.empty());
+}
+
+// Ids beyond the indexed range fall back to the overflow map.
+TEST_F(DBEntryStateMapTest, SparseIds) {
+    const int kMax = DBEntryStateMap::kMaxIndexedId;
+    EXPECT_TRUE(map_.Insert(kMax - 1, &states_[kMax - 1]));
+    EXPECT_TRUE(map_.Insert(kMax, &states_[kMax]));
+    EXPECT_TRUE(map_.Insert(kMax + 7, NULL));
+    EXPECT_EQ(3, map_.size());
+    EXPECT_EQ(&states_[kMax - 1], map_.Find(kMax - 1));
+    EXPECT_EQ(&states_[kMax], map_.Find(kMax));
+    EXPECT_TRUE(map_.Find(kMax + 7) == NULL);
+    EXPECT_TRUE(map_.Find(kMax + 1) == NULL);
+
+    map_.Erase(kMax - 1);
+    EXPECT_FALSE(map_.empty());
+    map_.Erase(kMax);
+    EXPECT_FALSE(map_.empty());
+    map_.Erase(kMax + 7);
+    EXPECT_TRUE(map_.empty());
+}
+
+TEST_F(DBEntryStateMapTest, AllIds) {
+    const int kCount = DBEntryStateMap::kMaxIndexedId + 8;
+    for (int i = kCount - 1; i >= 0; i--) {
+        EXPECT_TRUE(map_.Insert(i, &states_[i]));
+    }
+    EXPECT_EQ(kCount, map_.size());
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_EQ(&states_[i], map_.Find(i));
+    }
+    for (int i = 0; i < kCount; i += 2) {
+        map_.Erase(i);
+    }
+    for (int i = 0; i < kCount; i++) {
+        EXPECT_EQ((i % 2) ? &states_[i] : NULL, map_.Find(i));
+    }
+    for (int i = 1; i < kCount; i += 2) {
+        map_.Erase(i);
+    }
+    EXPECT_TRUE(map_.empty());
+}
+
+// The array is kept when the last state is erased, so a state that is set
+// again does not allocate it again.
+TEST_F(DBEntryStateMapTest, KeepArray) {
+    EXPECT_EQ(0, map_.capacity());
+    EXPECT_TRUE(map_.Insert(2, &states_[2]));
+    size_t capacity = map_.capacity();
+    EXPECT_LT(2, capacity);
+    for (int i = 0; i < 4; i++) {
+        map_.Erase(2);
+        EXPECT_TRUE(map_.empty());
+        EXPECT_EQ(capacity, map_.capacity());
+        EXPECT_TRUE(map_.Find(2) == NULL);
+        EXPECT_TRUE(map_.Insert(2, &states_[2]));
+    }
+    map_.Erase(2);
+    EXPECT_TRUE(map_.empty());
+}
+
+//
+// Compare the memory used by the listener states and the cost of looking
+// them up with the std::map that DBEntryBase used to keep, and measure the
+// notifications of a table whose listeners keep state on its entries. The
+// defaults are small so that the suite runs fast; set ENTRY_COUNT and
+// LISTENER_COUNT to measure a large table, e.g. 1000000 entries and 8
+// listeners.
+//
+static size_t HeapInUse() {
+#if defined(__linux__)
+    struct mallinfo info = mallinfo();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+class DBEntryStateMapBenchmark : public ::testing::Test {
+protected:
+    typedef map<DBTableBase::ListenerId, DBState *> StdStateMap;
+
+    virtual void SetUp() {
+        entry_count_ = GetEnvInt("ENTRY_COUNT", 10000);
+        listener_count_ = GetEnvInt("LISTENER_COUNT", 8);
+    }
+
+    template <typename MapType>
+    void Run(const char *name, size_t entry_size) {
+        size_t heap = HeapInUse();
+        MapType *maps = new MapType[entry_count_];
+        for (int i = 0; i < entry_count_; i++) {
+            for (int id = 0; id < listener_count_; id++) {
+                Insert(&maps[i], id);
+            }
+        }
+        size_t bytes = HeapInUse() - heap;
+
+        // Every listener looks up its state for every entry, as it does on
+        // a walk or notification of the whole table.
+        uint64_t start = UTCTimestampUsec();
+        size_t found = 0;
+        for (int i = 0; i < entry_count_; i++) {
+            for (int id = 0; id < listener_count_; id++) {
+                if (Find(&maps[i], id) == &state_) {
+                    found++;
+                }
+            }
+        }
+        uint64_t usec = UTCTimestampUsec() - start;
+        EXPECT_EQ((size_t) entry_count_ * listener_count_, found);
+        delete [] maps;
+
+        LOG(DEBUG, name << ": " << entry_count_ << " entries, " <<
+            listener_count_ << " listeners");
+        LOG(DEBUG, name << ": " <<
+            (bytes ? bytes / entry_count_ : entry_size) <<
+            " bytes per entry (" << entry_size << " inline)");
+        LOG(DEBUG, name << ": " << usec << " usec, " <<
+            found * 1000000 / max(usec, (uint64_t) 1) << " lookups/sec");
+    }
+
+    void Insert(StdStateMap *map, int id) {
+        map->insert(make_pair(id, &state_));
+    }
+    DBState *Find(StdStateMap *map, int id) {
+        StdStateMap::iterator loc = map->find(id);
+        return (loc != map->end()) ? loc->second : NULL;
+    }
+    void Insert(DBEntryStateMap *map, int id) {
+        map->Insert(id, &state_);
+    }
+    DBState *Find(DBEntryStateMap *map, int id) {
+        return map->Find(id);
+    }
+
+    int entry_count_;
+    int listener_count_;
+    TestState state_;
+};
+
+TEST_F(DBEntryStateMapBenchmark, StdMap) {
+    Run<StdStateMap>("std::map", sizeof(StdStateMap));
+}
+
+TEST_F(DBEntryStateMapBenchmark, StateMap) {
+    Run<DBEntryStateMap>("DBEntryStateMap", sizeof(DBEntryStateMap));
+}
+
+struct StateTestKey : public DBRequestKey {
+    explicit StateTestKey(int id) : id(id) { }
+    int id;
+};
+
+class StateTestEntry : public DBEntry {
+public:
+    explicit StateTestEntry(int id) : id_(id) { }
+
+    virtual void SetKey(const DBRequestKey *key) {
+        id_ = static_cast<const StateTestKey *>(key)->id;
+    }
+    virtual bool IsLess(const DBEntry &rhs) const {
+        return id_ < static_cast<const StateTestEntry &>(rhs).id_;
+    }
+    virtual std::string ToString() const { return "StateTestEntry"; }
+    virtual KeyPtr GetDBRequestKey() const {
+        return KeyPtr(new StateTestKey(id_));
+    }
+    int id() const { return id_; }
+
+private:
+    int id_;
+    DISALLOW_COPY_AND_ASSIGN(StateTestEntry);
+};
+
+class StateTestTable : public DBTable {
+public:
+    StateTestTable(DB *db, const std::string &name) : DBTable(db, name) { }
+
+    virtual std::auto_ptr<DBEntry> AllocEntry(const DBRequestKey *key) const {
+        const StateTestKey *tkey = static_cast<const StateTestKey *>(key);
+        return std::auto_ptr<DBEntry>(new StateTestEntry(tkey->id));
+    }
+    virtual size_t Hash(const DBEntry *entry) const {
+        return static_cast<const StateTestEntry *>(entry)->id();
+    }
+    virtual size_t Hash(const DBRequestKey *key) const {
+        return static_cast<const StateTestKey *>(key)->id;
+    }
+
+    static DBTableBase *CreateTable(DB *db, const std::string &name) {
+        StateTestTable *table = new StateTestTable(db, name);
+        table->Init();
+        return table;
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(StateTestTable);
+};
+
+//
+// Each listener sets its state on an entry when it is added, looks it up on
+// every change and clears it when the entry is deleted, as the listeners of
+// the routing and agent tables do.
+//
+class DBEntryStateNotifyBenchmark : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        entry_count_ = GetEnvInt("ENTRY_COUNT", 10000);
+        listener_count_ = GetEnvInt("LISTENER_COUNT", 8);
+        table_ = static_cast<DBTable *>(db_.CreateTable("db.test.state.0"));
+        for (int i = 0; i < listener_count_; i++) {
+            ids_.push_back(table_->Register(boost::bind(
+                &DBEntryStateNotifyBenchmark::Notify, this, i, _1, _2)));
+        }
+        notify_count_ = 0;
+        found_count_ = 0;
+    }
+
+    virtual void TearDown() {
+        for (int i = 0; i < listener_count_; i++) {
+            table_->Unregister(ids_[i]);
+        }
+        db_.Clear();
+    }
+
+    void Notify(int index, DBTablePartBase *tpart, DBEntryBase *entry) {
+        DBTableBase::ListenerId id = ids_[index];
+        notify_count_++;
+        if (entry->IsDeleted()) {
+            entry->ClearState(tpart->parent(), id);
+        } else if (entry->GetState(tpart->parent(), id) == &state_) {
+            found_count_++;
+        } else {
+            entry->SetState(tpart->parent(), id, &state_);
+        }
+    }
+
+    // Notifications per second for a request on every entry
+    void Run(const char *name, DBRequest::DBOperation oper) {
+        notify_count_ = 0;
+        uint64_t start = UTCTimestampUsec();
+        for (int i = 0; i < entry_count_; i++) {
+            DBRequest req;
+            req.oper = oper;
+            req.key.reset(new StateTestKey(i));
+            table_->Enqueue(&req);
+        }
+        task_util::WaitForIdle();
+        uint64_t usec = UTCTimestampUsec() - start;
+        EXPECT_EQ(entry_count_ * listener_count_, notify_count_);
+        LOG(DEBUG, name << ": " << notify_count_ << " notifications, " <<
+            usec << " usec, " <<
+            notify_count_ * 1000000 / max(usec, (uint64_t) 1) <<
+            " notifications/sec");
+    }
+
+    DB db_;
+    DBTable *table_;
+    std::vector<DBTableBase::ListenerId> ids_;
+    int entry_count_;
+    int listener_count_;
+    tbb::atomic<int> notify_count_;
+    tbb::atomic<int> found_count_;
+    TestState state_;
+};
+
+TEST_F(DBEntryStateNotifyBenchmark, AddChangeDelete) {
+    Run("Add", DBRequest::DB_ENTRY_ADD_CHANGE);
+    EXPECT_EQ((size_t) entry_count_, table_->Size());
+    EXPECT_EQ(0, found_count_);
+
+    Run("Change", DBRequest::DB_ENTRY_ADD_CHANGE);
+    EXPECT_EQ(entry_count_ * listener_count_, found_count_);
+
+    Run("Delete", DBRequest::DB_ENTRY_DELETE);
+    EXPECT_EQ(0U, table_->Size());
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    DB::RegisterFactory("db.test.state.0", &StateTestTable::CreateTable);
+    return RUN_ALL_TESTS();
+}
@@ -12,6 +12,7 @@
 #include "db/db_entry.h"
 #include "db/db_client.h"
 #include "db/db_partition.h"
+#include "db/db_table_partition.h"
 #include "db/db_table_walker.h"
 
 #include "base/logging.h"
@@ -131,6 +132,75 @@ public:
 
 #include "db_test_cmn.h"
 
+//
+// Lookups from another thread while the DBPartition tasks add and delete
+// entries.
+//
+struct LookupThreadArgs {
+    VlanTable *table;
+    int count;
+    tbb::atomic<bool> done;
+    tbb::atomic<long> lookups;
+};
+
+static void *LookupThread(void *arg) {
+    LookupThreadArgs *args = static_cast<LookupThreadArgs *>(arg);
+    while (!args->done) {
+        for (int i = 0; i < args->count; i++) {
+            VlanTableReqKey key(i);
+            args->table->Find(&key);
+            args->lookups++;
+        }
+    }
+    return NULL;
+}
+
+TEST_F(DBTest, ConcurrentLookup) {
+    LookupThreadArgs args;
+    args.table = itbl;
+    args.count = 1000;
+    args.done = false;
+    args.lookups = 0;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, &LookupThread, &args));
+
+    for (int i = 0; i < args.count; i++) {
+        DBRequest addReq;
+        addReq.key.reset(new VlanTableReqKey(i));
+        addReq.data.reset(new VlanTableReqData("DB Test Vlan"));
+        addReq.oper = DBRequest::DB_ENTRY_ADD_CHANGE;
+        EXPECT_TRUE(itbl->Enqueue(&addReq));
+    }
+    task_util::WaitForIdle();
+    EXPECT_EQ(args.count, itbl->Size());
+
+    for (int i = 0; i < args.count; i++) {
+        DBRequest delReq;
+        delReq.key.reset(new VlanTableReqKey(i));
+        delReq.oper = DBRequest::DB_ENTRY_DELETE;
+        EXPECT_TRUE(itbl->Enqueue(&delReq));
+    }
+    task_util::WaitForIdle();
+    EXPECT_EQ(0, itbl->Size());
+
+    args.done = true;
+    pthread_join(thread, NULL);
+    EXPECT_NE(0, args.lookups);
+
+    uint64_t writes = 0;
+    for (int idx = 0; idx < itbl->PartitionCount(); idx++) {
+        DBTablePartition *tpart =
+            static_cast<DBTablePartition *>(itbl->GetTablePartition(idx));
+        DBTablePartition::LockStats stats;
+        tpart->GetLockStats(&stats);
+        writes += stats.writes;
+        LOG(DEBUG, "Partition " << idx << " writes " << stats.writes <<
+            " read contended " << stats.read_contended <<
+            " write contended " << stats.write_contended);
+    }
+    EXPECT_EQ(2 * args.count, writes);
+}
+
 void RegisterFactory() {
     DB::RegisterFactory("db.test.vlan.0", &VlanTable::CreateTable);
 }
@@ -590,6 +590,55 @@ TEST_F(DBTest, Bulk) {
     del_notification = 0;
 }
 
+// To Test:
+// Requests enqueued in a batch are all processed, in order for each key
+TEST_F(DBTest, BulkBatch) {
+    int bulk_count = 100;
+    DBRequestBatch batch;
+    for (int i = 0; i < bulk_count; i++) {
+        DBRequest addReq;
+        addReq.key.reset(new VlanTableReqKey(i));
+        addReq.data.reset(new VlanTableReqData("DB Test Vlan"));
+        addReq.oper = DBRequest::DB_ENTRY_ADD_CHANGE;
+        batch.Add(itbl, &addReq);
+        EXPECT_TRUE(addReq.key.get() == NULL);
+    }
+    // Delete the even VLANs in the same batch.
+    for (int i = 0; i < bulk_count; i += 2) {
+        DBRequest delReq;
+        delReq.key.reset(new VlanTableReqKey(i));
+        delReq.oper = DBRequest::DB_ENTRY_DELETE;
+        batch.Add(itbl, &delReq);
+    }
+    EXPECT_EQ(bulk_count + bulk_count / 2, batch.size());
+    EXPECT_TRUE(batch.Enqueue());
+    EXPECT_TRUE(batch.empty());
+
+    task_util::WaitForIdle();
+    for (int i = 0; i < bulk_count; i++) {
+        VlanTableReqKey lookupKey(i);
+        Vlan *vlan = itbl->Find(&lookupKey);
+        if (i % 2) {
+            EXPECT_TRUE(vlan != NULL);
+        } else {
+            EXPECT_TRUE(vlan == NULL);
+        }
+    }
+
+    for (int i = 1; i < bulk_count; i += 2) {
+        DBRequest delReq;
+        delReq.key.reset(new VlanTableReqKey(i));
+        delReq.oper = DBRequest::DB_ENTRY_DELETE;
+        batch.Add(itbl, &delReq);
+    }
+    EXPECT_TRUE(batch.Enqueue());
+    task_util::WaitForIdle();
+    for (int i = 0; i < bulk_count; i++) {
+        VlanTableReqKey lookupKey(i);
+        EXPECT_TRUE(itbl->Find(&lookupKey) == NULL);
+    }
+}
+
 // To Test:
 // Verify that requests enqueued when a notification running is serviced
 TEST_F(DBTest, ReqInNotifyPath) {
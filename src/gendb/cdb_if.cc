@@ -96,11 +96,21 @@ CdbIf::CdbIf(boost::asio::io_service *ioservice, DbErrorHandler errhandler,
     errhandler_(errhandler),
     db_init_done_(false),
     name_(name),
-    cassandra_ttl_(ttl) {
+    cassandra_ttl_(ttl),
+    max_batch_columns_(kMaxBatchColumns),
+    max_batch_delay_usec_(kMaxBatchDelayUsec) {
+    batch_retry_ = false;
+    Db_ClearWriteBatchStats();
 }
 
-CdbIf::CdbIf()
-{ }
+CdbIf::CdbIf() :
+    db_init_done_(false),
+    cassandra_ttl_(0),
+    max_batch_columns_(kMaxBatchColumns),
+    max_batch_delay_usec_(kMaxBatchDelayUsec) {
+    batch_retry_ = false;
+    Db_ClearWriteBatchStats();
+}
 
 bool CdbIf::Db_IsInitDone() const {
     return db_init_done_;
@@ -108,15 +118,21 @@ bool CdbIf::Db_IsInitDone() const {
 
 void CdbIf::Db_SetInitDone(bool init_done) {
     if (db_init_done_ != init_done) {
+        db_init_done_ = init_done;
         if (init_done) {
             // Start cdbq dequeue if init is done
             cdbq_->MayBeStartRunner();
+            // Write the batch that failed when the connection went down,
+            // even if nothing else is queued
+            if (batch_retry_) {
+                std::auto_ptr<GenDb::ColList> flush;
+                cdbq_->Enqueue(new CdbIfColList(flush));
+            }
         }
-        db_init_done_ = init_done;
     }
 }
 
-bool CdbIf::Db_Init(std::string task_id, int task_instance) {
+void CdbIf::Db_InitQueue(std::string task_id, int task_instance) {
     /*
      * we can leave the queue contents as is so they can be replayed after the
      * connection to db is established
@@ -127,7 +143,20 @@ bool CdbIf::Db_Init(std::string task_id, int task_instance) {
             boost::bind(&CdbIf::Db_AsyncAddColumn, this, _1)));
         cdbq_->SetStartRunnerFunc(
             boost::bind(&CdbIf::Db_IsInitDone, this));
+        cdbq_->SetExitCallback(
+            boost::bind(&CdbIf::Db_AsyncAddColumnExit, this, _1));
     }
+}
+
+void CdbIf::Db_UninitQueue() {
+    cdbq_->Shutdown();
+    cdbq_.reset();
+    batch_.Clear();
+    batch_retry_ = false;
+}
+
+bool CdbIf::Db_Init(std::string task_id, int task_instance) {
+    Db_InitQueue(task_id, task_instance);
 
     try {
         transport_->open();
@@ -166,8 +195,7 @@ void CdbIf::Db_Uninit(bool shutdown) {
         CDBIF_HANDLE_EXCEPTION(__func__ << ": TException what: " << tx.what());
     }
     if (shutdown) {
-        cdbq_->Shutdown();
-        cdbq_.reset();
+        Db_UninitQueue();
     }
 }
 
@@ -642,6 +670,220 @@ bool CdbIf::NewDb_AddColumnfamily(const GenDb::NewCf& cf) {
     return true;
 }
 
+/*
+ * Convert the columns of a column list to mutations and append them to the
+ * mutations for the same row key and column family in the mutation map.
+ */
+bool CdbIf::Db_AddColumnToMutationMap(CdbIfMutationMap& mutation_map,
+        GenDb::ColList *new_colp, uint64_t ts, size_t *columns) {
+    std::vector<cassandra::Mutation> mutations;
+    GenDb::NewCf::ColumnFamilyType cftype = GenDb::NewCf::COLUMN_FAMILY_INVALID;
+
+    for (std::vector<GenDb::NewCol>::iterator it = new_colp->columns_.begin();
+                it != new_colp->columns_.end(); it++) {
+            cassandra::Mutation mutation;
+            cassandra::ColumnOrSuperColumn c_or_sc;
+            cassandra::Column c;
+
+            if (it->cftype_ == GenDb::NewCf::COLUMN_FAMILY_SQL) {
+                CDBIF_CONDCHECK_LOG_RETF((it->name.size() == 1) && (it->value.size() == 1));
+                CDBIF_CONDCHECK_LOG_RETF(cftype != GenDb::NewCf::COLUMN_FAMILY_NOSQL);
+                cftype = GenDb::NewCf::COLUMN_FAMILY_SQL;
+
+                std::string col_name;
+                try {
+                    col_name = boost::get<std::string>(it->name.at(0));
+                } catch (boost::bad_get& ex) {
+                    CDBIF_HANDLE_EXCEPTION(__func__ << "Exception for boost::get, what=" << ex.what());
+                }
+                c.__set_name(col_name);
+                std::string col_value;
+                DbDataValueToStringFromCf(col_value, new_colp->cfname_, col_name, it->value.at(0));
+                c.__set_value(col_value);
+                c.__set_timestamp(ts);
+                if (it->ttl == -1) {
+                    if (cassandra_ttl_)
+                        c.__set_ttl(cassandra_ttl_);
+                } else if (it->ttl) {
+                    c.__set_ttl(it->ttl);
+                }
+
+                c_or_sc.__set_column(c);
+                mutation.__set_column_or_supercolumn(c_or_sc);
+                mutations.push_back(mutation);
+            } else if (it->cftype_ == GenDb::NewCf::COLUMN_FAMILY_NOSQL) {
+                CDBIF_CONDCHECK_LOG_RETF(cftype != GenDb::NewCf::COLUMN_FAMILY_SQL);
+                cftype = GenDb::NewCf::COLUMN_FAMILY_NOSQL;
+
+                std::string col_name;
+                ConstructDbDataValueColumnName(col_name, new_colp->cfname_, it->name);
+                c.__set_name(col_name);
+
+                std::string col_value;
+                ConstructDbDataValueColumnValue(col_value, new_colp->cfname_, it->value);
+                c.__set_value(col_value);
+
+                c.__set_timestamp(ts);
+                if (it->ttl == -1) {
+                    if (cassandra_ttl_)
+                        c.__set_ttl(cassandra_ttl_);
+                } else if (it->ttl) {
+                    c.__set_ttl(it->ttl);
+                }
+
+                c_or_sc.__set_column(c);
+                mutation.__set_column_or_supercolumn(c_or_sc);
+                mutations.push_back(mutation);
+            } else {
+                CDBIF_CONDCHECK_LOG_RETF(0);
+            }
+    }
+
+    std::string key_value;
+    ConstructDbDataValueKey(key_value, new_colp->cfname_, new_colp->rowkey_);
+    std::vector<cassandra::Mutation>& cf_mutations =
+        mutation_map[key_value][new_colp->cfname_];
+    cf_mutations.insert(cf_mutations.end(), mutations.begin(), mutations.end());
+    *columns = mutations.size();
+    return true;
+}
+
+CdbIf::CdbIfWriteStatus CdbIf::Db_BatchMutate(
+        const CdbIfMutationMap& mutation_map) {
+    try {
+        client_->batch_mutate(mutation_map, org::apache::cassandra::ConsistencyLevel::ONE);
+    } catch (InvalidRequestException& ire) {
+        CDBIF_HANDLE_EXCEPTION(__func__ << ": InvalidRequestException: " << ire.why);
+        return CDBIF_WRITE_INVALID;
+    } catch (UnavailableException& ue) {
+        CDBIF_HANDLE_EXCEPTION(__func__ << ": UnavailableException: " << ue.what());
+        return CDBIF_WRITE_RETRY;
+    } catch (TimedOutException& te) {
+        CDBIF_HANDLE_EXCEPTION(__func__ << ": TimedOutException: " << te.what());
+        return CDBIF_WRITE_RETRY;
+    } catch (TTransportException& te) {
+        CDBIF_HANDLE_EXCEPTION(__func__ << ": TTransportException what: " << te.what());
+        errhandler_();
+        return CDBIF_WRITE_DISCONNECTED;
+    } catch (TException& tx) {
+        CDBIF_HANDLE_EXCEPTION(__func__ << ": TException what: " << tx.what());
+        return CDBIF_WRITE_RETRY;
+    }
+    return CDBIF_WRITE_OK;
+}
+
+/*
+ * Write the mutations with batch_mutate, retrying transient errors up to
+ * kMaxBatchRetries times. If cassandra rejects the mutations, they are
+ * split in two and each half is written, down to the single row and column
+ * family that is rejected, so that only the columns of the rejected ones
+ * are dropped. The number of columns dropped is added to dropped.
+ */
+CdbIf::CdbIfWriteStatus CdbIf::Db_WriteBatch(
+        const CdbIfMutationMap& mutation_map, size_t *dropped) {
+    CdbIfWriteStatus status = Db_BatchMutate(mutation_map);
+    for (int retry = 0; status == CDBIF_WRITE_RETRY &&
+         retry < kMaxBatchRetries; retry++) {
+        status = Db_BatchMutate(mutation_map);
+    }
+    if (status == CDBIF_WRITE_OK || status == CDBIF_WRITE_DISCONNECTED) {
+        return status;
+    }
+
+    size_t entries = 0;
+    size_t columns = 0;
+    for (CdbIfMutationMap::const_iterator it = mutation_map.begin();
+         it != mutation_map.end(); ++it) {
+        entries += it->second.size();
+        for (std::map<std::string, std::vector<cassandra::Mutation> >::
+             const_iterator cf_it = it->second.begin();
+             cf_it != it->second.end(); ++cf_it) {
+            columns += cf_it->second.size();
+        }
+    }
+    if (status == CDBIF_WRITE_RETRY || entries == 1) {
+        *dropped += columns;
+        return status;
+    }
+
+    CdbIfMutationMap halves[2];
+    size_t entry = 0;
+    for (CdbIfMutationMap::const_iterator it = mutation_map.begin();
+         it != mutation_map.end(); ++it) {
+        for (std::map<std::string, std::vector<cassandra::Mutation> >::
+             const_iterator cf_it = it->second.begin();
+             cf_it != it->second.end(); ++cf_it, ++entry) {
+            halves[entry * 2 / entries][it->first][cf_it->first] =
+                cf_it->second;
+        }
+    }
+    CdbIfWriteStatus ret_status = CDBIF_WRITE_OK;
+    for (int i = 0; i < 2; i++) {
+        CdbIfWriteStatus half_status = Db_WriteBatch(halves[i], dropped);
+        if (half_status == CDBIF_WRITE_DISCONNECTED) {
+            return half_status;
+        }
+        if (half_status != CDBIF_WRITE_OK) {
+            ret_status = half_status;
+        }
+    }
+    return ret_status;
+}
+
+/*
+ * Write the pending batch and account for it. Returns false if any of it
+ * could not be written. If the connection to the db failed, the batch is
+ * kept and written again once the connection is re-established. Otherwise
+ * the columns that could not be written are dropped and counted, and the
+ * rest of the batch is written.
+ */
+bool CdbIf::Db_FlushBatch() {
+    if (batch_.col_lists == 0) {
+        return true;
+    }
+
+    uint64_t start = UTCTimestampUsec();
+    size_t dropped = 0;
+    CdbIfWriteStatus status = Db_WriteBatch(batch_.mutation_map, &dropped);
+    uint64_t latency = UTCTimestampUsec() - start;
+
+    batches_++;
+    if (status == CDBIF_WRITE_DISCONNECTED) {
+        batch_errors_++;
+        batch_retry_ = true;
+        return false;
+    }
+    batch_retry_ = false;
+    if (status != CDBIF_WRITE_OK) {
+        batch_errors_++;
+        batch_dropped_columns_ += dropped;
+    }
+
+    size_t rows = 0;
+    for (CdbIfMutationMap::const_iterator it = batch_.mutation_map.begin();
+         it != batch_.mutation_map.end(); ++it) {
+        rows += it->second.size();
+    }
+    batch_col_lists_ += batch_.col_lists;
+    batch_rows_ += rows;
+    batch_columns_ += batch_.columns;
+    int bucket = 0;
+    for (size_t count = batch_.col_lists >> 1;
+         count && bucket < kBatchSizeBuckets - 1; count >>= 1) {
+        bucket++;
+    }
+    batch_size_hist_[bucket]++;
+    bucket = 0;
+    for (uint64_t usecs = latency / 10;
+         usecs && bucket < kBatchLatencyBuckets - 1; usecs /= 10) {
+        bucket++;
+    }
+    batch_latency_hist_[bucket]++;
+
+    batch_.Clear();
+    return status == CDBIF_WRITE_OK;
+}
+
 /*
  * called by the WorkQueue mechanism
  */
@@ -650,91 +892,34 @@ bool CdbIf::Db_AsyncAddColumn(CdbIfColList *cl) {
     uint64_t ts(UTCTimestampUsec());
     GenDb::ColList *new_colp;
 
+    /*
+     * A batch that failed is written first, the column list is added to
+     * it if the connection is still down
+     */
+    bool retry = batch_retry_;
+    if (retry && !Db_FlushBatch()) {
+        ret_value = false;
+    }
+
     if ((new_colp = cl->new_cl.get())) {
-        std::map<std::string, std::map<std::string, std::vector<cassandra::Mutation> > > mutation_map;
-        std::vector<cassandra::Mutation> mutations;
-        GenDb::NewCf::ColumnFamilyType cftype = GenDb::NewCf::COLUMN_FAMILY_INVALID;
-
-        for (std::vector<GenDb::NewCol>::iterator it = new_colp->columns_.begin();
-                    it != new_colp->columns_.end(); it++) {
-                cassandra::Mutation mutation;
-                cassandra::ColumnOrSuperColumn c_or_sc;
-                cassandra::Column c;
-
-                if (it->cftype_ == GenDb::NewCf::COLUMN_FAMILY_SQL) {
-                    CDBIF_CONDCHECK_LOG_RETF((it->name.size() == 1) && (it->value.size() == 1));
-                    CDBIF_CONDCHECK_LOG_RETF(cftype != GenDb::NewCf::COLUMN_FAMILY_NOSQL);
-                    cftype = GenDb::NewCf::COLUMN_FAMILY_SQL;
-
-                    std::string col_name;
-                    try {
-                        col_name = boost::get<std::string>(it->name.at(0));
-                    } catch (boost::bad_get& ex) {
-                        CDBIF_HANDLE_EXCEPTION(__func__ << "Exception for boost::get, what=" << ex.what());
-                    }
-                    c.__set_name(col_name);
-                    std::string col_value;
-                    DbDataValueToStringFromCf(col_value, new_colp->cfname_, col_name, it->value.at(0));
-                    c.__set_value(col_value);
-                    c.__set_timestamp(ts);
-                    if (it->ttl == -1) {
-                        if (cassandra_ttl_)
-                            c.__set_ttl(cassandra_ttl_);
-                    } else if (it->ttl) {
-                        c.__set_ttl(it->ttl);
-                    }
-
-                    c_or_sc.__set_column(c);
-                    mutation.__set_column_or_supercolumn(c_or_sc);
-                    mutations.push_back(mutation);
-                } else if (it->cftype_ == GenDb::NewCf::COLUMN_FAMILY_NOSQL) {
-                    CDBIF_CONDCHECK_LOG_RETF(cftype != GenDb::NewCf::COLUMN_FAMILY_SQL);
-                    cftype = GenDb::NewCf::COLUMN_FAMILY_NOSQL;
-
-                    std::string col_name;
-                    ConstructDbDataValueColumnName(col_name, new_colp->cfname_, it->name);
-                    c.__set_name(col_name);
-
-                    std::string col_value;
-                    ConstructDbDataValueColumnValue(col_value, new_colp->cfname_, it->value);
-                    c.__set_value(col_value);
-
-                    c.__set_timestamp(ts);
-                    if (it->ttl == -1) {
-                        if (cassandra_ttl_)
-                            c.__set_ttl(cassandra_ttl_);
-                    } else if (it->ttl) {
-                        c.__set_ttl(it->ttl);
-                    }
-
-                    c_or_sc.__set_column(c);
-                    mutation.__set_column_or_supercolumn(c_or_sc);
-                    mutations.push_back(mutation);
-                } else {
-                    CDBIF_CONDCHECK_LOG_RETF(0);
-                }
-        }
-        std::map<std::string, std::vector<cassandra::Mutation> > cf_map;
-        cf_map.insert(std::make_pair(new_colp->cfname_, mutations));
-        std::string key_value;
-        ConstructDbDataValueKey(key_value, new_colp->cfname_, new_colp->rowkey_);
-        mutation_map.insert(std::make_pair(key_value, cf_map));
-        try {
-            client_->batch_mutate(mutation_map, org::apache::cassandra::ConsistencyLevel::ONE);
-        } catch (InvalidRequestException& ire) {
-            CDBIF_HANDLE_EXCEPTION(__func__ << ": InvalidRequestException: " << ire.why << "for cf: " << new_colp->cfname_);
-        } catch (UnavailableException& ue) {
-            CDBIF_HANDLE_EXCEPTION(__func__ << "UnavailableException: " << ue.what() << "for cf: " << new_colp->cfname_);
-        } catch (TimedOutException& te) {
-            CDBIF_HANDLE_EXCEPTION(__func__ << "TimedOutException: " << te.what() << "for cf: " << new_colp->cfname_);
-        } catch (TTransportException& te) {
-            CDBIF_HANDLE_EXCEPTION(__func__ << ": TTransportException what: " << te.what());
-            errhandler_();
+        size_t columns = 0;
+        if (Db_AddColumnToMutationMap(batch_.mutation_map, new_colp, ts,
+                                      &columns)) {
+            if (batch_.col_lists++ == 0) {
+                batch_.start_time = ts;
+            }
+            batch_.columns += columns;
+        } else {
             ret_value = false;
-        } catch (TException& tx) {
-            CDBIF_HANDLE_EXCEPTION(__func__ << ": TTransportException what: " << tx.what() << new_colp->cfname_);
         }
-    } else {
+        if (!batch_retry_ && (batch_.columns >= max_batch_columns_ ||
+            ts - batch_.start_time >= max_batch_delay_usec_)) {
+            if (!Db_FlushBatch()) {
+                ret_value = false;
+            }
+        }
+    } else if (!retry) {
+        /* column list without columns is only queued to retry a batch */
         CDBIF_HANDLE_EXCEPTION(__func__ << ": No column info passed");
     }
 
@@ -743,6 +928,18 @@ bool CdbIf::Db_AsyncAddColumn(CdbIfColList *cl) {
     return ret_value;
 }
 
+/*
+ * called by the WorkQueue mechanism when the dequeue task yields or is done.
+ * The batch is kept across yields while there's a backlog, and written once
+ * the queue has been drained. A batch that failed waits for the connection
+ * to be re-established.
+ */
+void CdbIf::Db_AsyncAddColumnExit(bool done) {
+    if (done && !batch_retry_) {
+        Db_FlushBatch();
+    }
+}
+
 bool CdbIf::NewDb_AddColumn(std::auto_ptr<GenDb::ColList> cl) {
     if (!cdbq_.get()) return false;
 
@@ -752,9 +949,54 @@ bool CdbIf::NewDb_AddColumn(std::auto_ptr<GenDb::ColList> cl) {
 }
 
 bool CdbIf::AddColumnSync(std::auto_ptr<GenDb::ColList> cl) {
-    CdbIfColList *qentry(new CdbIfColList(cl));
+    CdbIfMutationMap mutation_map;
+    size_t columns = 0;
+    if (!Db_AddColumnToMutationMap(mutation_map, cl.get(),
+                                   UTCTimestampUsec(), &columns)) {
+        return false;
+    }
+    size_t dropped = 0;
+    return Db_WriteBatch(mutation_map, &dropped) == CDBIF_WRITE_OK;
+}
+
+void CdbIf::Db_SetBatchLimits(size_t max_columns, uint64_t max_delay_usec) {
+    max_batch_columns_ = max_columns;
+    max_batch_delay_usec_ = max_delay_usec;
+}
+
+void CdbIf::Db_ClearWriteBatchStats() {
+    batches_ = 0;
+    batch_col_lists_ = 0;
+    batch_rows_ = 0;
+    batch_columns_ = 0;
+    batch_errors_ = 0;
+    batch_dropped_columns_ = 0;
+    for (int i = 0; i < kBatchSizeBuckets; i++) {
+        batch_size_hist_[i] = 0;
+    }
+    for (int i = 0; i < kBatchLatencyBuckets; i++) {
+        batch_latency_hist_[i] = 0;
+    }
+}
 
-    return (Db_AsyncAddColumn(qentry));
+bool CdbIf::Db_GetWriteBatchStats(GenDb::DbWriteBatchStats &stats) const {
+    stats.set_batches(batches_);
+    stats.set_column_lists(batch_col_lists_);
+    stats.set_rows(batch_rows_);
+    stats.set_columns(batch_columns_);
+    stats.set_errors(batch_errors_);
+    stats.set_dropped_columns(batch_dropped_columns_);
+    std::vector<uint64_t> size_hist;
+    for (int i = 0; i < kBatchSizeBuckets; i++) {
+        size_hist.push_back(batch_size_hist_[i]);
+    }
+    stats.set_batch_size_histogram(size_hist);
+    std::vector<uint64_t> latency_hist;
+    for (int i = 0; i < kBatchLatencyBuckets; i++) {
+        latency_hist.push_back(batch_latency_hist_[i]);
+    }
+    stats.set_latency_usecs_histogram(latency_hist);
+    return true;
 }
 
 bool CdbIf::ColListFromColumnOrSuper(GenDb::ColList& ret,
@@ -16,6 +16,7 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 
+#include <tbb/atomic.h>
 #include <tbb/task.h>
 #include <tbb/mutex.h>
 
@@ -95,9 +96,55 @@ class CdbIf : public GenDbIf {
         virtual bool Db_GetQueueStats(uint64_t &queue_count, uint64_t &enqueues) const;
         virtual void Db_SetQueueWaterMark(bool high, size_t queue_count, DbQueueWaterMarkCb cb);
         virtual void Db_ResetQueueWaterMarks();
+        virtual bool Db_GetWriteBatchStats(GenDb::DbWriteBatchStats &stats) const;
+
+        /*
+         * Column lists dequeued from cdbq_ are coalesced by row key and
+         * column family into a single batch_mutate, which is issued when the
+         * batch has max_columns columns, when its oldest column list has
+         * waited max_delay_usec, or when the queue has been drained.
+         */
+        void Db_SetBatchLimits(size_t max_columns, uint64_t max_delay_usec);
+
+    protected:
+        typedef std::map<std::string, std::map<std::string,
+                std::vector<org::apache::cassandra::Mutation> > > CdbIfMutationMap;
+
+        struct CdbIfCfInfo {
+            CdbIfCfInfo() {
+            }
+            CdbIfCfInfo(CfDef *cfdef) {
+                cfdef_.reset(cfdef);
+            }
+            CdbIfCfInfo(CfDef *cfdef, GenDb::NewCf *cf) {
+                cfdef_.reset(cfdef);
+                cf_.reset(cf);
+            }
+            ~CdbIfCfInfo() {
+            }
+            std::auto_ptr<CfDef> cfdef_;
+            std::auto_ptr<GenDb::NewCf> cf_;
+        };
+        typedef boost::ptr_map<std::string, CdbIfCfInfo> CdbIfCfListType;
+        CdbIfCfListType CdbIfCfList;
+
+        void Db_InitQueue(std::string task_id, int task_instance);
+        void Db_UninitQueue();
+        /* result of a batch_mutate */
+        enum CdbIfWriteStatus {
+            CDBIF_WRITE_OK,
+            CDBIF_WRITE_INVALID,        /* rejected by cassandra */
+            CDBIF_WRITE_RETRY,          /* unavailable or timed out */
+            CDBIF_WRITE_DISCONNECTED,
+        };
+
+        /* issue the write, overridden by stand-ins that don't talk to cassandra */
+        virtual CdbIfWriteStatus Db_BatchMutate(
+                const CdbIfMutationMap& mutation_map);
 
     private:
         friend class CdbIfTest;
+        friend class CdbIfBatchTest;
 
         /* api to get range of column data for a range of rows 
          * Number of columns returned is less than or equal to count field
@@ -138,24 +185,6 @@ class CdbIf : public GenDbIf {
         typedef std::map<GenDb::DbDataType::type, CdbIfTypeInfo> CdbIfTypeMapDef;
         static CdbIfTypeMapDef CdbIfTypeMap;
 
-        struct CdbIfCfInfo {
-            CdbIfCfInfo() {
-            }
-            CdbIfCfInfo(CfDef *cfdef) {
-                cfdef_.reset(cfdef);
-            }
-            CdbIfCfInfo(CfDef *cfdef, GenDb::NewCf *cf) {
-                cfdef_.reset(cfdef);
-                cf_.reset(cf);
-            }
-            ~CdbIfCfInfo() {
-            }
-            std::auto_ptr<CfDef> cfdef_;
-            std::auto_ptr<GenDb::NewCf> cf_;
-        };
-        typedef boost::ptr_map<std::string, CdbIfCfInfo> CdbIfCfListType;
-        CdbIfCfListType CdbIfCfList;
-
         /*
          * structure for passing between sync and async add_column
          */
@@ -181,7 +210,38 @@ class CdbIf : public GenDbIf {
         bool DbDataValueVecFromString(GenDb::DbDataValueVec&, const DbDataTypeVec&, const string&);
         bool ColListFromColumnOrSuper(GenDb::ColList&, std::vector<org::apache::cassandra::ColumnOrSuperColumn>&, const string&);
 
+        /*
+         * Pending batch_mutate built from the column lists dequeued since
+         * the last flush
+         */
+        struct CdbIfBatch {
+            CdbIfBatch() : col_lists(0), columns(0), start_time(0) { }
+            void Clear() {
+                mutation_map.clear();
+                col_lists = 0;
+                columns = 0;
+                start_time = 0;
+            }
+            CdbIfMutationMap mutation_map;
+            size_t col_lists;
+            size_t columns;
+            uint64_t start_time;
+        };
+
+        static const size_t kMaxBatchColumns = 4096;
+        static const uint64_t kMaxBatchDelayUsec = 50000;
+        static const int kBatchSizeBuckets = 12;
+        static const int kBatchLatencyBuckets = 7;
+        static const int kMaxBatchRetries = 3;
+
         bool Db_AsyncAddColumn(CdbIfColList *cl);
+        void Db_AsyncAddColumnExit(bool done);
+        bool Db_AddColumnToMutationMap(CdbIfMutationMap& mutation_map,
+                GenDb::ColList *new_colp, uint64_t ts, size_t *columns);
+        CdbIfWriteStatus Db_WriteBatch(const CdbIfMutationMap& mutation_map,
+                size_t *dropped);
+        bool Db_FlushBatch();
+        void Db_ClearWriteBatchStats();
         bool Db_Columnfamily_present(const std::string& cfname);
         bool Db_GetColumnfamily(CdbIfCfInfo **info, const std::string& cfname);
         bool Db_IsInitDone() const;
@@ -236,6 +296,23 @@ class CdbIf : public GenDbIf {
         std::string name_;
 
         int cassandra_ttl_;
+
+        CdbIfBatch batch_;
+        /* set if the connection failed while writing batch_, it is
+           written again on reconnect */
+        tbb::atomic<bool> batch_retry_;
+        size_t max_batch_columns_;
+        uint64_t max_batch_delay_usec_;
+
+        /* write statistics, updated from the cdbq_ task and read by introspect */
+        tbb::atomic<uint64_t> batches_;
+        tbb::atomic<uint64_t> batch_col_lists_;
+        tbb::atomic<uint64_t> batch_rows_;
+        tbb::atomic<uint64_t> batch_columns_;
+        tbb::atomic<uint64_t> batch_errors_;
+        tbb::atomic<uint64_t> batch_dropped_columns_;
+        tbb::atomic<uint64_t> batch_size_hist_[kBatchSizeBuckets];
+        tbb::atomic<uint64_t> batch_latency_hist_[kBatchLatencyBuckets];
 };
 
 #endif
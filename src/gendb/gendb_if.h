@@ -148,6 +148,7 @@ class GenDbIf {
         virtual bool Db_GetQueueStats(uint64_t &queue_count, uint64_t &enqueues) const = 0;
         virtual void Db_SetQueueWaterMark(bool high, size_t queue_count, DbQueueWaterMarkCb cb) = 0;
         virtual void Db_ResetQueueWaterMarks() = 0;
+        virtual bool Db_GetWriteBatchStats(DbWriteBatchStats &stats) const = 0;
 
         static GenDbIf *GenDbIfImpl(boost::asio::io_service *ioservice, DbErrorHandler hdlr, 
                 std::string cassandra_ip, unsigned short cassandra_port, 
@@ -5,6 +5,98 @@
 #include "testing/gunit.h"
 #include "../cdb_if.h"
 #include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+
+//
+// In-memory stand-in for cassandra. It keeps the columns that are written
+// in a map instead of sending them to a live cassandra, which lets the
+// batching of the writes be tested and benchmarked. Reads aren't supported.
+//
+class CdbIfMem : public CdbIf {
+public:
+    typedef std::map<std::string, std::string> ColumnMap;
+    typedef std::map<std::string, ColumnMap> RowMap;
+    typedef std::map<std::string, RowMap> CfMap;
+
+    CdbIfMem() : batch_mutates_(0), fail_writes_(false), timeouts_(0) {
+    }
+
+    virtual bool Db_Init(std::string task_id, int task_instance) {
+        Db_InitQueue(task_id, task_instance);
+        return true;
+    }
+    virtual void Db_Uninit(bool shutdown) {
+        if (shutdown) {
+            Db_UninitQueue();
+        }
+    }
+    virtual bool Db_AddSetTablespace(const std::string& tablespace) {
+        return true;
+    }
+    virtual bool NewDb_AddColumnfamily(const GenDb::NewCf& cf) {
+        if (CdbIfCfList.find(cf.cfname_) == CdbIfCfList.end()) {
+            std::string name(cf.cfname_);
+            CdbIfCfList.insert(name,
+                new CdbIfCfInfo(new CfDef, new GenDb::NewCf(cf)));
+        }
+        return true;
+    }
+    virtual bool Db_GetRow(GenDb::ColList& ret, const std::string& cfname,
+            const GenDb::DbDataValueVec& rowkey) {
+        return false;
+    }
+
+    const CfMap &cf_map() const { return cf_map_; }
+    size_t batch_mutates() const { return batch_mutates_; }
+    // Fail writes as if the connection to cassandra was down
+    void set_fail_writes(bool fail) { fail_writes_ = fail; }
+    // Reject the writes to the column family as invalid
+    void set_invalid_cf(const std::string &cfname) { invalid_cf_ = cfname; }
+    // Time the next count writes out
+    void set_timeouts(int count) { timeouts_ = count; }
+
+protected:
+    virtual CdbIfWriteStatus Db_BatchMutate(
+            const CdbIfMutationMap& mutation_map) {
+        batch_mutates_++;
+        if (fail_writes_) {
+            return CDBIF_WRITE_DISCONNECTED;
+        }
+        if (timeouts_ > 0) {
+            timeouts_--;
+            return CDBIF_WRITE_RETRY;
+        }
+        for (CdbIfMutationMap::const_iterator it = mutation_map.begin();
+             it != mutation_map.end(); ++it) {
+            if (it->second.find(invalid_cf_) != it->second.end()) {
+                return CDBIF_WRITE_INVALID;
+            }
+        }
+        for (CdbIfMutationMap::const_iterator it = mutation_map.begin();
+             it != mutation_map.end(); ++it) {
+            for (std::map<std::string, std::vector<Mutation> >::const_iterator
+                 cf_it = it->second.begin(); cf_it != it->second.end();
+                 ++cf_it) {
+                ColumnMap &columns = cf_map_[cf_it->first][it->first];
+                for (std::vector<Mutation>::const_iterator m_it =
+                     cf_it->second.begin(); m_it != cf_it->second.end();
+                     ++m_it) {
+                    const Column &c = m_it->column_or_supercolumn.column;
+                    columns[c.name] = c.value;
+                }
+            }
+        }
+        return CDBIF_WRITE_OK;
+    }
+
+private:
+    CfMap cf_map_;
+    size_t batch_mutates_;
+    bool fail_writes_;
+    std::string invalid_cf_;
+    int timeouts_;
+};
 
 class CdbIfTest : public ::testing::Test {
 public:
@@ -42,6 +134,242 @@ private:
     CdbIf *cdbif_;
 };
 
+//
+// Feed the column lists written for a message, i.e. a message table row and
+// five index rows, to the dequeue callback of a CdbIfMem as a run of the
+// queue would.
+//
+class CdbIfBatchTest : public ::testing::Test {
+protected:
+    static const int kIndexCount = 5;
+    static const int kMaxBatchRetries = CdbIf::kMaxBatchRetries;
+
+    virtual void SetUp() {
+        GenDb::DbDataTypeVec key(1, GenDb::DbDataType::Unsigned32Type);
+        GenDb::DbDataTypeVec name(1, GenDb::DbDataType::Unsigned32Type);
+        GenDb::DbDataTypeVec value(1, GenDb::DbDataType::AsciiType);
+        cdbif_.NewDb_AddColumnfamily(GenDb::NewCf("Message", key, name, value));
+        for (int i = 0; i < kIndexCount; i++) {
+            cdbif_.NewDb_AddColumnfamily(
+                GenDb::NewCf(IndexCf(i), key, name, value));
+        }
+    }
+
+    static std::string IndexCf(int i) {
+        std::ostringstream out;
+        out << "MessageIndex" << i;
+        return out.str();
+    }
+
+    static GenDb::ColList *ColList(const std::string &cfname, uint32_t row,
+                                   uint32_t column, const std::string &value) {
+        GenDb::ColList *col_list = new GenDb::ColList;
+        col_list->cfname_ = cfname;
+        col_list->rowkey_.push_back(row);
+        GenDb::DbDataValueVec name(1, column);
+        GenDb::DbDataValueVec values(1, value);
+        col_list->columns_.push_back(GenDb::NewCol(name, values));
+        return col_list;
+    }
+
+    // A NULL column list is what is queued to retry a failed batch
+    bool AddColumn(GenDb::ColList *col_list) {
+        std::auto_ptr<GenDb::ColList> cl(col_list);
+        return cdbif_.Db_AsyncAddColumn(new CdbIf::CdbIfColList(cl));
+    }
+
+    // Each message gets its own message table row, the index rows are
+    // shared by the messages of the same second.
+    void AddMessages(int count, int per_second) {
+        for (int msg = 0; msg < count; msg++) {
+            std::string value("message body");
+            EXPECT_TRUE(AddColumn(ColList("Message", msg, 0, value)));
+            for (int i = 0; i < kIndexCount; i++) {
+                EXPECT_TRUE(AddColumn(
+                    ColList(IndexCf(i), msg / per_second, msg, "")));
+            }
+        }
+        cdbif_.Db_AsyncAddColumnExit(true);
+    }
+
+    bool FlushBatch() {
+        return cdbif_.Db_FlushBatch();
+    }
+
+    void GetStats(GenDb::DbWriteBatchStats *stats) {
+        cdbif_.Db_GetWriteBatchStats(*stats);
+    }
+
+    CdbIfMem cdbif_;
+};
+
+TEST_F(CdbIfBatchTest, Coalesce) {
+    cdbif_.Db_SetBatchLimits(1024, 1000000000);
+    AddMessages(100, 10);
+
+    // All column lists are written with one batch_mutate, and the index
+    // rows of the same second are merged.
+    EXPECT_EQ(1, cdbif_.batch_mutates());
+    GenDb::DbWriteBatchStats stats;
+    GetStats(&stats);
+    EXPECT_EQ(1, stats.get_batches());
+    EXPECT_EQ(600, stats.get_column_lists());
+    EXPECT_EQ(600, stats.get_columns());
+    EXPECT_EQ(100 + 10 * kIndexCount, stats.get_rows());
+
+    const CdbIfMem::CfMap &cf_map = cdbif_.cf_map();
+    EXPECT_EQ(1 + kIndexCount, cf_map.size());
+    EXPECT_EQ(100, cf_map.find("Message")->second.size());
+    const CdbIfMem::RowMap &index = cf_map.find(IndexCf(0))->second;
+    EXPECT_EQ(10, index.size());
+    EXPECT_EQ(10, index.begin()->second.size());
+}
+
+TEST_F(CdbIfBatchTest, SizeLimit) {
+    cdbif_.Db_SetBatchLimits(60, 1000000000);
+    AddMessages(100, 10);
+    EXPECT_EQ(10, cdbif_.batch_mutates());
+    GenDb::DbWriteBatchStats stats;
+    GetStats(&stats);
+    EXPECT_EQ(600, stats.get_column_lists());
+    // 10 batches of 60 column lists are all in the [32, 64) bucket.
+    EXPECT_EQ(10, stats.get_batch_size_histogram().at(5));
+}
+
+// The old behavior, one batch_mutate per column list.
+TEST_F(CdbIfBatchTest, NoBatching) {
+    cdbif_.Db_SetBatchLimits(1, 0);
+    AddMessages(100, 10);
+    EXPECT_EQ(600, cdbif_.batch_mutates());
+    EXPECT_EQ(1 + kIndexCount, cdbif_.cf_map().size());
+}
+
+// A batch that could not be written is kept, and written again once the
+// connection is back, before the column lists queued after it.
+TEST_F(CdbIfBatchTest, RetryAfterReconnect) {
+    cdbif_.Db_SetBatchLimits(6, 1000000000);
+    cdbif_.set_fail_writes(true);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(AddColumn(ColList("Message", i, 0, "body")));
+    }
+    EXPECT_FALSE(AddColumn(ColList("Message", 5, 0, "body")));
+    EXPECT_EQ(1, cdbif_.batch_mutates());
+
+    // Not retried while the connection is down
+    cdbif_.Db_AsyncAddColumnExit(true);
+    EXPECT_EQ(1, cdbif_.batch_mutates());
+    EXPECT_EQ(0, cdbif_.cf_map().size());
+
+    // Retried when the connection is re-established
+    cdbif_.set_fail_writes(false);
+    EXPECT_TRUE(AddColumn(NULL));
+    EXPECT_EQ(2, cdbif_.batch_mutates());
+    EXPECT_EQ(6, cdbif_.cf_map().find("Message")->second.size());
+
+    // Column lists that are dequeued before the retry are not lost either
+    cdbif_.set_fail_writes(true);
+    EXPECT_TRUE(AddColumn(ColList("Message", 6, 0, "body")));
+    cdbif_.Db_AsyncAddColumnExit(true);
+    cdbif_.set_fail_writes(false);
+    EXPECT_TRUE(AddColumn(ColList("Message", 7, 0, "body")));
+    cdbif_.Db_AsyncAddColumnExit(true);
+    EXPECT_EQ(8, cdbif_.cf_map().find("Message")->second.size());
+
+    GenDb::DbWriteBatchStats stats;
+    GetStats(&stats);
+    EXPECT_EQ(2, stats.get_errors());
+    EXPECT_EQ(8, stats.get_column_lists());
+    EXPECT_EQ(8, stats.get_rows());
+}
+
+// Transient errors are retried, and the batch is dropped if they persist.
+TEST_F(CdbIfBatchTest, RetryTransientErrors) {
+    cdbif_.Db_SetBatchLimits(1024, 1000000000);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(AddColumn(ColList("Message", i, 0, "body")));
+    }
+    cdbif_.set_timeouts(kMaxBatchRetries);
+    EXPECT_TRUE(FlushBatch());
+    EXPECT_EQ(kMaxBatchRetries + 1, cdbif_.batch_mutates());
+    EXPECT_EQ(5, cdbif_.cf_map().find("Message")->second.size());
+
+    for (int i = 5; i < 8; i++) {
+        EXPECT_TRUE(AddColumn(ColList("Message", i, 0, "body")));
+    }
+    cdbif_.set_timeouts(kMaxBatchRetries + 1);
+    EXPECT_FALSE(FlushBatch());
+    EXPECT_EQ(5, cdbif_.cf_map().find("Message")->second.size());
+
+    // The next batch is written
+    EXPECT_TRUE(AddColumn(ColList("Message", 8, 0, "body")));
+    EXPECT_TRUE(FlushBatch());
+    EXPECT_EQ(6, cdbif_.cf_map().find("Message")->second.size());
+
+    GenDb::DbWriteBatchStats stats;
+    GetStats(&stats);
+    EXPECT_EQ(3, stats.get_batches());
+    EXPECT_EQ(1, stats.get_errors());
+    EXPECT_EQ(3, stats.get_dropped_columns());
+}
+
+// The rows that cassandra rejects are found by splitting the batch, and the
+// rest of the batch is written.
+TEST_F(CdbIfBatchTest, InvalidRequest) {
+    cdbif_.Db_SetBatchLimits(1024, 1000000000);
+    cdbif_.set_invalid_cf(IndexCf(2));
+    for (int msg = 0; msg < 20; msg++) {
+        EXPECT_TRUE(AddColumn(ColList("Message", msg, 0, "body")));
+        for (int i = 0; i < kIndexCount; i++) {
+            EXPECT_TRUE(AddColumn(ColList(IndexCf(i), msg / 10, msg, "")));
+        }
+    }
+    EXPECT_FALSE(FlushBatch());
+
+    const CdbIfMem::CfMap &cf_map = cdbif_.cf_map();
+    EXPECT_EQ(kIndexCount, cf_map.size());
+    EXPECT_EQ(20, cf_map.find("Message")->second.size());
+    EXPECT_TRUE(cf_map.find(IndexCf(2)) == cf_map.end());
+    for (int i = 0; i < kIndexCount; i++) {
+        if (i != 2) {
+            EXPECT_EQ(2, cf_map.find(IndexCf(i))->second.size());
+        }
+    }
+
+    GenDb::DbWriteBatchStats stats;
+    GetStats(&stats);
+    EXPECT_EQ(1, stats.get_batches());
+    EXPECT_EQ(1, stats.get_errors());
+    EXPECT_EQ(20, stats.get_dropped_columns());
+
+    // The batches after it are not affected
+    cdbif_.set_invalid_cf("");
+    EXPECT_TRUE(AddColumn(ColList(IndexCf(2), 0, 0, "")));
+    EXPECT_TRUE(FlushBatch());
+    EXPECT_EQ(1, cdbif_.cf_map().find(IndexCf(2))->second.size());
+}
+
+//
+// Compare the number of writes and the time spent to build and issue them
+// with and without batching. MESSAGE_COUNT overrides the number of messages.
+//
+
+TEST_F(CdbIfBatchTest, Benchmark) {
+    int count = GetEnvInt("MESSAGE_COUNT", 20000);
+    size_t limits[] = { 1, 64, 1024, 4096 };
+    for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        cdbif_.Db_SetBatchLimits(limits[i], 1000000000);
+        size_t batch_mutates = cdbif_.batch_mutates();
+        uint64_t start = UTCTimestampUsec();
+        AddMessages(count, 100);
+        uint64_t elapsed = UTCTimestampUsec() - start;
+        LOG(DEBUG, "max columns " << limits[i] << ": " <<
+            cdbif_.batch_mutates() - batch_mutates << " batch_mutates, " <<
+            elapsed << " usec, " <<
+            count * 1000000ULL / std::max(elapsed, (uint64_t) 1) <<
+            " messages/sec");
+    }
+}
+
 TEST_F(CdbIfTest, Test1) {
     std::string teststrs[] = {"Test String1",
             "Test:Str :ing :2"};
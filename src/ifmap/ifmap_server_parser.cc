@@ -225,6 +225,9 @@ void IFMapServerParser::Receive(DB *db, const char *data, size_t length,
     IFMapServerParser::RequestList requests;
     ParseResults(xdoc, &requests);
 
+    // Enqueue the requests for all the tables together, which preserves
+    // their order within each DB partition.
+    DBRequestBatch batch;
     while (!requests.empty()) {
         auto_ptr<DBRequest> req(requests.front());
         requests.pop_front();
@@ -235,9 +238,10 @@ void IFMapServerParser::Receive(DB *db, const char *data, size_t length,
 
         IFMapTable *table = IFMapTable::FindTable(db, key->id_type);
         if (table != NULL) {
-            table->Enqueue(req.get());
+            batch.Add(table, req.get());
         } else {
             IFMAP_TRACE(IFMapTblNotFoundTrace, "Cant find table", key->id_type);
         }
     }
+    batch.Enqueue();
 }
@@ -10,7 +10,7 @@ using namespace boost::asio;
 
 SandeshTraceBufferPtr IOTraceBuf(SandeshTraceBufferCreate(IO_TRACE_BUF, 1000));
 
-EventManager::EventManager() {
+EventManager::EventManager() : buffer_pool_(new IoBufferPool) {
     shutdown_ = false;
 }
 
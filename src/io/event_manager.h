@@ -8,6 +8,7 @@
 #include <tbb/spin_mutex.h>
 
 #include "base/util.h"
+#include "io/io_buffer_pool.h"
 
 //
 // Wrapper around boost::io_service.
@@ -18,6 +19,10 @@
 // Poll directly or indirectly after having started a ServerThread (which
 // calls Run).
 //
+// The EventManager also owns the pool of I/O buffers that is used by all
+// the sessions that run on it. Each session also keeps a reference to the
+// pool, so buffers released after the EventManager is gone are still valid.
+//
 class EventManager {
 public:
     EventManager();
@@ -34,9 +39,11 @@ public:
     void Shutdown();
 
     boost::asio::io_service *io_service() { return &io_service_; }
+    IoBufferPool *buffer_pool() { return buffer_pool_.get(); }
 
 private:
     boost::asio::io_service io_service_;
+    IoBufferPoolPtr buffer_pool_;
     bool shutdown_;
     tbb::spin_mutex mutex_;
 
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "io/io_buffer_pool.h"
+
+#include "io/io_shared_buffer.h"
+#include "io/io_types.h"
+
+using namespace std;
+
+const size_t IoBufferPool::kMinBufferSize;
+const size_t IoBufferPool::kMaxBufferSize;
+const size_t IoBufferPool::kMaxCachedBytes;
+
+IoBufferPool::IoBufferPool() {
+    refcount_ = 0;
+    hits_ = 0;
+    misses_ = 0;
+    outstanding_bytes_ = 0;
+    cached_bytes_ = 0;
+}
+
+IoBufferPool::~IoBufferPool() {
+    for (int idx = 0; idx < kClassCount; idx++) {
+        SizeClass *sclass = &classes_[idx];
+        for (vector<uint8_t *>::iterator iter = sclass->free_list.begin();
+             iter != sclass->free_list.end(); ++iter) {
+            delete [] *iter;
+        }
+        sclass->free_list.clear();
+    }
+}
+
+int IoBufferPool::ClassIndex(size_t size) {
+    int idx = 0;
+    for (size_t bufsize = kMinBufferSize; bufsize < size; bufsize <<= 1) {
+        idx++;
+    }
+    return idx;
+}
+
+size_t IoBufferPool::BufferSize(size_t size) {
+    if (size > kMaxBufferSize) {
+        return size;
+    }
+    return kMinBufferSize << ClassIndex(size);
+}
+
+uint8_t *IoBufferPool::Allocate(size_t size) {
+    size_t bufsize = BufferSize(size);
+    outstanding_bytes_ += bufsize;
+    if (bufsize <= kMaxBufferSize) {
+        SizeClass *sclass = &classes_[ClassIndex(bufsize)];
+        tbb::spin_mutex::scoped_lock lock(sclass->mutex);
+        if (!sclass->free_list.empty()) {
+            uint8_t *data = sclass->free_list.back();
+            sclass->free_list.pop_back();
+            lock.release();
+            cached_bytes_ -= bufsize;
+            hits_++;
+            return data;
+        }
+    }
+    misses_++;
+    return new uint8_t[bufsize];
+}
+
+void IoBufferPool::Release(uint8_t *data, size_t size) {
+    size_t bufsize = BufferSize(size);
+    outstanding_bytes_ -= bufsize;
+    if (bufsize <= kMaxBufferSize) {
+        SizeClass *sclass = &classes_[ClassIndex(bufsize)];
+        tbb::spin_mutex::scoped_lock lock(sclass->mutex);
+        if ((sclass->free_list.size() + 1) * bufsize <= kMaxCachedBytes) {
+            sclass->free_list.push_back(data);
+            lock.release();
+            cached_bytes_ += bufsize;
+            return;
+        }
+    }
+    delete [] data;
+}
+
+void IoBufferPool::GetStats(IoBufferPoolStats *stats) const {
+    stats->set_hits(hits_);
+    stats->set_misses(misses_);
+    stats->set_outstanding_bytes(outstanding_bytes_);
+    stats->set_cached_bytes(cached_bytes_);
+    stats->set_shared_buffers(IoSharedBuffer::live_count());
+    stats->set_shared_bytes(IoSharedBuffer::live_bytes());
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef __IO_BUFFER_POOL_H__
+#define __IO_BUFFER_POOL_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/intrusive_ptr.hpp>
+#include <tbb/atomic.h>
+#include <tbb/spin_mutex.h>
+
+#include "base/util.h"
+
+class IoBufferPoolStats;
+
+//
+// Pool of I/O buffers shared by the sessions of an EventManager.
+//
+// Buffers are carved into power of two size classes between kMinBufferSize
+// and kMaxBufferSize. A released buffer is kept on the free list of its
+// class, up to kMaxCachedBytes per class, and handed out again to the next
+// allocation of the same class. Requests larger than kMaxBufferSize are
+// always satisfied from the heap.
+//
+// Release must be called with the same size that was passed to Allocate.
+//
+// The pool is reference counted. The EventManager and each session that
+// allocates from it hold a reference, so the pool outlives every buffer
+// that is still held by a session or its write queue.
+//
+class IoBufferPool {
+public:
+    static const size_t kMinBufferSize = 256;
+    static const size_t kMaxBufferSize = 64 * 1024;
+    static const size_t kMaxCachedBytes = 1024 * 1024;
+
+    IoBufferPool();
+    ~IoBufferPool();
+
+    uint8_t *Allocate(size_t size);
+    void Release(uint8_t *data, size_t size);
+
+    // Size of the buffer that is allocated for a request of the given size.
+    static size_t BufferSize(size_t size);
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t outstanding_bytes() const { return outstanding_bytes_; }
+    uint64_t cached_bytes() const { return cached_bytes_; }
+    void GetStats(IoBufferPoolStats *stats) const;
+
+private:
+    friend void intrusive_ptr_add_ref(IoBufferPool *pool);
+    friend void intrusive_ptr_release(IoBufferPool *pool);
+
+    static const int kClassCount = 9;
+
+    struct SizeClass {
+        tbb::spin_mutex mutex;
+        std::vector<uint8_t *> free_list;
+    };
+
+    static int ClassIndex(size_t size);
+
+    tbb::atomic<int> refcount_;
+    SizeClass classes_[kClassCount];
+    tbb::atomic<uint64_t> hits_;
+    tbb::atomic<uint64_t> misses_;
+    tbb::atomic<uint64_t> outstanding_bytes_;
+    tbb::atomic<uint64_t> cached_bytes_;
+
+    DISALLOW_COPY_AND_ASSIGN(IoBufferPool);
+};
+
+typedef boost::intrusive_ptr<IoBufferPool> IoBufferPoolPtr;
+
+inline void intrusive_ptr_add_ref(IoBufferPool *pool) {
+    pool->refcount_.fetch_and_increment();
+}
+
+inline void intrusive_ptr_release(IoBufferPool *pool) {
+    if (pool->refcount_.fetch_and_decrement() == 1) {
+        delete pool;
+    }
+}
+
+#endif // __IO_BUFFER_POOL_H__
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "io/io_shared_buffer.h"
+
+using namespace std;
+
+tbb::atomic<uint64_t> IoSharedBuffer::live_count_;
+tbb::atomic<uint64_t> IoSharedBuffer::live_bytes_;
+
+IoSharedBuffer::IoSharedBuffer(string *data, size_t offset)
+    : offset_(offset) {
+    assert(offset <= data->size());
+    refcount_ = 0;
+    data_.swap(*data);
+    live_count_++;
+    live_bytes_ += data_.size();
+}
+
+IoSharedBuffer::IoSharedBuffer(const uint8_t *data, size_t size)
+    : data_(reinterpret_cast<const char *>(data), size), offset_(0) {
+    refcount_ = 0;
+    live_count_++;
+    live_bytes_ += data_.size();
+}
+
+IoSharedBuffer::~IoSharedBuffer() {
+    live_count_--;
+    live_bytes_ -= data_.size();
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef __IO_SHARED_BUFFER_H__
+#define __IO_SHARED_BUFFER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/intrusive_ptr.hpp>
+#include <tbb/atomic.h>
+
+#include "base/util.h"
+
+//
+// Immutable, reference counted data that is sent on several sessions.
+//
+// The data is set when the buffer is created: the contents of a string are
+// swapped in without a copy, and raw data is copied. A session that can't
+// write all of it right away keeps a reference to the buffer in its
+// write queue instead of a copy of the data, so the buffer lives until the
+// last session that holds it has written it.
+//
+// The number and size of the buffers that are alive are kept for the
+// process, to account for the memory held by the write queues.
+//
+class IoSharedBuffer {
+public:
+    // The contents of the string are swapped in, which leaves the string
+    // empty. The data starts at the given offset.
+    IoSharedBuffer(std::string *data, size_t offset);
+    IoSharedBuffer(const uint8_t *data, size_t size);
+    ~IoSharedBuffer();
+
+    const uint8_t *data() const {
+        return reinterpret_cast<const uint8_t *>(data_.data()) + offset_;
+    }
+    size_t size() const { return data_.size() - offset_; }
+
+    static uint64_t live_count() { return live_count_; }
+    static uint64_t live_bytes() { return live_bytes_; }
+
+private:
+    friend void intrusive_ptr_add_ref(IoSharedBuffer *buffer);
+    friend void intrusive_ptr_release(IoSharedBuffer *buffer);
+
+    static tbb::atomic<uint64_t> live_count_;
+    static tbb::atomic<uint64_t> live_bytes_;
+
+    tbb::atomic<int> refcount_;
+    std::string data_;
+    size_t offset_;
+
+    DISALLOW_COPY_AND_ASSIGN(IoSharedBuffer);
+};
+
+typedef boost::intrusive_ptr<IoSharedBuffer> IoSharedBufferPtr;
+
+inline void intrusive_ptr_add_ref(IoSharedBuffer *buffer) {
+    buffer->refcount_.fetch_and_increment();
+}
+
+inline void intrusive_ptr_release(IoSharedBuffer *buffer) {
+    if (buffer->refcount_.fetch_and_decrement() == 1) {
+        delete buffer;
+    }
+}
+
+#endif // __IO_SHARED_BUFFER_H__
@@ -6,6 +6,8 @@
 
 #include "base/util.h"
 #include "base/logging.h"
+#include "io/event_manager.h"
+#include "io/io_buffer_pool.h"
 #include "io/tcp_session.h"
 #include "io/io_log.h"
 
@@ -14,6 +16,7 @@ using namespace boost::system;
 using tbb::mutex;
 
 TcpMessageWriter::TcpMessageWriter(Socket *socket, TcpSession *session) :
+    queue_bytes_(0), write_pending_(false), corked_(false),
     socket_(socket), offset_(0), session_(session) {
 }
 
@@ -35,31 +38,108 @@ int TcpMessageWriter::Send(const uint8_t *data, size_t len, error_code &ec) {
     session_->server_->stats_.write_calls++;
     session_->server_->stats_.write_bytes += len;
 
-    if (buffer_queue_.empty()) {
-        wrote = socket_->write_some(boost::asio::buffer(data, len), ec);
-        if (TcpSession::IsSocketErrorHard(ec)) return -1;
-        assert(wrote >= 0);
-
-        if ((size_t)wrote != len) {
-            TCP_SESSION_LOG_UT_DEBUG(session_, TCP_DIR_OUT,
-                "Encountered partial send of " << wrote << " bytes when "
-                "sending " << len << " bytes, Error: " << ec);
-            BufferAppend(data + wrote, len - wrote);
-            DeferWrite();
-        }
-    } else {
+    if (write_pending_) {
         TCP_SESSION_LOG_UT_DEBUG(session_, TCP_DIR_OUT,
             "Write not ready. Enqueue buffer (len = " << len << ") and return");
         BufferAppend(data, len);
+        return 0;
+    }
+
+    if (corked_ && queue_bytes_ + len <= kMaxCorkBytes) {
+        BufferAppend(data, len);
+        return len;
+    }
+
+    // Write the message along with the data that was queued while corked.
+    if (!buffer_queue_.empty()) {
+        BufferAppend(data, len);
+        if (!WriteQueue(ec)) return -1;
+        return write_pending_ ? 0 : len;
+    }
+
+    wrote = socket_->write_some(boost::asio::buffer(data, len), ec);
+    session_->stats_.write_syscalls++;
+    session_->server_->stats_.write_syscalls++;
+    if (TcpSession::IsSocketErrorHard(ec)) return -1;
+    assert(wrote >= 0);
+
+    if ((size_t)wrote != len) {
+        TCP_SESSION_LOG_UT_DEBUG(session_, TCP_DIR_OUT,
+            "Encountered partial send of " << wrote << " bytes when "
+            "sending " << len << " bytes, Error: " << ec);
+        BufferAppend(data + wrote, len - wrote);
+        DeferWrite();
+    }
+    return wrote;
+}
+
+int TcpMessageWriter::Send(const uint8_t *header, size_t header_len,
+                           const IoSharedBufferPtr &body, error_code &ec) {
+    size_t len = header_len + body->size();
+
+    // Update socket write call statistics.
+    session_->stats_.write_calls++;
+    session_->stats_.write_bytes += len;
+
+    session_->server_->stats_.write_calls++;
+    session_->server_->stats_.write_bytes += len;
+
+    if (write_pending_) {
+        BufferAppend(header, header_len);
+        SharedAppend(body, 0);
+        return 0;
+    }
+
+    if (corked_ && queue_bytes_ + len <= kMaxCorkBytes) {
+        BufferAppend(header, header_len);
+        SharedAppend(body, 0);
+        return len;
+    }
+
+    if (!buffer_queue_.empty()) {
+        BufferAppend(header, header_len);
+        SharedAppend(body, 0);
+        if (!WriteQueue(ec)) return -1;
+        return write_pending_ ? 0 : len;
+    }
+
+    BufferList buffers;
+    buffers.push_back(const_buffer(header, header_len));
+    buffers.push_back(const_buffer(body->data(), body->size()));
+    size_t wrote = WriteBuffers(buffers, ec);
+    if (TcpSession::IsSocketErrorHard(ec)) return -1;
+
+    if (wrote != len) {
+        TCP_SESSION_LOG_UT_DEBUG(session_, TCP_DIR_OUT,
+            "Encountered partial send of " << wrote << " bytes when "
+            "sending " << len << " bytes, Error: " << ec);
+        if (wrote < header_len) {
+            BufferAppend(header + wrote, header_len - wrote);
+            SharedAppend(body, 0);
+        } else {
+            SharedAppend(body, wrote - header_len);
+        }
+        DeferWrite();
     }
     return wrote;
 }
 
+void TcpMessageWriter::Cork() {
+    corked_ = true;
+}
+
+bool TcpMessageWriter::Uncork(error_code &ec) {
+    corked_ = false;
+    if (write_pending_) return true;
+    return WriteQueue(ec);
+}
+
 void TcpMessageWriter::DeferWrite() {
 
     // Update socket write block count.
     session_->stats_.write_blocked++;
     session_->server_->stats_.write_blocked++;
+    write_pending_ = true;
     socket_->async_write_some(
         boost::asio::null_buffers(), 
         boost::bind(&TcpMessageWriter::HandleWriteReady, this,
@@ -68,12 +148,76 @@ void TcpMessageWriter::DeferWrite() {
     return;
 }
 
+// Fill the list with the unwritten part of the buffers at the head of the
+// queue and return the number of bytes in them.
+size_t TcpMessageWriter::GatherBuffers(BufferList *buffers) {
+    size_t bytes = 0;
+    int offset = offset_;
+    for (BufferQueue::const_iterator iter = buffer_queue_.begin();
+         iter != buffer_queue_.end() && buffers->size() < kMaxWriteBuffers;
+         ++iter) {
+        const uint8_t *data =
+            buffer_cast<const uint8_t *>(iter->buffer) + offset;
+        size_t size = buffer_size(iter->buffer) - offset;
+        buffers->push_back(const_buffer(data, size));
+        bytes += size;
+        offset = 0;
+    }
+    return bytes;
+}
+
+size_t TcpMessageWriter::WriteBuffers(const BufferList &buffers,
+                                      error_code &ec) {
+    size_t wrote = socket_->write_some(buffers, ec);
+    session_->stats_.write_syscalls++;
+    session_->server_->stats_.write_syscalls++;
+    return wrote;
+}
+
+// Remove the given number of written bytes from the head of the queue.
+void TcpMessageWriter::ConsumeBuffers(size_t bytes) {
+    queue_bytes_ -= bytes;
+    while (bytes > 0) {
+        const QueueEntry &head = buffer_queue_.front();
+        size_t remaining = buffer_size(head.buffer) - offset_;
+        if (bytes < remaining) {
+            offset_ += bytes;
+            return;
+        }
+        bytes -= remaining;
+        offset_ = 0;
+        DeleteBuffer(head);
+        buffer_queue_.pop_front();
+    }
+}
+
+// Write the queue until it is empty or the socket can not take any more
+// data, in which case wait for it to become writable. Returns false on a
+// hard error.
+bool TcpMessageWriter::WriteQueue(error_code &ec) {
+    while (!buffer_queue_.empty()) {
+        BufferList buffers;
+        size_t bytes = GatherBuffers(&buffers);
+        size_t wrote = WriteBuffers(buffers, ec);
+        if (TcpSession::IsSocketErrorHard(ec)) {
+            return false;
+        }
+        ConsumeBuffers(wrote);
+        if (wrote != bytes) {
+            DeferWrite();
+            return true;
+        }
+    }
+    return true;
+}
+
 // Socket is ready for write. Flush any pending data and notify 
 // clients aboout it.
 void TcpMessageWriter::HandleWriteReady(TcpSessionPtr session_ptr,
                                         const error_code &error,
                                         uint64_t block_start_time) {
     mutex::scoped_lock lock(session_->mutex());
+    write_pending_ = false;
 
     // Update socket write block time.
     uint64_t blocked_usecs = UTCTimestampUsec() - block_start_time;
@@ -89,29 +233,15 @@ void TcpMessageWriter::HandleWriteReady(TcpSessionPtr session_ptr,
     //
     if (session_->IsClosedLocked()) return;
 
-    while (!buffer_queue_.empty()) {
-        boost::asio::mutable_buffer head = buffer_queue_.front();
-        const uint8_t *data = buffer_cast<const uint8_t *>(head) + offset_;
-        int remaining = buffer_size(head) - offset_;
+    {
         error_code ec;
-        int wrote = socket_->write_some(buffer(data, remaining), ec);
-        if (TcpSession::IsSocketErrorHard(ec)) {
+        if (!WriteQueue(ec)) {
             lock.release();
             if (!cb_.empty()) cb_(ec);
             return;
         }
-        assert(wrote >= 0);
-        if (wrote != remaining) {
-            offset_ += wrote;
-            DeferWrite();
-            return;
-        } else {
-            offset_ = 0;
-            DeleteBuffer(head);
-            buffer_queue_.pop_front();
-        }
     }
-    buffer_queue_.clear();
+    if (write_pending_) return;
 
 done:
     lock.release();
@@ -125,16 +255,29 @@ done:
 }
 
 void TcpMessageWriter::BufferAppend(const uint8_t *src, int bytes) {
-    u_int8_t *data = new u_int8_t[bytes];
+    if (bytes == 0) return;
+    u_int8_t *data = session_->buffer_pool()->Allocate(bytes);
     memcpy(data, src, bytes);
-    mutable_buffer buffer = mutable_buffer(data, bytes);
-    buffer_queue_.push_back(buffer);
+    buffer_queue_.push_back(QueueEntry());
+    buffer_queue_.back().buffer = const_buffer(data, bytes);
+    queue_bytes_ += bytes;
 }
 
-void TcpMessageWriter::DeleteBuffer(mutable_buffer buffer) {
-    const uint8_t *data = buffer_cast<const uint8_t *>(buffer);
-    delete[] data;
-    return;
+void TcpMessageWriter::SharedAppend(const IoSharedBufferPtr &shared,
+                                    size_t offset) {
+    size_t bytes = shared->size() - offset;
+    if (bytes == 0) return;
+    buffer_queue_.push_back(QueueEntry());
+    buffer_queue_.back().buffer = const_buffer(shared->data() + offset, bytes);
+    buffer_queue_.back().shared = shared;
+    queue_bytes_ += bytes;
+}
+
+void TcpMessageWriter::DeleteBuffer(const QueueEntry &entry) {
+    if (entry.shared) return;
+    uint8_t *data = const_cast<uint8_t *>(
+        buffer_cast<const uint8_t *>(entry.buffer));
+    session_->buffer_pool()->Release(data, buffer_size(entry.buffer));
 }
 
 void TcpMessageWriter::RegisterNotification(SendReadyCb cb) {
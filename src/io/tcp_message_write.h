@@ -6,6 +6,7 @@
 #define __MESSAGE_WRITE_H__
 
 #include <list>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/asio/buffer.hpp>
@@ -13,34 +14,81 @@
 #include <boost/system/error_code.hpp>
 #include <tbb/mutex.h>
 #include "base/util.h"
+#include "io/io_shared_buffer.h"
 
 using namespace boost::system;
 
 class TcpSession;
 
+//
+// Writes messages to a non-blocking socket on behalf of a TcpSession.
+//
+// Data that can not be written right away is copied into the buffer queue
+// and written when the socket becomes writable. The queue is written with
+// scatter-gather writes of up to kMaxWriteBuffers buffers per call, so that
+// a backlog of many small messages costs few system calls.
+//
+// While the writer is corked, messages are only queued, up to kMaxCorkBytes,
+// and are written together when it is uncorked.
+//
+// A message can also be sent as a header followed by a shared body. The
+// header and body are written with one call, and a body that can't be
+// written right away is queued by reference rather than copied.
+//
+// Concurrency: all methods except HandleWriteReady are called with the
+// session mutex held.
+//
 class TcpMessageWriter {
 public:
     typedef boost::asio::ip::tcp::socket Socket;
     static const int kDefaultBufferSize = 4 * 1024;
+    // Same as the limit on the number of buffers that asio passes to writev.
+    static const size_t kMaxWriteBuffers = 64;
+    static const size_t kMaxCorkBytes = 64 * 1024;
+
     explicit TcpMessageWriter(Socket *, TcpSession *session);
     ~TcpMessageWriter();
 
-    // return false for send  
+    // Returns the number of bytes of the message that were written or
+    // queued without blocking the session, or -1 on a hard error.
     int Send(const uint8_t *msg, size_t len, error_code &ec);
+    int Send(const uint8_t *header, size_t header_len,
+             const IoSharedBufferPtr &body, error_code &ec);
+
+    void Cork();
+    // Returns false on a hard error.
+    bool Uncork(error_code &ec);
 
     typedef boost::function<void(const error_code &ec)> SendReadyCb;
     void RegisterNotification(SendReadyCb);
 
 private:
     typedef boost::intrusive_ptr<TcpSession> TcpSessionPtr;
-    typedef std::list<boost::asio::mutable_buffer> BufferQueue;
+    typedef std::vector<boost::asio::const_buffer> BufferList;
+
+    // The data of a queue entry is either a buffer from the pool of the
+    // session or a part of a shared buffer.
+    struct QueueEntry {
+        boost::asio::const_buffer buffer;
+        IoSharedBufferPtr shared;
+    };
+    typedef std::list<QueueEntry> BufferQueue;
+
     void BufferAppend(const uint8_t *data, int len);
-    void DeleteBuffer(boost::asio::mutable_buffer buffer); 
+    void SharedAppend(const IoSharedBufferPtr &shared, size_t offset);
+    void DeleteBuffer(const QueueEntry &entry);
     void DeferWrite();
     void HandleWriteReady(TcpSessionPtr session_ref, const error_code &ec,
                           uint64_t block_start_time);
+    size_t GatherBuffers(BufferList *buffers);
+    size_t WriteBuffers(const BufferList &buffers, error_code &ec);
+    void ConsumeBuffers(size_t bytes);
+    bool WriteQueue(error_code &ec);
 
     BufferQueue buffer_queue_;
+    size_t queue_bytes_;        // Bytes in buffer_queue_ not yet written.
+    bool write_pending_;        // Waiting for the socket to become writable.
+    bool corked_;
     SendReadyCb cb_;
     Socket *socket_;
     int offset_;
@@ -391,6 +391,10 @@ void TcpServer::SocketStats::GetTxStats(TcpServerSocketStats &socket_stats) cons
     if (write_calls) {
         socket_stats.average_bytes = write_bytes/write_calls;
     }
+    socket_stats.syscalls = write_syscalls;
+    if (write_syscalls) {
+        socket_stats.average_syscall_bytes = write_bytes/write_syscalls;
+    }
     socket_stats.blocked_count = write_blocked;
     socket_stats.blocked_duration = duration_usecs_to_string(
         write_blocked_duration_usecs);
@@ -60,6 +60,7 @@ class TcpServer {
             read_bytes = 0;
             write_calls = 0;
             write_bytes = 0;
+            write_syscalls = 0;
             write_blocked = 0;
             write_blocked_duration_usecs = 0;
         }
@@ -71,6 +72,7 @@ class TcpServer {
         tbb::atomic<uint64_t> read_bytes;
         tbb::atomic<uint64_t> write_calls;
         tbb::atomic<uint64_t> write_bytes;
+        tbb::atomic<uint64_t> write_syscalls;
         tbb::atomic<uint64_t> write_blocked;
         tbb::atomic<uint64_t> write_blocked_duration_usecs;
     };
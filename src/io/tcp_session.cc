@@ -13,6 +13,7 @@
 #include "base/task.h"
 #include "base/util.h"
 #include "io/event_manager.h"
+#include "io/io_buffer_pool.h"
 #include "io/tcp_server.h"
 #include "io/tcp_message_write.h"
 #include "io/io_log.h"
@@ -47,9 +48,13 @@ private:
 TcpSession::TcpSession(
     TcpServer *server, Socket *socket, bool async_read_ready)
     : server_(server),
+      buffer_pool_(server->event_manager()->buffer_pool()),
       socket_(socket),
       read_on_connect_(async_read_ready),
+      min_buffer_size_(kDefaultBufferSize),
       buffer_size_(kDefaultBufferSize),
+      read_full_count_(0),
+      read_short_count_(0),
       established_(false),
       closed_(false),
       direction_(ACTIVE),
@@ -74,7 +79,7 @@ TcpSession::~TcpSession() {
 }
 
 mutable_buffer TcpSession::AllocateBuffer() {
-    u_int8_t *data = new u_int8_t[buffer_size_];
+    u_int8_t *data = buffer_pool()->Allocate(buffer_size_);
     mutable_buffer buffer = mutable_buffer(data, buffer_size_);
     {
         tbb::mutex::scoped_lock lock(mutex_);
@@ -85,7 +90,36 @@ mutable_buffer TcpSession::AllocateBuffer() {
 
 void TcpSession::DeleteBuffer(mutable_buffer buffer) {
     uint8_t *data = buffer_cast<uint8_t *>(buffer);
-    delete[] data;
+    buffer_pool()->Release(data, buffer_size(buffer));
+}
+
+//
+// Grow the read buffer for sessions that keep filling it, so that a busy
+// session needs fewer reads (and Reader tasks), and shrink it back when the
+// session goes quiet so that idle sessions do not hold on to large buffers.
+//
+// Called from the read handler. There is a single outstanding read per
+// session, so buffer_size_ is not modified concurrently with AllocateBuffer.
+//
+void TcpSession::AdjustBufferSize(size_t bytes_transferred, size_t capacity) {
+    if (bytes_transferred == capacity) {
+        read_short_count_ = 0;
+        if (++read_full_count_ >= kReadGrowThreshold &&
+            buffer_size_ * 2 <= (int) IoBufferPool::kMaxBufferSize) {
+            buffer_size_ *= 2;
+            read_full_count_ = 0;
+        }
+    } else if (bytes_transferred < capacity / 4) {
+        read_full_count_ = 0;
+        if (++read_short_count_ >= kReadShrinkThreshold &&
+            buffer_size_ / 2 >= min_buffer_size_) {
+            buffer_size_ /= 2;
+            read_short_count_ = 0;
+        }
+    } else {
+        read_full_count_ = 0;
+        read_short_count_ = 0;
+    }
 }
 
 static int BufferCmp(const mutable_buffer &lhs, const const_buffer &rhs) {
@@ -260,6 +294,13 @@ void TcpSession::AsyncWriteHandler(TcpSessionPtr session,
     }
 }
 
+void TcpSession::AsyncSharedWriteHandler(TcpSessionPtr session,
+                                         IoSharedBufferPtr header,
+                                         IoSharedBufferPtr body,
+                                         const boost::system::error_code &error) {
+    AsyncWriteHandler(session, error);
+}
+
 bool TcpSession::Send(const u_int8_t *data, size_t size, size_t *sent) {
     bool ret = true;
     tbb::mutex::scoped_lock lock(mutex_);
@@ -295,6 +336,66 @@ bool TcpSession::Send(const u_int8_t *data, size_t size, size_t *sent) {
     return ret;
 }
 
+bool TcpSession::SendShared(const u_int8_t *header, size_t header_size,
+                            const IoSharedBufferPtr &body, size_t *sent) {
+    tbb::mutex::scoped_lock lock(mutex_);
+
+    // Reset sent, if provided.
+    if (sent) *sent = 0;
+
+    if (!established_) return false;
+
+    if (!socket_->non_blocking()) {
+        // The header is copied, and the handler keeps both buffers alive
+        // until asio is done writing them.
+        IoSharedBufferPtr header_buffer(
+            new IoSharedBuffer(header, header_size));
+        vector<const_buffer> buffers;
+        buffers.push_back(const_buffer(header_buffer->data(),
+                                       header_buffer->size()));
+        buffers.push_back(const_buffer(body->data(), body->size()));
+        boost::asio::async_write(
+            *socket_.get(), buffers,
+            boost::bind(&TcpSession::AsyncSharedWriteHandler,
+                        TcpSessionPtr(this), header_buffer, body,
+                        boost::asio::placeholders::error));
+        if (sent) *sent = header_size + body->size();
+        return true;
+    }
+
+    boost::system::error_code error;
+    int len = writer_->Send(header, header_size, body, error);
+    lock.release();
+    if (len < 0) {
+        TCP_SESSION_LOG_INFO(this, TCP_DIR_OUT,
+            "Write failed due to error: " << error.category().name() << " "
+                                          << error.message());
+        CloseInternal(true);
+        return false;
+    }
+    if (sent) *sent = len;
+    return (size_t) len == header_size + body->size();
+}
+
+void TcpSession::Cork() {
+    tbb::mutex::scoped_lock lock(mutex_);
+    if (!established_ || !socket_->non_blocking()) return;
+    writer_->Cork();
+}
+
+void TcpSession::Uncork() {
+    tbb::mutex::scoped_lock lock(mutex_);
+    if (!established_) return;
+    boost::system::error_code error;
+    if (!writer_->Uncork(error)) {
+        lock.release();
+        TCP_SESSION_LOG_INFO(this, TCP_DIR_OUT,
+            "Write failed due to error: " << error.category().name() << " "
+                                          << error.message());
+        CloseInternal(true);
+    }
+}
+
 void TcpSession::AsyncReadHandler(
     TcpSessionPtr session, mutable_buffer buffer,
     const boost::system::error_code &error, size_t bytes_transferred) {
@@ -320,6 +421,7 @@ void TcpSession::AsyncReadHandler(
     session->stats_.read_bytes += bytes_transferred;
     session->server_->stats_.read_calls++;
     session->server_->stats_.read_bytes += bytes_transferred;
+    session->AdjustBufferSize(bytes_transferred, buffer_size(buffer));
 
     Buffer rdbuf(buffer_cast<const uint8_t *>(buffer), bytes_transferred);
     Reader *task = new Reader(
@@ -651,5 +753,8 @@ void TcpSession::GetTxSocketStats(TcpServerSocketStats &socket_stats) const {
 }
 
 void TcpSession::SetBufferSize(int buffer_size) {
+    min_buffer_size_ = buffer_size;
     buffer_size_ = buffer_size;
+    read_full_count_ = 0;
+    read_short_count_ = 0;
 }
@@ -21,6 +21,8 @@
 #include <tbb/compat/condition_variable>
 #endif
 #include "base/util.h"
+#include "io/io_buffer_pool.h"
+#include "io/io_shared_buffer.h"
 #include "io/tcp_server.h"
 
 class EventManager;
@@ -36,6 +38,12 @@ class TcpMessageWriter;
 class TcpSession {
   public:
     static const int kDefaultBufferSize = 4 * 1024;
+    // Number of consecutive reads that fill the read buffer after which
+    // the buffer size is doubled.
+    static const int kReadGrowThreshold = 4;
+    // Number of consecutive reads that use less than a quarter of the read
+    // buffer after which the buffer size is halved.
+    static const int kReadShrinkThreshold = 64;
 
     enum Event {
         EVENT_NONE,
@@ -58,6 +66,11 @@ class TcpSession {
                bool async_read_ready = true);
     // Performs a non-blocking send operation.
     virtual bool Send(const u_int8_t *data, size_t size, size_t *sent);
+    // Same as above for a message that is a header followed by a body that
+    // is shared with other sessions. The body is not copied if it has to be
+    // queued.
+    bool SendShared(const u_int8_t *header, size_t header_size,
+                    const IoSharedBufferPtr &body, size_t *sent);
 
     // Called by TcpServer to trigger async read.
     virtual bool Connected(Endpoint remote);
@@ -66,9 +79,17 @@ class TcpSession {
 
     void Close();
 
+    // While the session is corked, small messages given to Send are queued
+    // and written out together by Uncork.
+    void Cork();
+    void Uncork();
+
     virtual std::string ToString() const { return name_; }
 
+    // Sets the initial and minimum size of the read buffers. The size grows
+    // up to IoBufferPool::kMaxBufferSize while the reads fill the buffers.
     void SetBufferSize(int buffer_size);
+    int read_buffer_size() const { return buffer_size_; }
 
     // Getters and setters
     Socket *socket() { return socket_.get(); }
@@ -166,6 +187,11 @@ class TcpSession {
 			  size_t size);
     static void AsyncWriteHandler(TcpSessionPtr session,
                                   const boost::system::error_code &error);
+    // The buffers are held by the handler until the write is done.
+    static void AsyncSharedWriteHandler(TcpSessionPtr session,
+                                        IoSharedBufferPtr header,
+                                        IoSharedBufferPtr body,
+                                        const boost::system::error_code &error);
 
     void ReleaseBufferLocked(Buffer buffer);
     void CloseInternal(bool callObserver);
@@ -178,16 +204,22 @@ class TcpSession {
     }
     void SetName();
 
+    IoBufferPool *buffer_pool() { return buffer_pool_.get(); }
     boost::asio::mutable_buffer AllocateBuffer();
     void DeleteBuffer(boost::asio::mutable_buffer buffer);
+    void AdjustBufferSize(size_t bytes_transferred, size_t capacity);
     void WriteReadyInternal(const boost::system::error_code &);
 
     static int reader_task_id_;
 
     TcpServer *server_;
+    IoBufferPoolPtr buffer_pool_;   // Pool of the read and write buffers.
     boost::scoped_ptr<Socket> socket_;
     bool read_on_connect_;
-    int buffer_size_;
+    int min_buffer_size_;
+    int buffer_size_;           // Size of the next read buffer.
+    int read_full_count_;
+    int read_short_count_;
 
     // Protects session state and buffer queue.
     mutable tbb::mutex mutex_;
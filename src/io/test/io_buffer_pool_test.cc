@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "io/io_buffer_pool.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "io/event_manager.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+class IoBufferPoolTest : public ::testing::Test {
+protected:
+    IoBufferPool pool_;
+};
+
+TEST_F(IoBufferPoolTest, BufferSize) {
+    EXPECT_EQ(IoBufferPool::kMinBufferSize, IoBufferPool::BufferSize(1));
+    EXPECT_EQ(IoBufferPool::kMinBufferSize, IoBufferPool::BufferSize(256));
+    EXPECT_EQ(512, IoBufferPool::BufferSize(257));
+    EXPECT_EQ(4096, IoBufferPool::BufferSize(4096));
+    EXPECT_EQ(8192, IoBufferPool::BufferSize(4097));
+    EXPECT_EQ(IoBufferPool::kMaxBufferSize,
+              IoBufferPool::BufferSize(IoBufferPool::kMaxBufferSize));
+    EXPECT_EQ(IoBufferPool::kMaxBufferSize + 1,
+              IoBufferPool::BufferSize(IoBufferPool::kMaxBufferSize + 1));
+}
+
+TEST_F(IoBufferPoolTest, Reuse) {
+    uint8_t *data1 = pool_.Allocate(4096);
+    EXPECT_EQ(0, pool_.hits());
+    EXPECT_EQ(1, pool_.misses());
+    EXPECT_EQ(4096, pool_.outstanding_bytes());
+    pool_.Release(data1, 4096);
+    EXPECT_EQ(0, pool_.outstanding_bytes());
+    EXPECT_EQ(4096, pool_.cached_bytes());
+
+    // Any size in the same class gets the cached buffer.
+    uint8_t *data2 = pool_.Allocate(3000);
+    EXPECT_EQ(data1, data2);
+    EXPECT_EQ(1, pool_.hits());
+    EXPECT_EQ(4096, pool_.outstanding_bytes());
+    EXPECT_EQ(0, pool_.cached_bytes());
+
+    // A different class does not.
+    uint8_t *data3 = pool_.Allocate(100);
+    EXPECT_EQ(2, pool_.misses());
+    EXPECT_EQ(4096 + 256, pool_.outstanding_bytes());
+
+    pool_.Release(data2, 3000);
+    pool_.Release(data3, 100);
+    EXPECT_EQ(0, pool_.outstanding_bytes());
+    EXPECT_EQ(4096 + 256, pool_.cached_bytes());
+}
+
+TEST_F(IoBufferPoolTest, Oversize) {
+    size_t size = IoBufferPool::kMaxBufferSize + 100;
+    uint8_t *data = pool_.Allocate(size);
+    EXPECT_EQ(size, pool_.outstanding_bytes());
+    pool_.Release(data, size);
+    EXPECT_EQ(0, pool_.outstanding_bytes());
+    EXPECT_EQ(0, pool_.cached_bytes());
+
+    data = pool_.Allocate(size);
+    EXPECT_EQ(0, pool_.hits());
+    EXPECT_EQ(2, pool_.misses());
+    pool_.Release(data, size);
+}
+
+// The free list of a class holds at most kMaxCachedBytes.
+TEST_F(IoBufferPoolTest, CacheLimit) {
+    size_t size = IoBufferPool::kMaxBufferSize;
+    size_t count = IoBufferPool::kMaxCachedBytes / size + 4;
+    vector<uint8_t *> buffers;
+    for (size_t i = 0; i < count; i++) {
+        buffers.push_back(pool_.Allocate(size));
+    }
+    for (size_t i = 0; i < count; i++) {
+        pool_.Release(buffers[i], size);
+    }
+    EXPECT_EQ(0, pool_.outstanding_bytes());
+    EXPECT_EQ(IoBufferPool::kMaxCachedBytes, pool_.cached_bytes());
+}
+
+// A buffer can be released after the EventManager that owned the pool is
+// gone, as long as a reference to the pool is held.
+TEST_F(IoBufferPoolTest, OutlivesEventManager) {
+    IoBufferPoolPtr pool;
+    uint8_t *data;
+    {
+        EventManager evm;
+        pool = evm.buffer_pool();
+        data = pool->Allocate(1024);
+    }
+    EXPECT_EQ(1024, pool->outstanding_bytes());
+    pool->Release(data, 1024);
+    EXPECT_EQ(0, pool->outstanding_bytes());
+    EXPECT_EQ(1024, pool->cached_bytes());
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
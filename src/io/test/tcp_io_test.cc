@@ -21,6 +21,8 @@
 #include "base/test/task_test_util.h"
 
 #include "io/event_manager.h"
+#include "io/io_shared_buffer.h"
+#include "io/tcp_message_write.h"
 #include "io/tcp_server.h"
 #include "io/tcp_session.h"
 #include "io/test/event_manager_test.h"
@@ -104,6 +106,11 @@ class EchoServer : public TcpServer {
         return session_->Send(data, size, actual);
     }
 
+    bool SendShared(const u_int8_t *header, size_t header_size,
+                    const IoSharedBufferPtr &body, size_t *actual) {
+        return session_->SendShared(header, header_size, body, actual);
+    }
+
     EchoSession *GetSession() const { return session_; }
     void SetSocketOptions() { session_->SetSocketOptions(); }
 
@@ -315,6 +322,190 @@ TEST_F(EchoServerTest, SendAfterClose) {
     TASK_UTIL_ASSERT_NE(0, server_->GetSession()->GetTotal());
 }
 
+// Messages sent while the session is corked are written together, with
+// one system call per TcpMessageWriter::kMaxWriteBuffers messages.
+TEST_F(EchoServerTest, Cork) {
+    server_->Initialize(0);
+    task_util::WaitForIdle();
+    thread_->Start();
+    int port = server_->GetPort();
+    ASSERT_LT(0, port);
+
+    client_->CreateSession();
+    client_->EchoServer::ConnectTest(port);
+    client_->SetSocketOptions();
+    task_util::WaitForIdle();
+    TASK_UTIL_ASSERT_TRUE((server_->GetSession() != NULL));
+    TASK_UTIL_ASSERT_TRUE(client_->GetSession()->IsEstablished());
+
+    const TcpServer::SocketStats &stats =
+        client_->GetSession()->GetSocketStats();
+    uint64_t syscalls = stats.write_syscalls;
+
+    const char msg[] = "Test Message";
+    const int kCount = 100;
+    client_->GetSession()->Cork();
+    for (int i = 0; i < kCount; i++) {
+        size_t sent = 0;
+        EXPECT_TRUE(client_->Send((const u_int8_t *) msg, sizeof(msg), &sent));
+        EXPECT_EQ(sizeof(msg), sent);
+    }
+    EXPECT_EQ(syscalls, (uint64_t) stats.write_syscalls);
+    EXPECT_EQ((uint64_t) kCount, (uint64_t) stats.write_calls);
+
+    client_->GetSession()->Uncork();
+    EXPECT_EQ(syscalls + 2, (uint64_t) stats.write_syscalls);
+    TASK_UTIL_ASSERT_EQ(kCount * sizeof(msg),
+                        server_->GetSession()->GetTotal());
+
+    // Sends are written right away once the session is uncorked.
+    EXPECT_TRUE(client_->Send((const u_int8_t *) msg, sizeof(msg), NULL));
+    EXPECT_EQ(syscalls + 3, (uint64_t) stats.write_syscalls);
+    TASK_UTIL_ASSERT_EQ((kCount + 1) * sizeof(msg),
+                        server_->GetSession()->GetTotal());
+}
+
+// A header and a shared body are written with one system call.
+TEST_F(EchoServerTest, SharedBody) {
+    server_->Initialize(0);
+    task_util::WaitForIdle();
+    thread_->Start();
+    int port = server_->GetPort();
+    ASSERT_LT(0, port);
+
+    client_->CreateSession();
+    client_->EchoServer::ConnectTest(port);
+    client_->SetSocketOptions();
+    task_util::WaitForIdle();
+    TASK_UTIL_ASSERT_TRUE((server_->GetSession() != NULL));
+    TASK_UTIL_ASSERT_TRUE(client_->GetSession()->IsEstablished());
+
+    const TcpServer::SocketStats &stats =
+        client_->GetSession()->GetSocketStats();
+    uint64_t syscalls = stats.write_syscalls;
+    uint64_t live_count = IoSharedBuffer::live_count();
+
+    const char header[] = "Header";
+    char body[1024];
+    memset(body, 0xcd, sizeof(body));
+    size_t sent = 0;
+    EXPECT_TRUE(client_->SendShared((const u_int8_t *) header,
+        sizeof(header),
+        IoSharedBufferPtr(new IoSharedBuffer((const u_int8_t *) body,
+                                             sizeof(body))), &sent));
+    EXPECT_EQ(sizeof(header) + sizeof(body), sent);
+    EXPECT_EQ(syscalls + 1, (uint64_t) stats.write_syscalls);
+    EXPECT_EQ(live_count, IoSharedBuffer::live_count());
+    TASK_UTIL_ASSERT_EQ(sizeof(header) + sizeof(body),
+                        server_->GetSession()->GetTotal());
+}
+
+// When the socket can't take a whole message, the rest of the shared body
+// is queued by reference: the body stays alive, and no copy of it is made,
+// until the queue is written.
+TEST_F(EchoServerTest, SharedBodyPartialWrite) {
+    server_->Initialize(0);
+    task_util::WaitForIdle();
+    thread_->Start();
+    int port = server_->GetPort();
+    ASSERT_LT(0, port);
+
+    client_->CreateSession();
+    client_->EchoServer::ConnectTest(port);
+    client_->SetSocketOptions();
+    TASK_UTIL_ASSERT_TRUE((server_->GetSession() != NULL));
+    TASK_UTIL_ASSERT_TRUE(client_->GetSession()->IsEstablished());
+    TASK_UTIL_ASSERT_TRUE(server_->GetSession()->IsEstablished());
+
+    // Stop the scheduler so that the server does not read, and the client
+    // socket fills up.
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    scheduler->Stop();
+
+    uint64_t live_count = IoSharedBuffer::live_count();
+    uint64_t live_bytes = IoSharedBuffer::live_bytes();
+    const char header[] = "Header";
+    vector<uint8_t> data(64 * 1024, 0xcd);
+    IoSharedBufferPtr body(new IoSharedBuffer(&data[0], data.size()));
+    size_t len = sizeof(header) + body->size();
+
+    size_t total = 0;
+    size_t sent = 0;
+    bool res = true;
+    while (res) {
+        res = client_->SendShared((const u_int8_t *) header, sizeof(header),
+                                  body, &sent);
+        total += len;
+    }
+    EXPECT_LT(sent, len);
+
+    // Messages sent while the write is pending are queued as well.
+    for (int i = 0; i < 4; i++) {
+        EXPECT_FALSE(client_->SendShared((const u_int8_t *) header,
+                                         sizeof(header), body, &sent));
+        EXPECT_EQ(0U, sent);
+        total += len;
+    }
+
+    // The queue holds the only reference to the body.
+    body.reset();
+    EXPECT_EQ(live_count + 1, IoSharedBuffer::live_count());
+    EXPECT_EQ(live_bytes + data.size(), IoSharedBuffer::live_bytes());
+
+    scheduler->Start();
+    TASK_UTIL_ASSERT_EQ(total, (size_t) server_->GetSession()->GetTotal());
+    TASK_UTIL_EXPECT_EQ(live_count, IoSharedBuffer::live_count());
+    TASK_UTIL_EXPECT_EQ(live_bytes, IoSharedBuffer::live_bytes());
+}
+
+// Headers and shared bodies sent while the session is corked are queued,
+// the bodies by reference, and written together when it is uncorked.
+TEST_F(EchoServerTest, SharedBodyCork) {
+    server_->Initialize(0);
+    task_util::WaitForIdle();
+    thread_->Start();
+    int port = server_->GetPort();
+    ASSERT_LT(0, port);
+
+    client_->CreateSession();
+    client_->EchoServer::ConnectTest(port);
+    client_->SetSocketOptions();
+    task_util::WaitForIdle();
+    TASK_UTIL_ASSERT_TRUE((server_->GetSession() != NULL));
+    TASK_UTIL_ASSERT_TRUE(client_->GetSession()->IsEstablished());
+
+    const TcpServer::SocketStats &stats =
+        client_->GetSession()->GetSocketStats();
+    uint64_t syscalls = stats.write_syscalls;
+    uint64_t live_count = IoSharedBuffer::live_count();
+
+    const char header[] = "Header";
+    char data[128];
+    memset(data, 0xcd, sizeof(data));
+    IoSharedBufferPtr body(new IoSharedBuffer((const u_int8_t *) data,
+                                              sizeof(data)));
+    size_t len = sizeof(header) + sizeof(data);
+
+    // Each message is two buffers, so all of them fit in one write.
+    const int kCount = TcpMessageWriter::kMaxWriteBuffers / 2;
+    client_->GetSession()->Cork();
+    for (int i = 0; i < kCount; i++) {
+        size_t sent = 0;
+        EXPECT_TRUE(client_->SendShared((const u_int8_t *) header,
+                                        sizeof(header), body, &sent));
+        EXPECT_EQ(len, sent);
+    }
+    body.reset();
+    EXPECT_EQ(syscalls, (uint64_t) stats.write_syscalls);
+    EXPECT_EQ(live_count + 1, IoSharedBuffer::live_count());
+
+    client_->GetSession()->Uncork();
+    EXPECT_EQ(syscalls + 1, (uint64_t) stats.write_syscalls);
+    EXPECT_EQ(live_count, IoSharedBuffer::live_count());
+    TASK_UTIL_ASSERT_EQ(kCount * len,
+                        (size_t) server_->GetSession()->GetTotal());
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
@@ -3,15 +3,19 @@
  */
 
 #include <asm/types.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/genetlink.h>
 #include <linux/sockios.h>
 
+#include <algorithm>
 #include <boost/bind.hpp>
 
 #include <base/logging.h>
+#include <base/timer.h>
+#include <base/util.h>
 #include <db/db.h>
 #include <db/db_entry.h>
 #include <db/db_table.h>
@@ -48,12 +52,26 @@ AgentSandeshContext *KSyncSock::agent_sandesh_ctx_;
 std::vector<KSyncSock *> KSyncSock::sock_table_;
 pid_t KSyncSock::pid_;
 tbb::atomic<bool> KSyncSock::shutdown_;
+const unsigned KSyncSock::kBulkBufLen;
+const unsigned KSyncSock::kMaxBulkMsgCount;
+const int KSyncSock::kAckTimeoutMsec;
 
 const char* IoContext::io_wq_names[IoContext::MAX_WORK_QUEUES] = 
                                                 {"Agent::KSync", "Agent::Uve"};
 
 KSyncSockNetlink::KSyncSockNetlink(boost::asio::io_service &ios, int protocol) 
     : sock_(ios, protocol) {
+    // Bulk messages are limited to the socket send buffer
+    boost::system::error_code ec;
+    socket_base::send_buffer_size sndbuf;
+    sock_.get_option(sndbuf, ec);
+    if (ec || sndbuf.value() <= 0) {
+        set_bulk_buf_len(kBufLen);
+    } else {
+        set_bulk_buf_len(std::min((uint32_t)sndbuf.value(),
+                                  (uint32_t)kBulkBufLen));
+    }
+    CreateAckTimer(ios);
 }
 
 uint32_t KSyncSockNetlink::GetSeqno(char *data) {
@@ -111,15 +129,9 @@ void KSyncSockNetlink::Decoder(char *data, SandeshContext *ctxt) {
     
 }
 
+// Netlink errors are reported to the IoContext of the seqno
 bool KSyncSockNetlink::Validate(char *data) {
     struct nlmsghdr *nlh = (struct nlmsghdr *)data;
-    if (nlh->nlmsg_type == NLMSG_ERROR) {
-        LOG(ERROR, "Ignoring Netlink error for seqno " << nlh->nlmsg_seq 
-                        << " len " << nlh->nlmsg_len);
-        assert(0);
-        return true;
-    }
-
     if (nlh->nlmsg_len > kBufLen) {
         LOG(ERROR, "Length of " << nlh->nlmsg_len << " is more than expected "
             "length of " << kBufLen);
@@ -187,6 +199,20 @@ size_t KSyncSockNetlink::SendTo(const_buffers_1 buf) {
     return ret_val;
 }
 
+uint32_t KSyncSockNetlink::BulkEncode(IoContext *ioc, char *buf,
+                                      uint32_t buf_len) {
+    return NetlinkBulkEncode(ioc, buf, buf_len);
+}
+
+void KSyncSockNetlink::AsyncBulkSendTo(mutable_buffers_1 buf, HandlerCb cb) {
+    boost::asio::netlink::raw::endpoint ep;
+    sock_.async_send_to(buf, ep, cb);
+}
+
+int KSyncSockNetlink::GetResponseError(char *data) {
+    return NetlinkResponseError(data);
+}
+
 void KSyncSockNetlink::AsyncReceive(mutable_buffers_1 buf, HandlerCb cb) {
     sock_.async_receive(buf, cb);
 }
@@ -278,7 +304,9 @@ void KSyncSockUdp::Receive(mutable_buffers_1 buf) {
     sock_.receive_from(buf, ep);
 }
 
-KSyncSock::KSyncSock() : tx_count_(0), err_count_(0) {
+KSyncSock::KSyncSock() : bulk_ctx_(NULL), bulk_buf_len_(0), ack_timer_(NULL),
+    ack_timeout_msec_(kAckTimeoutMsec), tx_count_(0), ack_count_(0),
+    err_count_(0) {
     for(int i = 0; i < IoContext::MAX_WORK_QUEUES; i++) {
         receive_work_queue[i] = new WorkQueue<char *>(TaskScheduler::GetInstance()->
                              GetTaskId(IoContext::io_wq_names[i]), 0,
@@ -287,9 +315,13 @@ KSyncSock::KSyncSock() : tx_count_(0), err_count_(0) {
     }
     async_send_queue_ = new WorkQueue<IoContext *>(TaskScheduler::GetInstance()->
                             GetTaskId("Ksync::AsyncSend"), 0,
-                            boost::bind(&KSyncSock::SendAsyncImpl, this, _1));
+                            boost::bind(&KSyncSock::SendAsyncImpl, this, _1),
+                            WorkQueue<IoContext *>::kMaxSize,
+                            kMaxBulkMsgCount);
     async_send_queue_->SetStartRunnerFunc(
                             boost::bind(&KSyncSock::SendAsyncStart, this));
+    async_send_queue_->SetExitCallback(
+                            boost::bind(&KSyncSock::OnSendQueueExit, this, _1));
     rx_buff_ = NULL;
     seqno_ = 0;
     uve_seqno_ = 0;
@@ -306,6 +338,10 @@ KSyncSock::~KSyncSock() {
     assert(async_send_queue_->Length() == 0);
     async_send_queue_->Shutdown();
     delete async_send_queue_;
+    delete bulk_ctx_;
+    if (ack_timer_) {
+        TimerManager::DeleteTimer(ack_timer_);
+    }
 
     for(int i = 0; i < IoContext::MAX_WORK_QUEUES; i++) {
         receive_work_queue[i]->Shutdown();
@@ -378,13 +414,8 @@ void KSyncSock::ReadHandler(const boost::system::error_code& error,
 Tree::iterator KSyncSock::GetIoContext(char *data) {
     IoContext ioc;
     ioc.SetSeqno(GetSeqno(data));
-    Tree::iterator it;
-    {
-        tbb::mutex::scoped_lock lock(mutex_);
-        it = wait_tree_.find(ioc);
-    }
-    assert (it != wait_tree_.end());
-    return it;
+    tbb::mutex::scoped_lock lock(mutex_);
+    return wait_tree_.find(ioc);
 }
 
 bool KSyncSock::ValidateAndEnqueue(char *data) {
@@ -404,23 +435,43 @@ bool KSyncSock::ValidateAndEnqueue(char *data) {
 // Currently only Agent::KSync and Agent::Uve are possibilities
 bool KSyncSock::ProcessKernelData(char *data) {
     Tree::iterator it = GetIoContext(data);
+    if (it == wait_tree_.end()) {
+        // Only a request already completed by an ack timeout has no context
+        LOG(ERROR, "Ignoring late response for seqno " << GetSeqno(data));
+        delete[] data;
+        return true;
+    }
     IoContext *context = it.operator->();
 
-    AgentSandeshContext *ctxt = context->GetSandeshContext();
-    ctxt->SetErrno(0);
-    Decoder(data, ctxt);
-    if (ctxt->GetErrno() != 0) {
-        context->ErrorHandler(ctxt->GetErrno());
+    // An error response for the whole request completes it
+    int err = GetResponseError(data);
+    if (err != 0) {
+        context->ErrorHandler(err);
+    } else {
+        AgentSandeshContext *ctxt = context->GetSandeshContext();
+        ctxt->SetErrno(0);
+        Decoder(data, ctxt);
+        if (ctxt->GetErrno() != 0) {
+            context->ErrorHandler(ctxt->GetErrno());
+        }
     }
 
-    if (!IsMoreData(data)) {
+    if (err != 0 || !IsMoreData(data)) {
         context->Handler();
         {
             tbb::mutex::scoped_lock lock(mutex_);
             wait_tree_.erase(it);
+            ack_count_++;
+            if (err != 0) {
+                err_count_++;
+            }
         }
         async_send_queue_->MayBeStartRunner();
+        KSyncBulkMsgContext *bulk = context->bulk_ctx_;
         delete(context);
+        if (bulk) {
+            BulkRelease(bulk);
+        }
     }
 
     delete[] data;
@@ -492,6 +543,17 @@ bool KSyncSock::SendAsyncImpl(IoContext *ioc) {
         wait_tree_.insert(*ioc);
     }
 
+    // Requests are packed into the bulk message until it is full, or till
+    // the send queue run is over
+    if (bulk_buf_len_ && BulkAdd(ioc)) {
+        return true;
+    }
+    BulkFlush();
+    if (bulk_buf_len_ && BulkAdd(ioc)) {
+        return true;
+    }
+
+    tx_count_++;
     AsyncSendTo(ioc, boost::asio::buffer(ioc->GetMsg(), ioc->GetMsgLen()),
                 boost::bind(&KSyncSock::WriteHandler, this,
                             placeholders::error,
@@ -499,6 +561,178 @@ bool KSyncSock::SendAsyncImpl(IoContext *ioc) {
     return true;
 }
 
+bool KSyncSock::BulkAdd(IoContext *ioc) {
+    // An empty message of an earlier bulk_buf_len is not reused
+    if (bulk_ctx_ && bulk_ctx_->count_ == 0 &&
+        bulk_ctx_->buf_len_ != bulk_buf_len_) {
+        delete bulk_ctx_;
+        bulk_ctx_ = NULL;
+    }
+    if (bulk_ctx_ == NULL) {
+        bulk_ctx_ = new KSyncBulkMsgContext(bulk_buf_len_);
+    }
+
+    KSyncBulkMsgContext *bulk = bulk_ctx_;
+    uint32_t len = BulkEncode(ioc, bulk->buf_ + bulk->len_,
+                              bulk->buf_len_ - bulk->len_);
+    if (len == 0) {
+        return false;
+    }
+    bulk->len_ += len;
+    bulk->count_++;
+    ioc->bulk_ctx_ = bulk;
+    return true;
+}
+
+void KSyncSock::BulkFlush() {
+    KSyncBulkMsgContext *bulk = bulk_ctx_;
+    if (bulk == NULL || bulk->count_ == 0) {
+        return;
+    }
+    bulk_ctx_ = NULL;
+
+    // Responses can be processed before the send completes
+    bulk->pending_ = bulk->count_ + 1;
+    bulk->send_time_ = UTCTimestampUsec();
+    tx_count_++;
+    AsyncBulkSendTo(boost::asio::buffer(bulk->buf_, bulk->len_),
+                    boost::bind(&KSyncSock::BulkWriteHandler, this, bulk,
+                                placeholders::error,
+                                placeholders::bytes_transferred));
+    if (ack_timer_) {
+        ack_timer_->Start(ack_timeout_msec_,
+                          boost::bind(&KSyncSock::AckTimeout, this));
+    }
+}
+
+// The buffer is not needed once sent, whether or not the acks come
+void KSyncSock::BulkWriteHandler(KSyncBulkMsgContext *bulk,
+                                 const boost::system::error_code &error,
+                                 size_t bytes_transferred) {
+    WriteHandler(error, bytes_transferred);
+    delete [] bulk->buf_;
+    bulk->buf_ = NULL;
+    BulkRelease(bulk);
+}
+
+void KSyncSock::BulkRelease(KSyncBulkMsgContext *bulk) {
+    if (bulk->pending_.fetch_and_decrement() != 1) {
+        return;
+    }
+    if (!bulk_complete_cb_.empty()) {
+        bulk_complete_cb_(bulk->count_);
+    }
+    delete bulk;
+}
+
+// Requests of bulk messages sent longer than the ack timeout ago get an
+// ETIMEDOUT netlink error response, processed in the task of their seqno like
+// any other response. Runs in the send queue task, between its runs. Returns
+// true to run again while requests wait for acks
+bool KSyncSock::AckTimeout() {
+    uint64_t now = UTCTimestampUsec();
+    uint64_t timeout = (uint64_t)ack_timeout_msec_ * 1000;
+    std::vector<uint32_t> expired;
+    bool waiting = false;
+    {
+        tbb::mutex::scoped_lock lock(mutex_);
+        for (Tree::iterator it = wait_tree_.begin(); it != wait_tree_.end();
+             ++it) {
+            KSyncBulkMsgContext *bulk = it->bulk_ctx_;
+            if (bulk == NULL || bulk == bulk_ctx_ || it->ack_expired_) {
+                continue;
+            }
+            if (now - bulk->send_time_ < timeout) {
+                waiting = true;
+                continue;
+            }
+            it->ack_expired_ = true;
+            expired.push_back(it->GetSeqno());
+        }
+    }
+
+    for (std::vector<uint32_t>::iterator it = expired.begin();
+         it != expired.end(); ++it) {
+        LOG(ERROR, "Ksync ack timeout for seqno " << *it);
+        uint32_t len = NLMSG_SPACE(sizeof(struct nlmsgerr));
+        char *data = new char[len];
+        memset(data, 0, len);
+        struct nlmsghdr *nlh = (struct nlmsghdr *)data;
+        nlh->nlmsg_len = len;
+        nlh->nlmsg_type = NLMSG_ERROR;
+        nlh->nlmsg_seq = *it;
+        struct nlmsgerr *nl_err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+        nl_err->error = -ETIMEDOUT;
+        ValidateAndEnqueue(data);
+    }
+    return waiting;
+}
+
+void KSyncSock::OnSendQueueExit(bool done) {
+    BulkFlush();
+}
+
+uint32_t KSyncSock::NetlinkBulkEncode(IoContext *ioc, char *buf,
+                                      uint32_t buf_len) {
+    if (nl_header_.empty()) {
+        struct nl_client cl;
+        unsigned char *nl_buf;
+        uint32_t nl_buf_len;
+        int ret;
+
+        nl_init_generic_client_req(&cl, GetNetlinkFamilyId());
+        if ((ret = nl_build_header(&cl, &nl_buf, &nl_buf_len)) < 0) {
+            LOG(ERROR, "Error creating netlink message. Error : " << ret);
+            nl_free(&cl);
+            return 0;
+        }
+        nl_header_.assign(cl.cl_buf, cl.cl_buf + cl.cl_buf_offset);
+        nl_free(&cl);
+    }
+
+    uint32_t hdr_len = nl_header_.size();
+    uint32_t msg_len = hdr_len + ioc->GetMsgLen();
+    if (NLMSG_ALIGN(msg_len) > buf_len) {
+        return 0;
+    }
+
+    memcpy(buf, &nl_header_[0], hdr_len);
+    memcpy(buf + hdr_len, ioc->GetMsg(), ioc->GetMsgLen());
+    memset(buf + msg_len, 0, NLMSG_ALIGN(msg_len) - msg_len);
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = msg_len;
+    nlh->nlmsg_pid = KSyncSock::GetPid();
+    nlh->nlmsg_seq = ioc->GetSeqno();
+    struct nlattr *attr = (struct nlattr *)(buf + NLMSG_HDRLEN + GENL_HDRLEN);
+    attr->nla_len = msg_len - (NLMSG_HDRLEN + GENL_HDRLEN);
+    return NLMSG_ALIGN(msg_len);
+}
+
+int KSyncSock::NetlinkResponseError(char *data) {
+    struct nlmsghdr *nlh = (struct nlmsghdr *)data;
+    if (nlh->nlmsg_type != NLMSG_ERROR) {
+        return 0;
+    }
+    struct nlmsgerr *nl_err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+    return -nl_err->error;
+}
+
+void KSyncSock::CreateAckTimer(boost::asio::io_service &ios) {
+    ack_timer_ = TimerManager::CreateTimer(ios, "KSync Ack Timer",
+            TaskScheduler::GetInstance()->GetTaskId("Ksync::AsyncSend"), 0);
+}
+
+KSyncBulkMsgContext::KSyncBulkMsgContext(uint32_t buf_len)
+    : buf_(new char[buf_len]), buf_len_(buf_len), len_(0), count_(0),
+      send_time_(0) {
+    pending_ = 0;
+}
+
+KSyncBulkMsgContext::~KSyncBulkMsgContext() {
+    delete [] buf_;
+}
+
 KSyncIoContext::KSyncIoContext(KSyncEntry *sync_entry, int msg_len,
                                char *msg, uint32_t seqno,
                                KSyncEntry::KSyncEvent event) :
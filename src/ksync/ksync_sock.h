@@ -18,10 +18,13 @@
 #include <sandesh/sandesh.h>
 #include "vr_types.h"
 
+class Timer;
+
 #define KSYNC_DEFAULT_MSG_SIZE    4096
 #define KSYNC_DEFAULT_Q_ID_SEQ    0x00000001
 #define KSYNC_ACK_WAIT_THRESHOLD  200
 class KSyncEntry;
+class KSyncBulkMsgContext;
 
 /* Base class to hold sandesh context information which is passed to 
  * Sandesh decode
@@ -61,14 +64,16 @@ public:
         MAX_WORK_QUEUES // This should always be last
     };
     static const char* io_wq_names[MAX_WORK_QUEUES];
-    IoContext() : ctx_(NULL), msg_(NULL), msg_len_(0), seqno_(0) { };
+    IoContext() : ctx_(NULL), msg_(NULL), msg_len_(0), seqno_(0),
+        bulk_ctx_(NULL), ack_expired_(false) { };
 
     IoContext(char *msg, uint32_t len, uint32_t seq, AgentSandeshContext *ctx) 
         : ctx_(ctx), msg_(msg), msg_len_(len), seqno_(seq), 
-          work_q_id_(DEFAULT_Q_ID) { };
+          work_q_id_(DEFAULT_Q_ID), bulk_ctx_(NULL), ack_expired_(false) { };
     IoContext(char *msg, uint32_t len, uint32_t seq, AgentSandeshContext *ctx, 
               IoContextWorkQId id) : ctx_(ctx), msg_(msg), msg_len_(len), 
-              seqno_(seq), work_q_id_(id) { };
+              seqno_(seq), work_q_id_(id), bulk_ctx_(NULL),
+              ack_expired_(false) { };
     virtual ~IoContext() { 
         if (msg_ != NULL)
             free(msg_);
@@ -100,10 +105,38 @@ private:
     uint32_t msg_len_;
     uint32_t seqno_;
     IoContextWorkQId work_q_id_;
+    // Bulk message the request is sent in, if any
+    KSyncBulkMsgContext *bulk_ctx_;
+    // Set once a timeout response is queued for the request
+    bool ack_expired_;
 
     friend class KSyncSock;
 };
 
+/* Requests of several IoContexts packed into one message, each with its own
+ * netlink header and seqno. The buffer is freed once the send completes, and
+ * the context once the responses to all the requests in it are processed.
+ * A request not acked in time gets a timeout error response
+ */
+class KSyncBulkMsgContext {
+public:
+    explicit KSyncBulkMsgContext(uint32_t buf_len);
+    ~KSyncBulkMsgContext();
+
+private:
+    char *buf_;
+    uint32_t buf_len_;
+    uint32_t len_;
+    uint32_t count_;
+    // Time the message was sent, in usec
+    uint64_t send_time_;
+    // The send and the requests with responses yet to be processed
+    tbb::atomic<uint32_t> pending_;
+
+    friend class KSyncSock;
+    DISALLOW_COPY_AND_ASSIGN(KSyncBulkMsgContext);
+};
+
 /* IoContext tied to KSyncEntry */
 class  KSyncIoContext : public IoContext {
 public:
@@ -126,8 +159,18 @@ class KSyncSock {
 public:
     const static int kMsgGrowSize = 16;
     const static unsigned kBufLen = 4096;
+    // Largest bulk message, if the socket send buffer is not smaller
+    const static unsigned kBulkBufLen = 65536;
+    // Requests sent in one run of the send queue, so at most in a bulk message
+    const static unsigned kMaxBulkMsgCount = 128;
+    // Requests in a bulk message not acked in this time get an ETIMEDOUT
+    // error response
+    const static int kAckTimeoutMsec = 10000;
 
     typedef boost::function<void(const boost::system::error_code &, size_t)> HandlerCb;
+    // Called with the number of requests in a bulk message once all of them
+    // are acked, with an error response or the ack timeout for some
+    typedef boost::function<void(uint32_t)> BulkCompleteCb;
     KSyncSock();
     virtual ~KSyncSock();
 
@@ -164,6 +207,17 @@ public:
         agent_sandesh_ctx_ = ctx;
     }
     virtual void Decoder(char *data, SandeshContext *ctxt) = 0;
+
+    // Requests are packed in bulk messages of up to bulk_buf_len bytes.
+    // Every request is sent in a message of its own if it is 0
+    uint32_t bulk_buf_len() const { return bulk_buf_len_; }
+    void set_bulk_buf_len(uint32_t len) { bulk_buf_len_ = len; }
+    void SetBulkCompleteCallback(BulkCompleteCb cb) { bulk_complete_cb_ = cb; }
+    int ack_timeout_msec() const { return ack_timeout_msec_; }
+    void set_ack_timeout_msec(int msec) { ack_timeout_msec_ = msec; }
+    int tx_count() const { return tx_count_; }
+    int ack_count() const { return ack_count_; }
+    int err_count() const { return err_count_; }
 protected:
     static void Init(int count);
     static void SetSockTableEntry(int i, KSyncSock *sock);
@@ -173,6 +227,14 @@ protected:
     tbb::mutex mutex_;
 
     WorkQueue<char *> *receive_work_queue[IoContext::MAX_WORK_QUEUES];
+
+    // Adds the netlink and generic netlink headers of the request to the
+    // payload at buf, for sockets that send bulk netlink messages
+    uint32_t NetlinkBulkEncode(IoContext *ioc, char *buf, uint32_t buf_len);
+    // Errno of a netlink error response, 0 for other responses
+    static int NetlinkResponseError(char *data);
+    // Timer for the acks of bulk messages, for sockets that send them
+    void CreateAckTimer(boost::asio::io_service &ios);
 private:
     // Read handler registered with boost::asio. Demux done based on seqno_
     void ReadHandler(const boost::system::error_code& error,
@@ -186,6 +248,14 @@ private:
     virtual bool Validate(char *data) = 0;
     bool ValidateAndEnqueue(char *data);
     bool SendAsyncImpl(IoContext *ioc);
+    bool BulkAdd(IoContext *ioc);
+    void BulkFlush();
+    void BulkWriteHandler(KSyncBulkMsgContext *bulk,
+                          const boost::system::error_code &error,
+                          size_t bytes_transferred);
+    void BulkRelease(KSyncBulkMsgContext *bulk);
+    bool AckTimeout();
+    void OnSendQueueExit(bool done);
 
     bool SendAsyncStart() {
         tbb::mutex::scoped_lock lock(mutex_);
@@ -198,6 +268,17 @@ private:
     virtual std::size_t SendTo(boost::asio::const_buffers_1) = 0;
     virtual void Receive(boost::asio::mutable_buffers_1) = 0;
 
+    // Encode the request with its header at buf for a bulk message. Returns
+    // the length encoded, or 0 if the request does not fit in buf_len
+    virtual uint32_t BulkEncode(IoContext *ioc, char *buf, uint32_t buf_len) {
+        return 0;
+    }
+    virtual void AsyncBulkSendTo(boost::asio::mutable_buffers_1, HandlerCb) {
+    }
+    // Errno of an error response for the whole request, which is not
+    // decoded. Errors of the vrouter operation are in the decoded response
+    virtual int GetResponseError(char *data) { return 0; }
+
     virtual uint32_t GetSeqno(char *data) = 0;
     Tree::iterator GetIoContext(char *data);
     virtual bool IsMoreData(char *data) = 0;
@@ -212,6 +293,16 @@ private:
     tbb::atomic<int> seqno_;
     tbb::atomic<int> uve_seqno_;
 
+    // Bulk message being filled by the send queue
+    KSyncBulkMsgContext *bulk_ctx_;
+    uint32_t bulk_buf_len_;
+    BulkCompleteCb bulk_complete_cb_;
+    // Netlink and generic netlink headers of a request
+    std::vector<char> nl_header_;
+    // Runs in the send queue task while bulk requests wait for acks
+    Timer *ack_timer_;
+    int ack_timeout_msec_;
+
     // Debug stats
     int tx_count_;
     int ack_count_;
@@ -236,6 +327,9 @@ public:
                              HandlerCb);
     virtual std::size_t SendTo(boost::asio::const_buffers_1);
     virtual void Receive(boost::asio::mutable_buffers_1);
+    virtual uint32_t BulkEncode(IoContext *ioc, char *buf, uint32_t buf_len);
+    virtual void AsyncBulkSendTo(boost::asio::mutable_buffers_1, HandlerCb);
+    virtual int GetResponseError(char *data);
 private:
     boost::asio::netlink::raw::socket sock_;
 };
@@ -35,6 +35,7 @@
 #include "vr_defs.h"
 
 KSyncSockTypeMap *KSyncSockTypeMap::singleton_; 
+const int KSyncSockTypeMap::kDropResponse;
 vr_flow_entry *KSyncSockTypeMap::flow_table_;
 using namespace boost::asio;
 
@@ -300,13 +301,6 @@ void KSyncSockTypeMap::Decoder(char *data, SandeshContext *ctxt) {
 
 bool KSyncSockTypeMap::Validate(char *data) {
     struct nlmsghdr *nlh = (struct nlmsghdr *)data;
-    if (nlh->nlmsg_type == NLMSG_ERROR) {
-        LOG(ERROR, "Ignoring Netlink error for seqno " << nlh->nlmsg_seq 
-                        << " len " << nlh->nlmsg_len);
-        assert(0);
-        return true;
-    }
-
     if (nlh->nlmsg_len > kBufLen) {
         LOG(ERROR, "Length of " << nlh->nlmsg_len << " is more than expected "
             "length of " << kBufLen);
@@ -329,6 +323,67 @@ void KSyncSockTypeMap::AsyncSendTo(IoContext *ioc, mutable_buffers_1 buf,
     }
 }
 
+uint32_t KSyncSockTypeMap::BulkEncode(IoContext *ioc, char *buf,
+                                      uint32_t buf_len) {
+    return NetlinkBulkEncode(ioc, buf, buf_len);
+}
+
+//store each request of the bulk message in map, and respond to its seq
+void KSyncSockTypeMap::AsyncBulkSendTo(mutable_buffers_1 buf, HandlerCb cb) {
+    const uint32_t hdr_len = NLMSG_HDRLEN + GENL_HDRLEN + NLA_HDRLEN;
+    char *data = buffer_cast<char *>(buf);
+    size_t len = buffer_size(buf);
+    while (len >= hdr_len) {
+        struct nlmsghdr *nlh = (struct nlmsghdr *)data;
+        uint32_t msg_len = NLMSG_ALIGN(nlh->nlmsg_len);
+        assert(nlh->nlmsg_len >= hdr_len && msg_len <= len);
+
+        int code;
+        if (GetBulkResponseFault(nlh->nlmsg_seq, &code)) {
+            if (code != kDropResponse) {
+                SimulateResponse(nlh->nlmsg_seq, code, 0);
+            }
+        } else {
+            KSyncUserSockContext ctx(true, nlh->nlmsg_seq);
+            ProcessSandesh((const uint8_t *)(data + hdr_len),
+                           nlh->nlmsg_len - hdr_len, &ctx);
+            if (ctx.IsResponseReqd()) {
+                //simulate ok response with the same seq
+                SimulateResponse(nlh->nlmsg_seq, 0, 0);
+            }
+        }
+        data += msg_len;
+        len -= msg_len;
+    }
+    cb(boost::system::error_code(), buffer_size(buf));
+}
+
+int KSyncSockTypeMap::GetResponseError(char *data) {
+    return NetlinkResponseError(data);
+}
+
+void KSyncSockTypeMap::SetBulkResponseError(uint32_t seqno, int code) {
+    assert(code < 0);
+    tbb::mutex::scoped_lock lock(bulk_fault_lock_);
+    bulk_fault_map_[seqno] = code;
+}
+
+void KSyncSockTypeMap::DropBulkResponse(uint32_t seqno) {
+    tbb::mutex::scoped_lock lock(bulk_fault_lock_);
+    bulk_fault_map_[seqno] = kDropResponse;
+}
+
+bool KSyncSockTypeMap::GetBulkResponseFault(uint32_t seqno, int *code) {
+    tbb::mutex::scoped_lock lock(bulk_fault_lock_);
+    BulkResponseFaultMap::iterator it = bulk_fault_map_.find(seqno);
+    if (it == bulk_fault_map_.end()) {
+        return false;
+    }
+    *code = it->second;
+    bulk_fault_map_.erase(it);
+    return true;
+}
+
 //send or store in map
 size_t KSyncSockTypeMap::SendTo(const_buffers_1 buf) {
     KSyncUserSockContext ctx(true, 0);
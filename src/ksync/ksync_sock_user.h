@@ -5,6 +5,7 @@
 #ifndef ctrlplane_ksync_sock_user_h 
 #define ctrlplane_ksync_sock_user_h 
 
+#include <map>
 #include <queue>
 
 #include <tbb/mutex.h>
@@ -82,6 +83,7 @@ class KSyncSockTypeMap : public KSyncSock {
 public:
     KSyncSockTypeMap(boost::asio::io_service &ios) : KSyncSock(), sock_(ios) {
         block_msg_processing_ = false;
+        CreateAckTimer(ios);
     }
     ~KSyncSockTypeMap() {
         assert(nh_map.size() == 0);
@@ -127,6 +129,14 @@ public:
                              HandlerCb);
     virtual std::size_t SendTo(boost::asio::const_buffers_1);
     virtual void Receive(boost::asio::mutable_buffers_1);
+    virtual uint32_t BulkEncode(IoContext *ioc, char *buf, uint32_t buf_len);
+    virtual void AsyncBulkSendTo(boost::asio::mutable_buffers_1, HandlerCb);
+    virtual int GetResponseError(char *data);
+
+    // For tests of bulk messages. The request with seqno in a bulk message
+    // is not processed, and gets a response with code, or none if dropped
+    void SetBulkResponseError(uint32_t seqno, int code);
+    void DropBulkResponse(uint32_t seqno);
 
     static void ProcessSandesh(const uint8_t *, std::size_t, KSyncUserSockContext *);
     static void SimulateResponse(uint32_t, int, int);
@@ -171,7 +181,14 @@ public:
     }
 
 private:
+    typedef std::map<uint32_t, int> BulkResponseFaultMap;
+    // Code for a dropped response in bulk_fault_map_
+    static const int kDropResponse = 1;
+
     void PurgeBlockedMsg();
+    bool GetBulkResponseFault(uint32_t seqno, int *code);
+    BulkResponseFaultMap bulk_fault_map_;
+    tbb::mutex bulk_fault_lock_;
     udp::socket sock_;
     udp::endpoint local_ep_;
     bool block_msg_processing_;
@@ -23,6 +23,7 @@
 #include "query.h"
 #include "analytics_cpuinfo_types.h"
 #include "stats_select.h"
+#include "query_result_lines.h"
 
 using std::list;
 using std::string;
@@ -61,7 +62,21 @@ bool RedisAsyncArgCommand(RedisAsyncConnection * rac,
 
 class QEOpServerProxy::QEOpServerImpl {
 public:
-    typedef std::vector<std::string> QEOutputT;
+    // The lines streamed to redis for a query. The replies to them are
+    // passed to the stream, so that it can hold back more lines until
+    // redis has taken the ones already pushed.
+    class QueryStream : public QueryResultStream,
+                        public ExternalProcIf<RedisT> {
+    public:
+        QueryStream(const string &qid, const string &table, bool map_output)
+            : QueryResultStream(qid, table, map_output), qid_(qid) {}
+
+        std::string Key() const { return "STREAM:" + qid_; }
+        void Response(std::auto_ptr<RedisT> reply) { LineDone(); }
+
+    private:
+        const string qid_;
+    };
 
     struct Input {
         int cnum;
@@ -76,125 +91,48 @@ public:
         uint64_t time_period;
         string table;
         tbb::atomic<uint32_t> chunk_q;
+        // Lines of the chunks that are streamed to redis
+        shared_ptr<QueryStream> stream;
+        // Estimate of the result bytes held by the pipeline
+        QueryResultBytes result_bytes;
     };
 
-    void JsonInsert(std::vector<query_column> &columns,
-            rapidjson::Document& dd,
-            std::pair<const string,string> * map_it) {
-
-        bool found = false;
-        for (size_t j = 0; j < columns.size(); j++)
-        {
-            if (0 == map_it->first.compare(0,5,string("COUNT"))) {
-                rapidjson::Value val(rapidjson::kNumberType);
-                unsigned long num = 0;
-                stringToInteger(map_it->second, num);
-                val.SetUint64(num);
-                dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
-                found = true;
-            } else if (columns[j].name == map_it->first) {
-                // find out type and convert
-                if (columns[j].datatype == "string" || 
-                    columns[j].datatype == "uuid")
-                {
-                    rapidjson::Value val(rapidjson::kStringType);
-                    val.SetString(map_it->second.c_str());
-                    dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
-                } else if (columns[j].datatype == "ipv4") {
-                    rapidjson::Value val(rapidjson::kStringType);
-                    char str[INET_ADDRSTRLEN];
-                    uint32_t ipaddr = 0;
-
-                    stringToInteger(map_it->second, ipaddr);
-                    ipaddr = htonl(ipaddr);
-                    inet_ntop(AF_INET, &(ipaddr), str, INET_ADDRSTRLEN);
-                    map_it->second = str;
-
-                    val.SetString(map_it->second.c_str(), map_it->second.size());
-                    dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
-
-                } else if (columns[j].datatype == "double") {
-                    rapidjson::Value val(rapidjson::kNumberType);
-                    double dval = (double) strtod(map_it->second.c_str(), NULL);
-                    val.SetDouble(dval);
-                    dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
-                } else {
-                    rapidjson::Value val(rapidjson::kNumberType);
-                    unsigned long num = 0;
-                    stringToInteger(map_it->second, num);
-                    val.SetUint64(num);
-                    dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
-                }
-                found = true;
-            }
-        }
-        assert(found);    
+    static int64_t ResultRows(const BufferT* res,
+            const OutRowMultimapT* mres) {
+        return (res ? res->size() : 0) + (mres ? mres->size() : 0);
     }
 
-    void QueryJsonify(const string& table, bool map_output,
-        const BufferT* raw_res, const OutRowMultimapT* raw_mres, QEOutputT* raw_json) {
-
-        vector<OutRowT>::iterator res_it;
-
-        std::vector<query_column>  columns;
+    // Adds bytes (which may be negative) to the result bytes held for the
+    // query, and updates the peak.
+    static void ResultHeld(const Input & inp, int64_t bytes) {
+        const_cast<Input&>(inp).result_bytes.Held(bytes);
+    }
 
-        if (!table.size()) return;
-        bool found = false;
-        for(size_t i = 0; i < g_viz_constants._TABLES.size(); i++)
-        {
-            if (g_viz_constants._TABLES[i].name == table) {
-                found = true;
-                columns = g_viz_constants._TABLES[i].schema.columns;
-            }
+    // Sends the commands that push result lines, or set their expiry
+    void SendLines(RedisAsyncConnection * rac,
+            const QueryResultLines::CommandListT & commands) {
+        for (QueryResultLines::CommandListT::const_iterator it =
+                commands.begin(); it != commands.end(); ++it) {
+            RedisAsyncArgCommand(rac, NULL, *it);
         }
-        if (!found) {
-            if (g_viz_constants.OBJECT_VALUE_TABLE == table) {
-                found = true;
-                columns = g_viz_constants._OBJECT_TABLE_SCHEMA.columns; 
-            }
-        }
-        if (!found) {
-            for (std::map<std::string, objtable_info>::const_iterator it =
-                    g_viz_constants._OBJECT_TABLES.begin();
-                    it != g_viz_constants._OBJECT_TABLES.end(); it++) {
-                if (it->first == table) {
-                    found = true;
-                    columns = g_viz_constants._OBJECT_TABLE_SCHEMA.columns;
-                }
+    }
+
+    // Sends the commands of streamed lines. The EXPIRE is the last command
+    // of a line, so the reply to it tells the stream that redis has taken
+    // the line. There is no reply for a command that could not be sent.
+    void SendStreamLines(RedisAsyncConnection * rac, QueryStream * stream,
+            const QueryResultLines::CommandListT & commands) {
+        ExternalProcIf<RedisT> * rpi = stream;
+        for (QueryResultLines::CommandListT::const_iterator it =
+                commands.begin(); it != commands.end(); ++it) {
+            if (it->front() != "EXPIRE") {
+                RedisAsyncArgCommand(rac, NULL, *it);
+            } else if (!RedisAsyncArgCommand(rac, rpi, *it)) {
+                stream->LineDone();
             }
         }
-        assert(found || map_output);
-
-        if (map_output) {
-            OutRowMultimapT::const_iterator mres_it;
-            for (mres_it = raw_mres->begin(); mres_it != raw_mres->end(); ++mres_it) {
-                string jstr;
-                StatsSelect::Jsonify(mres_it->second.first, mres_it->second.second, jstr);
-                raw_json->push_back(jstr);
-            }
-        } else {
-            QEOpServerProxy::BufferT* raw_result = 
-                const_cast<QEOpServerProxy::BufferT*>(raw_res);
-            QEOpServerProxy::BufferT::iterator res_it;
-            for (res_it = raw_result->begin(); res_it != raw_result->end(); ++res_it) {
-                std::map<std::string, std::string>::iterator map_it;
-                rapidjson::Document dd;
-                dd.SetObject();
-
-                for (map_it = (*res_it).first.begin(); 
-                     map_it != (*res_it).first.end(); ++map_it) {
-                    // search for column name in the schema
-                    JsonInsert(columns, dd, &(*map_it));
-                }
-                rapidjson::StringBuffer sb;
-                rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
-                dd.Accept(writer);
-                raw_json->push_back(sb.GetString());
-            }
-        }        
     }
 
-
     void QECallback(void * qid, QPerfInfo qperf, auto_ptr<QEOpServerProxy::BufferT> res, 
             auto_ptr<QEOpServerProxy::OutRowMultimapT> mres) {
 
@@ -222,8 +160,38 @@ public:
         vector<uint32_t> chunk_merge_time;
         shared_ptr<BufferT> result;
         shared_ptr<OutRowMultimapT> mresult;
+        uint32_t stream_rows;
+        // Whether the chunk of the last step is still being streamed, and
+        // the next row of it to stream
+        bool streaming;
+        BufferT::const_iterator stream_row;
+        OutRowMultimapT::const_iterator stream_mrow;
+        // Estimate of the bytes of the chunk of the last step
+        uint64_t chunk_bytes;
     };
 
+    // Pushes the rows of a chunk to redis as soon as the chunk is done.
+    // This is only possible when the chunks do not need to be merged.
+    // Returns false if the rest of the chunk has to wait for redis to take
+    // the lines already pushed.
+    bool QueryStreamChunk(const Input & inp, const RawResultT & raw,
+            Stage0Out & res) {
+        RedisAsyncConnection * rac = conns_[inp.cnum].get();
+        QueryStream * stream = inp.stream.get();
+        QueryResultLines::CommandListT commands;
+        if (inp.map_output) {
+            res.stream_rows += stream->AddLines(&res.stream_mrow,
+                raw.second.second->end(), &commands);
+            res.streaming = (res.stream_mrow != raw.second.second->end());
+        } else {
+            res.stream_rows += stream->AddLines(&res.stream_row,
+                raw.second.first->end(), &commands);
+            res.streaming = (res.stream_row != raw.second.first->end());
+        }
+        SendStreamLines(rac, stream, commands);
+        return !res.streaming;
+    }
+
     ExternalBase::Efn QueryExec(uint32_t inst, const vector<RawResultT*> & exts,
             const Input & inp, Stage0Out & res) { 
         uint32_t step = exts.size();
@@ -232,6 +200,8 @@ public:
         if (!step) {
             res.inp = inp;
             res.ret_code = true;
+            res.stream_rows = 0;
+            res.streaming = false;
          
             if (inp.map_output)
                 res.mresult = shared_ptr<OutRowMultimapT>(new OutRowMultimapT());
@@ -264,42 +234,69 @@ public:
             }
         }
 
-        res.ret_info.push_back(exts[step-1]->first);
-        if (exts[step-1]->first.error) {
-            res.ret_code =false;
-        }
-        if (res.ret_code) {
-            if (inp.need_merge) {
-                uint64_t then = UTCTimestampUsec();
-                if (inp.map_output) {
-                    // TODO: This interface should not be Stats-Specific
-                    StatsSelect::Merge(*(exts[step-1]->second.second), *(res.mresult));
-                } else {
-                    res.ret_code =
-                        qosp_->qe_->QueryAccumulate(inp.qp,
-                            *(exts[step-1]->second.first), *(res.result));
-                }
-                res.chunk_merge_time.push_back(
-                    static_cast<uint32_t>((UTCTimestampUsec() - then)/1000));
-        
-            } else {
-                // TODO : When merge is not needed, we can just send
-                //        a result upto redis at this point.
-
-                if (inp.map_output) {
-                    OutRowMultimapT::iterator jt = res.mresult->begin();
-                    for (OutRowMultimapT::const_iterator it = exts[step-1]->second.second->begin();
-                            it != exts[step-1]->second.second->end(); it++ ) {
-
-                        jt = res.mresult->insert(jt,
-                                std::make_pair(it->first, it->second));
+        RawResultT * chunk = exts[step-1];
+        if (!res.streaming) {
+            res.chunk_bytes =
+                QueryResultBytes::Bytes(chunk->second.first.get()) +
+                QueryResultBytes::Bytes(chunk->second.second.get());
+            uint64_t chunk_bytes = res.chunk_bytes;
+            int64_t chunk_rows = ResultRows(chunk->second.first.get(),
+                chunk->second.second.get());
+            ResultHeld(inp, chunk_bytes);
+
+            res.ret_info.push_back(chunk->first);
+            if (chunk->first.error) {
+                res.ret_code =false;
+            }
+            if (res.ret_code) {
+                if (inp.need_merge) {
+                    int64_t merged_rows = ResultRows(res.result.get(),
+                        res.mresult.get());
+                    uint64_t then = UTCTimestampUsec();
+                    if (inp.map_output) {
+                        // TODO: This interface should not be Stats-Specific
+                        StatsSelect::Merge(*(chunk->second.second),
+                            *(res.mresult));
+                    } else {
+                        res.ret_code =
+                            qosp_->qe_->QueryAccumulate(inp.qp,
+                                *(chunk->second.first), *(res.result));
+                    }
+                    res.chunk_merge_time.push_back(static_cast<uint32_t>(
+                        (UTCTimestampUsec() - then)/1000));
+
+                    // The accumulated result is not walked again to size
+                    // it. It grows or shrinks by whole rows, which are
+                    // taken to be the average size of the rows of this
+                    // chunk.
+                    if (chunk_rows) {
+                        int64_t rows = ResultRows(res.result.get(),
+                            res.mresult.get()) - merged_rows;
+                        ResultHeld(inp,
+                            rows * (int64_t) (chunk_bytes / chunk_rows));
                     }
                 } else {
-                    res.result->insert(res.result->begin(),
-                        exts[step-1]->second.first->begin(),
-                        exts[step-1]->second.first->end());                        
+                    res.streaming = true;
+                    if (inp.map_output)
+                        res.stream_mrow = chunk->second.second->begin();
+                    else
+                        res.stream_row = chunk->second.first->begin();
                 }
             }
+        }
+
+        // The rest of a chunk that is streamed waits for redis to take the
+        // lines pushed before it, and the step is run again until then
+        if (res.streaming && !QueryStreamChunk(inp, *chunk, res))
+            return &ExternalBase::Incomplete;
+
+        // The pipeline keeps the results of all the steps until the
+        // instance is done, so let go of the chunk once it is used.
+        chunk->second.first.reset();
+        chunk->second.second.reset();
+        ResultHeld(inp, -(int64_t) res.chunk_bytes);
+
+        if (res.ret_code) {
             Input& cinp = const_cast<Input&>(inp);
             uint32_t chunknum = cinp.chunk_q.fetch_and_increment(); 
             if (chunknum < inp.chunk_size.size()) {
@@ -334,6 +331,9 @@ public:
         vector<vector<uint32_t> > chunk_merge_time;
         BufferT result;
         OutRowMultimapT mresult;
+        uint32_t stream_lines;
+        uint32_t stream_rows;
+        uint64_t peak_result_bytes;
     };
     bool QueryMerge(const std::vector<boost::shared_ptr<Stage0Out> > & subs,
            const boost::shared_ptr<Input> & inp, Stage0Merge & res) {
@@ -341,6 +341,8 @@ public:
         res.ret_code = true;
         res.inp = subs[0]->inp;
         res.fm_time = 0;
+        res.stream_lines = 0;
+        res.stream_rows = 0;
       
         std::vector<boost::shared_ptr<OutRowMultimapT> > mqsubs;
         std::vector<boost::shared_ptr<QEOpServerProxy::BufferT> > qsubs;
@@ -349,6 +351,7 @@ public:
 
             res.ret_info.push_back((*it)->ret_info);
             res.chunk_merge_time.push_back((*it)->chunk_merge_time);
+            res.stream_rows += (*it)->stream_rows;
 
             if ((*it)->ret_code == false) {
                 res.ret_code = false;
@@ -360,6 +363,10 @@ public:
             }
         }
 
+        // If a merge was not needed, the results have been sent to redis
+        // already, and the only thing still needed is the status
+        res.stream_lines = inp->stream->lines();
+        res.peak_result_bytes = inp->result_bytes.peak();
         if (!res.ret_code) return true;
 
         if (res.inp.need_merge) {
@@ -376,25 +383,10 @@ public:
 
             uint64_t now = UTCTimestampUsec();
             res.fm_time = static_cast<uint32_t>((now - then)/1000);
-        } else {
-            // TODO : If a merge was not needed, results have been sent to 
-            //        redis already. The only thing still needed is the status
-            for (vector<shared_ptr<Stage0Out> >::const_iterator it = subs.begin() ;
-                    it!=subs.end(); it++) {
-
-                if (res.inp.map_output) {
-                    OutRowMultimapT::iterator jt = res.mresult.begin();
-                    for (OutRowMultimapT::const_iterator kt = (*it)->mresult->begin();
-                            kt != (*it)->mresult->end(); kt++) {
-                        jt = res.mresult.insert(jt,
-                                std::make_pair(kt->first, kt->second));
-                    }
-                } else {
-                    res.result.insert(res.result.begin(),
-                        (*it)->result->begin(),
-                        (*it)->result->end());
-                }
-            }
+
+            ResultHeld(*inp, QueryResultBytes::Bytes(&res.result) +
+                QueryResultBytes::Bytes(&res.mresult));
+            res.peak_result_bytes = inp->result_bytes.peak();
         }
         return true;
     }
@@ -403,64 +395,83 @@ public:
         Input inp;
         uint32_t redis_time;
         bool ret_code;
+        shared_ptr<QueryResultLines> result_lines;
+        BufferT::const_iterator next_row;
+        OutRowMultimapT::const_iterator next_mrow;
+        uint32_t lines;
+        uint32_t rows;
+        bool status_sent;
     };
+
+    // Sends the next kRespLinesPerStep lines of the final result, and
+    // waits for redis to take them before sending more, so that only a few
+    // lines of JSON rows are held at a time. The status is sent after the
+    // last line, together with the expiry of all the lines.
+    ExternalBase::Efn QueryRespSend(const Stage0Merge & inp, Output & ret) {
+        RedisAsyncConnection * rac = conns_[ret.inp.cnum].get();
+        uint64_t then = UTCTimestampUsec();
+        QueryResultLines::CommandListT commands;
+        char stat[80];
+        string key = "REPLY:" + ret.inp.qp.qid;
+        if (!inp.ret_code) {
+            // Let the lines streamed before the failure go
+            ret.result_lines->ExpireLines(ret.lines, &commands);
+            sprintf(stat,"{\"progress\":%d}", - 5);
+            ret.status_sent = true;
+        } else if ((ret.next_row != inp.result.end()) ||
+                   (ret.next_mrow != inp.mresult.end())) {
+            for (int idx = 0; idx < kRespLinesPerStep; idx++) {
+                if (inp.inp.map_output) {
+                    if (ret.next_mrow == inp.mresult.end()) break;
+                    ret.rows += ret.result_lines->AddLine(ret.lines,
+                        &ret.next_mrow, inp.mresult.end(), &commands);
+                } else {
+                    if (ret.next_row == inp.result.end()) break;
+                    ret.rows += ret.result_lines->AddLine(ret.lines,
+                        &ret.next_row, inp.result.end(), &commands);
+                }
+                ret.lines++;
+            }
+            sprintf(stat,"{\"progress\":90, \"lines\":%d}",
+                (int)ret.lines - 1);
+        } else {
+            ret.result_lines->ExpireLines(ret.lines, &commands);
+            sprintf(stat,"{\"progress\":100, \"lines\":%d, \"count\":%d}",
+                (int)ret.lines, (int)ret.rows);
+            ret.status_sent = true;
+        }
+        SendLines(rac, commands);
+        uint64_t now = UTCTimestampUsec();
+        ret.redis_time += static_cast<uint32_t>((now - then)/1000);
+        if (ret.status_sent) {
+            QE_LOG_NOQID(DEBUG,  "QE Query Result is " << stat);
+        }
+        return boost::bind(&RedisAsyncArgCommand, rac, _1,
+                list_of(string("RPUSH"))(key)(stat));
+    }
+
     ExternalBase::Efn QueryResp(uint32_t inst, const vector<RedisT*> & exts,
             const Stage0Merge & inp, Output & ret) {
         uint32_t step = exts.size();
         switch (inst) {
         case 0: {
                 if (!step)  {
-
                     ret.inp = inp.inp;
-                    RedisAsyncConnection * rac = conns_[ret.inp.cnum].get();
-                    std::stringstream keystr;
-                    auto_ptr<QEOutputT> jsonresult(new QEOutputT);
+                    ret.redis_time = 0;
+                    ret.result_lines.reset(new QueryResultLines(
+                        ret.inp.qp.qid, inp.inp.table, inp.inp.map_output));
+                    ret.next_row = inp.result.begin();
+                    ret.next_mrow = inp.mresult.begin();
+                    ret.lines = inp.stream_lines;
+                    ret.rows = inp.stream_rows;
+                    ret.status_sent = false;
 
                     QE_LOG_NOQID(INFO,  "Will Jsonify #rows " << 
-                        inp.result.size() + inp.mresult.size());
-                    QueryJsonify(inp.inp.table, inp.inp.map_output,
-                        &inp.result, &inp.mresult, jsonresult.get());
-                        
-                    vector<string> const * const res = jsonresult.get();
-                    vector<string>::size_type idx = 0;
-                    uint32_t rownum = 0;
-
-                    QE_LOG_NOQID(INFO,  "Did Jsonify #rows " << res->size());
-                    
-                    uint64_t then = UTCTimestampUsec();
-                    char stat[80];
-                    string key = "REPLY:" + ret.inp.qp.qid;
-                    if (!inp.ret_code) {
-                        sprintf(stat,"{\"progress\":%d}", - 5);
-                    } else {
-                        while (idx < res->size()) {
-                            uint32_t rowsize = 0;
-                            keystr.str(string());
-                            keystr << "RESULT:" << ret.inp.qp.qid << ":" << rownum;
-                            vector<string> command = list_of(string("RPUSH"))(keystr.str());
-                            while ((idx < res->size()) && (((int)rowsize) < kMaxRowThreshold)) {
-                                command.push_back(res->at(idx));
-                                rowsize += res->at(idx).size();
-                                idx++;
-                            }
-                            RedisAsyncArgCommand(rac, NULL, command);
-                            RedisAsyncArgCommand(rac, NULL, 
-                                list_of(string("EXPIRE"))(keystr.str())("300"));
-                            sprintf(stat,"{\"progress\":90, \"lines\":%d}",
-                                (int)rownum);
-                            RedisAsyncArgCommand(rac, NULL, 
-                                list_of(string("RPUSH"))(key)(stat));
-                            rownum++;
-                        }
-                        sprintf(stat,"{\"progress\":100, \"lines\":%d, \"count\":%d}",
-                            (int)rownum, (int)res->size());
-                    }
-                    uint64_t now = UTCTimestampUsec();
-                    ret.redis_time = static_cast<uint32_t>((now - then)/1000);
-                    QE_LOG_NOQID(DEBUG,  "QE Query Result is " << stat);
-                    return boost::bind(&RedisAsyncArgCommand,
-                            conns_[ret.inp.cnum].get(), _1,
-                            list_of(string("RPUSH"))(key)(stat));   
+                        inp.result.size() + inp.mresult.size() <<
+                        " Streamed #rows " << inp.stream_rows);
+                }
+                if (!ret.status_sent) {
+                    return QueryRespSend(inp, ret);
                 } else {
                     RedisAsyncConnection * rac = conns_[ret.inp.cnum].get();
                     string key = "REPLY:" + ret.inp.qp.qid;
@@ -485,14 +496,10 @@ public:
 
                     QueryStats qs;
                     qs.set_table(inp.inp.table);
-                    size_t outsize;
-
-                    if (ret.inp.map_output)
-                        outsize = inp.mresult.size();
-                    else
-                        outsize = inp.result.size();
+                    size_t outsize = ret.rows;
 
                     qs.set_rows(static_cast<uint32_t>(outsize));                                           
+                    qs.set_peak_result_bytes(inp.peak_result_bytes);
 
 
                     qs.set_time(qtime);
@@ -548,6 +555,7 @@ public:
                         " RedisTime(ms) " << ret.redis_time <<
                         " MergeTime(ms) " << inp.fm_time <<
                         " Rows " << outsize <<
+                        " PeakResultBytes " << inp.peak_result_bytes <<
                         " EnQ-delay" << enq_delay);
 
                     ret.ret_code = true;
@@ -713,6 +721,7 @@ public:
         inp.get()->time_period = time_period;
         inp.get()->table = table;
         inp.get()->chunk_q = 0;
+        inp.get()->stream.reset(new QueryStream(qid, table, map_output));
 
         vector<pair<int,int> > tinfo;
         for (uint idx=0; idx<(uint)max_tasks_; idx++) {
@@ -847,7 +856,8 @@ public:
     }
 private:
 
-    static const int kMaxRowThreshold = 10000;
+    // Lines of the final result sent for each reply waited for
+    static const int kRespLinesPerStep = 16;
 
     // We always have one connection to receive new queries from OpServer
     // This is the number of addition connections, which will be 
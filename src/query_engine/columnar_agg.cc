@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "columnar_agg.h"
+
+#include <algorithm>
+
+const size_t FlowSeriesAggregator::kBatchSamples;
+
+FlowSeriesAggregator::GroupKey::GroupKey()
+    : t(0), vrouter(0), source_vn(0), dest_vn(0), source_ip(0), dest_ip(0),
+      protocol(0), source_port(0), dest_port(0), direction(0) {
+}
+
+bool FlowSeriesAggregator::GroupKey::operator==(const GroupKey& rhs) const {
+    return (t == rhs.t) &&
+        (vrouter == rhs.vrouter) &&
+        (source_vn == rhs.source_vn) &&
+        (dest_vn == rhs.dest_vn) &&
+        (source_ip == rhs.source_ip) &&
+        (dest_ip == rhs.dest_ip) &&
+        (protocol == rhs.protocol) &&
+        (source_port == rhs.source_port) &&
+        (dest_port == rhs.dest_port) &&
+        (direction == rhs.direction);
+}
+
+size_t FlowSeriesAggregator::GroupKeyHash::operator()(
+        const GroupKey& key) const {
+    size_t seed = 0;
+    boost::hash_combine(seed, key.t);
+    boost::hash_combine(seed, key.vrouter);
+    boost::hash_combine(seed, key.source_vn);
+    boost::hash_combine(seed, key.dest_vn);
+    boost::hash_combine(seed, key.source_ip);
+    boost::hash_combine(seed, key.dest_ip);
+    boost::hash_combine(seed, key.protocol);
+    boost::hash_combine(seed, key.source_port);
+    boost::hash_combine(seed, key.dest_port);
+    boost::hash_combine(seed, key.direction);
+    return seed;
+}
+
+class FlowSeriesAggregator::GroupLess {
+public:
+    GroupLess(const FlowSeriesAggregator *aggregator, bool time_major)
+        : aggregator_(aggregator), time_major_(time_major) {
+    }
+
+    bool operator()(uint32_t lhs, uint32_t rhs) const {
+        const GroupKey& lkey = aggregator_->groups_.key(lhs);
+        const GroupKey& rkey = aggregator_->groups_.key(rhs);
+        if (time_major_ && lkey.t != rkey.t) {
+            return lkey.t < rkey.t;
+        }
+        int result = aggregator_->CompareFlowClass(lkey, rkey);
+        if (result != 0) {
+            return result < 0;
+        }
+        return lkey.t < rkey.t;
+    }
+
+private:
+    const FlowSeriesAggregator *aggregator_;
+    bool time_major_;
+};
+
+FlowSeriesAggregator::FlowSeriesAggregator(uint32_t fields, bool with_stats)
+    : fields_(fields), with_stats_(with_stats), sample_count_(0) {
+}
+
+void FlowSeriesAggregator::AddSample(uint64_t t,
+        const boost::uuids::uuid& uuid, const flow_stats& stats,
+        const flow_tuple& tuple) {
+    GroupKey key;
+    key.t = t;
+    if (fields_ & VROUTER) key.vrouter = names_.Encode(tuple.vrouter);
+    if (fields_ & SOURCE_VN) key.source_vn = names_.Encode(tuple.source_vn);
+    if (fields_ & DEST_VN) key.dest_vn = names_.Encode(tuple.dest_vn);
+    if (fields_ & SOURCE_IP) key.source_ip = tuple.source_ip;
+    if (fields_ & DEST_IP) key.dest_ip = tuple.dest_ip;
+    if (fields_ & PROTOCOL) key.protocol = tuple.protocol;
+    if (fields_ & SOURCE_PORT) key.source_port = tuple.source_port;
+    if (fields_ & DEST_PORT) key.dest_port = tuple.dest_port;
+    if (fields_ & DIRECTION) key.direction = tuple.direction;
+
+    uint32_t group = groups_.Lookup(key);
+    sample_count_++;
+    if (!with_stats_) {
+        return;
+    }
+    group_flow_set_.insert(GroupFlow(group, flow_codes_.Encode(uuid)));
+    sample_groups_.push_back(group);
+    sample_pkts_.push_back(stats.pkts);
+    sample_bytes_.push_back(stats.bytes);
+    if (sample_groups_.size() == kBatchSamples) {
+        SumBatch();
+    }
+}
+
+void FlowSeriesAggregator::SumBatch() {
+    pkts_.resize(groups_.size(), 0);
+    bytes_.resize(groups_.size(), 0);
+    QeGroupSum(sample_groups_, sample_pkts_, &pkts_);
+    QeGroupSum(sample_groups_, sample_bytes_, &bytes_);
+    sample_groups_.clear();
+    sample_pkts_.clear();
+    sample_bytes_.clear();
+}
+
+void FlowSeriesAggregator::Aggregate() {
+    if (!with_stats_) {
+        return;
+    }
+    SumBatch();
+
+    size_t group_count = groups_.size();
+    flows_.assign(group_flow_set_.begin(), group_flow_set_.end());
+    boost::unordered_set<uint64_t>().swap(group_flow_set_);
+    std::sort(flows_.begin(), flows_.end());
+
+    flow_index_.assign(group_count + 1, 0);
+    for (size_t i = 0; i < flows_.size(); i++) {
+        flow_index_[(flows_[i] >> 32) + 1]++;
+    }
+    for (size_t group = 0; group < group_count; group++) {
+        flow_index_[group + 1] += flow_index_[group];
+    }
+}
+
+int FlowSeriesAggregator::CompareFlowClass(const GroupKey& lhs,
+        const GroupKey& rhs) const {
+    if (lhs.vrouter != rhs.vrouter) {
+        return names_.Decode(lhs.vrouter).compare(names_.Decode(rhs.vrouter));
+    }
+    if (lhs.source_vn != rhs.source_vn) {
+        return names_.Decode(lhs.source_vn).compare(
+                names_.Decode(rhs.source_vn));
+    }
+    if (lhs.dest_vn != rhs.dest_vn) {
+        return names_.Decode(lhs.dest_vn).compare(names_.Decode(rhs.dest_vn));
+    }
+    if (lhs.source_ip != rhs.source_ip) {
+        return lhs.source_ip < rhs.source_ip ? -1 : 1;
+    }
+    if (lhs.dest_ip != rhs.dest_ip) {
+        return lhs.dest_ip < rhs.dest_ip ? -1 : 1;
+    }
+    if (lhs.protocol != rhs.protocol) {
+        return lhs.protocol < rhs.protocol ? -1 : 1;
+    }
+    if (lhs.source_port != rhs.source_port) {
+        return lhs.source_port < rhs.source_port ? -1 : 1;
+    }
+    if (lhs.dest_port != rhs.dest_port) {
+        return lhs.dest_port < rhs.dest_port ? -1 : 1;
+    }
+    if (lhs.direction != rhs.direction) {
+        return lhs.direction < rhs.direction ? -1 : 1;
+    }
+    return 0;
+}
+
+void FlowSeriesAggregator::SortGroups(bool time_major,
+        std::vector<uint32_t> *order) const {
+    order->resize(groups_.size());
+    for (size_t group = 0; group < groups_.size(); group++) {
+        (*order)[group] = group;
+    }
+    std::sort(order->begin(), order->end(), GroupLess(this, time_major));
+}
+
+uint64_t FlowSeriesAggregator::GroupTime(uint32_t group) const {
+    return groups_.key(group).t;
+}
+
+void FlowSeriesAggregator::GroupFlowClass(uint32_t group,
+        flow_tuple *tuple) const {
+    const GroupKey& key = groups_.key(group);
+    *tuple = flow_tuple();
+    if (fields_ & VROUTER) tuple->vrouter = names_.Decode(key.vrouter);
+    if (fields_ & SOURCE_VN) tuple->source_vn = names_.Decode(key.source_vn);
+    if (fields_ & DEST_VN) tuple->dest_vn = names_.Decode(key.dest_vn);
+    tuple->source_ip = key.source_ip;
+    tuple->dest_ip = key.dest_ip;
+    tuple->protocol = key.protocol;
+    tuple->source_port = key.source_port;
+    tuple->dest_port = key.dest_port;
+    tuple->direction = key.direction;
+}
+
+void FlowSeriesAggregator::GroupStats(uint32_t group,
+        flow_stats *stats) const {
+    assert(with_stats_);
+    stats->pkts = pkts_[group];
+    stats->bytes = bytes_[group];
+    stats->flow_list.clear();
+    for (size_t i = flow_index_[group]; i < flow_index_[group + 1]; i++) {
+        uint32_t flow = flows_[i] & 0xffffffff;
+        stats->flow_list.insert(flow_codes_.Decode(flow));
+    }
+}
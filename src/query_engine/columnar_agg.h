@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+/*
+ * This file has the building blocks for aggregating query results in
+ * columns instead of in maps keyed by the rows.
+ *
+ * Rows are loaded one at a time. The group-by values of a row are encoded
+ * into a fixed width key, with each string replaced by its code in a
+ * dictionary, and the key is looked up in a hash table that gives the
+ * index of the group. The values to aggregate are appended to batch
+ * columns next to the group index of the row, and each batch is summed
+ * into per group columns in one pass, so that the memory used does not
+ * grow with the number of rows.
+ */
+
+#ifndef COLUMNAR_AGG_H_
+#define COLUMNAR_AGG_H_
+
+#include <stdint.h>
+#include <cassert>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/uuid/uuid.hpp>
+#include "base/util.h"
+#include "query.h"
+
+// Dictionary encoding of a column. Each distinct value is stored once, and
+// is replaced in the rows by its code, which is its index in the dictionary.
+template <typename T>
+class QeDictionary {
+public:
+    QeDictionary() {
+    }
+
+    uint32_t Encode(const T& value) {
+        typename CodeMap::const_iterator it = codes_.find(value);
+        if (it != codes_.end()) {
+            return it->second;
+        }
+        uint32_t code = values_.size();
+        it = codes_.insert(std::make_pair(value, code)).first;
+        values_.push_back(&it->first);
+        return code;
+    }
+
+    const T& Decode(uint32_t code) const { return *values_[code]; }
+    size_t size() const { return values_.size(); }
+
+    void Clear() {
+        values_.clear();
+        codes_.clear();
+    }
+
+private:
+    typedef boost::unordered_map<T, uint32_t> CodeMap;
+
+    CodeMap codes_;
+    std::vector<const T *> values_;
+
+    DISALLOW_COPY_AND_ASSIGN(QeDictionary);
+};
+
+// Hash based group-by. Gives the index of the group of a key. The indexes
+// are dense and in the order in which the groups are first seen, so that
+// they can be used to index the aggregated columns.
+template <typename Key, typename Hash = boost::hash<Key> >
+class QeGroupTable {
+public:
+    QeGroupTable() {
+    }
+
+    uint32_t Lookup(const Key& key) {
+        typename GroupMap::const_iterator it = groups_.find(key);
+        if (it != groups_.end()) {
+            return it->second;
+        }
+        uint32_t group = keys_.size();
+        it = groups_.insert(std::make_pair(key, group)).first;
+        keys_.push_back(&it->first);
+        return group;
+    }
+
+    const Key& key(uint32_t group) const { return *keys_[group]; }
+    size_t size() const { return keys_.size(); }
+
+    void Clear() {
+        keys_.clear();
+        groups_.clear();
+    }
+
+private:
+    typedef boost::unordered_map<Key, uint32_t, Hash> GroupMap;
+
+    GroupMap groups_;
+    std::vector<const Key *> keys_;
+
+    DISALLOW_COPY_AND_ASSIGN(QeGroupTable);
+};
+
+// sums[groups[i]] += values[i] for each row i. sums must have an entry
+// for every group.
+template <typename T>
+void QeGroupSum(const std::vector<uint32_t>& groups,
+        const std::vector<T>& values, std::vector<T> *sums) {
+    assert(groups.size() == values.size());
+    if (groups.empty()) {
+        return;
+    }
+    const uint32_t *group = &groups[0];
+    const T *value = &values[0];
+    T *sum = &(*sums)[0];
+    for (size_t i = 0, count = groups.size(); i < count; i++) {
+        sum[group[i]] += value[i];
+    }
+}
+
+// counts[groups[i]]++ for each row i.
+inline void QeGroupCount(const std::vector<uint32_t>& groups,
+        std::vector<uint64_t> *counts) {
+    if (groups.empty()) {
+        return;
+    }
+    const uint32_t *group = &groups[0];
+    uint64_t *count = &(*counts)[0];
+    for (size_t i = 0, rows = groups.size(); i < rows; i++) {
+        count[group[i]]++;
+    }
+}
+
+// Group-by of flow series samples on the flow class and the time slice,
+// with the sum of the packets and bytes and the set of flows of each group.
+//
+// The vrouter and virtual network names are dictionary encoded, so a group
+// key is a fixed width struct and the names are kept once per query rather
+// than once per group. Flow uuids are encoded too, and the flows of all the
+// groups are kept in one hash set of (group, flow code).
+class FlowSeriesAggregator {
+public:
+    static const size_t kBatchSamples = 4096;
+
+    // Flow tuple fields that make up the flow class
+    enum Field {
+        VROUTER = 1 << 0,
+        SOURCE_VN = 1 << 1,
+        DEST_VN = 1 << 2,
+        SOURCE_IP = 1 << 3,
+        DEST_IP = 1 << 4,
+        PROTOCOL = 1 << 5,
+        SOURCE_PORT = 1 << 6,
+        DEST_PORT = 1 << 7,
+        DIRECTION = 1 << 8,
+    };
+
+    // fields is a mask of Field. If with_stats is false, only the groups
+    // are kept, without their packets, bytes and flows.
+    FlowSeriesAggregator(uint32_t fields, bool with_stats);
+
+    // t is the time slice of the sample, or 0 if the samples are not
+    // grouped on time.
+    void AddSample(uint64_t t, const boost::uuids::uuid& uuid,
+            const flow_stats& stats, const flow_tuple& tuple);
+
+    // Sums up the last batch of samples and sorts the flows of the groups.
+    // Must be called after the last AddSample and before the groups are
+    // read.
+    void Aggregate();
+
+    size_t group_count() const { return groups_.size(); }
+    size_t sample_count() const { return sample_count_; }
+
+    // Group indexes in the order of the flow class and then of the time
+    // slice, or of the time slice first if time_major is set.
+    void SortGroups(bool time_major, std::vector<uint32_t> *order) const;
+
+    uint64_t GroupTime(uint32_t group) const;
+    void GroupFlowClass(uint32_t group, flow_tuple *tuple) const;
+    void GroupStats(uint32_t group, flow_stats *stats) const;
+
+private:
+    struct GroupKey {
+        GroupKey();
+        bool operator==(const GroupKey& rhs) const;
+
+        uint64_t t;
+        uint32_t vrouter;
+        uint32_t source_vn;
+        uint32_t dest_vn;
+        uint32_t source_ip;
+        uint32_t dest_ip;
+        uint32_t protocol;
+        uint32_t source_port;
+        uint32_t dest_port;
+        uint32_t direction;
+    };
+    struct GroupKeyHash {
+        size_t operator()(const GroupKey& key) const;
+    };
+    class GroupLess;
+
+    // Group index in the high half and flow code in the low half
+    static uint64_t GroupFlow(uint32_t group, uint32_t flow) {
+        return (static_cast<uint64_t>(group) << 32) | flow;
+    }
+
+    int CompareFlowClass(const GroupKey& lhs, const GroupKey& rhs) const;
+    void SumBatch();
+
+    uint32_t fields_;
+    bool with_stats_;
+    size_t sample_count_;
+    QeDictionary<std::string> names_;
+    QeDictionary<boost::uuids::uuid> flow_codes_;
+    QeGroupTable<GroupKey, GroupKeyHash> groups_;
+
+    // Batch columns of the samples
+    std::vector<uint32_t> sample_groups_;
+    std::vector<uint64_t> sample_pkts_;
+    std::vector<uint64_t> sample_bytes_;
+
+    // Aggregated columns of the groups
+    std::vector<uint64_t> pkts_;
+    std::vector<uint64_t> bytes_;
+    boost::unordered_set<uint64_t> group_flow_set_;
+
+    // Sorted group flows after Aggregate. The flows of group g are
+    // flows_[flow_index_[g]] to flows_[flow_index_[g + 1] - 1].
+    std::vector<uint64_t> flows_;
+    std::vector<size_t> flow_index_;
+
+    DISALLOW_COPY_AND_ASSIGN(FlowSeriesAggregator);
+};
+
+#endif
@@ -385,6 +385,8 @@ public:
 // This class provides interface to process SET operations involved in the 
 // WHERE part of the query
 // leaf node's child nodes are DbQueryUnit
+// The sorted results of the sub-queries are combined with a single k-way
+// merge
 class SetOperationUnit: public QueryUnit {
 public:
     SetOperationUnit(QueryUnit *p_query, QueryUnit *m_query):
@@ -396,8 +398,10 @@ public:
     bool is_leaf_node;
 
 private:
-    void or_operation();
-    void and_operation();
+    friend class SetOperationTest;
+
+    bool run_subqueries();
+    void merge_operation(bool intersection);
 };
 
 
@@ -454,6 +458,7 @@ struct agg_stats_t {
 };
 
 class StatsSelect;
+class FlowSeriesAggregator;
 
 // following data structure does the processing of SELECT portion of query
 class SelectQuery : public QueryUnit {
@@ -565,81 +570,58 @@ private:
             const std::set<boost::uuids::uuid> *flow_list = NULL);
     
     uint64_t fs_get_time_slice(const uint64_t& t);
-    // Common Flow series queries
-
-    // 1. SELECT with T=<granularity>, stats fields
-    typedef std::map<const uint64_t, flow_stats> fs_ts_stats_map_t;
-    fs_ts_stats_map_t fs_ts_stats_map_;
-    void process_fs_query_with_ts_stats_fields(const uint64_t&, 
-            const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
-    void populate_fs_query_result_with_ts_stats_fields();
-
-    // 2. SELECT with flow tuple fields, stats fields
-    typedef std::map<const flow_tuple, flow_stats> fs_tuple_stats_map_t;
-    fs_tuple_stats_map_t fs_tuple_stats_map_;
-    void process_fs_query_with_tuple_stats_fields(const uint64_t&, 
-            const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
-    void populate_fs_query_result_with_tuple_stats_fields();
-
-    // 3. SELECT with T=<granularity>, flow tuple fields, stats fields
-    typedef std::map<const flow_tuple, fs_ts_stats_map_t> 
-        fs_ts_tuple_stats_map_t;
-    fs_ts_tuple_stats_map_t fs_ts_tuple_stats_map_;
-    void process_fs_query_with_ts_tuple_stats_fields(const uint64_t&, 
-            const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
-    void populate_fs_query_result_with_ts_tuple_stats_fields();
-
-    // Rare Flow series queries
-
+    // Aggregated Flow series queries, which are grouped in columns
     // 1. SELECT with stats fields
-    flow_stats fs_flow_stats_;
-    void process_fs_query_with_stats_fields(const uint64_t&,
+    // 2. SELECT with T=<granularity>, stats fields
+    // 3. SELECT with flow tuple fields, stats fields
+    // 4. SELECT with T=<granularity>, flow tuple fields, stats fields
+    // 5. SELECT with T=<granularity>, flow tuple fields
+    std::auto_ptr<FlowSeriesAggregator> fs_aggregator_;
+    // FlowSeriesAggregator::Field mask of the flow tuple fields in the
+    // select_column_fields
+    uint32_t get_flow_class_fields();
+    void process_fs_query_with_aggregator(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
-    void populate_fs_query_result_with_stats_fields();
-    
-    // 2. SELECT with T=<granularity>, flow tuple fields
-    typedef std::map<const uint64_t, std::set<flow_tuple> > fs_ts_tuple_map_t;
-    fs_ts_tuple_map_t fs_ts_tuple_map_;
-    void process_fs_query_with_ts_tuple_fields(const uint64_t&,
-            const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
-    void populate_fs_query_result_with_ts_tuple_fields();
+    void populate_fs_query_result_with_aggregator();
+
+    // Other Flow series queries
 
-    // 3. SELECT with flow tuple fields
+    // 1. SELECT with flow tuple fields
     typedef std::set<flow_tuple> fs_flow_tuple_list_t;
     fs_flow_tuple_list_t fs_flow_tuple_list_;
     void process_fs_query_with_tuple_fields(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
     void populate_fs_query_result_with_tuple_fields();
 
-    // 4. SELECT with T 
+    // 2. SELECT with T 
     typedef std::set<uint64_t> fs_time_t;
     fs_time_t fs_time_list_;
     void process_fs_query_with_time(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
     void populate_fs_query_result_with_time();
     
-    // 5. SELECT with T=<granularity>
+    // 3. SELECT with T=<granularity>
     typedef std::set<uint64_t> fs_ts_t;
     fs_ts_t fs_ts_list_;
     void process_fs_query_with_ts(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
     void populate_fs_query_result_with_ts();
 
-    // 6. SELECT with T, flow tuple fields
+    // 4. SELECT with T, flow tuple fields
     typedef std::map<const uint64_t, std::set<flow_tuple> > fs_time_tuple_map_t;
     fs_time_tuple_map_t fs_time_tuple_map_;
     void process_fs_query_with_time_tuple_fields(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
     void populate_fs_query_result_with_time_tuple_fields();
 
-    // 7. SELECT with T, stats fields 
+    // 5. SELECT with T, stats fields 
     typedef std::map<const uint64_t, flow_stats> fs_time_stats_map_t;
     fs_time_stats_map_t fs_time_stats_map_;
     void process_fs_query_with_time_stats_fields(const uint64_t&,
             const boost::uuids::uuid&, const flow_stats&, const flow_tuple&);
     void populate_fs_query_result_with_time_stats_fields();
 
-    // 8. SELECT with T, flow tuple, stats
+    // 6. SELECT with T, flow tuple, stats
     typedef std::map<const flow_tuple, fs_time_stats_map_t> 
         fs_time_tuple_stats_map_t;
     fs_time_tuple_stats_map_t fs_time_tuple_stats_map_;
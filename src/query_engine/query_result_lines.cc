@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "query_result_lines.h"
+
+#include <sstream>
+#include <boost/lexical_cast.hpp>
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "stats_select.h"
+
+using std::string;
+using std::vector;
+
+const int QueryResultLines::kMaxRowThreshold;
+const int QueryResultLines::kResultTTL;
+const int QueryResultLines::kStreamTTL;
+const uint32_t QueryResultStream::kMaxPendingLines;
+
+static void JsonInsert(std::vector<query_column> &columns,
+        rapidjson::Document& dd,
+        std::pair<const string,string> * map_it) {
+
+    bool found = false;
+    for (size_t j = 0; j < columns.size(); j++)
+    {
+        if (0 == map_it->first.compare(0,5,string("COUNT"))) {
+            rapidjson::Value val(rapidjson::kNumberType);
+            unsigned long num = 0;
+            stringToInteger(map_it->second, num);
+            val.SetUint64(num);
+            dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
+            found = true;
+        } else if (columns[j].name == map_it->first) {
+            // find out type and convert
+            if (columns[j].datatype == "string" ||
+                columns[j].datatype == "uuid")
+            {
+                rapidjson::Value val(rapidjson::kStringType);
+                val.SetString(map_it->second.c_str());
+                dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
+            } else if (columns[j].datatype == "ipv4") {
+                rapidjson::Value val(rapidjson::kStringType);
+                char str[INET_ADDRSTRLEN];
+                uint32_t ipaddr = 0;
+
+                stringToInteger(map_it->second, ipaddr);
+                ipaddr = htonl(ipaddr);
+                inet_ntop(AF_INET, &(ipaddr), str, INET_ADDRSTRLEN);
+                map_it->second = str;
+
+                val.SetString(map_it->second.c_str(), map_it->second.size());
+                dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
+
+            } else if (columns[j].datatype == "double") {
+                rapidjson::Value val(rapidjson::kNumberType);
+                double dval = (double) strtod(map_it->second.c_str(), NULL);
+                val.SetDouble(dval);
+                dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
+            } else {
+                rapidjson::Value val(rapidjson::kNumberType);
+                unsigned long num = 0;
+                stringToInteger(map_it->second, num);
+                val.SetUint64(num);
+                dd.AddMember(map_it->first.c_str(), val, dd.GetAllocator());
+            }
+            found = true;
+        }
+    }
+    assert(found);
+}
+
+QueryResultLines::QueryResultLines(const string &qid, const string &table,
+                                   bool map_output)
+    : qid_(qid), map_output_(map_output) {
+    TableColumns(table, map_output, &columns_);
+}
+
+string QueryResultLines::LineKey(const string &qid, uint32_t line) {
+    std::stringstream keystr;
+    keystr << "RESULT:" << qid << ":" << line;
+    return keystr.str();
+}
+
+void QueryResultLines::TableColumns(const string& table, bool map_output,
+        std::vector<query_column>* columns) {
+    if (!table.size()) return;
+    bool found = false;
+    for(size_t i = 0; i < g_viz_constants._TABLES.size(); i++)
+    {
+        if (g_viz_constants._TABLES[i].name == table) {
+            found = true;
+            *columns = g_viz_constants._TABLES[i].schema.columns;
+        }
+    }
+    if (!found) {
+        if (g_viz_constants.OBJECT_VALUE_TABLE == table) {
+            found = true;
+            *columns = g_viz_constants._OBJECT_TABLE_SCHEMA.columns;
+        }
+    }
+    if (!found) {
+        for (std::map<std::string, objtable_info>::const_iterator it =
+                g_viz_constants._OBJECT_TABLES.begin();
+                it != g_viz_constants._OBJECT_TABLES.end(); it++) {
+            if (it->first == table) {
+                found = true;
+                *columns = g_viz_constants._OBJECT_TABLE_SCHEMA.columns;
+            }
+        }
+    }
+    assert(found || map_output);
+}
+
+void QueryResultLines::RowJsonify(const QEOpServerProxy::ResultRowT& row,
+        string* json) {
+    QEOpServerProxy::ResultRowT& raw_row =
+        const_cast<QEOpServerProxy::ResultRowT&>(row);
+    std::map<std::string, std::string>::iterator map_it;
+    rapidjson::Document dd;
+    dd.SetObject();
+
+    for (map_it = raw_row.first.begin();
+         map_it != raw_row.first.end(); ++map_it) {
+        // search for column name in the schema
+        JsonInsert(columns_, dd, &(*map_it));
+    }
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    dd.Accept(writer);
+    *json = sb.GetString();
+}
+
+size_t QueryResultLines::AddLine(uint32_t line,
+        QEOpServerProxy::BufferT::const_iterator *it,
+        QEOpServerProxy::BufferT::const_iterator end,
+        CommandListT *commands) {
+    commands->push_back(CommandT());
+    CommandT &command = commands->back();
+    command.push_back("RPUSH");
+    command.push_back(LineKey(qid_, line));
+
+    uint32_t rowsize = 0;
+    size_t rows = 0;
+    while ((*it != end) && (((int)rowsize) < kMaxRowThreshold)) {
+        command.push_back(string());
+        RowJsonify(**it, &command.back());
+        rowsize += command.back().size();
+        ++(*it);
+        rows++;
+    }
+    AddExpire(line, kStreamTTL, commands);
+    return rows;
+}
+
+size_t QueryResultLines::AddLine(uint32_t line,
+        QEOpServerProxy::OutRowMultimapT::const_iterator *it,
+        QEOpServerProxy::OutRowMultimapT::const_iterator end,
+        CommandListT *commands) {
+    commands->push_back(CommandT());
+    CommandT &command = commands->back();
+    command.push_back("RPUSH");
+    command.push_back(LineKey(qid_, line));
+
+    uint32_t rowsize = 0;
+    size_t rows = 0;
+    while ((*it != end) && (((int)rowsize) < kMaxRowThreshold)) {
+        command.push_back(string());
+        StatsSelect::Jsonify((*it)->second.first, (*it)->second.second,
+            command.back());
+        rowsize += command.back().size();
+        ++(*it);
+        rows++;
+    }
+    AddExpire(line, kStreamTTL, commands);
+    return rows;
+}
+
+void QueryResultLines::AddExpire(uint32_t line, int ttl,
+        CommandListT *commands) const {
+    commands->push_back(CommandT());
+    CommandT &command = commands->back();
+    command.push_back("EXPIRE");
+    command.push_back(LineKey(qid_, line));
+    command.push_back(boost::lexical_cast<string>(ttl));
+}
+
+void QueryResultLines::ExpireLines(uint32_t lines,
+        CommandListT *commands) const {
+    for (uint32_t line = 0; line < lines; line++) {
+        AddExpire(line, kResultTTL, commands);
+    }
+}
+
+QueryResultStream::QueryResultStream(const string &qid, const string &table,
+                                     bool map_output)
+    : result_lines_(qid, table, map_output) {
+    next_line_ = 0;
+    pending_ = 0;
+}
+
+template <typename IteratorT>
+size_t QueryResultStream::AddLinesInternal(IteratorT *it, IteratorT end,
+        QueryResultLines::CommandListT *commands) {
+    size_t rows = 0;
+    while (*it != end) {
+        // Other instances may be taking lines at the same time
+        if (pending_.fetch_and_increment() >= kMaxPendingLines) {
+            pending_--;
+            break;
+        }
+        rows += result_lines_.AddLine(next_line_.fetch_and_increment(), it,
+                                      end, commands);
+    }
+    return rows;
+}
+
+size_t QueryResultStream::AddLines(
+        QEOpServerProxy::BufferT::const_iterator *it,
+        QEOpServerProxy::BufferT::const_iterator end,
+        QueryResultLines::CommandListT *commands) {
+    return AddLinesInternal(it, end, commands);
+}
+
+size_t QueryResultStream::AddLines(
+        QEOpServerProxy::OutRowMultimapT::const_iterator *it,
+        QEOpServerProxy::OutRowMultimapT::const_iterator end,
+        QueryResultLines::CommandListT *commands) {
+    return AddLinesInternal(it, end, commands);
+}
+
+void QueryResultStream::LineDone() {
+    assert(pending_ > 0);
+    pending_--;
+}
+
+uint64_t QueryResultBytes::Bytes(const QEOpServerProxy::BufferT *res) {
+    if (!res) return 0;
+    uint64_t bytes = res->size() * sizeof(QEOpServerProxy::ResultRowT);
+    for (QEOpServerProxy::BufferT::const_iterator it = res->begin();
+            it != res->end(); ++it) {
+        for (QEOpServerProxy::OutRowT::const_iterator jt = it->first.begin();
+                jt != it->first.end(); ++jt) {
+            bytes += sizeof(QEOpServerProxy::OutRowT::value_type) +
+                jt->first.size() + jt->second.size();
+        }
+    }
+    return bytes;
+}
+
+uint64_t QueryResultBytes::Bytes(
+        const QEOpServerProxy::OutRowMultimapT *mres) {
+    if (!mres) return 0;
+    uint64_t bytes =
+        mres->size() * sizeof(QEOpServerProxy::OutRowMultimapT::value_type);
+    for (QEOpServerProxy::OutRowMultimapT::const_iterator it = mres->begin();
+            it != mres->end(); ++it) {
+        bytes += it->first.size() * sizeof(QEOpServerProxy::SubVal);
+        bytes += it->second.first.size() *
+            sizeof(std::map<string, QEOpServerProxy::SubVal>::value_type);
+        bytes += it->second.second.size() *
+            sizeof(QEOpServerProxy::AggRowT::value_type);
+    }
+    return bytes;
+}
+
+void QueryResultBytes::Held(int64_t bytes) {
+    uint64_t held = held_.fetch_and_add(bytes) + bytes;
+    uint64_t peak = peak_;
+    while (held > peak) {
+        uint64_t prev = peak_.compare_and_swap(held, peak);
+        if (prev == peak) break;
+        peak = prev;
+    }
+}
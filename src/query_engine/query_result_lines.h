@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+/*
+ * This file has the encoding of query results into the redis lists that
+ * the OpServer reads them from, and the estimate of the memory held by the
+ * results of a query.
+ *
+ * The rows are JSON-encoded and pushed into lists named
+ * RESULT:<qid>:<line>, with up to kMaxRowThreshold bytes of rows in each
+ * line. The OpServer reads the lines in order, starting at 0, and stops at
+ * the first line that is missing. Each line is pushed with an expiry of
+ * kStreamTTL, which is longer than a query runs for, so that the lines of a
+ * query that never finishes do not stay in redis. The expiry is cut down
+ * to kResultTTL on all of the lines when the final status of the query is
+ * written.
+ */
+
+#ifndef QUERY_RESULT_LINES_H_
+#define QUERY_RESULT_LINES_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <tbb/atomic.h>
+#include "query.h"
+
+class QueryResultLines {
+public:
+    typedef std::vector<std::string> CommandT;
+    typedef std::vector<CommandT> CommandListT;
+
+    // Approximate bytes of JSON rows in a line
+    static const int kMaxRowThreshold = 10000;
+    // Seconds the lines are kept for after the final status is written
+    static const int kResultTTL = 300;
+    // Seconds the lines are kept for until then
+    static const int kStreamTTL = 3600;
+
+    QueryResultLines(const std::string &qid, const std::string &table,
+                     bool map_output);
+
+    static std::string LineKey(const std::string &qid, uint32_t line);
+
+    // Appends the commands that push line number line, which holds the
+    // rows starting at *it, and set its expiry. *it is moved past the rows
+    // in the line. Returns the number of rows in the line.
+    size_t AddLine(uint32_t line, QEOpServerProxy::BufferT::const_iterator *it,
+                   QEOpServerProxy::BufferT::const_iterator end,
+                   CommandListT *commands);
+    size_t AddLine(uint32_t line,
+                   QEOpServerProxy::OutRowMultimapT::const_iterator *it,
+                   QEOpServerProxy::OutRowMultimapT::const_iterator end,
+                   CommandListT *commands);
+
+    // Appends the commands that set the expiry of lines 0 to lines - 1
+    void ExpireLines(uint32_t lines, CommandListT *commands) const;
+
+    static void TableColumns(const std::string &table, bool map_output,
+                             std::vector<query_column> *columns);
+
+private:
+    void AddExpire(uint32_t line, int ttl, CommandListT *commands) const;
+    void RowJsonify(const QEOpServerProxy::ResultRowT &row, std::string *json);
+
+    const std::string qid_;
+    const bool map_output_;
+    std::vector<query_column> columns_;
+
+    DISALLOW_COPY_AND_ASSIGN(QueryResultLines);
+};
+
+// The lines of a query whose chunks need no merge, which are pushed as the
+// chunks are done, by the pipeline instances in parallel. The line numbers
+// are taken from a counter shared by the instances. No more than
+// kMaxPendingLines lines are pushed that redis has not taken yet, so that
+// the rows wait in their chunks rather than in the output buffer of the
+// redis connection.
+class QueryResultStream {
+public:
+    static const uint32_t kMaxPendingLines = 64;
+
+    QueryResultStream(const std::string &qid, const std::string &table,
+                      bool map_output);
+
+    // Appends the commands that push the next lines, with the rows starting
+    // at *it, until *it reaches end or kMaxPendingLines lines are pending.
+    // Returns the number of rows in the lines.
+    size_t AddLines(QEOpServerProxy::BufferT::const_iterator *it,
+                    QEOpServerProxy::BufferT::const_iterator end,
+                    QueryResultLines::CommandListT *commands);
+    size_t AddLines(QEOpServerProxy::OutRowMultimapT::const_iterator *it,
+                    QEOpServerProxy::OutRowMultimapT::const_iterator end,
+                    QueryResultLines::CommandListT *commands);
+
+    // Called when redis has taken a line, or will not reply for it
+    void LineDone();
+
+    uint32_t lines() const { return next_line_; }
+    uint32_t pending() const { return pending_; }
+
+private:
+    template <typename IteratorT>
+    size_t AddLinesInternal(IteratorT *it, IteratorT end,
+                            QueryResultLines::CommandListT *commands);
+
+    QueryResultLines result_lines_;
+    tbb::atomic<uint32_t> next_line_;
+    tbb::atomic<uint32_t> pending_;
+
+    DISALLOW_COPY_AND_ASSIGN(QueryResultStream);
+};
+
+// Estimate of the bytes of results held by the pipeline of a query, for the
+// peak_result_bytes query stat
+class QueryResultBytes {
+public:
+    QueryResultBytes() {
+        held_ = 0;
+        peak_ = 0;
+    }
+
+    static uint64_t Bytes(const QEOpServerProxy::BufferT *res);
+    static uint64_t Bytes(const QEOpServerProxy::OutRowMultimapT *mres);
+
+    // Adds bytes, which may be negative, to the bytes held, and updates
+    // the peak
+    void Held(int64_t bytes);
+
+    uint64_t held() const { return held_; }
+    uint64_t peak() const { return peak_; }
+
+private:
+    tbb::atomic<uint64_t> held_;
+    tbb::atomic<uint64_t> peak_;
+};
+
+#endif // QUERY_RESULT_LINES_H_
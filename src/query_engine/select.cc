@@ -9,6 +9,7 @@
 #include "rapidjson/document.h"
 
 #include "analytics/vizd_table_desc.h"
+#include "columnar_agg.h"
 #include "stats_select.h"
 
 using std::string;
@@ -497,9 +498,10 @@ query_status_t SelectQuery::process_query() {
                 }
             }
             //uint64_t thenl = UTCTimestampUsec();
-            stats_->LoadRow(u, it->timestamp, attribs, *mresult_);
+            stats_->LoadRow(u, it->timestamp, attribs);
             //loadt += UTCTimestampUsec() - thenl; 
         }
+        stats_->Flush(*mresult_);
         //QE_TRACE(DEBUG, "Select ProcTime - Entries : " << query_result.size() <<
         //        " json : " << jsont << " parse : " << parset << " load : " << loadt);
 
@@ -4,6 +4,7 @@
 
 #include "base/util.h"
 #include "query.h"
+#include "columnar_agg.h"
 
 SelectQuery::process_fs_query_cb_map_t SelectQuery::process_fs_query_cb_map_ =
     SelectQuery::process_fs_query_cb_map_init();  
@@ -19,21 +20,21 @@ SelectQuery::process_fs_query_cb_map_t SelectQuery::process_fs_query_cb_map_init
     query_cb_map[FS_SELECT_FLOW_TUPLE] = 
         &SelectQuery::process_fs_query_with_tuple_fields;
     query_cb_map[FS_SELECT_STATS] = 
-        &SelectQuery::process_fs_query_with_stats_fields;
+        &SelectQuery::process_fs_query_with_aggregator;
     query_cb_map[FS_SELECT_T_FLOW_TUPLE] = 
         &SelectQuery::process_fs_query_with_time_tuple_fields;
     query_cb_map[FS_SELECT_T_STATS] = 
         &SelectQuery::process_fs_query_with_time_stats_fields;
     query_cb_map[FS_SELECT_FLOW_TUPLE_STATS] = 
-        &SelectQuery::process_fs_query_with_tuple_stats_fields;
+        &SelectQuery::process_fs_query_with_aggregator;
     query_cb_map[FS_SELECT_TS_FLOW_TUPLE] = 
-        &SelectQuery::process_fs_query_with_ts_tuple_fields;
+        &SelectQuery::process_fs_query_with_aggregator;
     query_cb_map[FS_SELECT_TS_STATS] = 
-        &SelectQuery::process_fs_query_with_ts_stats_fields;
+        &SelectQuery::process_fs_query_with_aggregator;
     query_cb_map[FS_SELECT_T_FLOW_TUPLE_STATS] = 
         &SelectQuery::process_fs_query_with_time_tuple_stats_fields;
     query_cb_map[FS_SELECT_TS_FLOW_TUPLE_STATS] = 
-        &SelectQuery::process_fs_query_with_ts_tuple_stats_fields;
+        &SelectQuery::process_fs_query_with_aggregator;
 
     return query_cb_map;
 }
@@ -47,50 +48,83 @@ SelectQuery::populate_fs_result_cb_map_t SelectQuery::populate_fs_result_cb_map_
     result_cb_map[FS_SELECT_FLOW_TUPLE] = 
         &SelectQuery::populate_fs_query_result_with_tuple_fields;
     result_cb_map[FS_SELECT_STATS] = 
-        &SelectQuery::populate_fs_query_result_with_stats_fields;
+        &SelectQuery::populate_fs_query_result_with_aggregator;
     result_cb_map[FS_SELECT_T_FLOW_TUPLE] = 
         &SelectQuery::populate_fs_query_result_with_time_tuple_fields;
     result_cb_map[FS_SELECT_T_STATS] = 
         &SelectQuery::populate_fs_query_result_with_time_stats_fields;
     result_cb_map[FS_SELECT_FLOW_TUPLE_STATS] = 
-        &SelectQuery::populate_fs_query_result_with_tuple_stats_fields;
+        &SelectQuery::populate_fs_query_result_with_aggregator;
     result_cb_map[FS_SELECT_TS_FLOW_TUPLE] = 
-        &SelectQuery::populate_fs_query_result_with_ts_tuple_fields;
+        &SelectQuery::populate_fs_query_result_with_aggregator;
     result_cb_map[FS_SELECT_TS_STATS] = 
-        &SelectQuery::populate_fs_query_result_with_ts_stats_fields;
+        &SelectQuery::populate_fs_query_result_with_aggregator;
     result_cb_map[FS_SELECT_T_FLOW_TUPLE_STATS] = 
         &SelectQuery::populate_fs_query_result_with_time_tuple_stats_fields;
     result_cb_map[FS_SELECT_TS_FLOW_TUPLE_STATS] = 
-        &SelectQuery::populate_fs_query_result_with_ts_tuple_stats_fields;
+        &SelectQuery::populate_fs_query_result_with_aggregator;
     
     return result_cb_map; 
 }
 
 void SelectQuery::get_flow_class(const flow_tuple& tuple, flow_tuple& flowclass) {
+    uint32_t fields = get_flow_class_fields();
+    if (fields & FlowSeriesAggregator::VROUTER) {
+        flowclass.vrouter = tuple.vrouter;
+    }
+    if (fields & FlowSeriesAggregator::SOURCE_VN) {
+        flowclass.source_vn = tuple.source_vn;
+    }
+    if (fields & FlowSeriesAggregator::SOURCE_IP) {
+        flowclass.source_ip = tuple.source_ip;
+    }
+    if (fields & FlowSeriesAggregator::DEST_VN) {
+        flowclass.dest_vn = tuple.dest_vn;
+    }
+    if (fields & FlowSeriesAggregator::DEST_IP) {
+        flowclass.dest_ip = tuple.dest_ip;
+    }
+    if (fields & FlowSeriesAggregator::PROTOCOL) {
+        flowclass.protocol = tuple.protocol;
+    }
+    if (fields & FlowSeriesAggregator::SOURCE_PORT) {
+        flowclass.source_port = tuple.source_port;
+    }
+    if (fields & FlowSeriesAggregator::DEST_PORT) {
+        flowclass.dest_port = tuple.dest_port;
+    }
+    if (fields & FlowSeriesAggregator::DIRECTION) {
+        flowclass.direction = tuple.direction;
+    }
+}
+
+uint32_t SelectQuery::get_flow_class_fields() {
+    uint32_t fields = 0;
     std::vector<std::string>::const_iterator it;
     for (it = select_column_fields.begin(); 
          it != select_column_fields.end(); ++it) {
         std::string qstring(get_query_string(*it));
         if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_VROUTER)->second) {
-            flowclass.vrouter = tuple.vrouter;
+            fields |= FlowSeriesAggregator::VROUTER;
         }  else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_SOURCEVN)->second) {
-            flowclass.source_vn = tuple.source_vn;
+            fields |= FlowSeriesAggregator::SOURCE_VN;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_SOURCEIP)->second) {
-            flowclass.source_ip = tuple.source_ip;
+            fields |= FlowSeriesAggregator::SOURCE_IP;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_DESTVN)->second) {
-            flowclass.dest_vn = tuple.dest_vn;
+            fields |= FlowSeriesAggregator::DEST_VN;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_DESTIP)->second) {
-            flowclass.dest_ip = tuple.dest_ip;
+            fields |= FlowSeriesAggregator::DEST_IP;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_PROTOCOL)->second) {
-            flowclass.protocol = tuple.protocol;
+            fields |= FlowSeriesAggregator::PROTOCOL;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_SPORT)->second) {
-            flowclass.source_port = tuple.source_port;
+            fields |= FlowSeriesAggregator::SOURCE_PORT;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_DPORT)->second) {
-            flowclass.dest_port = tuple.dest_port;
+            fields |= FlowSeriesAggregator::DEST_PORT;
         } else if (qstring == g_viz_constants.FlowRecordNames.find(FlowRecordFields::FLOWREC_DIRECTION_ING)->second) {
-            flowclass.direction = tuple.direction;
+            fields |= FlowSeriesAggregator::DIRECTION;
         }
     }
+    return fields;
 }
 
 void SelectQuery::fs_write_final_result_row(const uint64_t *t, 
@@ -240,6 +274,14 @@ query_status_t SelectQuery::process_fs_query(
     std::vector<query_result_unit_t>& where_query_result = 
         mquery->wherequery_->query_result; 
     std::vector<query_result_unit_t>::iterator where_result_it;
+    if (process_fs_query_cb == &SelectQuery::process_fs_query_with_aggregator) {
+        uint32_t fields = 0;
+        if (fs_query_type_ & FS_SELECT_FLOW_TUPLE) {
+            fields = get_flow_class_fields();
+        }
+        fs_aggregator_.reset(new FlowSeriesAggregator(fields,
+                    fs_query_type_ & FS_SELECT_STATS));
+    }
     // Walk thru each entry in the where result
     for (where_result_it = where_query_result.begin(); 
          where_result_it != where_query_result.end(); ++where_result_it) {
@@ -262,172 +304,60 @@ query_status_t SelectQuery::process_fs_query(
     return QUERY_SUCCESS;
 }
 
-void SelectQuery::process_fs_query_with_ts_stats_fields(
-        const uint64_t& t, const boost::uuids::uuid& uuid, 
-        const flow_stats& stats, const flow_tuple& tuple) {
-    QE_TRACE(DEBUG, ""); 
-    AnalyticsQuery *mquery = (AnalyticsQuery*)main_query;
-    // Get the time slice
-    uint64_t ts = fs_get_time_slice(t);
-    if (ts > mquery->end_time) {
-        return;
-    }
-
-    // Is the time slice present in the map?
-    fs_ts_stats_map_t::iterator map_it = 
-        fs_ts_stats_map_.find(ts);
-    if (map_it == fs_ts_stats_map_.end()) {
-        map_it = (fs_ts_stats_map_.insert(std::make_pair(ts, flow_stats()))).first;
-    }
-    map_it->second.pkts += stats.pkts;
-    map_it->second.bytes += stats.bytes;
-    map_it->second.flow_list.insert(uuid);
-}
-
-void SelectQuery::populate_fs_query_result_with_ts_stats_fields() {
-    QE_TRACE(DEBUG, "");
-    fs_ts_stats_map_t::const_iterator map_it;
-    for (map_it = fs_ts_stats_map_.begin();
-         map_it != fs_ts_stats_map_.end(); ++map_it) {
-        fs_write_final_result_row(&map_it->first, NULL, NULL, 
-                                  &map_it->second, NULL, 
-                                  &map_it->second.flow_list);
-    }
-}
-
-void SelectQuery::process_fs_query_with_tuple_stats_fields(
-        const uint64_t& t, const boost::uuids::uuid& uuid, 
-        const flow_stats& stats, const flow_tuple& tuple) {
-    QE_TRACE(DEBUG, ""); 
-    // Extract the flow class
-    flow_tuple flowclass;
-    get_flow_class(tuple, flowclass);
-
-    // Is there already an instance of this flow class in the map? 
-    fs_tuple_stats_map_t::iterator map_it = 
-        fs_tuple_stats_map_.find(flowclass);
-    if (map_it == fs_tuple_stats_map_.end()) {
-        map_it = (fs_tuple_stats_map_.insert(std::make_pair(
-                        flowclass, flow_stats()))).first;
-    }
-    map_it->second.pkts += stats.pkts;
-    map_it->second.bytes += stats.bytes;
-    map_it->second.flow_list.insert(uuid);
-}
-
-void SelectQuery::populate_fs_query_result_with_tuple_stats_fields() {
-    QE_TRACE(DEBUG, ""); 
-    fs_tuple_stats_map_t::const_iterator map_it; 
-    for (map_it = fs_tuple_stats_map_.begin(); 
-         map_it != fs_tuple_stats_map_.end(); ++map_it) {
-        fs_write_final_result_row(NULL, &map_it->first, NULL, 
-                &map_it->second, NULL, &map_it->second.flow_list);
-    }
-}
-
-void SelectQuery::process_fs_query_with_ts_tuple_stats_fields(
+void SelectQuery::process_fs_query_with_aggregator(
         const uint64_t& t, const boost::uuids::uuid& uuid,
         const flow_stats& stats, const flow_tuple& tuple) {
-    QE_TRACE(DEBUG, ""); 
     AnalyticsQuery *mquery = (AnalyticsQuery*)main_query;
-    // Extract the flow class
-    flow_tuple flowclass;
-    get_flow_class(tuple, flowclass);
-    // Get the time slice 
-    uint64_t ts = fs_get_time_slice(t);
-    if (ts > mquery->end_time) {
-        QE_TRACE(DEBUG, "ts > end_time");
-        return;
-    }
-    fs_ts_tuple_stats_map_t::iterator omap_it;
-    fs_ts_stats_map_t::iterator imap_it;
-    // Is there already an instance of this flow class in the map?
-    omap_it = fs_ts_tuple_stats_map_.find(flowclass);
-    if (omap_it == fs_ts_tuple_stats_map_.end()) {
-        omap_it = (fs_ts_tuple_stats_map_.insert(std::make_pair(
-                        flowclass, fs_ts_stats_map_t()))).first;
-        imap_it = (omap_it->second.insert(std::make_pair(
-                                        ts, flow_stats()))).first;
-    } else {
-        // Is the time slice present in the map?
-        imap_it = omap_it->second.find(ts);
-        if (imap_it == omap_it->second.end()) {
-            imap_it = (omap_it->second.insert(std::make_pair(
-                            ts, flow_stats()))).first;
+    uint64_t ts = 0;
+    if (fs_query_type_ & FS_SELECT_TS) {
+        // Get the time slice
+        ts = fs_get_time_slice(t);
+        if (ts > mquery->end_time) {
+            return;
         }
     }
-    imap_it->second.pkts += stats.pkts;
-    imap_it->second.bytes += stats.bytes;
-    imap_it->second.flow_list.insert(uuid);
+    fs_aggregator_->AddSample(ts, uuid, stats, tuple);
 }
 
-void SelectQuery::populate_fs_query_result_with_ts_tuple_stats_fields() {
-    QE_TRACE(DEBUG, ""); 
-    fs_ts_tuple_stats_map_t::const_iterator omap_it;
-    fs_ts_stats_map_t::const_iterator imap_it;
-    for (omap_it = fs_ts_tuple_stats_map_.begin();
-         omap_it != fs_ts_tuple_stats_map_.end(); ++omap_it) {
-        for (imap_it = omap_it->second.begin(); 
-             imap_it != omap_it->second.end(); ++imap_it) {
-            fs_write_final_result_row(&imap_it->first, &omap_it->first, NULL, 
-                                      &imap_it->second, NULL, 
-                                      &imap_it->second.flow_list);
-        }
-    }
-}
-
-void SelectQuery::process_fs_query_with_stats_fields(
-        const uint64_t& t, const boost::uuids::uuid& uuid,
-        const flow_stats& stats, const flow_tuple& tuple) {
+void SelectQuery::populate_fs_query_result_with_aggregator() {
     QE_TRACE(DEBUG, "");
-    fs_flow_stats_.pkts += stats.pkts;
-    fs_flow_stats_.bytes += stats.bytes;
-    fs_flow_stats_.flow_list.insert(uuid);
-}
-
-void SelectQuery::populate_fs_query_result_with_stats_fields() {
-    QE_TRACE(DEBUG, ""); 
-    fs_write_final_result_row(NULL, NULL, NULL, &fs_flow_stats_, NULL,
-                              &fs_flow_stats_.flow_list);
-}
-
-void SelectQuery::process_fs_query_with_ts_tuple_fields(
-        const uint64_t& t, const boost::uuids::uuid& uuid,
-        const flow_stats& stats, const flow_tuple& tuple) {
-    QE_TRACE(DEBUG, ""); 
-    AnalyticsQuery *mquery = (AnalyticsQuery*)main_query;
-    // Extract the flow class
-    flow_tuple flowclass;
-    get_flow_class(tuple, flowclass);
-    // Get the time slice
-    uint64_t ts = fs_get_time_slice(t); 
-    if (ts > mquery->end_time) {
+    bool with_ts = fs_query_type_ & FS_SELECT_TS;
+    bool with_tuple = fs_query_type_ & FS_SELECT_FLOW_TUPLE;
+    bool with_stats = fs_query_type_ & FS_SELECT_STATS;
+    flow_tuple tuple;
+    flow_stats stats;
+
+    fs_aggregator_->Aggregate();
+    QE_TRACE(DEBUG, "Aggregated " << fs_aggregator_->sample_count() <<
+            " samples into " << fs_aggregator_->group_count() << " groups");
+    if (fs_query_type_ == FS_SELECT_STATS &&
+        fs_aggregator_->group_count() == 0) {
+        // the sum over no samples is still a row
+        fs_write_final_result_row(NULL, NULL, NULL, &stats, NULL,
+                                  &stats.flow_list);
+        fs_aggregator_.reset();
         return;
     }
-    // Is the time slice present in the map?
-    fs_ts_tuple_map_t::iterator map_it = fs_ts_tuple_map_.find(ts);
-    if (map_it == fs_ts_tuple_map_.end()) {
-        map_it = (fs_ts_tuple_map_.insert(
-                    std::make_pair(ts, std::set<flow_tuple>()))).first;
-        map_it->second.insert(flowclass);
-    } else {
-        std::set<flow_tuple>::iterator it = map_it->second.find(tuple);
-        if (it == map_it->second.end()) {
-            map_it->second.insert(flowclass);
-        }
-    }
-}
 
-void SelectQuery::populate_fs_query_result_with_ts_tuple_fields() {
-    QE_TRACE(DEBUG, ""); 
-    fs_ts_tuple_map_t::const_iterator map_it;
-    for (map_it = fs_ts_tuple_map_.begin();
-         map_it != fs_ts_tuple_map_.end(); ++map_it) {
-        std::set<flow_tuple>::const_iterator it;
-        for (it = map_it->second.begin(); it != map_it->second.end(); ++it) {
-            fs_write_final_result_row(&map_it->first, &(*it), NULL, NULL, NULL);
+    // same order as the maps keyed on the flow class and/or the time slice
+    std::vector<uint32_t> groups;
+    fs_aggregator_->SortGroups(fs_query_type_ == FS_SELECT_TS_FLOW_TUPLE,
+                               &groups);
+    for (std::vector<uint32_t>::const_iterator it = groups.begin();
+         it != groups.end(); ++it) {
+        uint64_t ts = fs_aggregator_->GroupTime(*it);
+        if (with_tuple) {
+            fs_aggregator_->GroupFlowClass(*it, &tuple);
+        }
+        if (with_stats) {
+            fs_aggregator_->GroupStats(*it, &stats);
         }
+        fs_write_final_result_row(with_ts ? &ts : NULL,
+                                  with_tuple ? &tuple : NULL, NULL,
+                                  with_stats ? &stats : NULL, NULL,
+                                  with_stats ? &stats.flow_list : NULL);
     }
+    fs_aggregator_.reset();
 }
 
 void SelectQuery::process_fs_query_with_tuple_fields(
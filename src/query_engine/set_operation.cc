@@ -26,7 +26,46 @@ bool query_result_unit_t::operator<(const query_result_unit_t& rhs) const
     return (timestamp < rhs.timestamp);
 }
 
-void SetOperationUnit::or_operation()
+namespace {
+
+typedef std::vector<query_result_unit_t>::const_iterator ResultIterator;
+
+// Remaining part of the sorted result of a sub-query
+struct MergeCursor {
+    MergeCursor(ResultIterator first, ResultIterator last, size_t index)
+        : first(first), last(last), index(index) {
+    }
+    ResultIterator first;
+    ResultIterator last;
+    size_t index;       // index of the sub-query
+};
+
+// Heap order: the smallest result first and, among equivalent results,
+// the lowest sub-query index first
+struct MergeCursorCompare {
+    bool operator()(const MergeCursor &lhs, const MergeCursor &rhs) const {
+        if (*rhs.first < *lhs.first)
+            return true;
+        if (*lhs.first < *rhs.first)
+            return false;
+        return lhs.index > rhs.index;
+    }
+};
+
+}  // namespace
+
+//
+// Union or intersection of the sorted results of all the sub queries in
+// one pass, using a heap of cursors into the results.
+//
+// Results are compared on the timestamp only, so a result may have several
+// equivalent entries. The output is the same as that of set_union or
+// set_intersection applied to the sub query results from left to right:
+// for each run of equivalent entries, the union keeps as many entries as
+// the longest run and the intersection as many as the shortest, taken from
+// the lowest numbered sub queries first.
+//
+void SetOperationUnit::merge_operation(bool intersection)
 {
     if (sub_queries.size() == 0)
     {
@@ -34,55 +73,114 @@ void SetOperationUnit::or_operation()
         return;
     }
 
-    // with one query no need to do any operation
-    query_result = sub_queries[0]->query_result;
-
-    for (unsigned int i = 1; i < sub_queries.size(); i++)
+    size_t count = sub_queries.size();
+    size_t reserve_size = 0;
+    std::vector<MergeCursor> heap;
+    heap.reserve(count);
+    for (size_t i = 0; i < count; i++)
     {
-        std::vector<query_result_unit_t> tmp_query_result;
-
-        QE_TRACE(DEBUG, "UNION between tables of sizes " << 
-                query_result.size() << " and " <<
-                sub_queries[i]->query_result.size());
-        set_union(query_result.begin(), query_result.end(),
-                sub_queries[i]->query_result.begin(), 
-                sub_queries[i]->query_result.end(),
-                std::back_inserter(tmp_query_result));
-
-        query_result = tmp_query_result;    // keep the result in output var
-        QE_TRACE(DEBUG, "Resulting size of set " << query_result.size());
+        const std::vector<query_result_unit_t> &result =
+            sub_queries[i]->query_result;
+        QE_TRACE(DEBUG, (intersection ? "INT" : "UNION") <<
+                " input " << i << " of size " << result.size());
+        if (intersection)
+        {
+            if (i == 0 || result.size() < reserve_size)
+                reserve_size = result.size();
+        } else {
+            reserve_size += result.size();
+        }
+        if (!result.empty())
+            heap.push_back(MergeCursor(result.begin(), result.end(), i));
     }
-}
 
-void SetOperationUnit::and_operation()
-{
-    if (sub_queries.size() == 0)
-    {
-        QE_TRACE(DEBUG, "Empty where sub-clause");
+    query_result.clear();
+    if (intersection && heap.size() < count)
         return;
+    query_result.reserve(reserve_size);
+
+    MergeCursorCompare compare;
+    std::make_heap(heap.begin(), heap.end(), compare);
+    std::vector<MergeCursor> runs;
+    runs.reserve(count);
+    while (!heap.empty())
+    {
+        // Take the run of entries equivalent to the smallest one from each
+        // of the sub queries that has one, in sub query order
+        ResultIterator key = heap.front().first;
+        runs.clear();
+        while (!heap.empty() && !(*key < *heap.front().first))
+        {
+            std::pop_heap(heap.begin(), heap.end(), compare);
+            MergeCursor cursor = heap.back();
+            heap.pop_back();
+
+            ResultIterator run_end = cursor.first;
+            while (run_end != cursor.last && !(*key < *run_end))
+                run_end++;
+            runs.push_back(MergeCursor(cursor.first, run_end, cursor.index));
+            if (run_end != cursor.last)
+            {
+                heap.push_back(MergeCursor(run_end, cursor.last,
+                            cursor.index));
+                std::push_heap(heap.begin(), heap.end(), compare);
+            }
+        }
+
+        if (intersection)
+        {
+            if (runs.size() == count)
+            {
+                size_t length = runs[0].last - runs[0].first;
+                for (size_t i = 1; i < count; i++)
+                    length = std::min(length,
+                            (size_t)(runs[i].last - runs[i].first));
+                query_result.insert(query_result.end(), runs[0].first,
+                        runs[0].first + length);
+            }
+            // nothing more can match once a sub query is exhausted
+            if (heap.size() < count)
+                break;
+        } else {
+            size_t length = 0;
+            for (size_t i = 0; i < runs.size(); i++)
+            {
+                size_t run_length = runs[i].last - runs[i].first;
+                if (run_length > length)
+                {
+                    query_result.insert(query_result.end(),
+                            runs[i].first + length, runs[i].last);
+                    length = run_length;
+                }
+            }
+        }
     }
 
-    // with one query no need to do any operation
-    query_result = sub_queries[0]->query_result;
+    QE_TRACE(DEBUG, "Resulting size of set " << query_result.size());
+}
 
-    for (unsigned int i = 1; i < sub_queries.size(); i++)
+//
+// Run the sub queries one after the other. They all read through the
+// thrift client of the query, so there is little to gain from running them
+// in parallel. Returns false, with the status of the first sub query that
+// fails, if any of them does.
+//
+bool SetOperationUnit::run_subqueries()
+{
+    for (size_t i = 0; i < sub_queries.size(); i++)
     {
-        std::vector<query_result_unit_t> tmp_query_result;
-
-        QE_TRACE(DEBUG, "INT between tables of sizes " << 
-                query_result.size() << " and " <<
-                sub_queries[i]->query_result.size());
-        set_intersection(query_result.begin(), query_result.end(),
-                sub_queries[i]->query_result.begin(), 
-                sub_queries[i]->query_result.end(),
-                std::back_inserter(tmp_query_result));
-
-        query_result = tmp_query_result;    // keep the result in output var
-        QE_TRACE(DEBUG, "Resulting size of set " << query_result.size());
+        QueryUnit *sub_query = sub_queries[i];
+        sub_query->query_status = sub_query->process_query();
+        if (sub_query->query_status == QUERY_FAILURE)
+        {
+            status_details = sub_query->status_details ?
+                sub_query->status_details : EIO;
+            return false;
+        }
     }
+    return true;
 }
 
-
 query_status_t SetOperationUnit::process_query()
 {
     if (status_details != 0)
@@ -95,17 +193,8 @@ query_status_t SetOperationUnit::process_query()
     QE_TRACE(DEBUG, 
              " No of subset queries:"  << sub_queries.size());
     // invoke processing of all the sub queries
-    // TBD: Handle ASYNC processing
-    for (unsigned int i = 0; i < sub_queries.size(); i++)
-    {
-        query_status_t query_status = sub_queries[i]->process_query();
-
-        if (query_status == QUERY_FAILURE)
-        {
-            status_details = sub_queries[i]->status_details;
-            return QUERY_FAILURE;
-        }
-    }
+    if (!run_subqueries())
+        return QUERY_FAILURE;
 
     QE_TRACE(DEBUG, "Set operation between " << sub_queries.size()
             << " tables");
@@ -115,12 +204,12 @@ query_status_t SetOperationUnit::process_query()
     {
         case UNION_OP: 
             QE_TRACE(DEBUG, "Now do UNION set operation");
-            or_operation();
+            merge_operation(false);
             break;
 
         case INTERSECTION_OP:
             QE_TRACE(DEBUG, "Now do INTERSECTION set operation");
-            and_operation();
+            merge_operation(true);
             break;
 
         default:
@@ -135,4 +224,3 @@ query_status_t SetOperationUnit::process_query()
     parent_query->subquery_processed(this);
     return QUERY_SUCCESS;
 }
-
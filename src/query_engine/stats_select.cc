@@ -5,6 +5,7 @@
 #include "stats_select.h"
 #include "query.h"
 #include <cstdlib>
+#include <cstring>
 #include <boost/assign/list_of.hpp>
 #include <boost/functional/hash.hpp>
 #include "rapidjson/document.h"
@@ -20,6 +21,8 @@ using std::set;
 using std::pair;
 using std::make_pair;
 
+const size_t StatsSelect::kBatchRows;
+
 bool
 StatsSelect::Jsonify(const std::map<std::string, StatVal>&  uniks, 
         const QEOpServerProxy::AggRowT& aggs, std::string& jstr) {
@@ -230,7 +233,8 @@ void StatsSelect::Merge(const MapBufT& input, MapBufT& output) {
 StatsSelect::StatsSelect(AnalyticsQuery * m_query,
 		const std::vector<std::string> & select_fields) :
 			main_query(m_query), select_fields_(select_fields),
-			ts_period_(0), isT_(false), count_field_() {
+			ts_period_(0), isT_(false), count_field_(),
+			uuid_column_(-1), time_column_(-1), presence_words_(0) {
 
     int i = main_query->stat_table_index();
     QE_ASSERT(i != -1);
@@ -294,9 +298,52 @@ StatsSelect::StatsSelect(AnalyticsQuery * m_query,
         }
     }
 
+    for (set<string>::const_iterator it = unik_cols_.begin();
+            it != unik_cols_.end(); it++) {
+        std::string sfield;
+        QEOpServerProxy::AggOper agg;
+        if (*it == g_viz_constants.STAT_UUID_FIELD) {
+            uuid_column_ = unik_columns_.size();
+        }
+        AddUnikColumn(*it, Parse(i, *it, sfield, agg));
+    }
+    if (isT_) {
+        time_column_ = unik_columns_.size();
+        AddUnikColumn(g_viz_constants.STAT_TIME_FIELD, QEOpServerProxy::UINT64);
+    }
+    if (ts_period_) {
+        time_column_ = unik_columns_.size();
+        AddUnikColumn(g_viz_constants.STAT_TIMEBIN_FIELD,
+                QEOpServerProxy::UINT64);
+    }
+    presence_words_ = (unik_columns_.size() + 63) / 64;
+
+    for (set<string>::const_iterator it = sum_cols_.begin();
+            it != sum_cols_.end(); it++) {
+        std::string sfield;
+        QEOpServerProxy::AggOper agg;
+        sum_index_.insert(make_pair(*it, sum_names_.size()));
+        sum_names_.push_back(*it);
+        sum_types_.push_back(Parse(i, *it, sfield, agg));
+    }
+    row_has_sum_.resize(sum_names_.size());
+    row_uint_sums_.resize(sum_names_.size());
+    row_double_sums_.resize(sum_names_.size());
+    group_has_sum_.resize(sum_names_.size());
+    group_uint_sums_.resize(sum_names_.size());
+    group_double_sums_.resize(sum_names_.size());
+
     status_ = true;
 }
 
+void StatsSelect::AddUnikColumn(const std::string& name, StatType type) {
+    UnikColumn column;
+    column.name = name;
+    column.type = type;
+    unik_index_.insert(make_pair(name, unik_columns_.size()));
+    unik_columns_.push_back(column);
+}
+
 void StatsSelect::SetSortOrder(const std::vector<sort_field_t>& sort_fields) {
     if (sort_fields.size()) {
         sort_cols_.clear();
@@ -358,10 +405,13 @@ void StatsSelect::MergeFullRow(
 
 void StatsSelect::MergeAggRow(QEOpServerProxy::AggRowT &arows,
         const QEOpServerProxy::AggRowT &narows) {
-    for (QEOpServerProxy::AggRowT::iterator jt = arows.begin();
-            jt!= arows.end(); jt++) {
-        QEOpServerProxy::AggRowT::const_iterator kt = narows.find(jt->first);
-        if (kt!=narows.end()) {
+    for (QEOpServerProxy::AggRowT::const_iterator kt = narows.begin();
+            kt!= narows.end(); kt++) {
+        QEOpServerProxy::AggRowT::iterator jt = arows.find(kt->first);
+        if (jt==arows.end()) {
+            // The rows merged so far did not have this column
+            arows.insert(*kt);
+        } else {
             // Attribute name must match for aggregate and for the new value
             QE_ASSERT(jt->first.second == kt->first.second);
 
@@ -406,38 +456,154 @@ std::size_t boost::hash_value(const StatsSelect::StatVal& sv) {
     return boost::hash_value(ostr.str());
 }
 
+uint64_t StatsSelect::EncodeValue(const StatVal& value) {
+    switch (value.which()) {
+        case QEOpServerProxy::STRING :
+            return strings_.Encode(boost::get<string>(value));
+        case QEOpServerProxy::UUID :
+            return uuids_.Encode(boost::get<boost::uuids::uuid>(value));
+        case QEOpServerProxy::UINT64 :
+            return boost::get<uint64_t>(value);
+        case QEOpServerProxy::DOUBLE : {
+                double dval = boost::get<double>(value);
+                uint64_t word;
+                memcpy(&word, &dval, sizeof(word));
+                return word;
+            }
+        default:
+            QE_ASSERT(0);
+    }
+    return 0;
+}
+
+StatsSelect::StatVal StatsSelect::DecodeValue(StatType type,
+        uint64_t word) const {
+    switch (type) {
+        case QEOpServerProxy::STRING :
+            return strings_.Decode(word);
+        case QEOpServerProxy::UUID :
+            return uuids_.Decode(word);
+        case QEOpServerProxy::UINT64 :
+            return word;
+        case QEOpServerProxy::DOUBLE : {
+                double dval;
+                memcpy(&dval, &word, sizeof(dval));
+                return dval;
+            }
+        default:
+            QE_ASSERT(0);
+    }
+    return StatVal();
+}
+
+// The first value of a column wins, as with the insert into the uniks map
+void StatsSelect::SetUnik(size_t column, const StatVal& value) {
+    uint64_t bit = 1ULL << (column % 64);
+    if (key_[column / 64] & bit) {
+        return;
+    }
+    QE_ASSERT(value.which() == unik_columns_[column].type);
+    key_[column / 64] |= bit;
+    key_[presence_words_ + column] = EncodeValue(value);
+}
+
+void StatsSelect::AddGroup() {
+    group_counts_.push_back(0);
+    for (size_t col = 0; col < sum_names_.size(); col++) {
+        group_has_sum_[col].push_back(false);
+        if (sum_types_[col] == QEOpServerProxy::UINT64) {
+            group_uint_sums_[col].push_back(0);
+        } else {
+            group_double_sums_[col].push_back(0);
+        }
+    }
+}
+
+void StatsSelect::SumBatch() {
+    QeGroupCount(row_groups_, &group_counts_);
+    for (size_t col = 0; col < sum_names_.size(); col++) {
+        if (sum_types_[col] == QEOpServerProxy::UINT64) {
+            QeGroupSum(row_groups_, row_uint_sums_[col],
+                    &group_uint_sums_[col]);
+            row_uint_sums_[col].clear();
+        } else {
+            QeGroupSum(row_groups_, row_double_sums_[col],
+                    &group_double_sums_[col]);
+            row_double_sums_[col].clear();
+        }
+    }
+    row_groups_.clear();
+}
+
 bool StatsSelect::LoadRow(boost::uuids::uuid u,
-		uint64_t timestamp, const vector<StatEntry>& row, MapBufT& output) {
+		uint64_t timestamp, const vector<StatEntry>& row) {
 
 	if (!Status()) return false;
-    uint64_t ts = 0;
 
-    // Build Uniks map
-    StatMap uniks;
-    set<string>::const_iterator ukit =
-        unik_cols_.find(g_viz_constants.STAT_UUID_FIELD);
-    if (ukit!=unik_cols_.end()) {
-        uniks.insert(make_pair(g_viz_constants.STAT_UUID_FIELD,u));
+    // Build the group key
+    key_.assign(presence_words_ + unik_columns_.size(), 0);
+    if (uuid_column_ != -1) {
+        SetUnik(uuid_column_, u);
     }
-    
     if (isT_) {
-        ts = timestamp;
-        uniks.insert(make_pair(g_viz_constants.STAT_TIME_FIELD,ts)); 
+        SetUnik(time_column_, timestamp);
     }
-
     if (ts_period_) {
-        ts = timestamp - (timestamp % ts_period_);
-        uniks.insert(make_pair(g_viz_constants.STAT_TIMEBIN_FIELD,ts)); 
+        SetUnik(time_column_, timestamp - (timestamp % ts_period_));
+    }
+
+    for (size_t col = 0; col < sum_names_.size(); col++) {
+        row_has_sum_[col] = false;
+        if (sum_types_[col] == QEOpServerProxy::UINT64) {
+            row_uint_sums_[col].push_back(0);
+        } else {
+            row_double_sums_[col].push_back(0);
+        }
     }
 
     for (vector<StatEntry>::const_iterator it = row.begin();
             it != row.end(); it++) {
-        set<string>::const_iterator uit = unik_cols_.find(it->name);
-        if (uit!=unik_cols_.end()) {
-            uniks.insert(make_pair(it->name, it->value));
+        map<string, size_t>::const_iterator uit = unik_index_.find(it->name);
+        if (uit != unik_index_.end()) {
+            SetUnik(uit->second, it->value);
+        }
+        map<string, size_t>::const_iterator sit = sum_index_.find(it->name);
+        if (sit != sum_index_.end() && !row_has_sum_[sit->second]) {
+            size_t col = sit->second;
+            row_has_sum_[col] = true;
+            try {
+                if (sum_types_[col] == QEOpServerProxy::UINT64) {
+                    row_uint_sums_[col].back() =
+                        boost::get<uint64_t>(it->value);
+                } else {
+                    row_double_sums_[col].back() =
+                        boost::get<double>(it->value);
+                }
+            } catch (boost::bad_get& ex) {
+                QE_ASSERT(0);
+            }
         }
     }
 
+    uint32_t group = groups_.Lookup(key_);
+    if (group == group_counts_.size()) {
+        AddGroup();
+    }
+    for (size_t col = 0; col < sum_names_.size(); col++) {
+        if (row_has_sum_[col]) {
+            group_has_sum_[col][group] = true;
+        }
+    }
+    row_groups_.push_back(group);
+    if (row_groups_.size() == kBatchRows) {
+        SumBatch();
+    }
+
+    return true;
+}
+
+std::vector<StatsSelect::StatVal> StatsSelect::SortKey(
+        const StatMap& uniks) const {
     // Build sort vector
     // Last slot is reserved for the hash
     std::vector<StatVal> ukey(sort_cols_.size() + agg_sort_cols_.size() + 1);
@@ -450,24 +616,57 @@ bool StatsSelect::LoadRow(boost::uuids::uuid u,
         QE_ASSERT(uniks.find(st->first) != uniks.end());
         ukey[st->second] = uniks.at(st->first);
     }
+    return ukey;
+}
 
-    QEOpServerProxy::AggRowT narows;
-    for (vector<StatEntry>::const_iterator it = row.begin();
-            it != row.end(); it++) {
-        set<string>::const_iterator uit = sum_cols_.find(it->name);
-        if (uit!=sum_cols_.end()) {
-            pair<QEOpServerProxy::AggOper,string> aggkey(QEOpServerProxy::SUM,it->name);
-            narows.insert(make_pair(aggkey,  it->value)); 
+void StatsSelect::Flush(MapBufT& output) {
+    if (!Status()) return;
+    SumBatch();
+
+    for (size_t group = 0; group < groups_.size(); group++) {
+        const GroupKey& key = groups_.key(group);
+
+        // Build Uniks map
+        StatMap uniks;
+        for (size_t col = 0; col < unik_columns_.size(); col++) {
+            if (key[col / 64] & (1ULL << (col % 64))) {
+                uniks.insert(make_pair(unik_columns_[col].name,
+                    DecodeValue(unik_columns_[col].type,
+                        key[presence_words_ + col])));
+            }
+        }
+
+        QEOpServerProxy::AggRowT narows;
+        for (size_t col = 0; col < sum_names_.size(); col++) {
+            if (!group_has_sum_[col][group]) {
+                continue;
+            }
+            pair<QEOpServerProxy::AggOper,string> aggkey(QEOpServerProxy::SUM,
+                sum_names_[col]);
+            if (sum_types_[col] == QEOpServerProxy::UINT64) {
+                narows.insert(make_pair(aggkey,
+                    StatVal(group_uint_sums_[col][group])));
+            } else {
+                narows.insert(make_pair(aggkey,
+                    StatVal(group_double_sums_[col][group])));
+            }
         }
-    }
 
-    if (!count_field_.empty()) {
-        pair<QEOpServerProxy::AggOper,string> aggkey(QEOpServerProxy::COUNT,count_field_);
-        narows.insert(make_pair(aggkey, (uint64_t) 1));            
+        if (!count_field_.empty()) {
+            pair<QEOpServerProxy::AggOper,string> aggkey(QEOpServerProxy::COUNT,count_field_);
+            narows.insert(make_pair(aggkey, group_counts_[group]));
+        }
+
+        MergeFullRow(SortKey(uniks), uniks, narows, output);
     }
-    
-    MergeFullRow(ukey, uniks, narows, output);
 
-    return true;
+    strings_.Clear();
+    uuids_.Clear();
+    groups_.Clear();
+    group_counts_.clear();
+    for (size_t col = 0; col < sum_names_.size(); col++) {
+        group_has_sum_[col].clear();
+        group_uint_sums_[col].clear();
+        group_double_sums_[col].clear();
+    }
 }
-
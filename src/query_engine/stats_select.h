@@ -19,6 +19,7 @@
 #include <boost/uuid/uuid.hpp>
 #include "QEOpServerProxy.h"
 #include "query.h"
+#include "columnar_agg.h"
 
 class AnalyticsQuery;
 
@@ -43,8 +44,11 @@ public:
 
     // The client call this function once with every row from the where result.
     // cols that are not in the SELECT will be silently dropped.
+    // The rows are aggregated in columns, and are written to the output
+    // by Flush once they are all loaded.
     bool LoadRow(boost::uuids::uuid u, uint64_t timestamp,
-            const std::vector<StatEntry>& row, MapBufT& output);
+            const std::vector<StatEntry>& row);
+    void Flush(MapBufT& output);
 
     bool Status() { return status_; }
 
@@ -62,6 +66,24 @@ public:
             const QEOpServerProxy::AggRowT&, std::string& jstr);
 
 private:
+    static const size_t kBatchRows = 4096;
+
+    // Column of the group key of the rows. The key has a presence bit for
+    // each column, followed by one word per column with the value, the
+    // dictionary code of the value for strings and uuids.
+    struct UnikColumn {
+        std::string name;
+        StatType type;
+    };
+    typedef std::vector<uint64_t> GroupKey;
+
+    void AddUnikColumn(const std::string& name, StatType type);
+    void SetUnik(size_t column, const StatVal& value);
+    uint64_t EncodeValue(const StatVal& value);
+    StatVal DecodeValue(StatType type, uint64_t word) const;
+    void AddGroup();
+    void SumBatch();
+    std::vector<StatVal> SortKey(const StatMap& uniks) const;
 
     static void MergeAggRow(QEOpServerProxy::AggRowT &arows,
             const QEOpServerProxy::AggRowT &narows);
@@ -97,5 +119,33 @@ private:
     // This is the set of columns that require aggregation.
     std::set<std::string> sum_cols_;
 
+    // Columnar layout of the unik and sum columns
+    std::vector<UnikColumn> unik_columns_;
+    std::map<std::string, size_t> unik_index_;
+    int uuid_column_;
+    int time_column_;
+    size_t presence_words_;
+    std::vector<std::string> sum_names_;
+    std::vector<StatType> sum_types_;
+    std::map<std::string, size_t> sum_index_;
+
+    QeDictionary<std::string> strings_;
+    QeDictionary<boost::uuids::uuid> uuids_;
+    QeGroupTable<GroupKey> groups_;
+    GroupKey key_;
+
+    // Batch columns of the rows. Each sum column is kept in the vector of
+    // its type, and the vector of the other type is left empty.
+    std::vector<uint32_t> row_groups_;
+    std::vector<bool> row_has_sum_;
+    std::vector<std::vector<uint64_t> > row_uint_sums_;
+    std::vector<std::vector<double> > row_double_sums_;
+
+    // Aggregated columns of the groups. A group has the sum of a column if
+    // any of its rows has the column.
+    std::vector<uint64_t> group_counts_;
+    std::vector<std::vector<bool> > group_has_sum_;
+    std::vector<std::vector<uint64_t> > group_uint_sums_;
+    std::vector<std::vector<double> > group_double_sums_;
 };
 #endif
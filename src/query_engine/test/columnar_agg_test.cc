@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "columnar_agg.h"
+
+#include <malloc.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/uuid/uuid_generators.hpp>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+static const uint32_t kAllFields =
+    FlowSeriesAggregator::VROUTER | FlowSeriesAggregator::SOURCE_VN |
+    FlowSeriesAggregator::DEST_VN | FlowSeriesAggregator::SOURCE_IP |
+    FlowSeriesAggregator::DEST_IP | FlowSeriesAggregator::PROTOCOL |
+    FlowSeriesAggregator::SOURCE_PORT | FlowSeriesAggregator::DEST_PORT |
+    FlowSeriesAggregator::DIRECTION;
+
+struct FlowSample {
+    uint64_t t;
+    boost::uuids::uuid uuid;
+    flow_stats stats;
+    flow_tuple tuple;
+};
+
+//
+// Samples of flow_count flows, spread over vrouter_count vrouters, with
+// sample_count samples in all. A flow keeps its tuple across its samples.
+//
+static void MakeSamples(int sample_count, int flow_count, int vrouter_count,
+        vector<FlowSample> *samples) {
+    boost::uuids::random_generator gen;
+    vector<FlowSample> flows(flow_count);
+    for (int i = 0; i < flow_count; i++) {
+        FlowSample& flow = flows[i];
+        flow.uuid = gen();
+        flow.tuple.vrouter = "vrouter" + integerToString(i % vrouter_count);
+        flow.tuple.source_vn = "default-domain:demo:vn" +
+            integerToString(random() % 8);
+        flow.tuple.dest_vn = "default-domain:demo:vn" +
+            integerToString(random() % 8);
+        flow.tuple.source_ip = 0x0a000000 + random() % 64;
+        flow.tuple.dest_ip = 0x0a000000 + random() % 64;
+        flow.tuple.protocol = (random() % 2) ? 6 : 17;
+        flow.tuple.source_port = 1024 + random() % 16;
+        flow.tuple.dest_port = 80 + random() % 4;
+        flow.tuple.direction = random() % 2;
+    }
+
+    samples->resize(sample_count);
+    for (int i = 0; i < sample_count; i++) {
+        FlowSample& sample = (*samples)[i];
+        sample = flows[random() % flow_count];
+        sample.t = 1000000 + i * 1000;
+        sample.stats = flow_stats(random() % 100000, random() % 100);
+    }
+}
+
+// The flow class of a sample, with only the fields of the mask set.
+static flow_tuple FlowClass(const flow_tuple& tuple, uint32_t fields) {
+    flow_tuple fc;
+    if (fields & FlowSeriesAggregator::VROUTER) fc.vrouter = tuple.vrouter;
+    if (fields & FlowSeriesAggregator::SOURCE_VN) fc.source_vn = tuple.source_vn;
+    if (fields & FlowSeriesAggregator::DEST_VN) fc.dest_vn = tuple.dest_vn;
+    if (fields & FlowSeriesAggregator::SOURCE_IP) fc.source_ip = tuple.source_ip;
+    if (fields & FlowSeriesAggregator::DEST_IP) fc.dest_ip = tuple.dest_ip;
+    if (fields & FlowSeriesAggregator::PROTOCOL) fc.protocol = tuple.protocol;
+    if (fields & FlowSeriesAggregator::SOURCE_PORT) {
+        fc.source_port = tuple.source_port;
+    }
+    if (fields & FlowSeriesAggregator::DEST_PORT) fc.dest_port = tuple.dest_port;
+    if (fields & FlowSeriesAggregator::DIRECTION) fc.direction = tuple.direction;
+    return fc;
+}
+
+// Same aggregation as the maps that SelectQuery used for the flow series
+// queries grouped on the flow class and the time slice.
+typedef map<flow_tuple, map<uint64_t, flow_stats> > FlowStatsMap;
+
+static void MapAggregate(const vector<FlowSample>& samples, uint32_t fields,
+        uint64_t granularity, FlowStatsMap *result) {
+    for (vector<FlowSample>::const_iterator it = samples.begin();
+         it != samples.end(); ++it) {
+        uint64_t t = granularity ? it->t - (it->t % granularity) : 0;
+        flow_stats& stats = (*result)[FlowClass(it->tuple, fields)][t];
+        stats.pkts += it->stats.pkts;
+        stats.bytes += it->stats.bytes;
+        stats.flow_list.insert(it->uuid);
+    }
+}
+
+static void ColumnAggregate(const vector<FlowSample>& samples,
+        uint64_t granularity, FlowSeriesAggregator *aggregator) {
+    for (vector<FlowSample>::const_iterator it = samples.begin();
+         it != samples.end(); ++it) {
+        uint64_t t = granularity ? it->t - (it->t % granularity) : 0;
+        aggregator->AddSample(t, it->uuid, it->stats, it->tuple);
+    }
+    aggregator->Aggregate();
+}
+
+class QeDictionaryTest : public ::testing::Test {
+};
+
+TEST_F(QeDictionaryTest, Basic) {
+    QeDictionary<string> dict;
+    EXPECT_EQ(0, dict.Encode("vn1"));
+    EXPECT_EQ(1, dict.Encode("vn2"));
+    EXPECT_EQ(0, dict.Encode("vn1"));
+    EXPECT_EQ(2, dict.size());
+    EXPECT_EQ("vn1", dict.Decode(0));
+    EXPECT_EQ("vn2", dict.Decode(1));
+
+    dict.Clear();
+    EXPECT_EQ(0, dict.size());
+    EXPECT_EQ(0, dict.Encode("vn2"));
+}
+
+TEST_F(QeDictionaryTest, GroupSum) {
+    QeGroupTable<vector<uint64_t> > table;
+    vector<uint64_t> key1(2, 1), key2(2, 2);
+    EXPECT_EQ(0, table.Lookup(key1));
+    EXPECT_EQ(1, table.Lookup(key2));
+    EXPECT_EQ(0, table.Lookup(key1));
+    EXPECT_EQ(2, table.size());
+    EXPECT_TRUE(table.key(1) == key2);
+
+    vector<uint32_t> groups;
+    vector<double> values;
+    for (int i = 0; i < 10; i++) {
+        groups.push_back(i % 2);
+        values.push_back(i);
+    }
+    vector<double> sums(2, 0);
+    vector<uint64_t> counts(2, 0);
+    QeGroupSum(groups, values, &sums);
+    QeGroupCount(groups, &counts);
+    EXPECT_EQ(20, sums[0]);
+    EXPECT_EQ(25, sums[1]);
+    EXPECT_EQ(5, counts[0]);
+    EXPECT_EQ(5, counts[1]);
+}
+
+class FlowSeriesAggregatorTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        // More samples than a batch, so that the sums span batches.
+        MakeSamples(3 * FlowSeriesAggregator::kBatchSamples + 100, 500, 4,
+                    &samples_);
+    }
+
+    void Compare(uint32_t fields, uint64_t granularity) {
+        FlowStatsMap expected;
+        MapAggregate(samples_, fields, granularity, &expected);
+        FlowSeriesAggregator aggregator(fields, true);
+        ColumnAggregate(samples_, granularity, &aggregator);
+
+        vector<uint32_t> order;
+        aggregator.SortGroups(false, &order);
+        EXPECT_EQ(samples_.size(), aggregator.sample_count());
+
+        size_t idx = 0;
+        for (FlowStatsMap::const_iterator it = expected.begin();
+             it != expected.end(); ++it) {
+            for (map<uint64_t, flow_stats>::const_iterator jt =
+                 it->second.begin(); jt != it->second.end(); ++jt, ++idx) {
+                ASSERT_LT(idx, order.size());
+                flow_tuple tuple;
+                flow_stats stats;
+                aggregator.GroupFlowClass(order[idx], &tuple);
+                aggregator.GroupStats(order[idx], &stats);
+                EXPECT_FALSE(tuple < it->first || it->first < tuple);
+                EXPECT_EQ(jt->first, aggregator.GroupTime(order[idx]));
+                EXPECT_EQ(jt->second.pkts, stats.pkts);
+                EXPECT_EQ(jt->second.bytes, stats.bytes);
+                EXPECT_TRUE(jt->second.flow_list == stats.flow_list);
+            }
+        }
+        EXPECT_EQ(idx, order.size());
+    }
+
+    vector<FlowSample> samples_;
+};
+
+TEST_F(FlowSeriesAggregatorTest, Stats) {
+    Compare(0, 0);
+}
+
+TEST_F(FlowSeriesAggregatorTest, TimeSliceStats) {
+    Compare(0, 1000000);
+}
+
+TEST_F(FlowSeriesAggregatorTest, FlowTupleStats) {
+    Compare(kAllFields, 0);
+    Compare(FlowSeriesAggregator::SOURCE_VN | FlowSeriesAggregator::DEST_VN,
+            0);
+}
+
+TEST_F(FlowSeriesAggregatorTest, TimeSliceFlowTupleStats) {
+    Compare(kAllFields, 1000000);
+    Compare(FlowSeriesAggregator::VROUTER | FlowSeriesAggregator::PROTOCOL,
+            500000);
+}
+
+TEST_F(FlowSeriesAggregatorTest, TimeMajor) {
+    FlowSeriesAggregator aggregator(kAllFields, false);
+    ColumnAggregate(samples_, 1000000, &aggregator);
+
+    vector<uint32_t> order;
+    aggregator.SortGroups(true, &order);
+    for (size_t idx = 1; idx < order.size(); idx++) {
+        uint64_t prev = aggregator.GroupTime(order[idx - 1]);
+        uint64_t t = aggregator.GroupTime(order[idx]);
+        EXPECT_LE(prev, t);
+        if (prev == t) {
+            flow_tuple prev_tuple, tuple;
+            aggregator.GroupFlowClass(order[idx - 1], &prev_tuple);
+            aggregator.GroupFlowClass(order[idx], &tuple);
+            EXPECT_TRUE(prev_tuple < tuple);
+        }
+    }
+}
+
+//
+// Rows per second and heap used by the map and the column aggregation of
+// the same samples. The defaults match a busy hour of flow series samples;
+// SAMPLE_COUNT, FLOW_COUNT and VROUTER_COUNT override them.
+//
+static size_t HeapBytes() {
+    struct mallinfo info = mallinfo();
+    return info.uordblks + info.hblkhd;
+}
+
+class FlowSeriesAggregatorBenchmark : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        MakeSamples(GetEnvInt("SAMPLE_COUNT", 1000000),
+                    GetEnvInt("FLOW_COUNT", 20000),
+                    GetEnvInt("VROUTER_COUNT", 16), &samples_);
+    }
+
+    void Report(const char *name, uint64_t usec, size_t bytes,
+                size_t groups) {
+        LOG(DEBUG, name << ": " << groups << " groups, " << usec <<
+            " usec, " << samples_.size() * 1000000 / max(usec, (uint64_t) 1) <<
+            " rows/sec, " << bytes / 1024 << " KB");
+    }
+
+    vector<FlowSample> samples_;
+};
+
+TEST_F(FlowSeriesAggregatorBenchmark, MapVsColumns) {
+    uint64_t granularity = 60 * 1000000;
+    size_t heap = HeapBytes();
+    uint64_t start = UTCTimestampUsec();
+    FlowStatsMap *expected = new FlowStatsMap;
+    MapAggregate(samples_, kAllFields, granularity, expected);
+    uint64_t map_usec = UTCTimestampUsec() - start;
+    size_t map_bytes = HeapBytes() - heap;
+    size_t map_groups = 0;
+    for (FlowStatsMap::const_iterator it = expected->begin();
+         it != expected->end(); ++it) {
+        map_groups += it->second.size();
+    }
+    delete expected;
+
+    heap = HeapBytes();
+    start = UTCTimestampUsec();
+    FlowSeriesAggregator *aggregator =
+        new FlowSeriesAggregator(kAllFields, true);
+    ColumnAggregate(samples_, granularity, aggregator);
+    uint64_t column_usec = UTCTimestampUsec() - start;
+    size_t column_bytes = HeapBytes() - heap;
+    size_t column_groups = aggregator->group_count();
+    delete aggregator;
+
+    EXPECT_EQ(map_groups, column_groups);
+    Report("map", map_usec, map_bytes, map_groups);
+    Report("columns", column_usec, column_bytes, column_groups);
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
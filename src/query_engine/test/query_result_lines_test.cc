@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "query_result_lines.h"
+
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+
+#include "base/logging.h"
+#include "testing/gunit.h"
+
+using std::string;
+using std::vector;
+
+static const char *kQid = "RESULT-LINES-TEST";
+
+class QueryResultLinesTest : public ::testing::Test {
+protected:
+    // MessageTable rows, with a message big enough for a few rows to fill
+    // a line
+    static void MakeRows(int count, int first,
+                         QEOpServerProxy::BufferT *rows) {
+        string message(QueryResultLines::kMaxRowThreshold / 4, 'x');
+        for (int i = 0; i < count; i++) {
+            QEOpServerProxy::OutRowT row;
+            row[g_viz_constants.TIMESTAMP] =
+                boost::lexical_cast<string>(1365991500164230ULL + first + i);
+            row[g_viz_constants.SOURCE] = "a6s41";
+            row["Xmlmessage"] = message;
+            rows->push_back(std::make_pair(row, QEOpServerProxy::MetadataT()));
+        }
+    }
+
+    static void MakeStatsRows(int count,
+                              QEOpServerProxy::OutRowMultimapT *rows) {
+        for (int i = 0; i < count; i++) {
+            vector<QEOpServerProxy::SubVal> key;
+            key.push_back(QEOpServerProxy::SubVal((uint64_t) i));
+            std::map<string, QEOpServerProxy::SubVal> uniks;
+            uniks["T"] = QEOpServerProxy::SubVal((uint64_t) i);
+            QEOpServerProxy::AggRowT aggs;
+            aggs[std::make_pair(QEOpServerProxy::SUM, string("bytes"))] =
+                QEOpServerProxy::SubVal((uint64_t) (i * 100));
+            rows->insert(std::make_pair(key, std::make_pair(uniks, aggs)));
+        }
+    }
+
+    // Checks that the commands push lines first to first + count - 1,
+    // each with at most one row over the threshold and followed by the
+    // expiry of the line, and returns the rows.
+    static size_t CheckLines(const QueryResultLines::CommandListT &commands,
+                             uint32_t first, uint32_t count) {
+        std::set<string> keys;
+        size_t rows = 0;
+        string ttl =
+            boost::lexical_cast<string>(QueryResultLines::kStreamTTL);
+        EXPECT_EQ(0U, commands.size() % 2);
+        for (size_t i = 0; i + 1 < commands.size(); i += 2) {
+            const QueryResultLines::CommandT &command = commands[i];
+            EXPECT_EQ("RPUSH", command[0]);
+            EXPECT_LT(2U, command.size());
+            EXPECT_TRUE(keys.insert(command[1]).second);
+            size_t bytes = 0;
+            for (size_t j = 2; j < command.size(); j++) {
+                EXPECT_GT(QueryResultLines::kMaxRowThreshold, (int) bytes);
+                bytes += command[j].size();
+            }
+            rows += command.size() - 2;
+
+            const QueryResultLines::CommandT &expire = commands[i + 1];
+            EXPECT_EQ("EXPIRE", expire[0]);
+            EXPECT_EQ(command[1], expire[1]);
+            EXPECT_EQ(ttl, expire[2]);
+        }
+        EXPECT_EQ(count, keys.size());
+        for (uint32_t line = first; line < first + count; line++) {
+            EXPECT_EQ(1U, keys.count(QueryResultLines::LineKey(kQid, line)));
+        }
+        return rows;
+    }
+
+    static void LinesDone(QueryResultStream *stream, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            stream->LineDone();
+        }
+    }
+};
+
+// Chunks that need no merge are pushed as they are done, by the pipeline
+// instances in parallel, with the line numbers taken from a counter shared
+// by the instances.
+TEST_F(QueryResultLinesTest, StreamChunks) {
+    QEOpServerProxy::BufferT chunk1, chunk2;
+    MakeRows(10, 0, &chunk1);
+    MakeRows(7, 10, &chunk2);
+
+    QueryResultStream stream(kQid, g_viz_constants.COLLECTOR_GLOBAL_TABLE,
+                             false);
+    QueryResultLines::CommandListT commands;
+    QEOpServerProxy::BufferT::const_iterator it1 = chunk1.begin();
+    QEOpServerProxy::BufferT::const_iterator it2 = chunk2.begin();
+    size_t rows = stream.AddLines(&it1, chunk1.end(), &commands);
+    EXPECT_TRUE(it1 == chunk1.end());
+    uint32_t lines1 = stream.lines();
+    rows += stream.AddLines(&it2, chunk2.end(), &commands);
+    EXPECT_TRUE(it2 == chunk2.end());
+
+    EXPECT_EQ(17U, rows);
+    EXPECT_LT(lines1, stream.lines());
+    EXPECT_LT(2U, stream.lines());
+    EXPECT_EQ(stream.lines(), stream.pending());
+    EXPECT_EQ(rows, CheckLines(commands, 0, stream.lines()));
+
+    // The rows are JSON encoded with the types of the table schema
+    EXPECT_NE(string::npos, commands[0][2].find("\"Source\":\"a6s41\""));
+    EXPECT_NE(string::npos,
+              commands[0][2].find("\"MessageTS\":1365991500164230"));
+
+    LinesDone(&stream, stream.lines());
+    EXPECT_EQ(0U, stream.pending());
+}
+
+// No more than kMaxPendingLines lines are pushed before redis takes them,
+// and the rest of the chunk is pushed as it does.
+TEST_F(QueryResultLinesTest, StreamPendingLines) {
+    QEOpServerProxy::BufferT chunk;
+    MakeRows(QueryResultStream::kMaxPendingLines * 10, 0, &chunk);
+
+    QueryResultStream stream(kQid, g_viz_constants.COLLECTOR_GLOBAL_TABLE,
+                             false);
+    QueryResultLines::CommandListT commands;
+    QEOpServerProxy::BufferT::const_iterator it = chunk.begin();
+    size_t rows = stream.AddLines(&it, chunk.end(), &commands);
+    EXPECT_TRUE(it != chunk.end());
+    EXPECT_EQ(QueryResultStream::kMaxPendingLines, stream.lines());
+    EXPECT_EQ(QueryResultStream::kMaxPendingLines, stream.pending());
+
+    // Nothing more is pushed until redis takes some of the lines
+    EXPECT_EQ(0U, stream.AddLines(&it, chunk.end(), &commands));
+    EXPECT_EQ(QueryResultStream::kMaxPendingLines, stream.lines());
+
+    LinesDone(&stream, 2);
+    rows += stream.AddLines(&it, chunk.end(), &commands);
+    EXPECT_EQ(QueryResultStream::kMaxPendingLines + 2, stream.lines());
+    EXPECT_EQ(QueryResultStream::kMaxPendingLines, stream.pending());
+
+    while (it != chunk.end()) {
+        LinesDone(&stream, stream.pending());
+        rows += stream.AddLines(&it, chunk.end(), &commands);
+        EXPECT_GE(QueryResultStream::kMaxPendingLines, stream.pending());
+    }
+    EXPECT_EQ(chunk.size(), rows);
+    EXPECT_EQ(rows, CheckLines(commands, 0, stream.lines()));
+}
+
+// The final result of a merged query is pushed a line at a time, after the
+// lines streamed before it.
+TEST_F(QueryResultLinesTest, MergedLines) {
+    QEOpServerProxy::OutRowMultimapT result;
+    MakeStatsRows(2000, &result);
+
+    QueryResultLines lines(kQid, "", true);
+    uint32_t first = 3;
+    uint32_t line = first;
+    size_t rows = 0;
+    QueryResultLines::CommandListT commands;
+    QEOpServerProxy::OutRowMultimapT::const_iterator it = result.begin();
+    while (it != result.end()) {
+        rows += lines.AddLine(line++, &it, result.end(), &commands);
+    }
+    EXPECT_EQ(result.size(), rows);
+    EXPECT_LT(first + 1, line);
+    EXPECT_EQ(rows, CheckLines(commands, first, line - first));
+    EXPECT_EQ("{\"T\":0,\"SUM(bytes)\":0}", commands[0][2]);
+}
+
+// The lines are pushed with an expiry that outlasts the query, and the
+// expiry of all of them is cut down when the final status is written.
+TEST_F(QueryResultLinesTest, ExpireLines) {
+    QEOpServerProxy::BufferT chunk;
+    MakeRows(10, 0, &chunk);
+
+    QueryResultLines lines(kQid, g_viz_constants.COLLECTOR_GLOBAL_TABLE,
+                           false);
+    QueryResultLines::CommandListT commands;
+    uint32_t line = 0;
+    QEOpServerProxy::BufferT::const_iterator it = chunk.begin();
+    while (it != chunk.end()) {
+        lines.AddLine(line++, &it, chunk.end(), &commands);
+    }
+    CheckLines(commands, 0, line);
+
+    commands.clear();
+    lines.ExpireLines(line, &commands);
+    ASSERT_EQ(line, commands.size());
+    string ttl =
+        boost::lexical_cast<string>(QueryResultLines::kResultTTL);
+    for (uint32_t i = 0; i < line; i++) {
+        EXPECT_EQ("EXPIRE", commands[i][0]);
+        EXPECT_EQ(QueryResultLines::LineKey(kQid, i), commands[i][1]);
+        EXPECT_EQ(ttl, commands[i][2]);
+    }
+}
+
+// The peak is the most held at once, as chunks come and go
+TEST_F(QueryResultLinesTest, PeakResultBytes) {
+    QEOpServerProxy::BufferT chunk1, chunk2;
+    MakeRows(10, 0, &chunk1);
+    MakeRows(20, 10, &chunk2);
+    uint64_t bytes1 = QueryResultBytes::Bytes(&chunk1);
+    uint64_t bytes2 = QueryResultBytes::Bytes(&chunk2);
+    EXPECT_LT(10 * (uint64_t) QueryResultLines::kMaxRowThreshold / 4,
+              bytes1);
+    EXPECT_LT(bytes1, bytes2);
+    EXPECT_EQ(0U, QueryResultBytes::Bytes(
+        (const QEOpServerProxy::BufferT *) NULL));
+
+    QEOpServerProxy::OutRowMultimapT mchunk;
+    MakeStatsRows(10, &mchunk);
+    uint64_t mbytes = QueryResultBytes::Bytes(&mchunk);
+    EXPECT_LT(0U, mbytes);
+
+    QueryResultBytes result_bytes;
+    result_bytes.Held(bytes1);
+    result_bytes.Held(bytes2);
+    result_bytes.Held(-(int64_t) bytes1);
+    EXPECT_EQ(bytes2, result_bytes.held());
+    EXPECT_EQ(bytes1 + bytes2, result_bytes.peak());
+
+    result_bytes.Held(mbytes);
+    result_bytes.Held(-(int64_t) bytes2);
+    result_bytes.Held(-(int64_t) mbytes);
+    EXPECT_EQ(0U, result_bytes.held());
+    EXPECT_EQ(bytes1 + bytes2, result_bytes.peak());
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "query_engine/query.h"
+
+#include <unistd.h>
+#include <iterator>
+#include <boost/scoped_ptr.hpp>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+//
+// In-memory stand-in for the database. Each column family is a single
+// list of columns that is returned for any row key, after an optional
+// delay that stands for the round trip to cassandra.
+//
+class QeDbMem : public GenDb::GenDbIf {
+public:
+    typedef map<string, vector<GenDb::NewCol> > CfMap;
+
+    QeDbMem() : latency_usec_(0) {
+    }
+
+    virtual bool Db_Init(string task_id, int task_instance) { return true; }
+    virtual void Db_Uninit(bool shutdown) { }
+    virtual void Db_SetInitDone(bool init_done) { }
+    virtual bool Db_AddTablespace(const string& tablespace) { return true; }
+    virtual bool Db_SetTablespace(const string& tablespace) { return true; }
+    virtual bool Db_AddSetTablespace(const string& tablespace) {
+        return true;
+    }
+    virtual bool Db_FindTablespace(const string& tablespace) { return true; }
+    virtual bool NewDb_AddColumnfamily(const GenDb::NewCf& cf) {
+        return true;
+    }
+    virtual bool Db_UseColumnfamily(const GenDb::NewCf& cf) { return true; }
+    virtual bool NewDb_AddColumn(auto_ptr<GenDb::ColList> cl) {
+        vector<GenDb::NewCol> &columns = cf_map_[cl->cfname_];
+        columns.insert(columns.end(), cl->columns_.begin(),
+                       cl->columns_.end());
+        return true;
+    }
+    virtual bool AddColumnSync(auto_ptr<GenDb::ColList> cl) {
+        return NewDb_AddColumn(cl);
+    }
+    virtual bool Db_GetRow(GenDb::ColList& ret, const string& cfname,
+            const GenDb::DbDataValueVec& rowkey) {
+        CfMap::const_iterator it = cf_map_.find(cfname);
+        if (it == cf_map_.end()) {
+            return false;
+        }
+        if (latency_usec_) {
+            usleep(latency_usec_);
+        }
+        ret.cfname_ = cfname;
+        ret.rowkey_ = rowkey;
+        ret.columns_ = it->second;
+        return true;
+    }
+    virtual bool Db_GetMultiRow(vector<GenDb::ColList>& ret,
+            const string& cfname, const vector<GenDb::DbDataValueVec>& keys,
+            GenDb::ColumnNameRange *crange_ptr = NULL) {
+        bool ok = true;
+        for (vector<GenDb::DbDataValueVec>::const_iterator it = keys.begin();
+             ok && it != keys.end(); ++it) {
+            ret.push_back(GenDb::ColList());
+            ok = Db_GetRow(ret.back(), cfname, *it);
+        }
+        return ok;
+    }
+    virtual bool Db_GetRangeSlices(GenDb::ColList& col_list,
+            const string& cfname, const GenDb::ColumnNameRange& crange,
+            const GenDb::DbDataValueVec& key) {
+        return Db_GetRow(col_list, cfname, key);
+    }
+    virtual bool Db_GetQueueStats(uint64_t &queue_count,
+                                  uint64_t &enqueues) const {
+        queue_count = enqueues = 0;
+        return true;
+    }
+    virtual void Db_SetQueueWaterMark(bool high, size_t queue_count,
+                                      DbQueueWaterMarkCb cb) { }
+    virtual void Db_ResetQueueWaterMarks() { }
+    virtual bool Db_GetWriteBatchStats(
+            GenDb::DbWriteBatchStats &stats) const {
+        return true;
+    }
+
+    void AddColumnFamily(const string &cfname) {
+        cf_map_[cfname];
+    }
+    void AddColumn(const string &cfname, uint32_t ts, uint32_t value) {
+        GenDb::DbDataValueVec name(1, ts);
+        GenDb::DbDataValueVec data(1, value);
+        cf_map_[cfname].push_back(GenDb::NewCol(name, data));
+    }
+    void set_latency_usec(int latency_usec) { latency_usec_ = latency_usec; }
+
+private:
+    CfMap cf_map_;
+    int latency_usec_;
+};
+
+class TestQueryUnit : public QueryUnit {
+public:
+    TestQueryUnit() : QueryUnit(NULL, NULL) {
+    }
+    virtual query_status_t process_query() { return QUERY_SUCCESS; }
+};
+
+// Sub query that fails without setting its status details
+class FailedQueryUnit : public QueryUnit {
+public:
+    explicit FailedQueryUnit(QueryUnit *parent)
+        : QueryUnit(parent, parent->main_query) {
+    }
+    virtual query_status_t process_query() { return QUERY_FAILURE; }
+};
+
+// Row of the MessageTable query that the DbQueryUnits read, in 2013
+static const uint32_t kQueryRow =
+    1365791500164230ULL >> g_viz_constants.RowTimeInBits;
+
+class SetOperationTest : public ::testing::Test {
+protected:
+    SetOperationTest() : cf_count_(0) {
+    }
+
+    // The sub queries are DbQueryUnits of a MessageTable query over the
+    // single row kQueryRow, which read the stand-in through the dbif of
+    // the query.
+    virtual void SetUp() {
+        uint64_t from_time =
+            (uint64_t) kQueryRow << g_viz_constants.RowTimeInBits;
+        uint64_t end_time =
+            from_time + (1 << g_viz_constants.RowTimeInBits) - 1;
+        map<string, string> json_api_data;
+        json_api_data["table"] = "\"MessageTable\"";
+        json_api_data["start_time"] = integerToString(from_time);
+        json_api_data["end_time"] = integerToString(end_time);
+        json_api_data["select_fields"] = "[\"ModuleId\", \"Source\"]";
+        query_.reset(new AnalyticsQuery(&db_, "SET-OPERATION-TEST",
+                                        json_api_data, 0));
+        ASSERT_EQ(0, query_->status_details);
+        ASSERT_EQ(from_time, query_->from_time);
+        ASSERT_EQ(end_time, query_->end_time);
+    }
+
+    DbQueryUnit *AddDbQuery(QueryUnit *parent, const string &cfname) {
+        DbQueryUnit *unit = new DbQueryUnit(parent, query_.get());
+        unit->cfname = cfname;
+        unit->t_only_row = true;
+        return unit;
+    }
+
+    // Sub query i has count results with timestamps below range, so that
+    // there are several equivalent results in and across sub queries.
+    SetOperationUnit *AddSetOperation(QueryUnit *parent, bool intersection,
+                                      int sub_query_count, int count,
+                                      int range) {
+        SetOperationUnit *unit = new SetOperationUnit(parent, query_.get());
+        unit->set_operation = intersection ?
+            SetOperationUnit::INTERSECTION_OP : SetOperationUnit::UNION_OP;
+        range = min(range, 1 << g_viz_constants.RowTimeInBits);
+        for (int i = 0; i < sub_query_count; i++) {
+            string cfname = "cf" + integerToString(cf_count_++);
+            db_.AddColumnFamily(cfname);
+            for (int j = 0; j < count; j++) {
+                db_.AddColumn(cfname, random() % range, j);
+            }
+            AddDbQuery(unit, cfname);
+        }
+        return unit;
+    }
+
+    // The set operations as they were done before, one sub query at a time.
+    static void PairwiseOperation(const QueryUnit *unit, bool intersection,
+                                  vector<query_result_unit_t> *result) {
+        *result = unit->sub_queries[0]->query_result;
+        for (size_t i = 1; i < unit->sub_queries.size(); i++) {
+            const vector<query_result_unit_t> &next =
+                unit->sub_queries[i]->query_result;
+            vector<query_result_unit_t> tmp;
+            if (intersection) {
+                set_intersection(result->begin(), result->end(),
+                                 next.begin(), next.end(),
+                                 back_inserter(tmp));
+            } else {
+                set_union(result->begin(), result->end(),
+                          next.begin(), next.end(), back_inserter(tmp));
+            }
+            result->swap(tmp);
+        }
+    }
+
+    static void VerifyResult(const vector<query_result_unit_t> &expected,
+                             const vector<query_result_unit_t> &actual) {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_EQ(expected[i].timestamp, actual[i].timestamp);
+            EXPECT_TRUE(expected[i].info == actual[i].info);
+        }
+    }
+
+    void RunCompare(bool intersection) {
+        for (int iter = 0; iter < 64; iter++) {
+            TestQueryUnit root;
+            SetOperationUnit *unit = AddSetOperation(&root, intersection,
+                1 + random() % 6, random() % 64, 32);
+            EXPECT_EQ(QUERY_SUCCESS, unit->process_query());
+            vector<query_result_unit_t> expected;
+            PairwiseOperation(unit, intersection, &expected);
+            VerifyResult(expected, unit->query_result);
+        }
+    }
+
+    static void MergeOperation(SetOperationUnit *unit, bool intersection) {
+        unit->merge_operation(intersection);
+    }
+
+    QeDbMem db_;
+    boost::scoped_ptr<AnalyticsQuery> query_;
+    int cf_count_;
+};
+
+TEST_F(SetOperationTest, Union) {
+    RunCompare(false);
+}
+
+TEST_F(SetOperationTest, Intersection) {
+    RunCompare(true);
+}
+
+// An empty sub query result empties the intersection only.
+TEST_F(SetOperationTest, Empty) {
+    TestQueryUnit root;
+    SetOperationUnit *and_unit = AddSetOperation(&root, true, 3, 16, 32);
+    SetOperationUnit *or_unit = AddSetOperation(&root, false, 3, 16, 32);
+    db_.AddColumnFamily("empty");
+    AddDbQuery(and_unit, "empty");
+    AddDbQuery(or_unit, "empty");
+
+    EXPECT_EQ(QUERY_SUCCESS, and_unit->process_query());
+    EXPECT_TRUE(and_unit->query_result.empty());
+
+    EXPECT_EQ(QUERY_SUCCESS, or_unit->process_query());
+    vector<query_result_unit_t> expected;
+    PairwiseOperation(or_unit, false, &expected);
+    VerifyResult(expected, or_unit->query_result);
+}
+
+// OR of ANDs, which is how the WhereQuery builds the set operations.
+TEST_F(SetOperationTest, Tree) {
+    TestQueryUnit root;
+    SetOperationUnit *or_unit = new SetOperationUnit(&root, NULL);
+    for (int i = 0; i < 4; i++) {
+        AddSetOperation(or_unit, true, 3, 256, 128);
+    }
+    EXPECT_EQ(QUERY_SUCCESS, or_unit->process_query());
+
+    vector<query_result_unit_t> expected;
+    for (size_t i = 0; i < or_unit->sub_queries.size(); i++) {
+        QueryUnit *and_unit = or_unit->sub_queries[i];
+        PairwiseOperation(and_unit, true, &expected);
+        VerifyResult(expected, and_unit->query_result);
+    }
+    PairwiseOperation(or_unit, false, &expected);
+    VerifyResult(expected, or_unit->query_result);
+}
+
+// A failed sub query fails the set operation with its status.
+TEST_F(SetOperationTest, Failure) {
+    TestQueryUnit root;
+    SetOperationUnit *unit = AddSetOperation(&root, false, 4, 16, 32);
+    AddDbQuery(unit, "missing");
+    EXPECT_EQ(QUERY_FAILURE, unit->process_query());
+    EXPECT_EQ(EIO, unit->status_details);
+    EXPECT_EQ(QUERY_FAILURE, unit->sub_queries.back()->query_status);
+}
+
+// A sub query that fails without status details still fails the set
+// operation, and the sub queries after it are not run.
+TEST_F(SetOperationTest, FailureWithoutDetails) {
+    TestQueryUnit root;
+    SetOperationUnit *unit = AddSetOperation(&root, true, 2, 16, 32);
+    new FailedQueryUnit(unit);
+    AddDbQuery(unit, "cf0");
+    EXPECT_EQ(QUERY_FAILURE, unit->process_query());
+    EXPECT_NE(0U, unit->status_details);
+    EXPECT_EQ(QUERY_SUCCESS, unit->sub_queries[0]->query_status);
+    EXPECT_EQ(QUERY_FAILURE, unit->sub_queries[2]->query_status);
+    EXPECT_EQ(QUERY_PROCESSING_NOT_STARTED,
+              unit->sub_queries[3]->query_status);
+
+    // The failure is kept if the set operation is processed again
+    EXPECT_EQ(QUERY_FAILURE, unit->process_query());
+}
+
+//
+// Cost of a set operation over SUBQUERY_COUNT sub queries of RESULT_COUNT
+// results each. DB_LATENCY_USEC is the time taken by each database read.
+//
+TEST_F(SetOperationTest, Benchmark) {
+    int sub_query_count = GetEnvInt("SUBQUERY_COUNT", 8);
+    int result_count = GetEnvInt("RESULT_COUNT", 100000);
+    db_.set_latency_usec(GetEnvInt("DB_LATENCY_USEC", 20000));
+
+    for (int op = 0; op < 2; op++) {
+        bool intersection = (op == 1);
+        TestQueryUnit root;
+        SetOperationUnit *unit = AddSetOperation(&root, intersection,
+            sub_query_count, result_count, result_count * 4);
+
+        uint64_t start = UTCTimestampUsec();
+        EXPECT_EQ(QUERY_SUCCESS, unit->process_query());
+        uint64_t query_usec = UTCTimestampUsec() - start;
+
+        // The set operation alone, pairwise and as one k-way merge.
+        vector<query_result_unit_t> expected;
+        start = UTCTimestampUsec();
+        PairwiseOperation(unit, intersection, &expected);
+        uint64_t pairwise_usec = UTCTimestampUsec() - start;
+
+        start = UTCTimestampUsec();
+        MergeOperation(unit, intersection);
+        uint64_t merge_usec = UTCTimestampUsec() - start;
+        VerifyResult(expected, unit->query_result);
+
+        LOG(DEBUG, (intersection ? "Intersection" : "Union") << " of " <<
+            sub_query_count << " x " << result_count << " results: " <<
+            unit->query_result.size() << " results");
+        LOG(DEBUG, "set operation query:    " << query_usec << " usec");
+        LOG(DEBUG, "pairwise set operation: " << pairwise_usec << " usec");
+        LOG(DEBUG, "k-way merge:            " << merge_usec << " usec");
+    }
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
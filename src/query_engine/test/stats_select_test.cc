@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "query_engine/stats_select.h"
+
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+
+using namespace std;
+
+//
+// The rows are loaded directly into StatsSelect, so the query only needs a
+// database for its parsing, and nothing is read from it.
+//
+class QeDbNull : public GenDb::GenDbIf {
+public:
+    virtual bool Db_Init(string task_id, int task_instance) { return true; }
+    virtual void Db_Uninit(bool shutdown) { }
+    virtual void Db_SetInitDone(bool init_done) { }
+    virtual bool Db_AddTablespace(const string& tablespace) { return true; }
+    virtual bool Db_SetTablespace(const string& tablespace) { return true; }
+    virtual bool Db_AddSetTablespace(const string& tablespace) {
+        return true;
+    }
+    virtual bool Db_FindTablespace(const string& tablespace) { return true; }
+    virtual bool NewDb_AddColumnfamily(const GenDb::NewCf& cf) {
+        return true;
+    }
+    virtual bool Db_UseColumnfamily(const GenDb::NewCf& cf) { return true; }
+    virtual bool NewDb_AddColumn(auto_ptr<GenDb::ColList> cl) {
+        return true;
+    }
+    virtual bool AddColumnSync(auto_ptr<GenDb::ColList> cl) { return true; }
+    virtual bool Db_GetRow(GenDb::ColList& ret, const string& cfname,
+            const GenDb::DbDataValueVec& rowkey) {
+        return false;
+    }
+    virtual bool Db_GetMultiRow(vector<GenDb::ColList>& ret,
+            const string& cfname, const vector<GenDb::DbDataValueVec>& keys,
+            GenDb::ColumnNameRange *crange_ptr = NULL) {
+        return false;
+    }
+    virtual bool Db_GetRangeSlices(GenDb::ColList& col_list,
+            const string& cfname, const GenDb::ColumnNameRange& crange,
+            const GenDb::DbDataValueVec& key) {
+        return false;
+    }
+    virtual bool Db_GetQueueStats(uint64_t &queue_count,
+                                  uint64_t &enqueues) const {
+        queue_count = enqueues = 0;
+        return true;
+    }
+    virtual void Db_SetQueueWaterMark(bool high, size_t queue_count,
+                                      DbQueueWaterMarkCb cb) { }
+    virtual void Db_ResetQueueWaterMarks() { }
+    virtual bool Db_GetWriteBatchStats(
+            GenDb::DbWriteBatchStats &stats) const {
+        return true;
+    }
+};
+
+class StatsSelectTest : public ::testing::Test {
+protected:
+    typedef map<StatsSelect::StatMap, QEOpServerProxy::AggRowT> MapResultT;
+
+    struct Row {
+        boost::uuids::uuid u;
+        uint64_t timestamp;
+        vector<StatsSelect::StatEntry> attribs;
+    };
+
+    static const uint64_t kStartTime = 1365791500000000ULL;
+
+    virtual void SetUp() {
+        map<string, string> json_api_data;
+        json_api_data["table"] = "\"StatTable.AnalyticsCpuState.cpu_info\"";
+        json_api_data["start_time"] = integerToString(kStartTime);
+        json_api_data["end_time"] =
+            integerToString(kStartTime + 3600 * 1000000ULL);
+        json_api_data["select_fields"] = "[\"name\", \"T=60\", "
+            "\"SUM(cpu_info.mem_virt)\", \"SUM(cpu_info.cpu_share)\", "
+            "\"COUNT(cpu_info)\"]";
+        query_.reset(new AnalyticsQuery(&db_, "STATS-SELECT-TEST",
+                                        json_api_data, 0));
+        ASSERT_EQ(0, query_->status_details);
+
+        select_fields_.push_back("name");
+        select_fields_.push_back("T=60");
+        select_fields_.push_back("SUM(cpu_info.mem_virt)");
+        select_fields_.push_back("SUM(cpu_info.cpu_share)");
+        select_fields_.push_back("COUNT(cpu_info)");
+    }
+
+    static void AddEntry(const string &name, const StatsSelect::StatVal &value,
+                         Row *row) {
+        StatsSelect::StatEntry entry;
+        entry.name = name;
+        entry.value = value;
+        row->attribs.push_back(entry);
+    }
+
+    // Rows of a few objects over a few minutes, each with or without each
+    // of the summed columns, and with a column that is not selected. The
+    // doubles are whole quarters so that their sums are exact in any order.
+    static void MakeRows(int count, int objects, vector<Row> *rows) {
+        for (int i = 0; i < count; i++) {
+            Row row;
+            row.u = boost::uuids::uuid();
+            row.timestamp = kStartTime + (random() % 300) * 1000000ULL;
+            AddEntry("name", "obj-" + integerToString(random() % objects),
+                     &row);
+            if (random() % 2) {
+                AddEntry("cpu_info.mem_virt", (uint64_t) (random() % 1000),
+                         &row);
+            }
+            if (random() % 2) {
+                AddEntry("cpu_info.cpu_share", (random() % 400) / 4.0, &row);
+            }
+            AddEntry("cpu_info.module_id", string("Collector"), &row);
+            rows->push_back(row);
+        }
+    }
+
+    // The aggregation as it was done before the columns, into a map keyed
+    // on the uniks of the rows. A group has the sum of every column that
+    // any of its rows has.
+    static void MapAggregate(const vector<Row> &rows, MapResultT *result) {
+        for (vector<Row>::const_iterator it = rows.begin();
+             it != rows.end(); ++it) {
+            StatsSelect::StatMap uniks;
+            QEOpServerProxy::AggRowT narows;
+            uniks["T="] = it->timestamp - (it->timestamp % 60000000ULL);
+            for (size_t i = 0; i < it->attribs.size(); i++) {
+                const StatsSelect::StatEntry &entry = it->attribs[i];
+                if (entry.name == "name") {
+                    uniks[entry.name] = entry.value;
+                } else if (entry.name != "cpu_info.module_id") {
+                    narows[make_pair(QEOpServerProxy::SUM, entry.name)] =
+                        entry.value;
+                }
+            }
+            narows[make_pair(QEOpServerProxy::COUNT, string("cpu_info"))] =
+                (uint64_t) 1;
+
+            QEOpServerProxy::AggRowT &arows = (*result)[uniks];
+            for (QEOpServerProxy::AggRowT::const_iterator kt = narows.begin();
+                 kt != narows.end(); ++kt) {
+                QEOpServerProxy::AggRowT::iterator jt = arows.find(kt->first);
+                if (jt == arows.end()) {
+                    arows.insert(*kt);
+                } else if (kt->second.which() == QEOpServerProxy::DOUBLE) {
+                    jt->second = boost::get<double>(jt->second) +
+                        boost::get<double>(kt->second);
+                } else {
+                    jt->second = boost::get<uint64_t>(jt->second) +
+                        boost::get<uint64_t>(kt->second);
+                }
+            }
+        }
+    }
+
+    void ColumnAggregate(const vector<Row> &rows,
+                         StatsSelect::MapBufT *result) {
+        StatsSelect stats(query_.get(), select_fields_);
+        ASSERT_TRUE(stats.Status());
+        for (vector<Row>::const_iterator it = rows.begin();
+             it != rows.end(); ++it) {
+            EXPECT_TRUE(stats.LoadRow(it->u, it->timestamp, it->attribs));
+        }
+        stats.Flush(*result);
+    }
+
+    static void VerifyResult(const MapResultT &expected,
+                             const StatsSelect::MapBufT &actual) {
+        EXPECT_EQ(expected.size(), actual.size());
+        for (StatsSelect::MapBufT::const_iterator it = actual.begin();
+             it != actual.end(); ++it) {
+            MapResultT::const_iterator et = expected.find(it->second.first);
+            ASSERT_TRUE(et != expected.end());
+            const QEOpServerProxy::AggRowT &aggs = it->second.second;
+            ASSERT_EQ(et->second.size(), aggs.size());
+            for (QEOpServerProxy::AggRowT::const_iterator kt =
+                 et->second.begin(); kt != et->second.end(); ++kt) {
+                QEOpServerProxy::AggRowT::const_iterator jt =
+                    aggs.find(kt->first);
+                ASSERT_TRUE(jt != aggs.end());
+                EXPECT_TRUE(jt->second == kt->second);
+            }
+        }
+    }
+
+    QeDbNull db_;
+    boost::scoped_ptr<AnalyticsQuery> query_;
+    vector<string> select_fields_;
+};
+
+const uint64_t StatsSelectTest::kStartTime;
+
+// Groups whose rows have different columns get the sums of all of them,
+// whichever row comes first. There are more rows than in a batch.
+TEST_F(StatsSelectTest, MixedColumns) {
+    vector<Row> rows;
+    MakeRows(10000, 8, &rows);
+
+    MapResultT expected;
+    MapAggregate(rows, &expected);
+    StatsSelect::MapBufT actual;
+    ColumnAggregate(rows, &actual);
+    VerifyResult(expected, actual);
+}
+
+// The results of chunks merge into the same result as one chunk does,
+// also when a column is only in the rows of some of the chunks.
+TEST_F(StatsSelectTest, MergeChunks) {
+    vector<Row> rows1, rows2;
+    MakeRows(1000, 4, &rows1);
+    MakeRows(1000, 4, &rows2);
+    for (size_t i = 0; i < rows1.size(); i++) {
+        vector<StatsSelect::StatEntry> &attribs = rows1[i].attribs;
+        for (size_t j = 0; j < attribs.size(); j++) {
+            if (attribs[j].name == "cpu_info.cpu_share") {
+                attribs.erase(attribs.begin() + j);
+                break;
+            }
+        }
+    }
+
+    StatsSelect::MapBufT actual1, actual2, actual;
+    ColumnAggregate(rows1, &actual1);
+    ColumnAggregate(rows2, &actual2);
+    StatsSelect::Merge(actual1, actual);
+    StatsSelect::Merge(actual2, actual);
+
+    vector<Row> rows(rows1);
+    rows.insert(rows.end(), rows2.begin(), rows2.end());
+    MapResultT expected;
+    MapAggregate(rows, &expected);
+    VerifyResult(expected, actual);
+}
+
+// Set ROW_COUNT and OBJECT_COUNT to measure larger queries
+TEST_F(StatsSelectTest, MapVsColumns) {
+    vector<Row> rows;
+    MakeRows(GetEnvInt("ROW_COUNT", 20000), GetEnvInt("OBJECT_COUNT", 64),
+             &rows);
+
+    uint64_t start = UTCTimestampUsec();
+    MapResultT expected;
+    MapAggregate(rows, &expected);
+    uint64_t map_usecs = UTCTimestampUsec() - start;
+
+    start = UTCTimestampUsec();
+    StatsSelect::MapBufT actual;
+    ColumnAggregate(rows, &actual);
+    uint64_t column_usecs = UTCTimestampUsec() - start;
+
+    VerifyResult(expected, actual);
+    LOG(DEBUG, "Stats select of " << rows.size() << " rows: map " <<
+        rows.size() * 1000000 / (map_usecs + 1) << " rows/sec, columns " <<
+        rows.size() * 1000000 / (column_usecs + 1) << " rows/sec");
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -793,7 +793,7 @@ query_status_t WhereQuery::process_query()
 
     // TBD make this generic 
     if (sub_queries.size() > 0)
-        query_result = sub_queries[0]->query_result;
+        query_result.swap(sub_queries[0]->query_result);
 
     QE_TRACE(DEBUG, "Set ops returns # of rows:" << query_result.size());
 
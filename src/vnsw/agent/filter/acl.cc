@@ -25,6 +25,8 @@
 #include <pkt/flow_table.h>
 
 static AclTable *acl_table_;
+// Revision given to the next ACL entry added or changed
+static uint32_t acl_entry_revision_;
 
 using namespace autogen;
 
@@ -104,6 +106,7 @@ DBEntry *AclTable::Add(const DBRequest *req) {
          ++it) {
         acl->AddAclEntry(*it, acl->acl_entries_);
     }
+    acl->Compile();
     return acl;
 }
 
@@ -113,6 +116,7 @@ bool AclTable::OnChange(DBEntry *entry, const DBRequest *req) {
 
     if (data->ace_id_to_del_) {
         acl->DeleteAclEntry(data->ace_id_to_del_);
+        acl->Compile();
         return true;
     }
 
@@ -132,9 +136,12 @@ bool AclTable::OnChange(DBEntry *entry, const DBRequest *req) {
     // entries
     if (!data->ace_add) {
         // Delete All acl entries for now and set newly created one.
+        acl->KeepRevisions(entries);
         acl->DeleteAllAclEntries();
         acl->SetAclEntries(entries);
     }
+    // Only the classifier of this ACL is rebuilt
+    acl->Compile();
     return true;
 }
 
@@ -530,6 +537,7 @@ void AclTable::AddMirrorTableEntry (AclEntrySpec &ace_spec)
 // ACL methods
 void AclDBEntry::SetAclEntries(AclEntries &entries)
 {
+    classifier_.Clear();
     AclEntries::iterator it, tmp;
     it = entries.begin();
     while (it != entries.end()) {
@@ -562,6 +570,7 @@ AclEntry *AclDBEntry::AddAclEntry(const AclEntrySpec &acl_entry_spec, AclEntries
     
     AclEntry *entry = new AclEntry();
     entry->PopulateAclEntry(acl_entry_spec);
+    entry->set_revision(++acl_entry_revision_);
     
     std::vector<ActionSpec>::const_iterator it;
     for (it = acl_entry_spec.action_l.begin(); it != acl_entry_spec.action_l.end();
@@ -582,10 +591,53 @@ AclEntry *AclDBEntry::AddAclEntry(const AclEntrySpec &acl_entry_spec, AclEntries
         }
     }
     entries.insert(iter, *entry);
+    if (&entries == &acl_entries_) {
+        classifier_.Clear();
+    }
     ACL_TRACE(Info, "acl entry " + integerToString(acl_entry_spec.id) + " added");
     return entry;
 }
 
+// Entries that are the same as the entry of their id in the ACL keep its
+// revision, so that only the entries that changed are seen as changed.
+void AclDBEntry::KeepRevisions(AclEntries &entries)
+{
+    AclEntries::iterator it = entries.begin();
+    AclEntries::const_iterator old_it = acl_entries_.begin();
+    while (it != entries.end() && old_it != acl_entries_.end()) {
+        if (old_it->id() < it->id()) {
+            ++old_it;
+        } else if (it->id() < old_it->id()) {
+            ++it;
+        } else {
+            if (it->IsEqual(*old_it)) {
+                it->set_revision(old_it->revision());
+            }
+            ++it;
+            ++old_it;
+        }
+    }
+}
+
+void AclDBEntry::GetAceRevisions(AceRevisionMap *revisions) const
+{
+    AclEntries::const_iterator iter;
+    for (iter = acl_entries_.begin(); iter != acl_entries_.end(); ++iter) {
+        revisions->insert(std::make_pair(iter->id(), iter->revision()));
+    }
+}
+
+void AclDBEntry::GetAclEntries(const AclEntryIDSet &ids,
+                               std::vector<const AclEntry *> *entries) const
+{
+    AclEntries::const_iterator iter;
+    for (iter = acl_entries_.begin(); iter != acl_entries_.end(); ++iter) {
+        if (ids.find(iter->id()) != ids.end()) {
+            entries->push_back(iter.operator->());
+        }
+    }
+}
+
 bool AclDBEntry::DeleteAclEntry(const uint32_t acl_entry_id)
 {
     AclEntries::iterator iter;
@@ -594,6 +646,7 @@ bool AclDBEntry::DeleteAclEntry(const uint32_t acl_entry_id)
         if (acl_entry_id == iter->id()) {
             AclEntry *ae = iter.operator->();
             acl_entries_.erase(acl_entries_.iterator_to(*iter));
+            classifier_.Clear();
             ACL_TRACE(Info, "acl entry " + integerToString(acl_entry_id) + " deleted");
             delete ae;
             return true;
@@ -605,6 +658,7 @@ bool AclDBEntry::DeleteAclEntry(const uint32_t acl_entry_id)
 
 void AclDBEntry::DeleteAllAclEntries()
 {
+    classifier_.Clear();
     AclEntries::iterator iter;
     iter = acl_entries_.begin();
     while (iter != acl_entries_.end()) {
@@ -615,42 +669,84 @@ void AclDBEntry::DeleteAllAclEntries()
     return;
 }
 
+// Adds up the actions of the entries that match a packet, up to the first
+// terminal entry.
+class AclMatchVisitor {
+public:
+    AclMatchVisitor(MatchAclParams &m_acl) : m_acl_(m_acl), matched_(false) {
+        m_acl_.terminal_rule = false;
+        m_acl_.action_info.action = 0;
+    }
+
+    bool operator()(const AclEntry *entry, const AclEntry::ActionList &al) {
+        AclEntry::ActionList::const_iterator al_it;
+        for (al_it = al.begin(); al_it != al.end(); ++al_it) {
+            TrafficAction *ta = static_cast<TrafficAction *>(*al_it);
+            m_acl_.action_info.action |= 1 << ta->GetAction();
+            if (ta->GetActionType() == TrafficAction::MIRROR_ACTION) {
+                MirrorAction *a = static_cast<MirrorAction *>(*al_it);
+                MirrorActionSpec as;
+                as.ip = a->GetIp();
+                as.port = a->GetPort();
+                as.vrf_name = a->GetVrfName();
+                as.analyzer_name = a->GetAnalyzerName();
+                as.encap = a->GetEncap();
+                m_acl_.action_info.mirror_l.push_back(as);
+            }
+        }
+        if (!(al.empty())) {
+            matched_ = true;
+            m_acl_.ace_id_list.push_back((int32_t)(entry->id()));
+            if (entry->IsTerminal()) {
+                m_acl_.terminal_rule = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool matched() const { return matched_; }
+
+private:
+    MatchAclParams &m_acl_;
+    bool matched_;
+};
+
+void AclDBEntry::Compile()
+{
+    AclClassifier::EntryList entries;
+    AclEntries::const_iterator iter;
+    for (iter = acl_entries_.begin(); iter != acl_entries_.end(); ++iter) {
+        entries.push_back(iter.operator->());
+    }
+    classifier_.Build(entries);
+}
+
 bool AclDBEntry::PacketMatch(const PacketHeader &packet_header, 
 			     MatchAclParams &m_acl) const
 {
+    // Entries changed outside of the AclTable are not compiled
+    if (!classifier_.built()) {
+        return LinearPacketMatch(packet_header, m_acl);
+    }
+    AclMatchVisitor visitor(m_acl);
+    classifier_.Match(packet_header, visitor);
+    return visitor.matched();
+}
+
+bool AclDBEntry::LinearPacketMatch(const PacketHeader &packet_header,
+                                   MatchAclParams &m_acl) const
+{
+    AclMatchVisitor visitor(m_acl);
     AclEntries::const_iterator iter;
-    bool ret_val = false;
-    m_acl.terminal_rule = false;
-	m_acl.action_info.action = 0;
     for (iter = acl_entries_.begin();
          iter != acl_entries_.end();
          ++iter) {
-        const AclEntry::ActionList &al = iter->PacketMatch(packet_header);
-	AclEntry::ActionList::const_iterator al_it;
-	for (al_it = al.begin(); al_it != al.end(); ++al_it) {
-	     TrafficAction *ta = static_cast<TrafficAction *>(*al_it.operator->());
-	     m_acl.action_info.action |= 1 << ta->GetAction();
-	     if (ta->GetActionType() == TrafficAction::MIRROR_ACTION) {
-	         MirrorAction *a = static_cast<MirrorAction *>(*al_it.operator->());
-                 MirrorActionSpec as;
-		 as.ip = a->GetIp();
-		 as.port = a->GetPort();
-                 as.vrf_name = a->GetVrfName();
-                 as.analyzer_name = a->GetAnalyzerName();
-                 as.encap = a->GetEncap();
-                 m_acl.action_info.mirror_l.push_back(as);
-	     }
-	}
-        if (!(al.empty())) {
-            ret_val = true;
-            m_acl.ace_id_list.push_back((int32_t)(iter->id()));
-            if (iter->IsTerminal()) {
-	        m_acl.terminal_rule = true;
-                return ret_val;
-            }
+        if (!visitor(iter.operator->(), iter->PacketMatch(packet_header))) {
+            break;
         }
     }
-    return ret_val;
+    return visitor.matched();
 }
 
 const AclDBEntry* AclTable::GetAclDBEntry(const string acl_uuid_str, 
@@ -7,6 +7,7 @@
 
 #include "vnsw/agent/filter/acl_entry.h"
 #include "vnsw/agent/filter/acl_entry_spec.h"
+#include "vnsw/agent/filter/acl_classifier.h"
 
 #include <boost/intrusive/list.hpp>
 #include <boost/uuid/uuid.hpp>
@@ -96,6 +97,8 @@ public:
             boost::intrusive::list_member_hook<>, 
             &AclEntry::acl_list_node> AclEntryNode;
     typedef boost::intrusive::list<AclEntry, AclEntryNode> AclEntries;
+    // Revision of each entry, by entry id
+    typedef std::map<uint32_t, uint32_t> AceRevisionMap;
     
     AclDBEntry(uuid id) : uuid_(id), dynamic_acl_(false) { };
     ~AclDBEntry() { };
@@ -123,15 +126,28 @@ public:
     void SetDynamicAcl(bool dyn) {dynamic_acl_ = dyn;};
     bool GetDynamicAcl () const {return dynamic_acl_;};
 
+    // Build the classifier of the entries, after they change
+    void Compile();
+    void GetAceRevisions(AceRevisionMap *revisions) const;
+    // Entries of the ids that are in the ACL, in the order of the ACL
+    void GetAclEntries(const AclEntryIDSet &ids,
+                       std::vector<const AclEntry *> *entries) const;
+    const AclClassifier &classifier() const {return classifier_;};
+
     // Packet Match
     bool PacketMatch(const PacketHeader &packet_header, 
 		     MatchAclParams &m_acl) const;
+    // Packet Match running the matches of each entry in turn
+    bool LinearPacketMatch(const PacketHeader &packet_header,
+                           MatchAclParams &m_acl) const;
 private:
     friend class AclTable;
+    void KeepRevisions(AclEntries &entries);
     uuid uuid_;
     bool dynamic_acl_;
     std::string name_;
     AclEntries acl_entries_;
+    AclClassifier classifier_;
     DISALLOW_COPY_AND_ASSIGN(AclDBEntry);
 };
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <algorithm>
+#include "vnsw/agent/filter/acl_classifier.h"
+
+const size_t AclClassifier::kStackWords;
+
+static inline void SetBit(uint64_t *bits, size_t bit) {
+    bits[bit / 64] |= (1ULL << (bit % 64));
+}
+
+static inline void OrBits(uint64_t *bits, const std::vector<uint64_t> &row,
+                          size_t words) {
+    for (size_t word = 0; word < words; word++) {
+        bits[word] |= row[word];
+    }
+}
+
+bool AclMatchFields::Address::operator==(const Address &rhs) const {
+    return type == rhs.type && any == rhs.any && never == rhs.never &&
+        verify == rhs.verify && ip == rhs.ip && mask == rhs.mask &&
+        ip_min == rhs.ip_min && ip_max == rhs.ip_max &&
+        network == rhs.network && sg_id == rhs.sg_id;
+}
+
+void AclClassifier::FieldIndex::Build(
+        const std::vector<const AclMatchFields::Field *> &fields,
+        size_t words) {
+    words_ = words;
+
+    // Start of each elementary interval
+    starts_.clear();
+    starts_.push_back(0);
+    for (size_t i = 0; i < fields.size(); i++) {
+        const AclMatchFields::FieldRangeList &ranges = fields[i]->ranges;
+        for (size_t j = 0; j < ranges.size(); j++) {
+            if (ranges[j].first > ranges[j].second) {
+                continue;
+            }
+            starts_.push_back(ranges[j].first);
+            if (ranges[j].second != 0xFFFFFFFF) {
+                starts_.push_back(ranges[j].second + 1);
+            }
+        }
+    }
+    std::sort(starts_.begin(), starts_.end());
+    starts_.erase(std::unique(starts_.begin(), starts_.end()), starts_.end());
+
+    bits_.assign(starts_.size() * words_, 0);
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i]->match == false) {
+            for (size_t row = 0; row < starts_.size(); row++) {
+                SetBit(&bits_[row * words_], i);
+            }
+            continue;
+        }
+        const AclMatchFields::FieldRangeList &ranges = fields[i]->ranges;
+        for (size_t j = 0; j < ranges.size(); j++) {
+            if (ranges[j].first > ranges[j].second) {
+                continue;
+            }
+            size_t first = std::lower_bound(starts_.begin(), starts_.end(),
+                                            ranges[j].first) - starts_.begin();
+            size_t last = std::upper_bound(starts_.begin(), starts_.end(),
+                                           ranges[j].second) - starts_.begin();
+            for (size_t row = first; row < last; row++) {
+                SetBit(&bits_[row * words_], i);
+            }
+        }
+    }
+}
+
+void AclClassifier::FieldIndex::Clear() {
+    starts_.clear();
+    bits_.clear();
+    words_ = 0;
+}
+
+const uint64_t *AclClassifier::FieldIndex::Row(uint32_t value) const {
+    size_t row = std::upper_bound(starts_.begin(), starts_.end(), value) -
+        starts_.begin() - 1;
+    return &bits_[row * words_];
+}
+
+void AclClassifier::AddressIndex::Build(
+        const std::vector<const AclMatchFields::Address *> &addrs,
+        size_t words, std::vector<uint64_t> *verify) {
+    std::vector<AclMatchFields::Field> ip_fields(addrs.size());
+    std::vector<const AclMatchFields::Field *> ip_field_list;
+    sg_any_.assign(words, 0);
+    for (size_t i = 0; i < addrs.size(); i++) {
+        const AclMatchFields::Address *addr = addrs[i];
+        AclMatchFields::Field &field = ip_fields[i];
+        ip_field_list.push_back(&field);
+
+        if (addr->type == 0 || addr->any) {
+            continue;
+        }
+        if (addr->verify) {
+            SetBit(&(*verify)[0], i);
+            continue;
+        }
+        // Entries of the other address types have no bits in the intervals
+        field.match = true;
+        if (addr->never) {
+            continue;
+        }
+
+        if (addr->type == AddressMatch::IP_ADDR) {
+            field.ranges.push_back(std::make_pair(addr->ip_min, addr->ip_max));
+        } else if (addr->type == AddressMatch::NETWORK_ID) {
+            std::vector<uint64_t> &row = network_[addr->network];
+            row.resize(words, 0);
+            SetBit(&row[0], i);
+            has_network_ = true;
+        } else if (addr->type == AddressMatch::SG) {
+            if (addr->sg_id == AddressMatch::kAny) {
+                SetBit(&sg_any_[0], i);
+            } else {
+                std::vector<uint64_t> &row = sg_[addr->sg_id];
+                row.resize(words, 0);
+                SetBit(&row[0], i);
+            }
+            has_sg_ = true;
+        }
+    }
+    ip_.Build(ip_field_list, words);
+}
+
+void AclClassifier::AddressIndex::Clear() {
+    ip_.Clear();
+    network_.clear();
+    sg_.clear();
+    sg_any_.clear();
+    has_network_ = false;
+    has_sg_ = false;
+}
+
+void AclClassifier::AddressIndex::Lookup(uint32_t ip,
+        const std::string *network, const SecurityGroupList *sg_l,
+        size_t words, uint64_t *bits) const {
+    const uint64_t *row = ip_.Row(ip);
+    std::copy(row, row + words, bits);
+
+    if (has_network_ && network) {
+        NetworkMap::const_iterator it = network_.find(*network);
+        if (it != network_.end()) {
+            OrBits(bits, it->second, words);
+        }
+    }
+
+    if (has_sg_ && sg_l) {
+        OrBits(bits, sg_any_, words);
+        SecurityGroupList::const_iterator it;
+        for (it = sg_l->begin(); it != sg_l->end(); ++it) {
+            SgMap::const_iterator sg_it = sg_.find(*it);
+            if (sg_it != sg_.end()) {
+                OrBits(bits, sg_it->second, words);
+            }
+        }
+    }
+}
+
+AclClassifier::AclClassifier() : built_(false), words_(0) {
+}
+
+AclClassifier::~AclClassifier() {
+}
+
+void AclClassifier::Build(const EntryList &entries) {
+    Clear();
+    entries_ = entries;
+    words_ = (entries_.size() + 63) / 64;
+    verify_.assign(words_, 0);
+
+    std::vector<AclMatchFields> fields(entries_.size());
+    std::vector<const AclMatchFields::Address *> src, dst;
+    std::vector<const AclMatchFields::Field *> protocol, src_port, dst_port;
+    for (size_t i = 0; i < entries_.size(); i++) {
+        entries_[i]->GetMatchFields(&fields[i]);
+        src.push_back(&fields[i].src);
+        dst.push_back(&fields[i].dst);
+        protocol.push_back(&fields[i].protocol);
+        src_port.push_back(&fields[i].src_port);
+        dst_port.push_back(&fields[i].dst_port);
+    }
+
+    if (words_) {
+        src_.Build(src, words_, &verify_);
+        dst_.Build(dst, words_, &verify_);
+        protocol_.Build(protocol, words_);
+        src_port_.Build(src_port, words_);
+        dst_port_.Build(dst_port, words_);
+    }
+    built_ = true;
+}
+
+void AclClassifier::Clear() {
+    built_ = false;
+    words_ = 0;
+    entries_.clear();
+    verify_.clear();
+    src_.Clear();
+    dst_.Clear();
+    protocol_.Clear();
+    src_port_.Clear();
+    dst_port_.Clear();
+}
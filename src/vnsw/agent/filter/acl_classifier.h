@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef __AGENT_ACL_CLASSIFIER_H__
+#define __AGENT_ACL_CLASSIFIER_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include "base/util.h"
+#include "vnsw/agent/filter/acl_entry.h"
+#include "vnsw/agent/filter/packet_header.h"
+
+//
+// Packet fields matched by an ACL entry, as filled in by the Compile()
+// of its AclEntryMatch objects. A field without a match is a wildcard.
+//
+struct AclMatchFields {
+    typedef std::pair<uint32_t, uint32_t> FieldRange;
+    typedef std::vector<FieldRange> FieldRangeList;
+
+    struct Address {
+        Address() : type(0), any(false), never(false), verify(false),
+            ip(0), mask(0), ip_min(0), ip_max(0), sg_id(0) { }
+        bool operator==(const Address &rhs) const;
+
+        // AddressMatch::AddressType, or 0 if the address is not matched
+        int type;
+        // Matches every packet, for a network id of "any"
+        bool any;
+        // Matches no packet, such as an IPv6 address
+        bool never;
+        // The mask is not a prefix, the ranges of addresses are not
+        // computed and the entry itself is matched
+        bool verify;
+        uint32_t ip;
+        uint32_t mask;
+        uint32_t ip_min;
+        uint32_t ip_max;
+        std::string network;
+        int sg_id;
+    };
+
+    struct Field {
+        Field() : match(false) { }
+        bool operator==(const Field &rhs) const {
+            return match == rhs.match && ranges == rhs.ranges;
+        }
+
+        // Matches a packet if the field is in one of the ranges
+        bool match;
+        FieldRangeList ranges;
+    };
+
+    bool operator==(const AclMatchFields &rhs) const {
+        return src == rhs.src && dst == rhs.dst &&
+            protocol == rhs.protocol && src_port == rhs.src_port &&
+            dst_port == rhs.dst_port;
+    }
+
+    Address src;
+    Address dst;
+    Field protocol;
+    Field src_port;
+    Field dst_port;
+};
+
+//
+// Entries of an ACL compiled into bit vectors, to find the entries that
+// match a packet without running the matches of each entry.
+//
+// Every entry is given a bit, in the order of the ACL. Each packet field is
+// split into the elementary intervals that the ranges of the entries start
+// and end on, and each interval has the bits of the entries that match a
+// packet with the field in it. The address fields have intervals for the
+// IP address entries, and a bit vector per network id and SG id. A lookup
+// is a binary search per field, and an AND of the bit vectors of the
+// fields gives the entries that match, which are walked in order.
+//
+// The classifier is rebuilt when the entries of the ACL change, it is
+// not updated in place. Lookups must not run while it is built.
+//
+class AclClassifier {
+public:
+    typedef std::vector<const AclEntry *> EntryList;
+
+    // Bit vectors of up to kStackWords words are combined on the stack
+    static const size_t kStackWords = 16;
+
+    AclClassifier();
+    ~AclClassifier();
+
+    void Build(const EntryList &entries);
+    void Clear();
+
+    bool built() const { return built_; }
+    size_t size() const { return entries_.size(); }
+
+    // Calls visitor(entry, actions) for each entry that matches the packet,
+    // in the order of the ACL, until the visitor returns false. The actions
+    // are those of AclEntry::PacketMatch().
+    template <typename Visitor>
+    void Match(const PacketHeader &hdr, Visitor &visitor) const {
+        if (entries_.empty()) {
+            return;
+        }
+        uint64_t src_stack[kStackWords];
+        uint64_t dst_stack[kStackWords];
+        std::vector<uint64_t> src_heap, dst_heap;
+        uint64_t *src = src_stack;
+        uint64_t *dst = dst_stack;
+        if (words_ > kStackWords) {
+            src_heap.resize(words_);
+            dst_heap.resize(words_);
+            src = &src_heap[0];
+            dst = &dst_heap[0];
+        }
+        src_.Lookup(hdr.src_ip, hdr.src_policy_id, hdr.src_sg_id_l, words_,
+                    src);
+        dst_.Lookup(hdr.dst_ip, hdr.dst_policy_id, hdr.dst_sg_id_l, words_,
+                    dst);
+        const uint64_t *protocol = protocol_.Row(hdr.protocol);
+        const uint64_t *src_port = src_port_.Row(hdr.src_port);
+        const uint64_t *dst_port = dst_port_.Row(hdr.dst_port);
+
+        for (size_t word = 0; word < words_; word++) {
+            uint64_t bits = src[word] & dst[word] & protocol[word] &
+                src_port[word] & dst_port[word];
+            while (bits) {
+                size_t bit = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                const AclEntry *entry = entries_[word * 64 + bit];
+                bool cont;
+                if (verify_[word] & (1ULL << bit)) {
+                    cont = visitor(entry, entry->PacketMatch(hdr));
+                } else {
+                    cont = visitor(entry, entry->Actions());
+                }
+                if (!cont) {
+                    return;
+                }
+            }
+        }
+    }
+
+private:
+    // Bit vectors over the elementary intervals of one field
+    class FieldIndex {
+    public:
+        FieldIndex() : words_(0) { }
+
+        void Build(const std::vector<const AclMatchFields::Field *> &fields,
+                   size_t words);
+        void Clear();
+        const uint64_t *Row(uint32_t value) const;
+
+    private:
+        std::vector<uint32_t> starts_;
+        std::vector<uint64_t> bits_;
+        size_t words_;
+
+        DISALLOW_COPY_AND_ASSIGN(FieldIndex);
+    };
+
+    // Bit vectors of the source or destination address
+    class AddressIndex {
+    public:
+        AddressIndex() : has_network_(false), has_sg_(false) { }
+
+        void Build(const std::vector<const AclMatchFields::Address *> &addrs,
+                   size_t words, std::vector<uint64_t> *verify);
+        void Clear();
+        void Lookup(uint32_t ip, const std::string *network,
+                    const SecurityGroupList *sg_l, size_t words,
+                    uint64_t *bits) const;
+
+    private:
+        typedef boost::unordered_map<std::string, std::vector<uint64_t> >
+            NetworkMap;
+        typedef std::map<int, std::vector<uint64_t> > SgMap;
+
+        // IP address entries and entries that do not match the address
+        FieldIndex ip_;
+        NetworkMap network_;
+        SgMap sg_;
+        std::vector<uint64_t> sg_any_;
+        bool has_network_;
+        bool has_sg_;
+
+        DISALLOW_COPY_AND_ASSIGN(AddressIndex);
+    };
+
+    bool built_;
+    size_t words_;
+    EntryList entries_;
+    // Entries matched by AclEntry::PacketMatch() once the bits hit
+    std::vector<uint64_t> verify_;
+    AddressIndex src_;
+    AddressIndex dst_;
+    FieldIndex protocol_;
+    FieldIndex src_port_;
+    FieldIndex dst_port_;
+
+    DISALLOW_COPY_AND_ASSIGN(AclClassifier);
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <vector>
 #include "vnsw/agent/filter/acl_entry.h"
 #include "vnsw/agent/filter/acl_entry_spec.h"
+#include "vnsw/agent/filter/acl_classifier.h"
 #include "vnsw/agent/filter/packet_header.h"
 #include "vnsw/agent/oper/mirror_table.h"
 #include "base/logging.h"
@@ -141,6 +142,14 @@ const AclEntry::ActionList &AclEntry::PacketMatch(const PacketHeader &packet_hea
     return Actions();
 }
 
+void AclEntry::GetMatchFields(AclMatchFields *fields) const
+{
+    std::vector<AclEntryMatch *>::const_iterator it;
+    for (it = matches_.begin(); it != matches_.end(); it++) {
+        (*it)->Compile(fields);
+    }
+}
+
 void AclEntry::SetAclEntrySandeshData(AclEntrySandeshData &data) const {
 
     // Set match data
@@ -168,6 +177,45 @@ void AclEntry::SetAclEntrySandeshData(AclEntrySandeshData &data) const {
     data.ace_id = integerToString(id_);
 }
 
+static bool ActionIsEqual(TrafficAction *lhs, TrafficAction *rhs)
+{
+    if (lhs->GetActionType() != rhs->GetActionType() ||
+        lhs->GetAction() != rhs->GetAction()) {
+        return false;
+    }
+    if (lhs->GetActionType() != TrafficAction::MIRROR_ACTION) {
+        return true;
+    }
+    MirrorAction *lma = static_cast<MirrorAction *>(lhs);
+    MirrorAction *rma = static_cast<MirrorAction *>(rhs);
+    return lma->GetAnalyzerName() == rma->GetAnalyzerName() &&
+        lma->GetVrfName() == rma->GetVrfName() &&
+        lma->GetIp() == rma->GetIp() &&
+        lma->GetPort() == rma->GetPort() &&
+        lma->GetEncap() == rma->GetEncap();
+}
+
+bool AclEntry::IsEqual(const AclEntry &rhs) const
+{
+    if (id_ != rhs.id_ || type_ != rhs.type_ ||
+        actions_.size() != rhs.actions_.size()) {
+        return false;
+    }
+
+    ActionList::const_iterator it, rhs_it;
+    for (it = actions_.begin(), rhs_it = rhs.actions_.begin();
+         it != actions_.end(); ++it, ++rhs_it) {
+        if (!ActionIsEqual(*it, *rhs_it)) {
+            return false;
+        }
+    }
+
+    AclMatchFields fields, rhs_fields;
+    GetMatchFields(&fields);
+    rhs.GetMatchFields(&rhs_fields);
+    return fields == rhs_fields;
+}
+
 bool AclEntry::IsTerminal() const
 {
     if (type_ == TERMINAL) {
@@ -284,6 +332,44 @@ bool AddressMatch::Match(const PacketHeader *pheader) const
     return false;
 }
 
+void AddressMatch::Compile(AclMatchFields *fields) const
+{
+    AclMatchFields::Address *addr = src_ ? &fields->src : &fields->dst;
+    addr->type = addr_type_;
+    if (policy_id_s_.compare("any") == 0) {
+        addr->any = true;
+        return;
+    }
+
+    if (addr_type_ == IP_ADDR) {
+        if (!ip_addr_.is_v4()) {
+            addr->never = true;
+            return;
+        }
+        uint32_t ip = ip_addr_.to_v4().to_ulong();
+        uint32_t mask = ip_mask_.to_v4().to_ulong();
+        uint32_t host = ~mask;
+        addr->ip = ip;
+        addr->mask = mask;
+        if (host & (host + 1)) {
+            // Not a prefix
+            addr->verify = true;
+        } else if (ip & host) {
+            // Bits of the address outside the mask never match
+            addr->never = true;
+        } else {
+            addr->ip_min = ip;
+            addr->ip_max = ip | host;
+        }
+    } else if (addr_type_ == NETWORK_ID) {
+        addr->network = policy_id_s_;
+    } else if (addr_type_ == SG) {
+        addr->sg_id = sg_id_;
+    } else {
+        addr->never = true;
+    }
+}
+
 void AddressMatch::SetAclEntryMatchSandeshData(AclEntrySandeshData &data)
 {
 
@@ -331,6 +417,16 @@ bool ProtocolMatch::Match(const PacketHeader *packet_header) const
     return false;
 }
 
+void ProtocolMatch::Compile(AclMatchFields *fields) const
+{
+    fields->protocol.match = true;
+    for (RangeSList::const_iterator it = protocol_ranges_.begin(); 
+         it != protocol_ranges_.end(); it++) {
+        fields->protocol.ranges.push_back(std::make_pair((*it).min,
+                                                         (*it).max));
+    }
+}
+
 void ProtocolMatch::SetAclEntryMatchSandeshData(AclEntrySandeshData &data)
 {
     for (RangeSList::const_iterator it = protocol_ranges_.begin(); 
@@ -349,6 +445,16 @@ void PortMatch::SetPortRange(const uint16_t min_port, const uint16_t max_port)
     port_ranges_.push_back(*port_range);
 }
 
+void PortMatch::CompileRanges(bool src, AclMatchFields *fields) const
+{
+    AclMatchFields::Field *field = src ? &fields->src_port : &fields->dst_port;
+    field->match = true;
+    for (RangeSList::const_iterator it = port_ranges_.begin(); 
+         it != port_ranges_.end(); it++) {
+        field->ranges.push_back(std::make_pair((*it).min, (*it).max));
+    }
+}
+
 bool SrcPortMatch::Match(const PacketHeader *packet_header) const
 {
     for (RangeSList::const_iterator it = port_ranges_.begin(); 
@@ -375,6 +481,11 @@ void SrcPortMatch::SetAclEntryMatchSandeshData(AclEntrySandeshData &data)
 }
 
 
+void SrcPortMatch::Compile(AclMatchFields *fields) const
+{
+    CompileRanges(true, fields);
+}
+
 bool DstPortMatch::Match(const PacketHeader *packet_header) const
 {
     for (RangeSList::const_iterator it = port_ranges_.begin(); 
@@ -399,3 +510,8 @@ void DstPortMatch::SetAclEntryMatchSandeshData(AclEntrySandeshData &data)
         data.dst_port_l.push_back(port);
     }
 }
+
+void DstPortMatch::Compile(AclMatchFields *fields) const
+{
+    CompileRanges(false, fields);
+}
@@ -5,6 +5,7 @@
 #ifndef __AGENT_ACL_ENTRY_H__
 #define __AGENT_ACL_ENTRY_H__
 
+#include <set>
 #include <boost/ptr_container/ptr_list.hpp>
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/slist.hpp>
@@ -17,13 +18,17 @@
 
 struct PacketHeader;
 struct AclEntrySpec;
+struct AclMatchFields;
 typedef std::vector<int32_t> AclEntryIDList;
+typedef std::set<int32_t> AclEntryIDSet;
 
 class AclEntryMatch {
 public:
     virtual ~AclEntryMatch() { };
     virtual bool Match(const PacketHeader *packet_header) const = 0;
     virtual void SetAclEntryMatchSandeshData(AclEntrySandeshData &data) = 0;
+    // Fill in the fields matched, for the AclClassifier
+    virtual void Compile(AclMatchFields *fields) const = 0;
 };
 
 struct Range {
@@ -56,7 +61,9 @@ public:
     void SetPortRange(const uint16_t min_port, const uint16_t max_port);
     void SetAclEntryMatchSandeshData(AclEntrySandeshData &data) = 0;
     virtual bool Match(const PacketHeader *packet_header) const = 0;
+    virtual void Compile(AclMatchFields *fields) const = 0;
 protected:
+    void CompileRanges(bool src, AclMatchFields *fields) const;
     RangeSList port_ranges_;
 };
 
@@ -64,11 +71,13 @@ class SrcPortMatch : public PortMatch {
 public:
     bool Match(const PacketHeader *packet_header) const;
     void SetAclEntryMatchSandeshData(AclEntrySandeshData &data);
+    void Compile(AclMatchFields *fields) const;
 };
 class DstPortMatch : public PortMatch {
 public:
     bool Match(const PacketHeader *packet_header) const;
     void SetAclEntryMatchSandeshData(AclEntrySandeshData &data);
+    void Compile(AclMatchFields *fields) const;
 };
 
 class ProtocolMatch : public AclEntryMatch {
@@ -78,6 +87,7 @@ public:
     void SetProtocolRange(const uint16_t min, const uint16_t max);
     bool Match(const PacketHeader *packet_header) const;
     void SetAclEntryMatchSandeshData(AclEntrySandeshData &data);
+    void Compile(AclMatchFields *fields) const;
 private:
     RangeSList protocol_ranges_;
 };
@@ -109,6 +119,7 @@ public:
     // Match packet header for address
     bool Match(const PacketHeader *packet_header) const;
     void SetAclEntryMatchSandeshData(AclEntrySandeshData &data);
+    void Compile(AclMatchFields *fields) const;
 private:
     AddressType addr_type_;
     bool src_;
@@ -137,10 +148,12 @@ public:
     typedef std::list<TrafficAction *> ActionList;
     static ActionList kEmptyActionList;
     AclEntry() : 
-        id_(0), type_(TERMINAL), matches_(), actions_(), mirror_entry_(NULL) {};
+        id_(0), type_(TERMINAL), matches_(), actions_(), mirror_entry_(NULL),
+        revision_(0) {};
 
     AclEntry(AclType type) :
-        id_(0), type_(type), matches_(), actions_(), mirror_entry_(NULL) {};
+        id_(0), type_(type), matches_(), actions_(), mirror_entry_(NULL),
+        revision_(0) {};
 
     ~AclEntry();
     
@@ -152,6 +165,8 @@ public:
     // Match packet header
     const ActionList &PacketMatch(const PacketHeader &packet_header) const;
     const ActionList &Actions() const {return actions_;};
+    // Fields matched by the entry, for the AclClassifier
+    void GetMatchFields(AclMatchFields *fields) const;
 
     void SetAclEntrySandeshData(AclEntrySandeshData &data) const;
 
@@ -159,6 +174,12 @@ public:
 
     uint32_t id() const { return id_; }
 
+    // Same matches, actions and type
+    bool IsEqual(const AclEntry &rhs) const;
+    // Changes when the entry of the id changes in the ACL
+    uint32_t revision() const { return revision_; }
+    void set_revision(uint32_t revision) { revision_ = revision; }
+
     boost::intrusive::list_member_hook<> acl_list_node;
 
 private:
@@ -167,6 +188,7 @@ private:
     std::vector<AclEntryMatch *> matches_;
     ActionList actions_;
     MirrorEntryRef mirror_entry_;
+    uint32_t revision_;
 
     DISALLOW_COPY_AND_ASSIGN(AclEntry);
 };
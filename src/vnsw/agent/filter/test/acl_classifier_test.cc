@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+
+#include "vnsw/agent/filter/acl_classifier.h"
+#include "vnsw/agent/filter/acl_entry.h"
+#include "vnsw/agent/filter/acl_entry_spec.h"
+#include "vnsw/agent/filter/packet_header.h"
+#include "vnsw/agent/filter/traffic_action.h"
+
+#include "net/address.h"
+
+using namespace std;
+
+void RouterIdDepInit() {
+}
+
+namespace {
+
+static const char *kNetworks[] = { "vn1", "vn2", "vn3", "any" };
+static const int kSgIds[] = { 1, 2, 3, AddressMatch::kAny };
+
+static RangeSpec MakeRange(uint16_t min, uint16_t max) {
+    RangeSpec range;
+    range.min = min;
+    range.max = max;
+    return range;
+}
+
+static void RandomAddress(AddressMatch::AddressType *type, IpAddress *ip,
+                          IpAddress *mask, string *network, int *sg_id) {
+    switch (random() % 6) {
+    case 0:
+        *type = AddressMatch::UNKNOWN_TYPE;
+        break;
+    case 1:
+    case 2: {
+        *type = AddressMatch::IP_ADDR;
+        int plen = 16 + random() % 17;
+        uint32_t m = plen ? ~((1ULL << (32 - plen)) - 1) : 0;
+        uint32_t addr = 0x0a000000 | (random() & 0xffff);
+        if (random() % 16 == 0) {
+            // Mask that is not a prefix
+            m = 0xff00ff00;
+        } else if (random() % 16 != 0) {
+            // Leave some addresses with bits outside of the mask
+            addr &= m;
+        }
+        *ip = IpAddress(Ip4Address(addr));
+        *mask = IpAddress(Ip4Address(m));
+        break;
+    }
+    case 3:
+    case 4:
+        *type = AddressMatch::NETWORK_ID;
+        *network = kNetworks[random() % 4];
+        break;
+    default:
+        *type = AddressMatch::SG;
+        *sg_id = kSgIds[random() % 4];
+        break;
+    }
+}
+
+static void RandomRanges(vector<RangeSpec> *ranges, uint16_t max) {
+    int count = random() % 3;
+    for (int i = 0; i < count; i++) {
+        uint16_t lo = random() % max;
+        uint16_t hi = lo + random() % 64;
+        if (random() % 16 == 0) {
+            // Empty range
+            ranges->push_back(MakeRange(hi + 1, lo));
+        } else {
+            ranges->push_back(MakeRange(lo, hi));
+        }
+    }
+}
+
+static AclEntry *RandomEntry(uint32_t id) {
+    AclEntrySpec spec;
+    spec.id = id;
+    RandomAddress(&spec.src_addr_type, &spec.src_ip_addr, &spec.src_ip_mask,
+                  &spec.src_policy_id_str, &spec.src_sg_id);
+    RandomAddress(&spec.dst_addr_type, &spec.dst_ip_addr, &spec.dst_ip_mask,
+                  &spec.dst_policy_id_str, &spec.dst_sg_id);
+    RandomRanges(&spec.protocol, 20);
+    RandomRanges(&spec.src_port, 1024);
+    RandomRanges(&spec.dst_port, 1024);
+    spec.terminal = (random() % 8 == 0);
+
+    int action_count = random() % 8 ? 1 : 0;
+    for (int i = 0; i < action_count; i++) {
+        ActionSpec action;
+        action.ta_type = TrafficAction::SIMPLE_ACTION;
+        action.simple_action = (random() % 2) ? TrafficAction::PASS :
+            TrafficAction::DENY;
+        spec.action_l.push_back(action);
+    }
+
+    AclEntry *entry = new AclEntry();
+    entry->PopulateAclEntry(spec);
+    return entry;
+}
+
+// Entries that matched, in order, up to the first terminal entry, as
+// AclDBEntry::PacketMatch() adds up their actions.
+class MatchRecorder {
+public:
+    bool operator()(const AclEntry *entry, const AclEntry::ActionList &al) {
+        if (al.empty()) {
+            return true;
+        }
+        ids.push_back(entry->id());
+        return !entry->IsTerminal();
+    }
+
+    vector<uint32_t> ids;
+};
+
+static void LinearMatch(const vector<const AclEntry *> &entries,
+                        const PacketHeader &hdr, MatchRecorder *recorder) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!(*recorder)(entries[i], entries[i]->PacketMatch(hdr))) {
+            break;
+        }
+    }
+}
+
+class AclClassifierTest : public ::testing::Test {
+protected:
+    virtual void TearDown() {
+        for (size_t i = 0; i < entries_.size(); i++) {
+            delete entries_[i];
+        }
+        entries_.clear();
+    }
+
+    void AddEntries(int count) {
+        for (int i = 0; i < count; i++) {
+            entries_.push_back(RandomEntry(entries_.size() + 1));
+        }
+    }
+
+    void RandomPacket(PacketHeader *hdr) {
+        hdr->src_ip = 0x0a000000 | (random() & 0xffff);
+        hdr->dst_ip = 0x0a000000 | (random() & 0xffff);
+        hdr->protocol = random() % 24;
+        hdr->src_port = random() % 1100;
+        hdr->dst_port = random() % 1100;
+        hdr->src_policy_id = &networks_[random() % networks_.size()];
+        hdr->dst_policy_id = &networks_[random() % networks_.size()];
+        hdr->src_sg_id_l = &sg_lists_[random() % sg_lists_.size()];
+        hdr->dst_sg_id_l = &sg_lists_[random() % sg_lists_.size()];
+    }
+
+    void Compare(int packet_count) {
+        AclClassifier classifier;
+        classifier.Build(entries_);
+        EXPECT_TRUE(classifier.built());
+        EXPECT_EQ(entries_.size(), classifier.size());
+
+        for (int i = 0; i < packet_count; i++) {
+            PacketHeader hdr;
+            RandomPacket(&hdr);
+            MatchRecorder expected, result;
+            LinearMatch(entries_, hdr, &expected);
+            classifier.Match(hdr, result);
+            EXPECT_TRUE(expected.ids == result.ids);
+        }
+    }
+
+    virtual void SetUp() {
+        networks_.push_back("vn1");
+        networks_.push_back("vn2");
+        networks_.push_back("vn4");
+        sg_lists_.resize(4);
+        sg_lists_[1].push_back(1);
+        sg_lists_[2].push_back(2);
+        sg_lists_[2].push_back(3);
+        sg_lists_[3].push_back(4);
+    }
+
+    vector<const AclEntry *> entries_;
+    vector<string> networks_;
+    vector<SecurityGroupList> sg_lists_;
+};
+
+TEST_F(AclClassifierTest, Empty) {
+    AclClassifier classifier;
+    EXPECT_FALSE(classifier.built());
+    classifier.Build(entries_);
+    EXPECT_TRUE(classifier.built());
+
+    PacketHeader hdr;
+    MatchRecorder result;
+    classifier.Match(hdr, result);
+    EXPECT_EQ(0U, result.ids.size());
+
+    classifier.Clear();
+    EXPECT_FALSE(classifier.built());
+}
+
+TEST_F(AclClassifierTest, Basic) {
+    AclEntrySpec spec;
+    spec.id = 1;
+    spec.src_addr_type = AddressMatch::IP_ADDR;
+    spec.src_ip_addr = IpAddress::from_string("1.1.1.0");
+    spec.src_ip_mask = IpAddress::from_string("255.255.255.0");
+    spec.protocol.push_back(MakeRange(6, 6));
+    spec.dst_port.push_back(MakeRange(10, 100));
+    spec.terminal = false;
+    ActionSpec action;
+    action.ta_type = TrafficAction::SIMPLE_ACTION;
+    action.simple_action = TrafficAction::PASS;
+    spec.action_l.push_back(action);
+    AclEntry *entry = new AclEntry();
+    entry->PopulateAclEntry(spec);
+    entries_.push_back(entry);
+
+    AclEntrySpec spec2;
+    spec2.id = 2;
+    spec2.dst_addr_type = AddressMatch::NETWORK_ID;
+    spec2.dst_policy_id_str = "vn2";
+    spec2.action_l.push_back(action);
+    entry = new AclEntry();
+    entry->PopulateAclEntry(spec2);
+    entries_.push_back(entry);
+
+    AclClassifier classifier;
+    classifier.Build(entries_);
+
+    string vn2("vn2");
+    PacketHeader hdr;
+    hdr.src_ip = 0x01010105;
+    hdr.protocol = 6;
+    hdr.dst_port = 80;
+    hdr.dst_policy_id = &vn2;
+    MatchRecorder result;
+    classifier.Match(hdr, result);
+    ASSERT_EQ(2U, result.ids.size());
+    EXPECT_EQ(1U, result.ids[0]);
+    EXPECT_EQ(2U, result.ids[1]);
+
+    hdr.dst_port = 101;
+    result.ids.clear();
+    classifier.Match(hdr, result);
+    ASSERT_EQ(1U, result.ids.size());
+    EXPECT_EQ(2U, result.ids[0]);
+
+    hdr.dst_port = 80;
+    hdr.src_ip = 0x01010205;
+    hdr.dst_policy_id = NULL;
+    result.ids.clear();
+    classifier.Match(hdr, result);
+    EXPECT_EQ(0U, result.ids.size());
+}
+
+// Same entries matched as the matches of each entry run in turn
+TEST_F(AclClassifierTest, Equivalence) {
+    AddEntries(10);
+    Compare(5000);
+}
+
+// More than 64 entries, and more than fit in the words on the stack
+TEST_F(AclClassifierTest, EquivalenceLarge) {
+    AddEntries(100);
+    Compare(5000);
+    TearDown();
+    AddEntries(64 * AclClassifier::kStackWords + 10);
+    Compare(2000);
+}
+
+// Entries are only seen after the classifier is built again
+TEST_F(AclClassifierTest, Rebuild) {
+    AddEntries(50);
+    Compare(1000);
+    delete entries_[10];
+    entries_.erase(entries_.begin() + 10);
+    AddEntries(20);
+    Compare(1000);
+}
+
+//
+// Lookups per second of the entries run in turn and of the classifier, for
+// ACLs of more and more entries. ACL_LOOKUP_COUNT and ACL_MAX_ENTRIES
+// override the defaults.
+//
+static uint64_t Rate(uint64_t count, uint64_t usec) {
+    return count * 1000000 / std::max(usec, (uint64_t) 1);
+}
+
+TEST_F(AclClassifierTest, LookupRate) {
+    int lookup_count = GetEnvInt("ACL_LOOKUP_COUNT", 100000);
+    int max_entries = GetEnvInt("ACL_MAX_ENTRIES", 1024);
+
+    vector<PacketHeader> packets(lookup_count);
+    for (int i = 0; i < lookup_count; i++) {
+        RandomPacket(&packets[i]);
+    }
+
+    for (int count = 16; count <= max_entries; count *= 4) {
+        TearDown();
+        AddEntries(count);
+
+        uint64_t start = UTCTimestampUsec();
+        AclClassifier classifier;
+        classifier.Build(entries_);
+        uint64_t build_usec = UTCTimestampUsec() - start;
+
+        size_t linear_hits = 0;
+        start = UTCTimestampUsec();
+        for (int i = 0; i < lookup_count; i++) {
+            MatchRecorder recorder;
+            LinearMatch(entries_, packets[i], &recorder);
+            linear_hits += recorder.ids.size();
+        }
+        uint64_t linear_usec = UTCTimestampUsec() - start;
+
+        size_t classifier_hits = 0;
+        start = UTCTimestampUsec();
+        for (int i = 0; i < lookup_count; i++) {
+            MatchRecorder recorder;
+            classifier.Match(packets[i], recorder);
+            classifier_hits += recorder.ids.size();
+        }
+        uint64_t classifier_usec = UTCTimestampUsec() - start;
+        EXPECT_EQ(linear_hits, classifier_hits);
+
+        LOG(DEBUG, count << " entries: build " << build_usec << " usec, " <<
+            "linear " << Rate(lookup_count, linear_usec) << " lookups/sec, " <<
+            "classifier " << Rate(lookup_count, classifier_usec) <<
+            " lookups/sec");
+    }
+}
+
+} // namespace
+
+int main (int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
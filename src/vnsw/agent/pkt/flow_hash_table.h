@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef __AGENT_FLOW_HASH_TABLE_H__
+#define __AGENT_FLOW_HASH_TABLE_H__
+
+#include <stdint.h>
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+#include <base/util.h>
+
+//
+// Open addressed hash table with linear probing, used to hold the flows.
+//
+// The entries are stored in one array of slots, so a lookup touches one or
+// two cache lines instead of walking the nodes of a tree. The interface is
+// the subset of std::map used by the flow table and its walkers.
+//
+// The slots are kept in the order of the hash of their keys, and of the
+// keys for equal hashes: the home slot of a key is given by the top bits of
+// its hash, and an insert shifts the entries after it in its cluster to
+// keep the order. The order of the walk is the order of the hashes, and not
+// the order of the keys, and it does not depend on the size of the table.
+//
+// An erased entry leaves a tombstone that keeps its key, so that iterators
+// stay valid across erase and a walker can delete the entry it is on, as
+// with std::map.
+//
+// upper_bound() of a key resumes a walk right after the key, whether or not
+// the key is still in the table and whether or not the table was resized
+// since, so a walk done a few entries at a time sees each entry that is in
+// the table for all of the walk once. Iterators are invalidated by insert.
+//
+template <typename Key, typename Value, typename Hash, typename Equal,
+          typename Compare>
+class FlowHashTable {
+public:
+    typedef std::pair<Key, Value> value_type;
+    static const size_t kMinSlots = 1024;
+
+    class iterator {
+    public:
+        iterator() : table_(NULL), index_(0) { }
+
+        value_type &operator*() const { return table_->slots_[index_].value; }
+        value_type *operator->() const {
+            return &table_->slots_[index_].value;
+        }
+        iterator &operator++() {
+            index_ = table_->NextUsed(index_ + 1);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator it = *this;
+            ++(*this);
+            return it;
+        }
+        bool operator==(const iterator &rhs) const {
+            return index_ == rhs.index_;
+        }
+        bool operator!=(const iterator &rhs) const {
+            return index_ != rhs.index_;
+        }
+
+    private:
+        friend class FlowHashTable;
+        iterator(FlowHashTable *table, size_t index)
+            : table_(table), index_(index) { }
+
+        FlowHashTable *table_;
+        size_t index_;
+    };
+
+    FlowHashTable() : home_count_(0), shift_(0), used_(0), deleted_(0) { }
+
+    size_t size() const { return used_; }
+    bool empty() const { return used_ == 0; }
+    size_t bucket_count() const { return home_count_; }
+
+    iterator begin() { return iterator(this, NextUsed(0)); }
+    iterator end() { return iterator(this, slots_.size()); }
+
+    iterator find(const Key &key) {
+        size_t index;
+        if (Position(key, HashOf(key), &index) &&
+            slots_[index].state == kUsed) {
+            return iterator(this, index);
+        }
+        return end();
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        uint32_t hash = HashOf(value.first);
+        size_t index;
+        if (Position(value.first, hash, &index)) {
+            Slot &slot = slots_[index];
+            if (slot.state == kUsed) {
+                return std::make_pair(iterator(this, index), false);
+            }
+            // The tombstone of the key is in its place in the order
+            slot.state = kUsed;
+            slot.value.second = value.second;
+            deleted_--;
+            used_++;
+            return std::make_pair(iterator(this, index), true);
+        }
+
+        if ((used_ + deleted_ + 1) * 4 > home_count_ * 3) {
+            Resize();
+            Position(value.first, hash, &index);
+        }
+        MakeRoom(index);
+        Slot &slot = slots_[index];
+        slot.value = value;
+        slot.hash = hash;
+        slot.state = kUsed;
+        used_++;
+        return std::make_pair(iterator(this, index), true);
+    }
+
+    void erase(iterator it) {
+        Slot &slot = slots_[it.index_];
+        assert(slot.state == kUsed);
+        slot.value.second = Value();
+        slot.state = kDeleted;
+        used_--;
+        deleted_++;
+    }
+
+    size_t erase(const Key &key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    // First entry after key in the walk.
+    iterator upper_bound(const Key &key) {
+        size_t index;
+        if (Position(key, HashOf(key), &index)) {
+            index++;
+        }
+        return iterator(this, NextUsed(index));
+    }
+
+    void clear() {
+        slots_.clear();
+        home_count_ = 0;
+        shift_ = 0;
+        used_ = 0;
+        deleted_ = 0;
+    }
+
+private:
+    enum SlotState {
+        kEmpty,
+        kUsed,
+        kDeleted
+    };
+
+    struct Slot {
+        Slot() : value(), hash(0), state(kEmpty) { }
+        value_type value;
+        uint32_t hash;
+        uint8_t state;
+    };
+
+    // The home slot is taken from the top bits of the hash, which hashes
+    // built with boost::hash_combine don't spread, so they are mixed first.
+    static uint32_t HashOf(const Key &key) {
+        uint32_t hash = Hash()(key);
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    // Whether the entry or tombstone in slot comes before key in the order.
+    static bool Before(const Slot &slot, const Key &key, uint32_t hash) {
+        if (slot.hash != hash) {
+            return slot.hash < hash;
+        }
+        return Compare()(slot.value.first, key);
+    }
+
+    // Slot of key in the order, starting from its home slot: the slot of
+    // key, used or tombstone, if it has one, else the slot it goes in.
+    // Returns whether key has a slot.
+    bool Position(const Key &key, uint32_t hash, size_t *index) const {
+        if (slots_.empty()) {
+            *index = 0;
+            return false;
+        }
+        size_t i = hash >> shift_;
+        while (i < slots_.size() && slots_[i].state != kEmpty &&
+               Before(slots_[i], key, hash)) {
+            i++;
+        }
+        *index = i;
+        return (i < slots_.size() && slots_[i].state != kEmpty &&
+                slots_[i].hash == hash && Equal()(slots_[i].value.first, key));
+    }
+
+    // Frees slot index for a new entry, by shifting the entries from index
+    // up to the next free slot or tombstone. The table grows past the last
+    // home slot when the last cluster does.
+    void MakeRoom(size_t index) {
+        size_t free = index;
+        while (free < slots_.size() && slots_[free].state == kUsed) {
+            free++;
+        }
+        if (free == slots_.size()) {
+            slots_.push_back(Slot());
+        } else if (slots_[free].state == kDeleted) {
+            deleted_--;
+        }
+        for (size_t i = free; i > index; i--) {
+            slots_[i] = slots_[i - 1];
+        }
+        slots_[index] = Slot();
+    }
+
+    size_t NextUsed(size_t index) const {
+        while (index < slots_.size() && slots_[index].state != kUsed) {
+            index++;
+        }
+        return index;
+    }
+
+    // Grows the table to keep it at most half full, and drops the
+    // tombstones. The entries are placed in the order they are in, so the
+    // order of the walk is kept.
+    void Resize() {
+        size_t count = std::max(home_count_, kMinSlots);
+        while ((used_ + 1) * 2 > count) {
+            count *= 2;
+        }
+        int shift = 32;
+        for (size_t i = count; i > 1; i >>= 1) {
+            shift--;
+        }
+
+        std::vector<Slot> slots(count);
+        slots_.swap(slots);
+        home_count_ = count;
+        shift_ = shift;
+        size_t next = 0;
+        for (size_t idx = 0; idx < slots.size(); idx++) {
+            if (slots[idx].state != kUsed) {
+                continue;
+            }
+            size_t i = std::max(next, (size_t) (slots[idx].hash >> shift_));
+            if (i == slots_.size()) {
+                slots_.push_back(Slot());
+            }
+            slots_[i] = slots[idx];
+            next = i + 1;
+        }
+        deleted_ = 0;
+    }
+
+    std::vector<Slot> slots_;
+    size_t home_count_;
+    int shift_;
+    size_t used_;
+    size_t deleted_;
+
+    DISALLOW_COPY_AND_ASSIGN(FlowHashTable);
+};
+
+template <typename Key, typename Value, typename Hash, typename Equal,
+          typename Compare>
+const size_t FlowHashTable<Key, Value, Hash, Equal, Compare>::kMinSlots;
+
+#endif
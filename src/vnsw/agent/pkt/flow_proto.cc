@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include "pkt/flow_proto.h"
+
+const uint32_t FlowProto::kMaxFlowQueues;
+
+FlowProto::FlowProto(Agent *agent, boost::asio::io_service &io) :
+    Proto(agent, "Agent::FlowHandler", PktHandler::FLOW, io) {
+    agent->SetFlowProto(this);
+
+    TaskScheduler *scheduler = TaskScheduler::GetInstance();
+    int task_id = scheduler->GetTaskId("Agent::FlowHandler");
+    uint32_t count = std::max(1, scheduler->HardwareThreadCount());
+    flow_queue_list_.resize(std::min(count, kMaxFlowQueues));
+    // Task instances of the flow queues. The instance of the Proto queue,
+    // which is not used, is PktHandler::FLOW.
+    int instance = PktHandler::MAX_MODULES;
+    for (size_t i = 0; i < flow_queue_list_.size(); i++, instance++) {
+        flow_queue_list_[i].queue = new FlowWorkQueue(task_id, instance,
+            boost::bind(&FlowProto::FlowEventHandler, this, i, _1));
+    }
+}
+
+FlowProto::~FlowProto() {
+    Shutdown();
+}
+
+void FlowProto::Shutdown() {
+    for (size_t i = 0; i < flow_queue_list_.size(); i++) {
+        if (flow_queue_list_[i].queue == NULL) {
+            continue;
+        }
+        flow_queue_list_[i].queue->Shutdown();
+        delete flow_queue_list_[i].queue;
+        flow_queue_list_[i].queue = NULL;
+    }
+}
+
+// Same for the packets of a flow and of its reverse flow: the addresses and
+// ports are taken in their order and not as source and destination, and the
+// VRF is left out as the reverse flow can be in another VRF. Reverse packets
+// of NAT flows can go to another queue, FlowTable serializes them.
+uint32_t FlowProto::FlowQueueIndex(const PktInfo *msg) const {
+    size_t seed = 0;
+    boost::hash_combine(seed, std::min(msg->ip_saddr, msg->ip_daddr));
+    boost::hash_combine(seed, std::max(msg->ip_saddr, msg->ip_daddr));
+    boost::hash_combine(seed, std::min(msg->sport, msg->dport));
+    boost::hash_combine(seed, std::max(msg->sport, msg->dport));
+    boost::hash_combine(seed, msg->ip_proto);
+    return seed % flow_queue_list_.size();
+}
+
+bool FlowProto::ValidateAndEnqueueMessage(boost::shared_ptr<PktInfo> msg) {
+    if (!Validate(msg.get())) {
+        return true;
+    }
+
+    if (msg->pkt)
+        delete [] msg->pkt;
+    msg->pkt = NULL;
+    msg->eth = NULL;
+    msg->arp = NULL;
+    msg->ip = NULL;
+    msg->transp.tcp = NULL;
+    msg->data = NULL;
+
+    FlowQueue &flow_queue = flow_queue_list_[FlowQueueIndex(msg.get())];
+    bool ret = flow_queue.queue->Enqueue(FlowEvent(msg, UTCTimestampUsec()));
+    flow_queue.max_depth = std::max(flow_queue.max_depth,
+                                    flow_queue.queue->Length());
+    return ret;
+}
+
+bool FlowProto::FlowEventHandler(uint32_t index, FlowEvent event) {
+    FlowQueue &flow_queue = flow_queue_list_[index];
+    uint64_t latency = UTCTimestampUsec() - event.enqueue_time;
+    flow_queue.latency_usec += latency;
+    flow_queue.max_latency_usec = std::max(flow_queue.max_latency_usec,
+                                           latency);
+    return ProcessProto(event.pkt_info);
+}
+
+void FlowProto::GetQueueStats(std::vector<FlowQueueStats> *list) const {
+    for (size_t i = 0; i < flow_queue_list_.size(); i++) {
+        const FlowQueue &flow_queue = flow_queue_list_[i];
+        FlowWorkQueue *queue = flow_queue.queue;
+        FlowQueueStats stats;
+        stats.set_queue(i);
+        stats.set_enqueues(queue->NumEnqueues());
+        stats.set_dequeues(queue->NumDequeues());
+        stats.set_drops(queue->NumDrops());
+        stats.set_depth(queue->Length());
+        stats.set_max_depth(flow_queue.max_depth);
+        uint64_t dequeues = queue->NumDequeues();
+        stats.set_avg_latency_usec(dequeues ?
+                                   flow_queue.latency_usec / dequeues : 0);
+        stats.set_max_latency_usec(flow_queue.max_latency_usec);
+        list->push_back(stats);
+    }
+}
+
+void FlowQueueStatsReq::HandleRequest() const {
+    FlowQueueStatsResp *resp = new FlowQueueStatsResp();
+    std::vector<FlowQueueStats> list;
+    Agent::GetInstance()->GetFlowProto()->GetQueueStats(&list);
+    resp->set_queue_list(list);
+    resp->set_context(context());
+    resp->Response();
+}
@@ -13,15 +13,29 @@
 #include "pkt/flow_table.h"
 #include "pkt/flow_handler.h"
 
+//
+// Flow setup runs on kMaxFlowQueues work queues at most, one per core. Each
+// queue is an instance of the flow handler task, so the queues run in
+// parallel. Packets are steered to a queue by a hash of the flow key that is
+// the same for the flow and its reverse flow.
+//
 class FlowProto : public Proto {
 public:
-    FlowProto(Agent *agent, boost::asio::io_service &io) :
-        Proto(agent, "Agent::FlowHandler", PktHandler::FLOW, io) {
-        agent->SetFlowProto(this);
-    }
-    virtual ~FlowProto() {}
+    static const uint32_t kMaxFlowQueues = 4;
+
+    struct FlowEvent {
+        FlowEvent() : enqueue_time(0) { }
+        FlowEvent(boost::shared_ptr<PktInfo> info, uint64_t time)
+            : pkt_info(info), enqueue_time(time) { }
+        boost::shared_ptr<PktInfo> pkt_info;
+        uint64_t enqueue_time;
+    };
+    typedef WorkQueue<FlowEvent> FlowWorkQueue;
+
+    FlowProto(Agent *agent, boost::asio::io_service &io);
+    virtual ~FlowProto();
     void Init() {}
-    void Shutdown() {}
+    void Shutdown();
 
     FlowHandler *AllocProtoHandler(boost::shared_ptr<PktInfo> info,
                                    boost::asio::io_service &io) {
@@ -42,6 +56,28 @@ public:
     bool RemovePktBuff() {
         return true;
     }
+
+    bool ValidateAndEnqueueMessage(boost::shared_ptr<PktInfo> msg);
+    uint32_t FlowQueueIndex(const PktInfo *msg) const;
+    uint32_t flow_queue_count() const { return flow_queue_list_.size(); }
+    void GetQueueStats(std::vector<FlowQueueStats> *list) const;
+
+private:
+    struct FlowQueue {
+        FlowQueue() : queue(NULL), max_depth(0), latency_usec(0),
+            max_latency_usec(0) { }
+        FlowWorkQueue *queue;
+        // Updated by the packet handler
+        size_t max_depth;
+        // Updated by the flow handler task of the queue
+        uint64_t latency_usec;
+        uint64_t max_latency_usec;
+    };
+
+    bool FlowEventHandler(uint32_t index, FlowEvent event);
+
+    std::vector<FlowQueue> flow_queue_list_;
+    DISALLOW_COPY_AND_ASSIGN(FlowProto);
 };
 
 extern SandeshTraceBufferPtr PktFlowTraceBuf;
@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <bitset>
+#include <tbb/spin_mutex.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <sandesh/sandesh_types.h>
 #include <sandesh/sandesh.h>
@@ -54,6 +55,72 @@
 boost::uuids::random_generator FlowTable::rand_gen_ = boost::uuids::random_generator();
 tbb::atomic<int> FlowEntry::alloc_count_;
 
+//
+// Free list of flow entries. Flows are set up and aged at a high rate, so
+// the memory of aged flows is kept for the next flows instead of going
+// back to malloc, up to kMaxFreeEntries entries. The pool is never
+// destroyed, as flows can be released after the static destructors ran.
+//
+class FlowEntryPool {
+public:
+    static const size_t kMaxFreeEntries = 16 * 1024;
+
+    FlowEntryPool() { }
+
+    void *Allocate() {
+        tbb::spin_mutex::scoped_lock lock(mutex_);
+        if (free_list_.empty()) {
+            lock.release();
+            return ::operator new(sizeof(FlowEntry));
+        }
+        void *ptr = free_list_.back();
+        free_list_.pop_back();
+        return ptr;
+    }
+
+    void Release(void *ptr) {
+        tbb::spin_mutex::scoped_lock lock(mutex_);
+        if (free_list_.size() < kMaxFreeEntries) {
+            free_list_.push_back(ptr);
+            return;
+        }
+        lock.release();
+        ::operator delete(ptr);
+    }
+
+private:
+    tbb::spin_mutex mutex_;
+    std::vector<void *> free_list_;
+
+    DISALLOW_COPY_AND_ASSIGN(FlowEntryPool);
+};
+
+const size_t FlowEntryPool::kMaxFreeEntries;
+const size_t FlowTable::kAclResyncFlowsPerRun;
+
+static FlowEntryPool *FlowPool() {
+    static FlowEntryPool *pool = new FlowEntryPool();
+    return pool;
+}
+
+void *FlowEntry::operator new(size_t size) {
+    if (size != sizeof(FlowEntry)) {
+        return ::operator new(size);
+    }
+    return FlowPool()->Allocate();
+}
+
+void FlowEntry::operator delete(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (size != sizeof(FlowEntry)) {
+        ::operator delete(ptr);
+        return;
+    }
+    FlowPool()->Release(ptr);
+}
+
 inline void intrusive_ptr_add_ref(FlowEntry *fe) {
     fe->refcount_.fetch_and_increment();
 }
@@ -61,6 +128,7 @@ inline void intrusive_ptr_release(FlowEntry *fe) {
     int prev = fe->refcount_.fetch_and_decrement();
     if (prev == 1) {
         FlowTable *table = Agent::GetInstance()->pkt()->flow_table();
+        tbb::recursive_mutex::scoped_lock lock(table->mutex());
         FlowTable::FlowEntryMap::iterator it = table->flow_entry_map_.find(fe->key());
         assert(it != table->flow_entry_map_.end());
         table->flow_entry_map_.erase(it);
@@ -68,6 +136,38 @@ inline void intrusive_ptr_release(FlowEntry *fe) {
     }
 }
 
+// Flow lists of the VN, interface, VM and route dimensions are intrusive
+// lists through the nodes in FlowEntry. A flow is in at most one list of
+// each dimension, and holds a reference while it is linked. The flow records
+// the info whose list it is linked in, and is unlinked from that list, since
+// its VN, interface, VM or route can change while it is linked.
+template <typename List>
+static void LinkFlow(List &list, boost::intrusive::list_member_hook<> &node,
+                     FlowEntry *fe) {
+    assert(!node.is_linked());
+    list.push_back(*fe);
+    intrusive_ptr_add_ref(fe);
+}
+
+// fe can be freed by the time it returns
+template <typename List>
+static void UnlinkFlow(List &list, boost::intrusive::list_member_hook<> &node,
+                       FlowEntry *fe) {
+    assert(node.is_linked());
+    list.erase(list.iterator_to(*fe));
+    intrusive_ptr_release(fe);
+}
+
+// Walks that re-evaluate or delete flows move them across the lists, so
+// they walk a copy of the list that holds a reference to each flow.
+template <typename List>
+static void CopyFlowList(List &list, FlowTable::FlowEntryList *flows) {
+    flows->reserve(list.size());
+    for (typename List::iterator it = list.begin(); it != list.end(); ++it) {
+        flows->push_back(FlowEntryPtr(&(*it)));
+    }
+}
+
 static bool ShouldDrop(uint32_t action) {
     if ((action & TrafficAction::DROP_FLAGS) || (action & TrafficAction::IMPLICIT_DENY_FLAGS))
         return true;
@@ -108,7 +208,9 @@ static void SetAclListAceId(const AclDBEntry *acl, const std::list<MatchAclParam
 
 FlowEntry::FlowEntry() :
     key_(), data_(), stats_(), flow_handle_(kInvalidFlowHandle),
-    deleted_(false), flags_(0) {
+    deleted_(false), flags_(0), vn_flow_info_(NULL), intf_flow_info_(NULL),
+    vm_flow_info_(NULL), src_route_flow_info_(NULL),
+    dst_route_flow_info_(NULL) {
     flow_uuid_ = nil_uuid(); 
     egress_uuid_ = nil_uuid(); 
     refcount_ = 0;
@@ -117,7 +219,9 @@ FlowEntry::FlowEntry() :
 
 FlowEntry::FlowEntry(const FlowKey &k) : 
     key_(k), data_(), stats_(), flow_handle_(kInvalidFlowHandle),
-    deleted_(false), flags_(0) {
+    deleted_(false), flags_(0), vn_flow_info_(NULL), intf_flow_info_(NULL),
+    vm_flow_info_(NULL), src_route_flow_info_(NULL),
+    dst_route_flow_info_(NULL) {
     flow_uuid_ = FlowTable::rand_gen_(); 
     egress_uuid_ = FlowTable::rand_gen_(); 
     refcount_ = 0;
@@ -468,6 +572,7 @@ void FlowEntry::GetPolicyInfo() {
 }
 
 void FlowTable::Add(FlowEntry *flow, FlowEntry *rflow) {
+    tbb::recursive_mutex::scoped_lock lock(mutex_);
     UpdateReverseFlow(flow, rflow);
 
     flow->GetPolicyInfo();
@@ -910,6 +1015,7 @@ void FlowEntry::InitAuditFlow(uint32_t flow_idx) {
 }
 
 FlowEntry *FlowTable::Allocate(const FlowKey &key) {
+    tbb::recursive_mutex::scoped_lock lock(mutex_);
     FlowEntry *flow = new FlowEntry(key);
     std::pair<FlowEntryMap::iterator, bool> ret;
     ret = flow_entry_map_.insert(std::pair<FlowKey, FlowEntry*>(key, flow));
@@ -927,6 +1033,7 @@ FlowEntry *FlowTable::Allocate(const FlowKey &key) {
 }
 
 FlowEntry *FlowTable::Find(const FlowKey &key) {
+    tbb::recursive_mutex::scoped_lock lock(mutex_);
     FlowEntryMap::iterator it;
 
     it = flow_entry_map_.find(key);
@@ -1015,6 +1122,7 @@ bool FlowTable::Delete(FlowEntryMap::iterator &it, bool rev_flow)
 
 bool FlowTable::Delete(const FlowKey &key, bool del_reverse_flow)
 {
+    tbb::recursive_mutex::scoped_lock lock(mutex_);
     FlowEntryMap::iterator it;
     FlowEntry *fe;
 
@@ -1087,6 +1195,9 @@ void FlowTable::Init() {
 
     acl_listener_id_ = Agent::GetInstance()->GetAclTable()->Register
         (boost::bind(&FlowTable::AclNotify, this, _1, _2));
+    acl_resync_trigger_ = new TaskTrigger
+        (boost::bind(&FlowTable::AclResyncRun, this),
+         TaskScheduler::GetInstance()->GetTaskId("db::DBTable"), 0);
 
     intf_listener_id_ = Agent::GetInstance()->GetInterfaceTable()->Register
         (boost::bind(&FlowTable::IntfNotify, this, _1, _2));
@@ -1206,16 +1317,221 @@ void FlowTable::AclNotify(DBTablePartBase *part, DBEntryBase *e)
 {
     // Delete ACL: (could be ignored), VN gets anyway notification of delete ACL.
     // Modify ACL:
-    // Get VN 
-    // Resync with VN network policies
+    // Re-evaluate the flows of the ACL that the changed entries can affect
     AclDBEntry *acl = static_cast<AclDBEntry *>(e);
+    DBState *s = e->GetState(part->parent(), acl_listener_id_);
+    AclFlowHandlerState *state = static_cast<AclFlowHandlerState *>(s);
+
     if (e->IsDeleted()) {
         // VN entry must have got updated and VnNotify will take care of the chnages.
         // no need to do any here.
+        AclFlowResyncTree::iterator it = acl_resync_tree_.find(acl);
+        if (it != acl_resync_tree_.end()) {
+            delete it->second;
+            acl_resync_tree_.erase(it);
+        }
         DeleteAclFlows(acl);
+        if (state) {
+            e->ClearState(part->parent(), acl_listener_id_);
+            delete state;
+        }
+        return;
+    }
+
+    AclDBEntry::AceRevisionMap revisions;
+    acl->GetAceRevisions(&revisions);
+    if (state == NULL) {
+        state = new AclFlowHandlerState();
+        state->revisions_.swap(revisions);
+        e->SetState(part->parent(), acl_listener_id_, state);
+        ScheduleAclResync(acl, AclEntryIDSet(), true);
+        return;
+    }
+
+    // Entries added, deleted or changed since the last notification
+    AclEntryIDSet changed;
+    bool added = false;
+    AclDBEntry::AceRevisionMap::const_iterator it = revisions.begin();
+    AclDBEntry::AceRevisionMap::const_iterator old_it =
+        state->revisions_.begin();
+    while (it != revisions.end() || old_it != state->revisions_.end()) {
+        if (it == revisions.end() ||
+            (old_it != state->revisions_.end() && old_it->first < it->first)) {
+            changed.insert(old_it->first);
+            ++old_it;
+        } else if (old_it == state->revisions_.end() ||
+                   it->first < old_it->first) {
+            changed.insert(it->first);
+            added = true;
+            ++it;
+        } else {
+            if (it->second != old_it->second) {
+                changed.insert(it->first);
+                added = true;
+            }
+            ++it;
+            ++old_it;
+        }
+    }
+    state->revisions_.swap(revisions);
+    if (changed.empty()) {
+        return;
+    }
+
+    // Entries deleted that no flow matched do not change any flow
+    if (!added) {
+        AclFlowTree::iterator acl_it = acl_flow_tree_.find(acl);
+        if (acl_it == acl_flow_tree_.end()) {
+            return;
+        }
+        const AceIdFlowCntMap &cnt_map = acl_it->second->aceid_cnt_map;
+        AclEntryIDSet::const_iterator id_it;
+        for (id_it = changed.begin(); id_it != changed.end(); ++id_it) {
+            AceIdFlowCntMap::const_iterator cnt_it = cnt_map.find(*id_it);
+            if (cnt_it != cnt_map.end() && cnt_it->second > 0) {
+                break;
+            }
+        }
+        if (id_it == changed.end()) {
+            return;
+        }
+    }
+    ScheduleAclResync(acl, changed, false);
+}
+
+// Queues the flows of the ACL to be evaluated again by the ACL resync task,
+// which runs in the DB task and yields after every kAclResyncFlowsPerRun
+// flows. If flows of the ACL are queued already, the walk starts over with
+// the changes added up, as the flows already done may be hit by the new
+// changes.
+void FlowTable::ScheduleAclResync(const AclDBEntry *acl,
+                                  const AclEntryIDSet &changed, bool all)
+{
+    AclFlowTree::iterator acl_it = acl_flow_tree_.find(acl);
+    if (acl_it == acl_flow_tree_.end()) {
+        return;
+    }
+
+    AclFlowResync *resync;
+    AclFlowResyncTree::iterator it = acl_resync_tree_.find(acl);
+    if (it == acl_resync_tree_.end()) {
+        resync = new AclFlowResync();
+        resync->acl = acl;
+        acl_resync_tree_.insert(std::make_pair(acl, resync));
     } else {
-        ResyncAclFlows(acl);
+        resync = it->second;
+    }
+    resync->all |= all;
+    resync->changed.insert(changed.begin(), changed.end());
+    const FlowEntryTree &fet = acl_it->second->fet;
+    resync->flows.assign(fet.begin(), fet.end());
+    resync->next = 0;
+    acl_resync_trigger_->Set();
+}
+
+bool FlowTable::AclResyncRun()
+{
+    size_t count = 0;
+    while (!acl_resync_tree_.empty()) {
+        AclFlowResyncTree::iterator it = acl_resync_tree_.begin();
+        AclFlowResync *resync = it->second;
+        std::vector<const AclEntry *> entries;
+        resync->acl->GetAclEntries(resync->changed, &entries);
+
+        while (resync->next < resync->flows.size()) {
+            if (count++ == kAclResyncFlowsPerRun) {
+                return false;
+            }
+            FlowEntry *fe = resync->flows[resync->next++].get();
+            if (fe->deleted()) {
+                continue;
+            }
+            if (resync->all || AclChangeAffectsFlow(resync->acl.get(),
+                                                    resync->changed, entries,
+                                                    fe)) {
+                ResyncAclFlow(fe);
+            }
+        }
+        delete resync;
+        acl_resync_tree_.erase(it);
     }
+    return true;
+}
+
+static void BuildPacketHeader(FlowEntry *fe, PacketHeader *hdr) {
+    hdr->vrf = fe->key().vrf;
+    hdr->src_ip = fe->key().src.ipv4;
+    hdr->dst_ip = fe->key().dst.ipv4;
+    hdr->protocol = fe->key().protocol;
+    if (hdr->protocol == IPPROTO_UDP || hdr->protocol == IPPROTO_TCP) {
+        hdr->src_port = fe->key().src_port;
+        hdr->dst_port = fe->key().dst_port;
+    } else {
+        hdr->src_port = 0;
+        hdr->dst_port = 0;
+    }
+    hdr->src_policy_id = &(fe->data().source_vn);
+    hdr->dst_policy_id = &(fe->data().dest_vn);
+    hdr->src_sg_id_l = &(fe->data().source_sg_id_l);
+    hdr->dst_sg_id_l = &(fe->data().dest_sg_id_l);
+}
+
+// The match of the ACL changes if the flow matched an entry that changed, or
+// if one of the entries added or changed now matches the flow ahead of the
+// terminal entry that the flow matched.
+static bool AclChangeAffectsMatch(const MatchAclParams &params,
+                                  const AclEntryIDSet &changed,
+                                  const std::vector<const AclEntry *> &entries,
+                                  const PacketHeader &hdr) {
+    AclEntryIDList::const_iterator id_it;
+    for (id_it = params.ace_id_list.begin();
+         id_it != params.ace_id_list.end(); ++id_it) {
+        if (changed.find(*id_it) != changed.end()) {
+            return true;
+        }
+    }
+
+    std::vector<const AclEntry *>::const_iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        if (params.terminal_rule && !params.ace_id_list.empty() &&
+            (*it)->id() > (uint32_t) params.ace_id_list.back()) {
+            break;
+        }
+        if (!(*it)->PacketMatch(hdr).empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool AclChangeAffectsList(const AclDBEntry *acl,
+                                 const std::list<MatchAclParams> &acl_l,
+                                 const AclEntryIDSet &changed,
+                                 const std::vector<const AclEntry *> &entries,
+                                 const PacketHeader &hdr) {
+    std::list<MatchAclParams>::const_iterator it;
+    for (it = acl_l.begin(); it != acl_l.end(); ++it) {
+        if (it->acl.get() == acl &&
+            AclChangeAffectsMatch(*it, changed, entries, hdr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FlowTable::AclChangeAffectsFlow(const AclDBEntry *acl,
+        const AclEntryIDSet &changed,
+        const std::vector<const AclEntry *> &entries, FlowEntry *fe)
+{
+    PacketHeader hdr;
+    BuildPacketHeader(fe, &hdr);
+    const MatchPolicy &m = fe->match_p();
+    return AclChangeAffectsList(acl, m.m_acl_l, changed, entries, hdr) ||
+        AclChangeAffectsList(acl, m.m_sg_acl_l, changed, entries, hdr) ||
+        AclChangeAffectsList(acl, m.m_mirror_acl_l, changed, entries, hdr) ||
+        AclChangeAffectsList(acl, m.m_out_acl_l, changed, entries, hdr) ||
+        AclChangeAffectsList(acl, m.m_out_sg_acl_l, changed, entries, hdr) ||
+        AclChangeAffectsList(acl, m.m_out_mirror_acl_l, changed, entries, hdr);
 }
 
 Inet4RouteUpdate::Inet4RouteUpdate(Inet4UnicastAgentRouteTable *rt_table):
@@ -1385,12 +1701,11 @@ void FlowTable::ResyncVnFlows(const VnEntry *vn) {
         return;
     }
 
-    FlowEntryTree fet = vn_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *fe = (*fet_it).get();
+    FlowEntryList flows;
+    CopyFlowList(vn_it->second->flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        FlowEntry *fe = (*it).get();
         DeleteFlowInfo(fe);
         fe->GetPolicyInfo(vn);
         ResyncAFlow(fe, false);
@@ -1401,28 +1716,16 @@ void FlowTable::ResyncVnFlows(const VnEntry *vn) {
     }
 }
 
-void FlowTable::ResyncAclFlows(const AclDBEntry *acl)
+void FlowTable::ResyncAclFlow(FlowEntry *fe)
 {
-    AclFlowTree::iterator acl_it;
-    acl_it = acl_flow_tree_.find(acl);
-    if (acl_it == acl_flow_tree_.end()) {
-        return;
-    }
-
-    FlowEntryTree fet = acl_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *fe = (*fet_it).get();
-        DeleteFlowInfo(fe);
-        fe->GetPolicyInfo();
-        ResyncAFlow(fe, false);
-        AddFlowInfo(fe);
-        FlowInfo flow_info;
-        fe->FillFlowInfo(flow_info);
-        FLOW_TRACE(Trace, "Evaluate Acl Flows", flow_info);
-    }
+    acl_flow_resync_count_++;
+    DeleteFlowInfo(fe);
+    fe->GetPolicyInfo();
+    ResyncAFlow(fe, false);
+    AddFlowInfo(fe);
+    FlowInfo flow_info;
+    fe->FillFlowInfo(flow_info);
+    FLOW_TRACE(Trace, "Evaluate Acl Flows", flow_info);
 }
 
 void FlowTable::ResyncRpfNH(const RouteFlowKey &key, 
@@ -1432,12 +1735,13 @@ void FlowTable::ResyncRpfNH(const RouteFlowKey &key,
     if (rf_it == route_flow_tree_.end()) {
         return;
     }
-    FlowEntryTree fet = rf_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *flow = (*fet_it).get();
+    // RPF is on the source of the flow, only the flows in the source list
+    // of the route can match
+    FlowEntryList flows;
+    CopyFlowList(rf_it->second->src_flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        FlowEntry *flow = (*it).get();
         if (flow->FlowSrcMatch(key) == false) {
             continue;
         }
@@ -1460,12 +1764,12 @@ void FlowTable::ResyncRouteFlows(RouteFlowKey &key, SecurityGroupList &sg_l)
     if (rf_it == route_flow_tree_.end()) {
         return;
     }
-    FlowEntryTree fet = rf_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *fe = (*fet_it).get();
+    FlowEntryList flows;
+    CopyFlowList(rf_it->second->src_flows, &flows);
+    CopyFlowList(rf_it->second->dst_flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        FlowEntry *fe = (*it).get();
         DeleteFlowInfo(fe);
         fe->GetPolicyInfo();
         if (fe->FlowSrcMatch(key)) {
@@ -1494,12 +1798,11 @@ void FlowTable::ResyncVmPortFlows(const VmInterface *intf) {
         return;
     }
 
-    FlowEntryTree fet = intf_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *fe = (*fet_it).get();
+    FlowEntryList flows;
+    CopyFlowList(intf_it->second->flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        FlowEntry *fe = (*it).get();
         DeleteFlowInfo(fe);
         fe->GetPolicyInfo(intf->vn());
         ResyncAFlow(fe, false);
@@ -1519,13 +1822,12 @@ void FlowTable::DeleteRouteFlows(const RouteFlowKey &key)
         return;
     }
     FLOW_TRACE(ModuleInfo, "Delete Route flows");
-    FlowEntryTree fet = rf_it->second->fet;
-    FlowEntryTree::iterator fet_it, it;
-    it = fet.begin();
-    while (it != fet.end()) {
-        fet_it = it++;
-        FlowEntry *fe = (*fet_it).get();
-        Delete(fe->key(), true);
+    FlowEntryList flows;
+    CopyFlowList(rf_it->second->src_flows, &flows);
+    CopyFlowList(rf_it->second->dst_flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        Delete((*it)->key(), true);
     }
 }
 
@@ -1579,20 +1881,16 @@ void FlowTable::DeleteFlowInfo(FlowEntry *fe)
 
 void FlowTable::DeleteVnFlowInfo(FlowEntry *fe)
 {
-    VnFlowTree::iterator vn_it;
-    if (fe->vn_entry()) {
-        vn_it = vn_flow_tree_.find(fe->vn_entry());
-        if (vn_it != vn_flow_tree_.end()) {
-            VnFlowInfo *vn_flow_info = vn_it->second;
-            int count = vn_flow_info->fet.erase(fe);
-            if (count > 0) {
-                DecrVnFlowCounter(vn_flow_info, fe);
-            }
-            if (vn_flow_info->fet.empty()) {
-                delete vn_flow_info;
-                vn_flow_tree_.erase(vn_it);
-            }
-        }
+    VnFlowInfo *vn_flow_info = fe->vn_flow_info_;
+    if (vn_flow_info == NULL) {
+        return;
+    }
+    fe->vn_flow_info_ = NULL;
+    DecrVnFlowCounter(vn_flow_info, fe);
+    UnlinkFlow(vn_flow_info->flows, fe->vn_node_, fe);
+    if (vn_flow_info->flows.empty()) {
+        vn_flow_tree_.erase(vn_flow_info->vn_entry.get());
+        delete vn_flow_info;
     }
 }
 
@@ -1620,65 +1918,67 @@ void FlowTable::DeleteAclFlowInfo(const AclDBEntry *acl, FlowEntry* flow,
 
 void FlowTable::DeleteIntfFlowInfo(FlowEntry *fe)
 {
-    IntfFlowTree::iterator intf_it;
-    if (fe->intf_entry()) {
-        intf_it = intf_flow_tree_.find(fe->intf_entry());
-        if (intf_it != intf_flow_tree_.end()) {
-            IntfFlowInfo *intf_flow_info = intf_it->second;
-            intf_flow_info->fet.erase(fe);
-            if (intf_flow_info->fet.empty()) {
-                delete intf_flow_info;
-                intf_flow_tree_.erase(intf_it);
-            }
-        }
+    IntfFlowInfo *intf_flow_info = fe->intf_flow_info_;
+    if (intf_flow_info == NULL) {
+        return;
+    }
+    fe->intf_flow_info_ = NULL;
+    UnlinkFlow(intf_flow_info->flows, fe->intf_node_, fe);
+    if (intf_flow_info->flows.empty()) {
+        intf_flow_tree_.erase(intf_flow_info->intf_entry.get());
+        delete intf_flow_info;
     }
 }
 
 void FlowTable::DeleteVmFlowInfo(FlowEntry *fe)
 {
-    VmFlowTree::iterator vm_it;
-    if (fe->vm_entry()) {
-        vm_it = vm_flow_tree_.find(fe->vm_entry());
-        if (vm_it != vm_flow_tree_.end()) {
-            VmFlowInfo *vm_flow_info = vm_it->second;
-            vm_flow_info->fet.erase(fe);
-            if (vm_flow_info->fet.empty()) {
-                delete vm_flow_info;
-                vm_flow_tree_.erase(vm_it);
-            }
-        }
+    VmFlowInfo *vm_flow_info = fe->vm_flow_info_;
+    if (vm_flow_info == NULL) {
+        return;
+    }
+    fe->vm_flow_info_ = NULL;
+    UnlinkFlow(vm_flow_info->flows, fe->vm_node_, fe);
+    if (vm_flow_info->flows.empty()) {
+        vm_flow_tree_.erase(vm_flow_info->vm_entry.get());
+        delete vm_flow_info;
     }
 }
 
+// Both lists are read before unlinking, since fe can be freed by the time
+// the last of them is unlinked
 void FlowTable::DeleteRouteFlowInfo (FlowEntry *fe)
 {
-    RouteFlowTree::iterator rf_it;
-    RouteFlowKey skey(fe->data().flow_source_vrf, fe->key().src.ipv4, 
-                      fe->data().source_plen);
-    rf_it = route_flow_tree_.find(skey);
-    RouteFlowInfo *route_flow_info;
-    if (rf_it != route_flow_tree_.end()) {
-        route_flow_info = rf_it->second;
-        route_flow_info->fet.erase(fe);
-        if (route_flow_info->fet.empty()) {
-            delete route_flow_info;
-            route_flow_tree_.erase(rf_it);
-        }
+    RouteFlowInfo *src_info = fe->src_route_flow_info_;
+    RouteFlowInfo *dst_info = fe->dst_route_flow_info_;
+    fe->src_route_flow_info_ = NULL;
+    fe->dst_route_flow_info_ = NULL;
+    if (src_info) {
+        UnlinkFlow(src_info->src_flows, fe->src_route_node_, fe);
+        DeleteRouteFlowInfoIfEmpty(src_info);
     }
-   
-    RouteFlowKey dkey(fe->data().flow_dest_vrf, fe->key().dst.ipv4,
-                      fe->data().dest_plen);
-    rf_it = route_flow_tree_.find(dkey);
-    if (rf_it != route_flow_tree_.end()) {
-        route_flow_info = rf_it->second;
-        route_flow_info->fet.erase(fe);
-        if (route_flow_info->fet.empty()) {
-            delete route_flow_info;
-            route_flow_tree_.erase(rf_it);
-        }
+    if (dst_info) {
+        UnlinkFlow(dst_info->dst_flows, fe->dst_route_node_, fe);
+        DeleteRouteFlowInfoIfEmpty(dst_info);
     }
 }
 
+void FlowTable::DeleteRouteFlowInfoIfEmpty(RouteFlowInfo *route_flow_info) {
+    if (route_flow_info->empty()) {
+        route_flow_tree_.erase(route_flow_info->key);
+        delete route_flow_info;
+    }
+}
+
+RouteFlowInfo *FlowTable::LocateRouteFlowInfo(const RouteFlowKey &key) {
+    RouteFlowTree::iterator it = route_flow_tree_.find(key);
+    if (it != route_flow_tree_.end()) {
+        return it->second;
+    }
+    RouteFlowInfo *route_flow_info = new RouteFlowInfo(key);
+    route_flow_tree_.insert(RouteFlowPair(key, route_flow_info));
+    return route_flow_info;
+}
+
 void FlowTable::AddFlowInfo(FlowEntry *fe)
 {
     FlowUve::GetInstance()->NewFlow(fe);
@@ -1766,19 +2066,25 @@ void FlowTable::AddIntfFlowInfo (FlowEntry *fe)
     if (!fe->intf_entry()) {
         return;
     }
+    if (fe->intf_flow_info_) {
+        if (fe->intf_flow_info_->intf_entry.get() == fe->intf_entry()) {
+            return;
+        }
+        // The flow moved to another interface
+        DeleteIntfFlowInfo(fe);
+    }
     IntfFlowTree::iterator it;
     it = intf_flow_tree_.find(fe->intf_entry());
     IntfFlowInfo *intf_flow_info;
     if (it == intf_flow_tree_.end()) {
         intf_flow_info = new IntfFlowInfo();
         intf_flow_info->intf_entry = fe->intf_entry();
-        intf_flow_info->fet.insert(fe);
         intf_flow_tree_.insert(IntfFlowPair(fe->intf_entry(), intf_flow_info));
     } else {
         intf_flow_info = it->second;
-        /* fe can already exist. In that case it won't be inserted */
-        intf_flow_info->fet.insert(fe);
     }
+    LinkFlow(intf_flow_info->flows, fe->intf_node_, fe);
+    fe->intf_flow_info_ = intf_flow_info;
 }
 
 void FlowTable::AddVmFlowInfo (FlowEntry *fe)
@@ -1786,19 +2092,25 @@ void FlowTable::AddVmFlowInfo (FlowEntry *fe)
     if (!fe->vm_entry()) {
         return;
     }
+    if (fe->vm_flow_info_) {
+        if (fe->vm_flow_info_->vm_entry.get() == fe->vm_entry()) {
+            return;
+        }
+        // The flow moved to another VM
+        DeleteVmFlowInfo(fe);
+    }
     VmFlowTree::iterator it;
     it = vm_flow_tree_.find(fe->vm_entry());
     VmFlowInfo *vm_flow_info;
     if (it == vm_flow_tree_.end()) {
         vm_flow_info = new VmFlowInfo();
         vm_flow_info->vm_entry = fe->vm_entry();
-        vm_flow_info->fet.insert(fe);
         vm_flow_tree_.insert(VmFlowPair(fe->vm_entry(), vm_flow_info));
     } else {
         vm_flow_info = it->second;
-        /* fe can already exist. In that case it won't be inserted */
-        vm_flow_info->fet.insert(fe);
     }
+    LinkFlow(vm_flow_info->flows, fe->vm_node_, fe);
+    fe->vm_flow_info_ = vm_flow_info;
 }
 
 void FlowTable::IncrVnFlowCounter(VnFlowInfo *vn_flow_info, 
@@ -1834,24 +2146,26 @@ void FlowTable::AddVnFlowInfo (FlowEntry *fe)
     if (!fe->vn_entry()) {
         return;
     }    
+    if (fe->vn_flow_info_) {
+        if (fe->vn_flow_info_->vn_entry.get() == fe->vn_entry()) {
+            return;
+        }
+        // The flow moved to another VN
+        DeleteVnFlowInfo(fe);
+    }
     VnFlowTree::iterator it;
     it = vn_flow_tree_.find(fe->vn_entry());
     VnFlowInfo *vn_flow_info;
     if (it == vn_flow_tree_.end()) {
         vn_flow_info = new VnFlowInfo();
         vn_flow_info->vn_entry = fe->vn_entry();
-        vn_flow_info->fet.insert(fe);
-        IncrVnFlowCounter(vn_flow_info, fe);
         vn_flow_tree_.insert(VnFlowPair(fe->vn_entry(), vn_flow_info));
     } else {
         vn_flow_info = it->second;
-        /* fe can already exist. In that case it won't be inserted */
-        pair<FlowTable::FlowEntryTree::iterator, bool> ret = 
-                                            vn_flow_info->fet.insert(fe);
-        if (ret.second) {
-            IncrVnFlowCounter(vn_flow_info, fe);
-        }
     }
+    LinkFlow(vn_flow_info->flows, fe->vn_node_, fe);
+    fe->vn_flow_info_ = vn_flow_info;
+    IncrVnFlowCounter(vn_flow_info, fe);
 }
 
 void FlowTable::VnFlowCounters(const VnEntry *vn, uint32_t *in_count, 
@@ -1868,55 +2182,46 @@ void FlowTable::VnFlowCounters(const VnEntry *vn, uint32_t *in_count,
     *out_count = vn_flow_info->egress_flow_count;
 }
 
+static bool IsSameRoute(const RouteFlowKey &lhs, const RouteFlowKey &rhs) {
+    RouteFlowKeyCmp cmp;
+    return (!cmp(lhs, rhs) && !cmp(rhs, lhs));
+}
+
 void FlowTable::AddRouteFlowInfo (FlowEntry *fe)
 {
-    RouteFlowTree::iterator it;
-    RouteFlowInfo *route_flow_info;
-    if (fe->data().flow_source_vrf != VrfEntry::kInvalidIndex) {
-        RouteFlowKey skey(fe->data().flow_source_vrf, fe->key().src.ipv4,
-                          fe->data().source_plen);
-        it = route_flow_tree_.find(skey);
-        if (it == route_flow_tree_.end()) {
-            route_flow_info = new RouteFlowInfo();
-            route_flow_info->fet.insert(fe);
-            route_flow_tree_.insert(RouteFlowPair(skey, route_flow_info));
-        } else {
-            route_flow_info = it->second;
-            route_flow_info->fet.insert(fe);
-        }
+    RouteFlowKey skey(fe->data().flow_source_vrf, fe->key().src.ipv4,
+                      fe->data().source_plen);
+    RouteFlowKey dkey(fe->data().flow_dest_vrf, fe->key().dst.ipv4, 
+                      fe->data().dest_plen);
+    bool link_src = (fe->data().flow_source_vrf != VrfEntry::kInvalidIndex);
+    // A flow whose source and destination are on the same route is only
+    // kept in the source list
+    bool link_dst = (fe->data().flow_dest_vrf != VrfEntry::kInvalidIndex &&
+                     (!link_src || !IsSameRoute(skey, dkey)));
+
+    // The flow moved to other routes
+    RouteFlowInfo *src_info = fe->src_route_flow_info_;
+    RouteFlowInfo *dst_info = fe->dst_route_flow_info_;
+    if ((src_info && link_src && !IsSameRoute(src_info->key, skey)) ||
+        (dst_info && link_dst && !IsSameRoute(dst_info->key, dkey))) {
+        DeleteRouteFlowInfo(fe);
     }
 
-    if (fe->data().flow_dest_vrf != VrfEntry::kInvalidIndex) {
-        RouteFlowKey dkey(fe->data().flow_dest_vrf, fe->key().dst.ipv4, 
-                          fe->data().dest_plen);
-        it = route_flow_tree_.find(dkey);
-        if (it == route_flow_tree_.end()) {
-            route_flow_info = new RouteFlowInfo();
-            route_flow_info->fet.insert(fe);
-            route_flow_tree_.insert(RouteFlowPair(dkey, route_flow_info));
-        } else {
-            route_flow_info = it->second;
-            route_flow_info->fet.insert(fe);
-        }
+    if (link_src && fe->src_route_flow_info_ == NULL) {
+        RouteFlowInfo *route_flow_info = LocateRouteFlowInfo(skey);
+        LinkFlow(route_flow_info->src_flows, fe->src_route_node_, fe);
+        fe->src_route_flow_info_ = route_flow_info;
+    }
+    if (link_dst && fe->dst_route_flow_info_ == NULL) {
+        RouteFlowInfo *route_flow_info = LocateRouteFlowInfo(dkey);
+        LinkFlow(route_flow_info->dst_flows, fe->dst_route_node_, fe);
+        fe->dst_route_flow_info_ = route_flow_info;
     }
 }
 
 void FlowTable::ResyncAFlow(FlowEntry *fe, bool create) {
     PacketHeader hdr;
-    hdr.vrf = fe->key().vrf; hdr.src_ip = fe->key().src.ipv4;
-    hdr.dst_ip = fe->key().dst.ipv4;
-    hdr.protocol = fe->key().protocol;
-    if (hdr.protocol == IPPROTO_UDP || hdr.protocol == IPPROTO_TCP) {
-        hdr.src_port = fe->key().src_port;
-        hdr.dst_port = fe->key().dst_port;
-    } else {
-        hdr.src_port = 0;
-        hdr.dst_port = 0;
-    }
-    hdr.src_policy_id = &(fe->data().source_vn);
-    hdr.dst_policy_id = &(fe->data().dest_vn);
-    hdr.src_sg_id_l = &(fe->data().source_sg_id_l);
-    hdr.dst_sg_id_l = &(fe->data().dest_sg_id_l);
+    BuildPacketHeader(fe, &hdr);
 
     fe->DoPolicy(hdr, fe->is_flags_set(FlowEntry::IngressDir));
     fe->CompareAndModify(create);
@@ -1950,10 +2255,11 @@ void FlowTable::DeleteVnFlows(const VnEntry *vn)
         return;
     }
     FLOW_TRACE(ModuleInfo, "Delete Vn Flows");
-    FlowEntryTree fet = vn_it->second->fet;
-    FlowEntryTree::iterator fet_it;
-    for (fet_it = fet.begin(); fet_it != fet.end(); ++fet_it) {
-        Delete((*fet_it)->key(), true);
+    FlowEntryList flows;
+    CopyFlowList(vn_it->second->flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        Delete((*it)->key(), true);
     }
 }
 
@@ -1965,10 +2271,11 @@ void FlowTable::DeleteVmFlows(const VmEntry *vm)
         return;
     }
     FLOW_TRACE(ModuleInfo, "Delete VM flows");
-    FlowEntryTree fet = vm_it->second->fet;
-    FlowEntryTree::iterator fet_it;
-    for (fet_it = fet.begin(); fet_it != fet.end(); ++fet_it) {
-        Delete((*fet_it)->key(), true);
+    FlowEntryList flows;
+    CopyFlowList(vm_it->second->flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        Delete((*it)->key(), true);
     }
 }
 
@@ -1980,10 +2287,11 @@ void FlowTable::DeleteVmIntfFlows(const Interface *intf)
         return;
     }
     FLOW_TRACE(ModuleInfo, "Delete Interface Flows");
-    FlowEntryTree fet = intf_it->second->fet;
-    FlowEntryTree::iterator fet_it;
-    for (fet_it = fet.begin(); fet_it != fet.end(); ++fet_it) {
-        Delete((*fet_it)->key(), true);
+    FlowEntryList flows;
+    CopyFlowList(intf_it->second->flows, &flows);
+    FlowEntryList::iterator it;
+    for (it = flows.begin(); it != flows.end(); ++it) {
+        Delete((*it)->key(), true);
     }
 }
 
@@ -2156,6 +2464,15 @@ void FlowTable::SetAclFlowSandeshData(const AclDBEntry *acl, AclFlowResp &data,
 }
 
 FlowTable::~FlowTable() {
+    if (acl_resync_trigger_) {
+        acl_resync_trigger_->Reset();
+        delete acl_resync_trigger_;
+    }
+    AclFlowResyncTree::iterator it;
+    for (it = acl_resync_tree_.begin(); it != acl_resync_tree_.end(); ++it) {
+        delete it->second;
+    }
+    acl_resync_tree_.clear();
     Agent::GetInstance()->GetAclTable()->Unregister(acl_listener_id_);
     Agent::GetInstance()->GetInterfaceTable()->Unregister(intf_listener_id_);
     Agent::GetInstance()->GetVnTable()->Unregister(vn_listener_id_);
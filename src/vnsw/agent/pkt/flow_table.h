@@ -6,11 +6,15 @@
 #define __AGENT_FLOW_TABLE_H__
 
 #include <map>
+#include <set>
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/intrusive_ptr.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/functional/hash.hpp>
 #include <tbb/atomic.h>
 #include <tbb/mutex.h>
+#include <tbb/recursive_mutex.h>
 #include <base/util.h>
 #include <cmn/agent_cmn.h>
 #include <oper/mirror_table.h>
@@ -21,6 +25,7 @@
 #include <pkt/pkt_handler.h>
 #include <pkt/pkt_init.h>
 #include <pkt/pkt_flow_info.h>
+#include <pkt/flow_hash_table.h>
 #include <sandesh/sandesh_trace.h>
 #include <oper/vn.h>
 #include <oper/vm.h>
@@ -154,6 +159,30 @@ struct FlowKeyCmp {
     }
 };
 
+struct FlowKeyHash {
+    uint32_t operator()(const FlowKey &key) const {
+        size_t seed = 0;
+        boost::hash_combine(seed, key.vrf);
+        boost::hash_combine(seed, key.src.ipv4);
+        boost::hash_combine(seed, key.dst.ipv4);
+        boost::hash_combine(seed, key.protocol);
+        boost::hash_combine(seed, key.src_port);
+        boost::hash_combine(seed, key.dst_port);
+        return seed;
+    }
+};
+
+struct FlowKeyEqual {
+    bool operator()(const FlowKey &lhs, const FlowKey &rhs) const {
+        return (lhs.vrf == rhs.vrf &&
+                lhs.src.ipv4 == rhs.src.ipv4 &&
+                lhs.dst.ipv4 == rhs.dst.ipv4 &&
+                lhs.src_port == rhs.src_port &&
+                lhs.dst_port == rhs.dst_port &&
+                lhs.protocol == rhs.protocol);
+    }
+};
+
 struct FlowStats {
     FlowStats() : setup_time(0), teardown_time(0), last_modified_time(0),
         bytes(0), packets(0), intf_in(0), exported(false) {};
@@ -228,6 +257,10 @@ class FlowEntry {
         alloc_count_.fetch_and_decrement();
     };
 
+    // Flow entries come from a pool of freed entries
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
     bool ActionRecompute();
     void CompareAndModify(bool create);
     void UpdateKSync(FlowTableKSyncEntry *entry, bool create);
@@ -305,6 +338,19 @@ private:
     uint32_t flags_;
     // atomic refcount
     tbb::atomic<int> refcount_;
+    // Links in the flow lists of the VN, interface, VM and routes of the
+    // flow. A linked flow holds a reference to itself.
+    boost::intrusive::list_member_hook<> vn_node_;
+    boost::intrusive::list_member_hook<> intf_node_;
+    boost::intrusive::list_member_hook<> vm_node_;
+    boost::intrusive::list_member_hook<> src_route_node_;
+    boost::intrusive::list_member_hook<> dst_route_node_;
+    // Infos of the lists the flow is linked in, recorded at link time
+    VnFlowInfo *vn_flow_info_;
+    IntfFlowInfo *intf_flow_info_;
+    VmFlowInfo *vm_flow_info_;
+    RouteFlowInfo *src_route_flow_info_;
+    RouteFlowInfo *dst_route_flow_info_;
 };
  
 struct FlowEntryCmp {
@@ -319,10 +365,30 @@ struct FlowEntryCmp {
 class FlowTable {
 public:
     static const int MaxResponses = 100;
-    typedef std::map<FlowKey, FlowEntry *, FlowKeyCmp> FlowEntryMap;
+    typedef FlowHashTable<FlowKey, FlowEntry *, FlowKeyHash, FlowKeyEqual,
+                          FlowKeyCmp> FlowEntryMap;
 
     typedef std::map<int, int> AceIdFlowCntMap;
     typedef std::set<FlowEntryPtr, FlowEntryCmp> FlowEntryTree;
+
+    typedef boost::intrusive::member_hook<FlowEntry,
+        boost::intrusive::list_member_hook<>, &FlowEntry::vn_node_> VnNode;
+    typedef boost::intrusive::list<FlowEntry, VnNode> VnFlowList;
+    typedef boost::intrusive::member_hook<FlowEntry,
+        boost::intrusive::list_member_hook<>, &FlowEntry::intf_node_> IntfNode;
+    typedef boost::intrusive::list<FlowEntry, IntfNode> IntfFlowList;
+    typedef boost::intrusive::member_hook<FlowEntry,
+        boost::intrusive::list_member_hook<>, &FlowEntry::vm_node_> VmNode;
+    typedef boost::intrusive::list<FlowEntry, VmNode> VmFlowList;
+    typedef boost::intrusive::member_hook<FlowEntry,
+        boost::intrusive::list_member_hook<>,
+        &FlowEntry::src_route_node_> SrcRouteNode;
+    typedef boost::intrusive::list<FlowEntry, SrcRouteNode> SrcRouteFlowList;
+    typedef boost::intrusive::member_hook<FlowEntry,
+        boost::intrusive::list_member_hook<>,
+        &FlowEntry::dst_route_node_> DstRouteNode;
+    typedef boost::intrusive::list<FlowEntry, DstRouteNode> DstRouteFlowList;
+    typedef std::vector<FlowEntryPtr> FlowEntryList;
     typedef std::map<const AclDBEntry *, AclFlowInfo *> AclFlowTree;
     typedef std::pair<const AclDBEntry *, AclFlowInfo *> AclFlowPair;
 
@@ -339,6 +405,12 @@ public:
     typedef std::map<RouteFlowKey, RouteFlowInfo *, RouteFlowKeyCmp> RouteFlowTree;
     typedef std::pair<RouteFlowKey, RouteFlowInfo *> RouteFlowPair;
 
+    struct AclFlowHandlerState : public DBState {
+        AclFlowHandlerState() { };
+        virtual ~AclFlowHandlerState() { };
+        // Entries of the ACL when the flows were last evaluated
+        AclDBEntry::AceRevisionMap revisions_;
+    };
     struct VnFlowHandlerState : public DBState {
         AclDBEntryConstRef acl_;
         AclDBEntryConstRef macl_;
@@ -372,7 +444,8 @@ public:
     FlowTable() : 
         flow_entry_map_(), acl_flow_tree_(), acl_listener_id_(), intf_listener_id_(),
         vn_listener_id_(), vm_listener_id_(), vrf_listener_id_(), 
-        nh_listener_(NULL) {};
+        nh_listener_(NULL), acl_resync_trigger_(NULL),
+        acl_flow_resync_count_(0) {};
     virtual ~FlowTable();
     
     void Init();
@@ -384,13 +457,17 @@ public:
     bool Delete(const FlowKey &key, bool del_reverse_flow);
 
     size_t Size() {return flow_entry_map_.size();};
+    // Serializes the flow queues. Flows are set up in parallel up to the
+    // update of the table, which runs under the mutex.
+    tbb::recursive_mutex &mutex() { return mutex_; }
     void VnFlowCounters(const VnEntry *vn, uint32_t *in_count, 
                         uint32_t *out_count);
 
     // Test code only used method
     void DeleteFlow(const AclDBEntry *acl, const FlowKey &key, AclEntryIDList &id_list);
-    void ResyncAclFlows(const AclDBEntry *acl);
     void DeleteAll();
+    // Number of flows re-evaluated after a change to one of their ACLs
+    uint64_t acl_flow_resync_count() const { return acl_flow_resync_count_; }
 
     void SetAclFlowSandeshData(const AclDBEntry *acl, AclFlowResp &data, 
                                const int last_count);
@@ -413,6 +490,23 @@ public:
     friend class NhState;
     friend void intrusive_ptr_release(FlowEntry *fe);
 private:
+    // Flows of an ACL left to evaluate after some of its entries changed
+    struct AclFlowResync {
+        AclFlowResync() : all(false), next(0) { };
+
+        AclDBEntryConstRef acl;
+        // Ids of the entries that changed, unless all flows are evaluated
+        AclEntryIDSet changed;
+        bool all;
+        FlowEntryList flows;
+        size_t next;
+    };
+    typedef std::map<const AclDBEntry *, AclFlowResync *> AclFlowResyncTree;
+
+    // Flows looked at per run of the ACL resync task
+    static const size_t kAclResyncFlowsPerRun = 256;
+
+    tbb::recursive_mutex mutex_;
     FlowEntryMap flow_entry_map_;
 
     AclFlowTree acl_flow_tree_;
@@ -427,8 +521,19 @@ private:
     DBTableBase::ListenerId vm_listener_id_;
     DBTableBase::ListenerId vrf_listener_id_;
     NhListener *nh_listener_;
+    AclFlowResyncTree acl_resync_tree_;
+    TaskTrigger *acl_resync_trigger_;
+    uint64_t acl_flow_resync_count_;
 
     void AclNotify(DBTablePartBase *part, DBEntryBase *e);
+    void ScheduleAclResync(const AclDBEntry *acl, const AclEntryIDSet &changed,
+                           bool all);
+    bool AclResyncRun();
+    bool AclChangeAffectsFlow(const AclDBEntry *acl,
+                              const AclEntryIDSet &changed,
+                              const std::vector<const AclEntry *> &entries,
+                              FlowEntry *fe);
+    void ResyncAclFlow(FlowEntry *fe);
     void IntfNotify(DBTablePartBase *part, DBEntryBase *e);
     void VnNotify(DBTablePartBase *part, DBEntryBase *e);
     void VrfNotify(DBTablePartBase *part, DBEntryBase *e);
@@ -449,6 +554,7 @@ private:
     void DeleteVmFlowInfo(FlowEntry *fe);
     void DeleteIntfFlowInfo(FlowEntry *fe);
     void DeleteRouteFlowInfo(FlowEntry *fe);
+    void DeleteRouteFlowInfoIfEmpty(RouteFlowInfo *route_flow_info);
     void DeleteAclFlowInfo(const AclDBEntry *acl, FlowEntry* flow, const AclEntryIDList &id_list);
 
     void DeleteVnFlows(const VnEntry *vn);
@@ -462,6 +568,7 @@ private:
     void AddVnFlowInfo(FlowEntry *fe);
     void AddVmFlowInfo(FlowEntry *fe);
     void AddRouteFlowInfo(FlowEntry *fe);
+    RouteFlowInfo *LocateRouteFlowInfo(const RouteFlowKey &key);
 
     void DeleteAclFlows(const AclDBEntry *acl);
     void DeleteInternal(FlowEntryMap::iterator &it);
@@ -557,7 +664,7 @@ struct VnFlowInfo {
     ~VnFlowInfo() {};
 
     VnEntryConstRef vn_entry;
-    FlowTable::FlowEntryTree fet;
+    FlowTable::VnFlowList flows;
     uint32_t ingress_flow_count;
     uint32_t egress_flow_count;
 };
@@ -567,7 +674,7 @@ struct IntfFlowInfo {
     ~IntfFlowInfo() {};
 
     InterfaceConstRef intf_entry;
-    FlowTable::FlowEntryTree fet;
+    FlowTable::IntfFlowList flows;
 };
 
 struct VmFlowInfo {
@@ -575,13 +682,17 @@ struct VmFlowInfo {
     ~VmFlowInfo() {};
 
     VmEntryConstRef vm_entry;
-    FlowTable::FlowEntryTree fet;
+    FlowTable::VmFlowList flows;
 };
 
 struct RouteFlowInfo {
-    RouteFlowInfo() {};
+    explicit RouteFlowInfo(const RouteFlowKey &k) : key(k) {};
     ~RouteFlowInfo() {};
-    FlowTable::FlowEntryTree fet;
+    bool empty() const { return src_flows.empty() && dst_flows.empty(); }
+    RouteFlowKey key;
+    // Flows with the route as source, and as destination
+    FlowTable::SrcRouteFlowList src_flows;
+    FlowTable::DstRouteFlowList dst_flows;
 };
 
 extern SandeshTraceBufferPtr FlowTraceBuf;
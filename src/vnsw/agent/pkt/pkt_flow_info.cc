@@ -695,7 +695,11 @@ void PktFlowInfo::Add(const PktInfo *pkt, PktControlInfo *in,
                       PktControlInfo *out) {
     FlowKey key(pkt->vrf, pkt->ip_saddr, pkt->ip_daddr,
                 pkt->ip_proto, pkt->sport, pkt->dport);
-    FlowEntryPtr flow(Agent::GetInstance()->pkt()->flow_table()->Allocate(key));
+    // The flow and its reverse flow are set up in one go, before another
+    // flow queue can get to them
+    FlowTable *table = Agent::GetInstance()->pkt()->flow_table();
+    tbb::recursive_mutex::scoped_lock lock(table->mutex());
+    FlowEntryPtr flow(table->Allocate(key));
 
     FlowEntryPtr rflow(NULL);
     uint16_t r_sport;
@@ -715,17 +719,17 @@ void PktFlowInfo::Add(const PktInfo *pkt, PktControlInfo *in,
     if (nat_done) {
         FlowKey rkey(nat_vrf, nat_ip_daddr, nat_ip_saddr,
                      pkt->ip_proto, r_sport, r_dport);
-        rflow = Agent::GetInstance()->pkt()->flow_table()->Allocate(rkey);
+        rflow = table->Allocate(rkey);
     } else {
         FlowKey rkey(dest_vrf, pkt->ip_daddr, pkt->ip_saddr,
                      pkt->ip_proto, r_sport, r_dport);
-        rflow = Agent::GetInstance()->pkt()->flow_table()->Allocate(rkey);
+        rflow = table->Allocate(rkey);
     }
 
     flow->InitFwdFlow(this, pkt, in, out);
     rflow->InitRevFlow(this, out, in);
 
-    Agent::GetInstance()->pkt()->flow_table()->Add(flow.get(), rflow.get());
+    table->Add(flow.get(), rflow.get());
 }
 
 //If a packet is trapped for ecmp resolve, dp might have already
@@ -747,7 +751,9 @@ void PktFlowInfo::RewritePktInfo(uint32_t flow_index) {
         return;
     }
 
-    FlowEntry *flow = Agent::GetInstance()->pkt()->flow_table()->Find(key);
+    FlowTable *table = Agent::GetInstance()->pkt()->flow_table();
+    tbb::recursive_mutex::scoped_lock lock(table->mutex());
+    FlowEntry *flow = table->Find(key);
     if (!flow) {
         std::ostringstream ostr;  
         ostr << "ECMP Resolve: unable to find flow index " << flow_index;
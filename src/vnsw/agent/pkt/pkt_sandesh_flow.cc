@@ -253,7 +253,13 @@ bool PktSandeshFlow::Run() {
     FlowTable *flow_obj = Agent::GetInstance()->pkt()->flow_table();
 
     if (key_valid_) {
-        it = flow_obj->flow_entry_map_.upper_bound(flow_iteration_key_);
+        // start_key is not a flow, and the walk is not in the order of the
+        // keys, so it starts at the beginning of the flow table
+        if (flow_iteration_key_.CompareKey(FlowKey())) {
+            it = flow_obj->flow_entry_map_.begin();
+        } else {
+            it = flow_obj->flow_entry_map_.upper_bound(flow_iteration_key_);
+        }
     } else {
         FlowErrorResp *resp = new FlowErrorResp();
         SendResponse(resp);
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "base/logging.h"
+#include "testing/gunit.h"
+
+#include "vnsw/agent/pkt/flow_hash_table.h"
+
+void RouterIdDepInit() {
+}
+
+namespace {
+
+// Keys with the same hash in threes, so that the order of the keys with
+// equal hashes is covered as well
+struct TestKeyHash {
+    uint32_t operator()(uint32_t key) const { return key / 3; }
+};
+
+struct TestKeyEqual {
+    bool operator()(uint32_t lhs, uint32_t rhs) const { return lhs == rhs; }
+};
+
+struct TestKeyCmp {
+    bool operator()(uint32_t lhs, uint32_t rhs) const { return lhs < rhs; }
+};
+
+typedef FlowHashTable<uint32_t, int, TestKeyHash, TestKeyEqual, TestKeyCmp>
+    TestTable;
+
+class FlowHashTableTest : public ::testing::Test {
+protected:
+    void Insert(uint32_t first, uint32_t count) {
+        for (uint32_t key = first; key < first + count; key++) {
+            EXPECT_TRUE(table_.insert(std::make_pair(key, key + 1)).second);
+        }
+    }
+
+    // Keys of the walk from it, count at a time, resuming with upper_bound()
+    // of the last key walked after calling between(last key) each time.
+    template <typename Between>
+    std::vector<uint32_t> PagedWalk(size_t count, Between between) {
+        std::vector<uint32_t> keys;
+        TestTable::iterator it = table_.begin();
+        while (it != table_.end()) {
+            uint32_t last = 0;
+            for (size_t i = 0; i < count && it != table_.end(); i++, ++it) {
+                last = it->first;
+                keys.push_back(last);
+            }
+            between(last);
+            it = table_.upper_bound(last);
+        }
+        return keys;
+    }
+
+    // Checks that the keys have no repeats and include all of expected
+    void ExpectWalked(const std::vector<uint32_t> &keys,
+                      const std::set<uint32_t> &expected) {
+        std::set<uint32_t> walked;
+        for (size_t i = 0; i < keys.size(); i++) {
+            EXPECT_TRUE(walked.insert(keys[i]).second) << keys[i];
+        }
+        for (std::set<uint32_t>::const_iterator it = expected.begin();
+             it != expected.end(); ++it) {
+            EXPECT_EQ(1U, walked.count(*it)) << *it;
+        }
+    }
+
+    std::set<uint32_t> Keys() {
+        std::set<uint32_t> keys;
+        for (TestTable::iterator it = table_.begin(); it != table_.end();
+             ++it) {
+            keys.insert(it->first);
+        }
+        return keys;
+    }
+
+    TestTable table_;
+};
+
+struct NoOp {
+    void operator()(uint32_t last) const { }
+};
+
+// Erases the last key walked if erase_last, and inserts count new keys from
+// next up to limit, which resizes the table when there are enough of them
+struct InsertKeys {
+    InsertKeys(TestTable *table, bool erase_last, uint32_t *next,
+               uint32_t count, uint32_t limit)
+        : table(table), erase_last(erase_last), next(next), count(count),
+          limit(limit) {
+    }
+    void operator()(uint32_t last) const {
+        if (erase_last) {
+            table->erase(last);
+        }
+        for (uint32_t i = 0; i < count && *next < limit; i++, (*next)++) {
+            table->insert(std::make_pair(*next, 0));
+        }
+    }
+    TestTable *table;
+    bool erase_last;
+    uint32_t *next;
+    uint32_t count;
+    uint32_t limit;
+};
+
+TEST_F(FlowHashTableTest, Insert) {
+    EXPECT_TRUE(table_.empty());
+    EXPECT_TRUE(table_.begin() == table_.end());
+    EXPECT_TRUE(table_.find(1) == table_.end());
+    EXPECT_TRUE(table_.upper_bound(1) == table_.end());
+
+    Insert(0, 5000);
+    EXPECT_EQ(5000U, table_.size());
+    EXPECT_GE(table_.bucket_count() * 3, 5000U * 4);
+    for (uint32_t key = 0; key < 5000; key++) {
+        TestTable::iterator it = table_.find(key);
+        ASSERT_TRUE(it != table_.end());
+        EXPECT_EQ(key, it->first);
+        EXPECT_EQ((int) key + 1, it->second);
+    }
+    EXPECT_TRUE(table_.find(5000) == table_.end());
+
+    // Inserting a key again returns its entry
+    std::pair<TestTable::iterator, bool> ret =
+        table_.insert(std::make_pair(10U, 0));
+    EXPECT_FALSE(ret.second);
+    EXPECT_EQ(11, ret.first->second);
+    EXPECT_EQ(5000U, table_.size());
+
+    std::vector<uint32_t> keys = PagedWalk(5000, NoOp());
+    EXPECT_EQ(5000U, keys.size());
+    ExpectWalked(keys, Keys());
+}
+
+TEST_F(FlowHashTableTest, Erase) {
+    Insert(0, 100);
+    EXPECT_EQ(1U, table_.erase(10));
+    EXPECT_EQ(0U, table_.erase(10));
+    EXPECT_EQ(0U, table_.erase(1000));
+    table_.erase(table_.find(11));
+    EXPECT_EQ(98U, table_.size());
+    EXPECT_TRUE(table_.find(10) == table_.end());
+    EXPECT_TRUE(table_.find(11) == table_.end());
+    EXPECT_EQ(0U, Keys().count(10));
+
+    // An erased key can be inserted again
+    EXPECT_TRUE(table_.insert(std::make_pair(10U, 20)).second);
+    EXPECT_EQ(20, table_.find(10)->second);
+    EXPECT_EQ(99U, table_.size());
+
+    table_.clear();
+    EXPECT_TRUE(table_.empty());
+    EXPECT_TRUE(table_.find(12) == table_.end());
+}
+
+// upper_bound() of an erased key resumes the walk after it, from the
+// tombstone of the key
+TEST_F(FlowHashTableTest, Tombstones) {
+    Insert(0, 1000);
+    std::vector<uint32_t> keys = PagedWalk(1000, NoOp());
+    ASSERT_EQ(1000U, keys.size());
+
+    for (size_t i = 100; i < 200; i++) {
+        table_.erase(keys[i]);
+    }
+    TestTable::iterator it = table_.upper_bound(keys[150]);
+    ASSERT_TRUE(it != table_.end());
+    EXPECT_EQ(keys[200], it->first);
+
+    // The walk skips the tombstones
+    EXPECT_EQ(900U, PagedWalk(7, NoOp()).size());
+
+    // Erasing the same keys again and again doesn't fill the table
+    size_t buckets = table_.bucket_count();
+    for (int round = 0; round < 100; round++) {
+        for (size_t i = 100; i < 200; i++) {
+            table_.insert(std::make_pair(keys[i], 0));
+            table_.erase(keys[i]);
+        }
+    }
+    EXPECT_EQ(buckets, table_.bucket_count());
+    EXPECT_EQ(900U, table_.size());
+}
+
+// A walker can erase the entry it is on and continue from it
+TEST_F(FlowHashTableTest, EraseDuringWalk) {
+    Insert(0, 3000);
+    std::set<uint32_t> expected = Keys();
+    std::vector<uint32_t> keys;
+    TestTable::iterator it = table_.begin();
+    while (it != table_.end()) {
+        TestTable::iterator current = it++;
+        keys.push_back(current->first);
+        if (current->first % 2) {
+            table_.erase(current);
+        }
+    }
+    EXPECT_EQ(3000U, keys.size());
+    ExpectWalked(keys, expected);
+    EXPECT_EQ(1500U, table_.size());
+
+    // A paged walk that erases the last key walked each time
+    expected = Keys();
+    keys = PagedWalk(10, InsertKeys(&table_, true, NULL, 0, 0));
+    EXPECT_EQ(1500U, keys.size());
+    ExpectWalked(keys, expected);
+    EXPECT_EQ(1500U - (1500U + 9) / 10, table_.size());
+}
+
+// A paged walk sees each of the keys that were there when it started once,
+// when the table is resized between the pages
+TEST_F(FlowHashTableTest, ResizeDuringWalk) {
+    Insert(0, 2000);
+    std::set<uint32_t> expected = Keys();
+    size_t buckets = table_.bucket_count();
+    uint32_t next = 2000;
+    std::vector<uint32_t> keys =
+        PagedWalk(20, InsertKeys(&table_, false, &next, 200, 30000));
+    EXPECT_LT(buckets * 4, table_.bucket_count());
+    ExpectWalked(keys, expected);
+
+    // With the last key walked erased before the resize, so that upper_bound
+    // has no tombstone to resume from
+    table_.clear();
+    Insert(0, 2000);
+    expected = Keys();
+    buckets = table_.bucket_count();
+    next = 2000;
+    keys = PagedWalk(20, InsertKeys(&table_, true, &next, 200, 30000));
+    EXPECT_LT(buckets * 4, table_.bucket_count());
+    ExpectWalked(keys, expected);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <map>
+#include <vector>
+#include "base/test/task_test_util.h"
+#include "test/test_cmn_util.h"
+#include "test_pkt_util.h"
+#include "pkt/flow_proto.h"
+
+//
+// Flow setup and flow table benchmarks. They are not part of the test
+// suite, run them by hand and compare the rates logged. The defaults are
+// overridden by AGENT_FLOW_SETUP_COUNT and AGENT_FLOW_TABLE_COUNT.
+//
+struct PortInfo input[] = {
+    {"vnet1", 1, "1.1.1.1", "00:00:01:01:01:01", 1, 1},
+};
+
+void RouterIdDepInit() {
+}
+
+static uint64_t Rate(uint64_t count, uint64_t usec) {
+    return count * 1000000 / std::max(usec, (uint64_t) 1);
+}
+
+extern Peer *bgp_peer_;
+class FlowSetupRateTest : public ::testing::Test {
+public:
+    virtual void SetUp() {
+        CreateVmportEnv(input, 1);
+        client->WaitForIdle();
+        EXPECT_TRUE(VmPortActive(input, 0));
+
+        vnet = VmInterfaceGet(1);
+        strcpy(vnet_addr, vnet->ip_addr().to_string().c_str());
+
+        boost::system::error_code ec;
+        Inet4UnicastAgentRouteTable::AddRemoteVmRouteReq(bgp_peer_, "vrf1",
+                                        Ip4Address::from_string("5.0.0.0", ec),
+                                        8, Ip4Address::from_string("1.1.1.2", ec),
+                                        TunnelType::AllType(), 16, "TestVn");
+        client->WaitForIdle();
+        EXPECT_EQ(0U, Agent::GetInstance()->pkt()->flow_table()->Size());
+    }
+
+    virtual void TearDown() {
+        boost::system::error_code ec;
+        Inet4UnicastAgentRouteTable::DeleteReq(bgp_peer_, "vrf1",
+                                     Ip4Address::from_string("5.0.0.0", ec), 8);
+        DeleteVmportEnv(input, 1, 1);
+        client->WaitForIdle();
+    }
+
+    VmInterface *vnet;
+    char vnet_addr[32];
+};
+
+// Flows set up per second, from the packets trapped to the agent to the
+// flow and its reverse flow in the flow table, and flows deleted per
+// second on a flush of the flow table.
+TEST_F(FlowSetupRateTest, SetupAndDelete) {
+    FlowTable *table = Agent::GetInstance()->pkt()->flow_table();
+    int count = GetEnvInt("AGENT_FLOW_SETUP_COUNT", 10000);
+
+    uint64_t start = UTCTimestampUsec();
+    for (int i = 0; i < count; i++) {
+        Ip4Address addr(0x05000000 + i);
+        TxIpPacket(vnet->id(), vnet_addr, addr.to_string().c_str(), 1);
+    }
+    int flow_count = count * 2;
+    WAIT_FOR(flow_count, 10000, (flow_count == (int) table->Size()));
+    uint64_t setup_usec = UTCTimestampUsec() - start;
+
+    start = UTCTimestampUsec();
+    client->EnqueueFlowFlush();
+    WAIT_FOR(flow_count, 10000, (0 == table->Size()));
+    uint64_t delete_usec = UTCTimestampUsec() - start;
+    client->WaitForIdle(std::max(flow_count / 500, 1));
+
+    LOG(DEBUG, "Flow setup: " << flow_count << " flows, " << setup_usec <<
+        " usec, " << Rate(flow_count, setup_usec) << " flows/sec");
+    LOG(DEBUG, "Flow delete: " << flow_count << " flows, " << delete_usec <<
+        " usec, " << Rate(flow_count, delete_usec) << " flows/sec");
+}
+
+// Insert, lookup and erase of flow keys in the flow table map, against the
+// std::map it replaced, and allocation of flow entries.
+class FlowTableBenchmark : public ::testing::Test {
+public:
+    virtual void SetUp() {
+        int count = GetEnvInt("AGENT_FLOW_TABLE_COUNT", 500000);
+        for (int i = 0; i < count; i++) {
+            keys_.push_back(FlowKey(1 + i % 16, 0x01010000 + random() % 256,
+                                    0x05000000 + i, 6, 1024 + random() % 8192,
+                                    80));
+        }
+    }
+
+    template <typename Map>
+    void Run(const char *name, Map *map) {
+        uint64_t start = UTCTimestampUsec();
+        for (size_t i = 0; i < keys_.size(); i++) {
+            map->insert(std::make_pair(keys_[i], (FlowEntry *) NULL));
+        }
+        uint64_t insert_usec = UTCTimestampUsec() - start;
+
+        start = UTCTimestampUsec();
+        size_t found = 0;
+        for (size_t i = 0; i < keys_.size(); i++) {
+            if (map->find(keys_[random() % keys_.size()]) != map->end()) {
+                found++;
+            }
+        }
+        uint64_t find_usec = UTCTimestampUsec() - start;
+        EXPECT_EQ(keys_.size(), found);
+
+        start = UTCTimestampUsec();
+        for (size_t i = 0; i < keys_.size(); i++) {
+            map->erase(map->find(keys_[i]));
+        }
+        uint64_t erase_usec = UTCTimestampUsec() - start;
+        EXPECT_EQ(0U, map->size());
+
+        LOG(DEBUG, name << ": " << keys_.size() << " keys, " <<
+            Rate(keys_.size(), insert_usec) << " inserts/sec, " <<
+            Rate(keys_.size(), find_usec) << " lookups/sec, " <<
+            Rate(keys_.size(), erase_usec) << " erases/sec");
+    }
+
+    std::vector<FlowKey> keys_;
+};
+
+TEST_F(FlowTableBenchmark, MapVsHashTable) {
+    std::map<FlowKey, FlowEntry *, FlowKeyCmp> *map =
+        new std::map<FlowKey, FlowEntry *, FlowKeyCmp>();
+    Run("std::map", map);
+    delete map;
+
+    FlowTable::FlowEntryMap *table = new FlowTable::FlowEntryMap();
+    Run("hash table", table);
+    delete table;
+}
+
+TEST_F(FlowTableBenchmark, Allocate) {
+    std::vector<FlowEntry *> flows(std::min(keys_.size(), (size_t) 16384));
+    uint64_t start = UTCTimestampUsec();
+    size_t count = 0;
+    for (size_t i = 0; i < keys_.size(); i += flows.size()) {
+        for (size_t j = 0; j < flows.size(); j++) {
+            flows[j] = new FlowEntry(keys_[i]);
+        }
+        for (size_t j = 0; j < flows.size(); j++) {
+            delete flows[j];
+        }
+        count += flows.size();
+    }
+    uint64_t usec = UTCTimestampUsec() - start;
+    LOG(DEBUG, "Flow entry: " << count << " allocations, " <<
+        Rate(count, usec) << " allocations/sec");
+}
+
+int main(int argc, char *argv[]) {
+    int ret = 0;
+
+    GETUSERARGS();
+    client = TestInit(init_file, ksync_init, true, true, true, 100*1000);
+    client->SetFlowFlushExclusionPolicy();
+    ret = RUN_ALL_TESTS();
+    TestShutdown();
+    delete client;
+    return ret;
+}
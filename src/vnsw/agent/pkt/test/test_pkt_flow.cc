@@ -5,6 +5,7 @@
 #include "test/test_cmn_util.h"
 #include "test_flow_util.h"
 #include "ksync/ksync_sock_user.h"
+#include "pkt/flow_proto.h"
 #include <algorithm>
 
 #define MAX_VNET 4
@@ -1507,6 +1508,23 @@ TEST_F(FlowTest, AclDelete) {
     EXPECT_TRUE(FlowTableWait(0));
 }
 
+// Packets of a flow and of its reverse flow go to the same flow queue
+TEST_F(FlowTest, FlowQueueIndex) {
+    FlowProto *proto = Agent::GetInstance()->GetFlowProto();
+    EXPECT_LE(1U, proto->flow_queue_count());
+    EXPECT_GE(FlowProto::kMaxFlowQueues, proto->flow_queue_count());
+    for (uint32_t i = 0; i < 64; i++) {
+        PktInfo fwd, rev;
+        fwd.ip_saddr = rev.ip_daddr = 0x01010101 + i;
+        fwd.ip_daddr = rev.ip_saddr = 0x02020202 + i * 7;
+        fwd.sport = rev.dport = 1000 + i;
+        fwd.dport = rev.sport = 80;
+        fwd.ip_proto = rev.ip_proto = IPPROTO_TCP;
+        EXPECT_EQ(proto->FlowQueueIndex(&fwd), proto->FlowQueueIndex(&rev));
+        EXPECT_GT(proto->flow_queue_count(), proto->FlowQueueIndex(&fwd));
+    }
+}
+
 int main(int argc, char *argv[]) {
     GETUSERARGS();
 
@@ -394,6 +394,41 @@ TEST_F(SgTest, Fwd_Sg_Change_1) {
                            vnet_addr[2], 1, 0, 0));
 }
 
+// Change an ACL entry that one flow matched, and that now matches another
+// flow ahead of the entry it matched
+TEST_F(SgTest, Fwd_Sg_Change_2) {
+    TxIpPacket(vnet[1]->id(), vnet_addr[1], vnet_addr[2], 1);
+    TxTcpPacket(vnet[1]->id(), vnet_addr[1], vnet_addr[2], 10, 20);
+    client->WaitForIdle();
+
+    EXPECT_TRUE(ValidateAction(vnet[1]->vrf()->GetVrfId(), vnet_addr[1],
+                               vnet_addr[2], 1, 0, 0, TrafficAction::PASS));
+    EXPECT_TRUE(ValidateAction(vnet[1]->vrf()->GetVrfId(), vnet_addr[1],
+                               vnet_addr[2], 6, 10, 20, TrafficAction::DENY));
+
+    FlowTable *table = Agent::GetInstance()->pkt()->flow_table();
+    uint64_t resync_count = table->acl_flow_resync_count();
+    AddAclEntry("sg_acl1", 10, 6, "pass");
+    EXPECT_TRUE(ValidateAction(vnet[1]->vrf()->GetVrfId(), vnet_addr[1],
+                               vnet_addr[2], 1, 0, 0, TrafficAction::DENY));
+    EXPECT_TRUE(ValidateAction(vnet[1]->vrf()->GetVrfId(), vnet_addr[1],
+                               vnet_addr[2], 6, 10, 20, TrafficAction::PASS));
+    EXPECT_LT(resync_count, table->acl_flow_resync_count());
+
+    // Same entries, the flows are left as they are
+    resync_count = table->acl_flow_resync_count();
+    AddAclEntry("sg_acl1", 10, 6, "pass");
+    EXPECT_TRUE(ValidateAction(vnet[1]->vrf()->GetVrfId(), vnet_addr[1],
+                               vnet_addr[2], 6, 10, 20, TrafficAction::PASS));
+    EXPECT_EQ(resync_count, table->acl_flow_resync_count());
+
+    AddAclEntry("sg_acl1", 10, 1, "pass");
+    EXPECT_TRUE(FlowDelete(vnet[1]->vrf()->GetName(), vnet_addr[1],
+                           vnet_addr[2], 1, 0, 0));
+    EXPECT_TRUE(FlowDelete(vnet[1]->vrf()->GetName(), vnet_addr[1],
+                           vnet_addr[2], 6, 10, 20));
+}
+
 // Delete SG from interface
 TEST_F(SgTest, Sg_Delete_1) {
     TxTcpPacket(vnet[1]->id(), vnet_addr[1], vnet_addr[2],
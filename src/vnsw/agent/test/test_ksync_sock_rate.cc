@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "base/test/task_test_util.h"
+#include "testing/gunit.h"
+#include "test/test_cmn_util.h"
+#include "ksync/ksync_sock.h"
+#include "ksync/ksync_sock_user.h"
+#include "vr_types.h"
+
+//
+// KSync socket tests for bulk messages. Route add and delete requests are
+// sent to the vrouter, which is the ksync_sock_user stand-in unless run with
+// --kernel. Bulk messages are off by default, and each test turns them on.
+// The tests of error and lost responses need the stand-in.
+//
+// MessageVsBulk compares the rates logged in a message per request and in
+// bulk messages. AGENT_KSYNC_MSG_COUNT sets the number of routes.
+//
+void RouterIdDepInit() {
+}
+
+static uint64_t Rate(uint64_t count, uint64_t usec) {
+    return count * 1000000 / std::max(usec, (uint64_t) 1);
+}
+
+// VRF of the routes, not used by the agent
+static const int kTestVrfId = 4000;
+
+class RouteIoContext : public IoContext {
+public:
+    RouteIoContext(char *msg, uint32_t len, uint32_t seq) :
+        IoContext(msg, len, seq, KSyncSock::GetAgentSandeshContext()) {
+    }
+    virtual void Handler() { ack_count_++; }
+    virtual void ErrorHandler(int err) {
+        error_count_++;
+        last_error_ = err;
+    }
+
+    static tbb::atomic<int> ack_count_;
+    static tbb::atomic<int> error_count_;
+    static tbb::atomic<int> last_error_;
+};
+
+tbb::atomic<int> RouteIoContext::ack_count_;
+tbb::atomic<int> RouteIoContext::error_count_;
+tbb::atomic<int> RouteIoContext::last_error_;
+
+class KSyncSockRateTest : public ::testing::Test {
+public:
+    virtual void SetUp() {
+        sock_ = KSyncSock::Get(0);
+        type_map_ = KSyncSockTypeMap::GetKSyncSockTypeMap();
+        bulk_buf_len_ = sock_->bulk_buf_len();
+        ack_timeout_msec_ = sock_->ack_timeout_msec();
+        bulk_count_ = 0;
+        RouteIoContext::ack_count_ = 0;
+        RouteIoContext::error_count_ = 0;
+        RouteIoContext::last_error_ = 0;
+        sock_->SetBulkCompleteCallback(
+            boost::bind(&KSyncSockRateTest::BulkComplete, this, _1));
+    }
+
+    virtual void TearDown() {
+        client->WaitForIdle();
+        sock_->SetBulkCompleteCallback(KSyncSock::BulkCompleteCb());
+        sock_->set_bulk_buf_len(bulk_buf_len_);
+        sock_->set_ack_timeout_msec(ack_timeout_msec_);
+    }
+
+    void BulkComplete(uint32_t count) {
+        bulk_count_ += count;
+    }
+
+    void SendRoute(sandesh_op::type op, uint32_t prefix, uint32_t seq) {
+        vr_route_req encoder;
+        encoder.set_h_op(op);
+        encoder.set_rtr_rid(0);
+        encoder.set_rtr_vrf_id(kTestVrfId);
+        encoder.set_rtr_family(AF_INET);
+        encoder.set_rtr_prefix(prefix);
+        encoder.set_rtr_prefix_len(32);
+        encoder.set_rtr_label_flags(0);
+        encoder.set_rtr_label(0);
+        encoder.set_rtr_nh_id(0);
+
+        int error = 0;
+        char *buf = (char *)malloc(KSYNC_DEFAULT_MSG_SIZE);
+        int len = encoder.WriteBinary((uint8_t *)buf, KSYNC_DEFAULT_MSG_SIZE,
+                                      &error);
+        EXPECT_EQ(0, error);
+        sock_->GenericSend(new RouteIoContext(buf, len, seq));
+    }
+
+    void SendRoute(sandesh_op::type op, uint32_t prefix) {
+        SendRoute(op, prefix, sock_->AllocSeqNo(false));
+    }
+
+    void SendRoutes(sandesh_op::type op, int count) {
+        for (int i = 0; i < count; i++) {
+            SendRoute(op, 0x0a000000 + i);
+        }
+    }
+
+    void WaitForAcks(int count) {
+        WAIT_FOR(10000, 1000, (count == RouteIoContext::ack_count_));
+        EXPECT_EQ(count, RouteIoContext::ack_count_);
+    }
+
+    // Messages acked per second, for routes added and then deleted
+    void Run(const char *name, int count) {
+        RouteIoContext::ack_count_ = 0;
+        RouteIoContext::error_count_ = 0;
+        int tx_count = sock_->tx_count();
+
+        uint64_t start = UTCTimestampUsec();
+        SendRoutes(sandesh_op::ADD, count);
+        SendRoutes(sandesh_op::DELETE, count);
+        int msg_count = count * 2;
+        WaitForAcks(msg_count);
+        uint64_t usec = UTCTimestampUsec() - start;
+        client->WaitForIdle();
+
+        EXPECT_EQ(0, RouteIoContext::error_count_);
+        int sends = sock_->tx_count() - tx_count;
+        LOG(DEBUG, name << ": " << msg_count << " messages in " << sends <<
+            " sends, " << usec << " usec, " << Rate(msg_count, usec) <<
+            " messages/sec");
+    }
+
+    KSyncSock *sock_;
+    KSyncSockTypeMap *type_map_;
+    uint32_t bulk_buf_len_;
+    int ack_timeout_msec_;
+    tbb::atomic<uint32_t> bulk_count_;
+};
+
+// Requests too big for a bulk message are sent in a message of their own
+TEST_F(KSyncSockRateTest, RequestTooBigForBulk) {
+    int tx_count = sock_->tx_count();
+    sock_->set_bulk_buf_len(64);
+    SendRoutes(sandesh_op::ADD, 10);
+    WaitForAcks(10);
+    EXPECT_EQ(10, sock_->tx_count() - tx_count);
+    EXPECT_EQ(0U, bulk_count_);
+
+    sock_->set_bulk_buf_len(KSyncSock::kBulkBufLen);
+    SendRoutes(sandesh_op::DELETE, 10);
+    WaitForAcks(20);
+    TASK_UTIL_EXPECT_EQ(10U, bulk_count_);
+    EXPECT_EQ(0, RouteIoContext::error_count_);
+}
+
+// An error response to a request completes it, and the others of its bulk
+// message are processed as usual
+TEST_F(KSyncSockRateTest, BulkErrorResponse) {
+    if (type_map_ == NULL) {
+        return;
+    }
+    int route_count = KSyncSockTypeMap::RouteCount();
+    sock_->set_bulk_buf_len(KSyncSock::kBulkBufLen);
+    for (int i = 0; i < 20; i++) {
+        uint32_t seq = sock_->AllocSeqNo(false);
+        if (i == 5) {
+            type_map_->SetBulkResponseError(seq, -ENOENT);
+        }
+        SendRoute(sandesh_op::ADD, 0x0a000000 + i, seq);
+    }
+    WaitForAcks(20);
+    EXPECT_EQ(1, RouteIoContext::error_count_);
+    EXPECT_EQ(ENOENT, RouteIoContext::last_error_);
+    TASK_UTIL_EXPECT_EQ(20U, bulk_count_);
+    EXPECT_EQ(route_count + 19, KSyncSockTypeMap::RouteCount());
+
+    SendRoutes(sandesh_op::DELETE, 20);
+    WaitForAcks(40);
+    EXPECT_EQ(1, RouteIoContext::error_count_);
+}
+
+// A lost ack is completed with ETIMEDOUT after the ack timeout, which frees
+// its bulk message, and later requests are not held up by it
+TEST_F(KSyncSockRateTest, BulkLostAck) {
+    if (type_map_ == NULL) {
+        return;
+    }
+    int err_count = sock_->err_count();
+    sock_->set_bulk_buf_len(KSyncSock::kBulkBufLen);
+    sock_->set_ack_timeout_msec(100);
+    for (int i = 0; i < 20; i++) {
+        uint32_t seq = sock_->AllocSeqNo(false);
+        if (i == 3) {
+            type_map_->DropBulkResponse(seq);
+        }
+        SendRoute(sandesh_op::ADD, 0x0a000000 + i, seq);
+    }
+    WaitForAcks(20);
+    EXPECT_EQ(1, RouteIoContext::error_count_);
+    EXPECT_EQ(ETIMEDOUT, RouteIoContext::last_error_);
+    EXPECT_EQ(err_count + 1, sock_->err_count());
+    TASK_UTIL_EXPECT_EQ(20U, bulk_count_);
+
+    SendRoutes(sandesh_op::DELETE, 20);
+    WaitForAcks(40);
+    EXPECT_EQ(1, RouteIoContext::error_count_);
+    TASK_UTIL_EXPECT_EQ(40U, bulk_count_);
+}
+
+TEST_F(KSyncSockRateTest, MessageVsBulk) {
+    int count = GetEnvInt("AGENT_KSYNC_MSG_COUNT", 1000);
+
+    sock_->set_bulk_buf_len(0);
+    Run("Message per request", count);
+    EXPECT_EQ(0U, bulk_count_);
+
+    sock_->set_bulk_buf_len(KSyncSock::kBulkBufLen);
+    Run("Bulk messages", count);
+    TASK_UTIL_EXPECT_EQ((uint32_t)count * 2, bulk_count_);
+}
+
+int main(int argc, char **argv) {
+    GETUSERARGS();
+
+    client = TestInit(init_file, ksync_init);
+    int ret = RUN_ALL_TESTS();
+    TestShutdown();
+    delete client;
+    return ret;
+}
@@ -220,7 +220,15 @@ bool FlowStatsCollector::Run() {
         return true;
     }
     uint64_t curr_time = UTCTimestampUsec();
-    it = flow_obj->flow_entry_map_.upper_bound(flow_iteration_key_);
+    // The flows are walked in the order of the flow table, which is not the
+    // order of the keys, so the reset key starts the walk at the beginning
+    FlowKey start_key;
+    start_key.Reset();
+    if (flow_iteration_key_.CompareKey(start_key)) {
+        it = flow_obj->flow_entry_map_.begin();
+    } else {
+        it = flow_obj->flow_entry_map_.upper_bound(flow_iteration_key_);
+    }
     if (it == flow_obj->flow_entry_map_.end()) {
         it = flow_obj->flow_entry_map_.begin();
     }
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "xmpp/xmpp_stanza_scanner.h"
+
+#include <string>
+#include <vector>
+#include <boost/regex.hpp>
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "xmpp/xmpp_str.h"
+
+#include "testing/gunit.h"
+
+using namespace std;
+
+class XmppStanzaScannerTest : public ::testing::Test {
+protected:
+    // Feed the stream to the scanner in chunks of chunk_size bytes and
+    // collect the stanzas in the same way as XmppSession::ScanStanzas.
+    void Scan(const string &stream, size_t chunk_size) {
+        const uint8_t *data =
+            reinterpret_cast<const uint8_t *>(stream.data());
+        size_t remain = stream.size();
+        while (remain > 0) {
+            size_t size = min(chunk_size, remain);
+            ScanBuffer(data, size);
+            data += size;
+            remain -= size;
+        }
+    }
+
+    void ScanBuffer(const uint8_t *data, size_t size) {
+        while (size > 0) {
+            size_t len = scanner_.Scan(data, size);
+            partial_.append(reinterpret_cast<const char *>(data), len);
+            data += len;
+            size -= len;
+            if (!scanner_.complete())
+                break;
+            stanzas_.push_back(partial_);
+            types_.push_back(scanner_.type());
+            partial_.clear();
+            scanner_.Reset();
+        }
+    }
+
+    XmppStanzaScanner scanner_;
+    string partial_;
+    vector<string> stanzas_;
+    vector<XmppStanzaScanner::StanzaType> types_;
+};
+
+TEST_F(XmppStanzaScannerTest, SingleStanza) {
+    string iq("<iq type='set' from='agent' to='bgp'>"
+              "<pubsub><publish node='blue'><item id='1.1.1.1/32'/>"
+              "</publish></pubsub></iq>");
+    Scan(iq, iq.size());
+    ASSERT_EQ(1, stanzas_.size());
+    EXPECT_EQ(iq, stanzas_[0]);
+    EXPECT_EQ(XmppStanzaScanner::ELEMENT, types_[0]);
+    EXPECT_TRUE(partial_.empty());
+}
+
+TEST_F(XmppStanzaScannerTest, MultipleStanzas) {
+    string iq1("<iq type='set'><pubsub><subscribe node='red'/></pubsub></iq>");
+    string msg(sXMPP_CHAT_MSG);
+    string iq2("<iq type='get'/>");
+    Scan(iq1 + msg + iq2, 4096);
+    ASSERT_EQ(3, stanzas_.size());
+    EXPECT_EQ(iq1, stanzas_[0]);
+    EXPECT_EQ(msg, stanzas_[1]);
+    EXPECT_EQ(iq2, stanzas_[2]);
+}
+
+// Every possible split point, down to one byte per read.
+TEST_F(XmppStanzaScannerTest, SplitAcrossBuffers) {
+    string iq1("<iq type='set'><pubsub><subscribe node='red'/></pubsub></iq>");
+    string iq2("<iq type=\"set\"><pubsub><items node=\"blue\"/></pubsub>"
+               "</iq >");
+    for (size_t chunk = 1; chunk <= iq1.size() + iq2.size(); chunk++) {
+        stanzas_.clear();
+        Scan(iq1 + iq2, chunk);
+        ASSERT_EQ(2, stanzas_.size()) << "chunk size " << chunk;
+        EXPECT_EQ(iq1, stanzas_[0]);
+        EXPECT_EQ(iq2, stanzas_[1]);
+        EXPECT_TRUE(partial_.empty());
+    }
+}
+
+TEST_F(XmppStanzaScannerTest, QuotedMarkup) {
+    string iq("<iq id='a>b' name=\"c/>\"><item value='</iq>'/></iq>");
+    Scan(iq, 3);
+    ASSERT_EQ(1, stanzas_.size());
+    EXPECT_EQ(iq, stanzas_[0]);
+}
+
+TEST_F(XmppStanzaScannerTest, NestedSameName) {
+    string msg("<message><message><body>x</body></message></message>");
+    Scan(msg + msg, 7);
+    ASSERT_EQ(2, stanzas_.size());
+    EXPECT_EQ(msg, stanzas_[0]);
+    EXPECT_EQ(msg, stanzas_[1]);
+}
+
+TEST_F(XmppStanzaScannerTest, Whitespace) {
+    string iq("<iq type='get'/>");
+    string ws(sXMPP_WHITESPACE);
+    Scan(ws + iq + " \n" + iq, 4096);
+    ASSERT_EQ(4, stanzas_.size());
+    EXPECT_EQ(XmppStanzaScanner::WHITESPACE, types_[0]);
+    EXPECT_EQ(ws, stanzas_[0]);
+    EXPECT_EQ(iq, stanzas_[1]);
+    EXPECT_EQ(XmppStanzaScanner::WHITESPACE, types_[2]);
+    EXPECT_EQ(" \n", stanzas_[2]);
+    EXPECT_EQ(iq, stanzas_[3]);
+}
+
+TEST_F(XmppStanzaScannerTest, Partial) {
+    string iq("<iq type='set'><pubsub><subscribe node='red'/></pubsub>");
+    Scan(iq, 4096);
+    EXPECT_TRUE(stanzas_.empty());
+    EXPECT_EQ(iq, partial_);
+    EXPECT_EQ(1, scanner_.depth());
+
+    Scan("</iq>", 4096);
+    ASSERT_EQ(1, stanzas_.size());
+    EXPECT_EQ(iq + "</iq>", stanzas_[0]);
+}
+
+TEST_F(XmppStanzaScannerTest, StreamClose) {
+    string iq("<iq type='get'/>");
+    Scan(iq + "</stream:stream>", 4096);
+    ASSERT_EQ(2, stanzas_.size());
+    EXPECT_EQ(XmppStanzaScanner::ELEMENT, types_[0]);
+    EXPECT_EQ(XmppStanzaScanner::STREAM_CLOSE, types_[1]);
+}
+
+// Text and declarations between stanzas are reported separately, and are
+// not part of the next stanza, however the stream is split.
+TEST_F(XmppStanzaScannerTest, Junk) {
+    string iq("<iq type='get'/>");
+    string decl("<?xml version='1.0'?>");
+    for (size_t chunk = 1; chunk <= 64; chunk++) {
+        stanzas_.clear();
+        types_.clear();
+        Scan(decl + iq + "junk" + iq, chunk);
+        vector<string> elements;
+        for (size_t idx = 0; idx < stanzas_.size(); idx++) {
+            if (types_[idx] == XmppStanzaScanner::ELEMENT) {
+                elements.push_back(stanzas_[idx]);
+            } else {
+                EXPECT_EQ(XmppStanzaScanner::JUNK, types_[idx]);
+            }
+        }
+        ASSERT_EQ(2, elements.size()) << "chunk size " << chunk;
+        EXPECT_EQ(iq, elements[0]);
+        EXPECT_EQ(iq, elements[1]);
+        EXPECT_TRUE(partial_.empty());
+    }
+}
+
+//
+// Compare the scanner with the regex based framing that XmppSession used
+// for stanzas, with the stream split in TcpSession sized reads.
+//
+static const size_t kStanzaCount = 20000;
+static const size_t kReadSize = 4096;
+
+class XmppStanzaScannerBenchmark : public XmppStanzaScannerTest {
+protected:
+    virtual void SetUp() {
+        for (size_t i = 0; i < kStanzaCount; i++) {
+            stream_ += "<iq type='set' from='agent-0' to='network-control'>"
+                "<pubsub xmlns='http://jabber.org/protocol/pubsub'>"
+                "<publish node='1/1/default-domain:admin:vn:vn'>"
+                "<item id='10.1.";
+            stream_ += integerToString(i);
+            stream_ += "/32'><entry><nlri><af>1</af><address>10.1.1.1/32"
+                "</address></nlri><next-hops><next-hop><af>1</af>"
+                "<address>192.168.1.1</address><label>16</label>"
+                "</next-hop></next-hops><version>1</version></entry>"
+                "</item></publish></pubsub></iq>";
+        }
+    }
+
+    // Same algorithm as XmppSession::Match for the established state.
+    size_t RegexFrame() {
+        boost::regex start(rXMPP_MESSAGE);
+        boost::match_results<string::const_iterator> res;
+        string buf;
+        string begin_tag;
+        bool tag_known = false;
+        size_t count = 0;
+
+        for (size_t pos = 0; pos < stream_.size(); pos += kReadSize) {
+            buf += stream_.substr(pos, kReadSize);
+            string::const_iterator offset = buf.begin();
+            while (true) {
+                boost::regex patt(start);
+                if (tag_known) {
+                    patt = boost::regex("</" + begin_tag.substr(1) +
+                                        "[\\s\\t\\r\\n]*>");
+                }
+                if (!regex_search(offset, string::const_iterator(buf.end()),
+                        res, patt,
+                        boost::match_default | boost::match_partial) ||
+                    !res[0].matched) {
+                    break;
+                }
+                offset = res[0].second;
+                if (!tag_known) {
+                    begin_tag = string(res[0].first, res[0].second);
+                    tag_known = true;
+                    continue;
+                }
+                tag_known = false;
+                string xml(string::const_iterator(buf.begin()), offset);
+                count++;
+                buf = string(offset, string::const_iterator(buf.end()));
+                offset = buf.begin();
+            }
+        }
+        return count;
+    }
+
+    string stream_;
+};
+
+TEST_F(XmppStanzaScannerBenchmark, ScannerVsRegex) {
+    uint64_t start = UTCTimestampUsec();
+    size_t regex_count = RegexFrame();
+    uint64_t regex_usec = UTCTimestampUsec() - start;
+
+    start = UTCTimestampUsec();
+    Scan(stream_, kReadSize);
+    uint64_t scanner_usec = UTCTimestampUsec() - start;
+
+    EXPECT_EQ(kStanzaCount, regex_count);
+    EXPECT_EQ(kStanzaCount, stanzas_.size());
+
+    double mbytes = stream_.size() / (1024.0 * 1024.0);
+    LOG(DEBUG, "Framed " << kStanzaCount << " stanzas, " << mbytes << " MB");
+    LOG(DEBUG, "regex:   " << regex_usec << " usec, " <<
+        mbytes * 1000000 / max(regex_usec, (uint64_t) 1) << " MB/s");
+    LOG(DEBUG, "scanner: " << scanner_usec << " usec, " <<
+        mbytes * 1000000 / max(scanner_usec, (uint64_t) 1) << " MB/s");
+}
+
+int main(int argc, char **argv) {
+    LoggingInit();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
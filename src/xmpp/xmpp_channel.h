@@ -7,6 +7,7 @@
 
 #include <boost/function.hpp>
 #include <boost/system/error_code.hpp>
+#include "io/io_shared_buffer.h"
 #include "xmpp/xmpp_proto.h"
 
 class XmppConnection;
@@ -36,6 +37,19 @@ public:
 
     virtual ~XmppChannel() { }
     virtual bool Send(const uint8_t *, size_t, xmps::PeerId, SendReadyCb) = 0;
+    // Send a header followed by a body that is shared with other channels.
+    virtual bool SendShared(const uint8_t *header, size_t header_size,
+                            const IoSharedBufferPtr &body, xmps::PeerId id,
+                            SendReadyCb cb) {
+        std::string data(reinterpret_cast<const char *>(header), header_size);
+        data.append(reinterpret_cast<const char *>(body->data()),
+                    body->size());
+        return Send(reinterpret_cast<const uint8_t *>(data.data()),
+                    data.size(), id, cb);
+    }
+    // Messages sent between Cork and Uncork may be written out together.
+    virtual void Cork() { }
+    virtual void Uncork() { }
     virtual void RegisterReceive(xmps::PeerId, ReceiveCb) = 0;
     virtual void UnRegisterReceive(xmps::PeerId) = 0;
     virtual std::string ToString() const = 0;
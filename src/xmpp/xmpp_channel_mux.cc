@@ -48,6 +48,27 @@ bool XmppChannelMux::Send(const uint8_t *msg, size_t msgsize,
     return res;
 }
 
+bool XmppChannelMux::SendShared(const uint8_t *header, size_t header_size,
+                                const IoSharedBufferPtr &body,
+                                xmps::PeerId id, SendReadyCb cb) {
+    if (!connection_) return false;
+
+    tbb::mutex::scoped_lock lock(mutex_);
+    bool res = connection_->SendShared(header, header_size, body);
+    if (res == false) {
+        RegisterWriteReady(id, cb);
+    }
+    return res;
+}
+
+void XmppChannelMux::Cork() {
+    if (connection_) connection_->Cork();
+}
+
+void XmppChannelMux::Uncork() {
+    if (connection_) connection_->Uncork();
+}
+
 void XmppChannelMux::RegisterReceive(xmps::PeerId id, ReceiveCb cb) {
     rxmap_.insert(make_pair(id, cb));
 }
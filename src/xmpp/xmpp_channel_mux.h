@@ -19,6 +19,11 @@ public:
     virtual ~XmppChannelMux();
 
     virtual bool Send(const uint8_t *, size_t, xmps::PeerId, SendReadyCb);
+    virtual bool SendShared(const uint8_t *header, size_t header_size,
+                            const IoSharedBufferPtr &body, xmps::PeerId id,
+                            SendReadyCb cb);
+    virtual void Cork();
+    virtual void Uncork();
     virtual void RegisterReceive(xmps::PeerId, ReceiveCb);
     virtual void UnRegisterReceive(xmps::PeerId);
     size_t ReceiverCount() const;
@@ -182,6 +182,40 @@ bool XmppConnection::Send(const uint8_t *data, size_t size) {
     return session_->Send(data, size, &sent);
 }
 
+bool XmppConnection::SendShared(const uint8_t *header, size_t header_size,
+                                const IoSharedBufferPtr &body) {
+    size_t sent;
+    tbb::spin_mutex::scoped_lock lock(spin_mutex_);
+    if (session_ == NULL) {
+        return false;
+    }
+    if (!LoggingDisabled()) {
+        string data(reinterpret_cast<const char *>(header), header_size);
+        data.append(reinterpret_cast<const char *>(body->data()),
+                    body->size());
+        XMPP_MESSAGE_TRACE(XmppTxStream,
+               session_->remote_endpoint().address().to_string(),
+               session_->remote_endpoint().port(), data.size(), data);
+    }
+
+    stats_[1].update++;
+    return session_->SendShared(header, header_size, body, &sent);
+}
+
+void XmppConnection::Cork() {
+    tbb::spin_mutex::scoped_lock lock(spin_mutex_);
+    if (session_ != NULL) {
+        session_->Cork();
+    }
+}
+
+void XmppConnection::Uncork() {
+    tbb::spin_mutex::scoped_lock lock(spin_mutex_);
+    if (session_ != NULL) {
+        session_->Uncork();
+    }
+}
+
 void XmppConnection::SendOpen(TcpSession *session) {
     if (!session) return;
     XmppProto::XmppStanza::XmppStreamMessage openstream;
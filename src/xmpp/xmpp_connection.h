@@ -53,6 +53,10 @@ public:
     std::string FromString() const;
     void SetAdminDown(bool toggle);
     bool Send(const uint8_t *data, size_t size);
+    bool SendShared(const uint8_t *header, size_t header_size,
+                    const IoSharedBufferPtr &body);
+    void Cork();
+    void Uncork();
 
     // Xmpp connection messages
     void SendOpen(TcpSession *session);
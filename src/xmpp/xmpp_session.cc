@@ -162,9 +162,58 @@ bool XmppSession::Match(Buffer buffer, int *result, bool NewBuf) {
     return true;
 }
 
+// Stanzas are framed by the incremental scanner once the stream has been
+// negotiated. The regex based matching is only used for the stream header.
+bool XmppSession::ScannerEnabled() const {
+    xmsm::XmState state = connection_->GetStateMcState();
+    return (state == xmsm::OPENCONFIRM || state == xmsm::ESTABLISHED);
+}
+
+// Hand complete stanzas in the buffer to the connection. A stanza that is
+// split across reads is accumulated in stanza_; a stanza that is entirely
+// contained in the buffer is handed over without any intermediate copy.
+// Only the bytes of the stanza itself are handed over.
+void XmppSession::ScanStanzas(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        size_t len = scanner_.Scan(data, size);
+        const char *cp = reinterpret_cast<const char *>(data);
+        if (!scanner_.complete()) {
+            stanza_.append(cp, len);
+            break;
+        }
+        data += len;
+        size -= len;
+
+        XmppStanzaScanner::StanzaType type = scanner_.type();
+        scanner_.Reset();
+
+        // Text and markup between stanzas are dropped. So is the end of
+        // the stream, as it was by the regex framing, which only matched
+        // <iq> and <message>: the peer closes the tcp connection after
+        // it, and that tears down the session.
+        if (type == XmppStanzaScanner::JUNK ||
+            type == XmppStanzaScanner::STREAM_CLOSE) {
+            stanza_.clear();
+            continue;
+        }
+
+        //
+        // XXX Connection gone ?
+        //
+        if (!connection_) break;
+        if (stanza_.empty()) {
+            connection_->ReceiveMsg(this, string(cp, len));
+        } else {
+            stanza_.append(cp, len);
+            connection_->ReceiveMsg(this, stanza_);
+            stanza_.clear();
+        }
+    }
+}
+
 // Read the socket stream and send messages to the connection object.
-// The buffer is copied to local string for regex match. 
-// TODO Code need to change st Match() is done on buffer itself.
+// Until the stream is established the buffer is copied to local string
+// for regex match of the stream header.
 void XmppSession::OnRead(Buffer buffer) {
     if (this->Channel() == NULL || !connection_) {
         // Connection is deleted. Session is being deleted as well
@@ -182,6 +231,12 @@ void XmppSession::OnRead(Buffer buffer) {
         return;
     }
 
+    if (ScannerEnabled() && buf_.empty()) {
+        ScanStanzas(BufferData(buffer), BufferSize(buffer));
+        ReleaseBuffer(buffer);
+        return;
+    }
+
     int result = 0;
     bool more = Match(buffer, &result, true);
     do {
@@ -207,6 +262,18 @@ void XmppSession::OnRead(Buffer buffer) {
             break;
         }
 
+        if (connection_ && ScannerEnabled() && !tag_known_) {
+            // Stream negotiation is complete, the rest of the data is
+            // framed by the stanza scanner.
+            if (LeftOver()) {
+                string rest(offset_, string::const_iterator(buf_.end()));
+                ScanStanzas(reinterpret_cast<const uint8_t *>(rest.data()),
+                            rest.size());
+            }
+            buf_.clear();
+            break;
+        }
+
         if (LeftOver()) {
             std::string::const_iterator st = buf_.end();
             ReplaceBuf(string(offset_, st));
@@ -9,6 +9,7 @@
 #include <boost/regex.hpp>
 #include "io/tcp_server.h"
 #include "io/tcp_session.h"
+#include "xmpp/xmpp_stanza_scanner.h"
 
 class XmppStream;
 class XmppServer;
@@ -49,6 +50,8 @@ private:
     void SetBuf(const std::string &);
     void ReplaceBuf(const std::string &);
     bool LeftOver() const;
+    bool ScannerEnabled() const;
+    void ScanStanzas(const uint8_t *data, size_t size);
 
     XmppConnection *connection_;
     BufferQueue queue_;
@@ -59,6 +62,8 @@ private:
     int tag_known_;
     boost::match_results<std::string::const_iterator> res_;
     std::vector<StatsPair> stats_; // packet count
+    XmppStanzaScanner scanner_;
+    std::string stanza_;    // partial stanza carried over from earlier reads
 
     static const boost::regex patt_;
     static const boost::regex stream_patt_;
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#include "xmpp/xmpp_stanza_scanner.h"
+
+#include <cassert>
+
+XmppStanzaScanner::XmppStanzaScanner() {
+    Reset();
+}
+
+void XmppStanzaScanner::Reset() {
+    state_ = IDLE;
+    type_ = NONE;
+    depth_ = 0;
+    quote_ = 0;
+    last_ = 0;
+    complete_ = false;
+}
+
+// Same character set as sXMPP_VALIDWS, which includes the two bytes of
+// the utf-8 encoded whitespace keepalive character.
+bool XmppStanzaScanner::IsWhitespace(uint8_t c) {
+    switch (c) {
+    case ' ':
+    case '\n':
+    case '\r':
+    case '\t':
+    case 0xc8:
+    case 0x80:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void XmppStanzaScanner::EndTag() {
+    if (depth_ == 0) {
+        // End tag without a start tag at the top level i.e. the peer is
+        // closing the stream.
+        type_ = STREAM_CLOSE;
+        complete_ = true;
+        return;
+    }
+    depth_--;
+    state_ = TEXT;
+    if (depth_ == 0) {
+        complete_ = true;
+    }
+}
+
+size_t XmppStanzaScanner::Scan(const uint8_t *data, size_t size) {
+    assert(!complete_);
+
+    size_t i = 0;
+    while (i < size) {
+        uint8_t c = data[i++];
+        switch (state_) {
+        case IDLE:
+            if (IsWhitespace(c)) {
+                type_ = WHITESPACE;
+                state_ = SPACE;
+            } else if (c == '<') {
+                type_ = ELEMENT;
+                state_ = TAG_OPEN;
+            } else {
+                type_ = JUNK;
+                state_ = STRAY_TEXT;
+            }
+            break;
+
+        case SPACE:
+            if (!IsWhitespace(c)) {
+                // Leave the first non-whitespace character for the next
+                // stanza.
+                complete_ = true;
+                return i - 1;
+            }
+            break;
+
+        case STRAY_TEXT:
+            if (c == '<') {
+                // Leave the '<' for the next stanza.
+                complete_ = true;
+                return i - 1;
+            }
+            break;
+
+        case TEXT:
+            if (c == '<') {
+                state_ = TAG_OPEN;
+            }
+            break;
+
+        case TAG_OPEN:
+            if (c == '/') {
+                state_ = END_TAG;
+            } else if (c == '?' || c == '!') {
+                state_ = MARKUP;
+            } else {
+                state_ = START_TAG;
+                last_ = c;
+            }
+            break;
+
+        case START_TAG:
+            if (quote_) {
+                // '>' and '/' are allowed within attribute values.
+                if (c == quote_) quote_ = 0;
+                last_ = c;
+                break;
+            }
+            if (c == '"' || c == '\'') {
+                quote_ = c;
+                last_ = c;
+                break;
+            }
+            if (c == '>') {
+                state_ = TEXT;
+                if (last_ != '/') {
+                    depth_++;
+                } else if (depth_ == 0) {
+                    // Empty element at the top level.
+                    complete_ = true;
+                    return i;
+                }
+                break;
+            }
+            last_ = c;
+            break;
+
+        case END_TAG:
+            if (c == '>') {
+                EndTag();
+                if (complete_)
+                    return i;
+            }
+            break;
+
+        case MARKUP:
+            if (c == '>') {
+                if (depth_ == 0) {
+                    // Declaration or processing instruction between
+                    // stanzas.
+                    type_ = JUNK;
+                    complete_ = true;
+                    return i;
+                }
+                state_ = TEXT;
+            }
+            break;
+        }
+    }
+
+    // A whitespace keepalive is delivered as soon as the buffer runs out
+    // rather than waiting for the next read, and so is stray text.
+    if (state_ == SPACE || state_ == STRAY_TEXT) {
+        complete_ = true;
+    }
+    return i;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
+ */
+
+#ifndef __XMPP_STANZA_SCANNER_H__
+#define __XMPP_STANZA_SCANNER_H__
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "base/util.h"
+
+//
+// Incremental scanner that locates the boundaries of top level xmpp
+// stanzas (<iq/>, <message/>) in a byte stream.
+//
+// The scanner works directly on the receive buffers of the session and
+// keeps only a handful of lexer state variables (element depth, quote
+// character etc.) across calls. This allows a stanza to be split over
+// any number of reads without the stream having to be copied into an
+// intermediate string and re-scanned from the start for every buffer.
+//
+// Whitespace between stanzas is reported as a stanza of its own, since
+// that is how keepalives are sent by the peer. Anything else between
+// stanzas, such as character data or an <?xml?> declaration, is reported
+// as JUNK so that the caller can drop it rather than prepend it to the
+// next stanza.
+//
+// The scanner does not validate the xml; that is left to the decoder.
+//
+class XmppStanzaScanner {
+public:
+    enum StanzaType {
+        NONE,
+        ELEMENT,
+        WHITESPACE,
+        JUNK,
+        STREAM_CLOSE,
+    };
+
+    XmppStanzaScanner();
+
+    // Scan up to size bytes of data. Returns the number of bytes consumed.
+    // If complete() is true on return, the consumed bytes finish a stanza
+    // that started either in this buffer or in a previous one.
+    size_t Scan(const uint8_t *data, size_t size);
+
+    bool complete() const { return complete_; }
+    StanzaType type() const { return type_; }
+    int depth() const { return depth_; }
+
+    // Prepare for the next stanza. Must be called after a complete stanza
+    // has been consumed.
+    void Reset();
+
+    static bool IsWhitespace(uint8_t c);
+
+private:
+    enum State {
+        IDLE,           // between stanzas
+        SPACE,          // run of whitespace between stanzas
+        STRAY_TEXT,     // character data between stanzas
+        TEXT,           // character data within an element
+        TAG_OPEN,       // seen '<'
+        START_TAG,      // within <name ...>
+        END_TAG,        // within </name ...>
+        MARKUP,         // within <? ... ?> or <! ... >
+    };
+
+    void EndTag();
+
+    State state_;
+    StanzaType type_;
+    int depth_;
+    uint8_t quote_;
+    uint8_t last_;
+    bool complete_;
+
+    DISALLOW_COPY_AND_ASSIGN(XmppStanzaScanner);
+};
+
+#endif // __XMPP_STANZA_SCANNER_H__